@@ -0,0 +1,63 @@
+/**
+ * COG INVASION ONLINE
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file common_instancing_vert.inc.glsl
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ */
+
+#pragma once
+
+#ifdef INSTANCED
+    // Three texels per instance, the columns of the instance's 4x3 transform.
+    uniform samplerBuffer instanceData;
+
+    #ifdef INSTANCED_STATIC_LIGHTING
+        // The baked vertex lighting of every instance, one after another.
+        uniform samplerBuffer instanceLighting;
+        uniform int instanceVertexCount;
+    #endif
+#endif
+
+void DoInstanceTransform(inout vec4 finalVertex, inout vec3 finalNormal)
+{
+    #ifdef INSTANCED
+        int base = gl_InstanceID * 3;
+        vec4 col0 = texelFetch(instanceData, base);
+        vec4 col1 = texelFetch(instanceData, base + 1);
+        vec4 col2 = texelFetch(instanceData, base + 2);
+
+        finalVertex = vec4(dot(col0, finalVertex), dot(col1, finalVertex),
+                           dot(col2, finalVertex), finalVertex.w);
+
+        // Normals go through the inverse transpose of the upper 3x3, so they
+        // stay perpendicular to the surface under non-uniform scale.  That is
+        // the cofactors of the 3x3 over its determinant.
+        vec3 cof0 = cross(col1.xyz, col2.xyz);
+        vec3 cof1 = cross(col2.xyz, col0.xyz);
+        vec3 cof2 = cross(col0.xyz, col1.xyz);
+        finalNormal = vec3(dot(cof0, finalNormal), dot(cof1, finalNormal),
+                           dot(cof2, finalNormal)) / dot(col0.xyz, cof0);
+    #endif
+}
+
+vec3 InstanceTransformVector(vec3 vector)
+{
+    #ifdef INSTANCED
+        int base = gl_InstanceID * 3;
+        return vec3(dot(texelFetch(instanceData, base).xyz, vector),
+                    dot(texelFetch(instanceData, base + 1).xyz, vector),
+                    dot(texelFetch(instanceData, base + 2).xyz, vector));
+    #else
+        return vector;
+    #endif
+}
+
+#ifdef INSTANCED_STATIC_LIGHTING
+vec3 GetInstanceStaticLighting()
+{
+    return texelFetch(instanceLighting, gl_InstanceID * instanceVertexCount + gl_VertexID).rgb;
+}
+#endif
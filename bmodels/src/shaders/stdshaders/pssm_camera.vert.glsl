@@ -1,6 +1,7 @@
 #version 330
 
 #pragma include "shaders/stdshaders/common_animation_vert.inc.glsl"
+#pragma include "shaders/stdshaders/common_instancing_vert.inc.glsl"
 
 uniform mat4 p3d_ModelMatrix;
 in vec4 p3d_Vertex;
@@ -15,6 +16,11 @@ void main()
         vec3 foo = vec3(0);
         DoHardwareAnimation(finalVertex, foo, p3d_Vertex, foo);
     #endif
+
+    #ifdef INSTANCED
+        vec3 bar = vec3(0);
+        DoInstanceTransform(finalVertex, bar);
+    #endif
     
     // move vertex into world space
     // as the geometry shader will multiply the vertex
@@ -15,6 +15,7 @@
 #pragma include "shaders/stdshaders/common.inc.glsl"
 #pragma include "shaders/stdshaders/common_shadows_vert.inc.glsl"
 #pragma include "shaders/stdshaders/common_animation_vert.inc.glsl"
+#pragma include "shaders/stdshaders/common_instancing_vert.inc.glsl"
 
 uniform mat4 p3d_ModelViewProjectionMatrix;
 uniform mat3 p3d_NormalMatrix;
@@ -84,6 +85,10 @@ void main()
         DoHardwareAnimation(finalVertex, finalNormal, p3d_Vertex, p3d_Normal);
     #endif
 
+    #ifdef INSTANCED
+        DoInstanceTransform(finalVertex, finalNormal);
+    #endif
+
 	gl_Position = p3d_ModelViewProjectionMatrix * finalVertex;
     
     // pass through the texcoord input as-is
@@ -95,8 +100,8 @@ void main()
 
     #ifdef NEED_WORLD_NORMAL
         l_worldNormal = normalize(p3d_ModelMatrix * vec4(finalNormal, 0));
-        l_tangentSpaceTranspose[0] = normalize(mat3(p3d_ModelMatrix) * p3d_Tangent.xyz);
-        l_tangentSpaceTranspose[1] = normalize(mat3(p3d_ModelMatrix) * p3d_Binormal.xyz);
+        l_tangentSpaceTranspose[0] = normalize(mat3(p3d_ModelMatrix) * InstanceTransformVector(p3d_Tangent.xyz));
+        l_tangentSpaceTranspose[1] = normalize(mat3(p3d_ModelMatrix) * InstanceTransformVector(p3d_Binormal.xyz));
         l_tangentSpaceTranspose[2] = l_worldNormal.xyz;
     #endif
 
@@ -115,8 +120,8 @@ void main()
     l_vertexColor = vertexColor * colorScale;
 
     #ifdef NEED_TBN
-        l_tangent = vec4(normalize(p3d_NormalMatrix * p3d_Tangent.xyz), 0.0);
-        l_binormal = vec4(normalize(p3d_NormalMatrix * -p3d_Binormal.xyz), 0.0);
+        l_tangent = vec4(normalize(p3d_NormalMatrix * InstanceTransformVector(p3d_Tangent.xyz)), 0.0);
+        l_binormal = vec4(normalize(p3d_NormalMatrix * -InstanceTransformVector(p3d_Binormal.xyz)), 0.0);
     #endif
 
     #ifdef NEED_WORLD_VEC
@@ -128,7 +133,9 @@ void main()
                                sunVector[0], pssmMVPs, l_pssmCoords);
     #endif
     
-    #ifdef STATIC_PROP_LIGHTING
+    #ifdef INSTANCED_STATIC_LIGHTING
+        l_staticVertexLighting = GetInstanceStaticLighting();
+    #elif defined(STATIC_PROP_LIGHTING)
         l_staticVertexLighting = static_vertex_lighting;
     #endif
 }
@@ -0,0 +1,214 @@
+"""
+PANDA3D BSP TOOLS
+Copyright (c) CIO Team. All rights reserved.
+
+@file CompileBenchmark.py
+@author Brian Lach
+@date October 17, 2026
+
+@desc Compiles a fixed set of maps with pcsg, pbsp, pvis and prad and
+      compares the -profile reports of the tools against a baseline, so
+      compile time regressions are caught before they reach the artists.
+
+      The maps are listed in a JSON manifest:
+
+        {
+            "args": { "prad": ["-extra"] },
+            "maps": [
+                "maps/testmap.map",
+                { "source": "maps/bigmap.map", "args": { "pvis": ["-fast"] } }
+            ]
+        }
+
+      Paths are relative to the manifest.  "args" are extra arguments for a
+      tool, either for every map or for a single one.
+
+      usage: CompileBenchmark.py --bindir <tools> --manifest <file>
+                                 [--baseline <file>] [--write-baseline]
+                                 [--output <file>] [--threads #]
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+TOOLS = ["pcsg", "pbsp", "pvis", "prad"]
+
+def loadManifest(filename):
+    """Returns the list of maps in the manifest as (name, source, args)."""
+
+    with open(filename, "r") as f:
+        manifest = json.load(f)
+
+    root = os.path.dirname(os.path.abspath(filename))
+    commonArgs = manifest.get("args", {})
+
+    maps = []
+    for entry in manifest.get("maps", []):
+        if isinstance(entry, str):
+            entry = {"source": entry}
+
+        source = os.path.join(root, entry["source"])
+        name = entry.get("name", os.path.splitext(os.path.basename(source))[0])
+
+        args = {}
+        for tool in TOOLS:
+            args[tool] = list(commonArgs.get(tool, [])) + list(entry.get("args", {}).get(tool, []))
+
+        maps.append((name, source, args))
+
+    return maps
+
+def findTool(bindir, tool):
+    for name in (tool, tool + ".exe"):
+        path = os.path.join(bindir, name)
+        if os.path.isfile(path):
+            return path
+    return None
+
+def compileMap(bindir, workdir, name, source, args, threads):
+    """Runs every tool on the map and returns their reports, keyed by tool."""
+
+    mapdir = os.path.join(workdir, name)
+    if not os.path.isdir(mapdir):
+        os.makedirs(mapdir)
+    shutil.copy(source, os.path.join(mapdir, name + os.path.splitext(source)[1]))
+
+    mapname = os.path.join(mapdir, name)
+    reports = {}
+
+    for tool in TOOLS:
+        exe = findTool(bindir, tool)
+        if not exe:
+            raise RuntimeError("Couldn't find %s in %s" % (tool, bindir))
+
+        report = os.path.join(mapdir, "%s.%s.json" % (name, tool))
+        cmd = [exe, "-threads", str(threads), "-profile", report] + args[tool] + [mapname]
+
+        print("  %s" % " ".join(cmd))
+        with open(os.path.join(mapdir, "%s.%s.out" % (name, tool)), "w") as out:
+            ret = subprocess.call(cmd, stdout = out, stderr = subprocess.STDOUT)
+        if ret != 0 or not os.path.isfile(report):
+            raise RuntimeError("%s failed on %s (exit code %d), see %s" % (tool, name, ret, mapdir))
+
+        with open(report, "r") as f:
+            reports[tool] = json.load(f)
+
+    return reports
+
+def compareReports(results, baseline, tolerance, memTolerance, minTime):
+    """Returns a list of regressions, and prints every difference worth
+    looking at."""
+
+    regressions = []
+
+    def check(what, old, new, tol, minimum):
+        if old < minimum:
+            return
+        change = (new - old) / old if old else 0.0
+        line = "  %-48s %12.2f -> %12.2f (%+6.1f%%)" % (what, old, new, change * 100.0)
+        if change > tol:
+            print(line + "  REGRESSION")
+            regressions.append(what)
+        elif change < -tol:
+            print(line + "  faster")
+
+    for name, tools in sorted(results["maps"].items()):
+        oldTools = baseline.get("maps", {}).get(name)
+        if oldTools is None:
+            print("  %s: not in the baseline" % name)
+            continue
+
+        for tool in TOOLS:
+            new = tools.get(tool)
+            old = oldTools.get(tool)
+            if new is None or old is None:
+                continue
+
+            prefix = "%s/%s" % (name, tool)
+            check(prefix + " elapsed", old["elapsed"], new["elapsed"], tolerance, minTime)
+            check(prefix + " peak memory (MB)", old["peak_memory"] / 1048576.0,
+                  new["peak_memory"] / 1048576.0, memTolerance, 1.0)
+
+            oldPhases = dict((p["name"], p["elapsed"]) for p in old.get("phases", []))
+            for phase in new.get("phases", []):
+                if phase["name"] in oldPhases:
+                    check("%s %s" % (prefix, phase["name"]), oldPhases[phase["name"]],
+                          phase["elapsed"], tolerance, minTime)
+
+            # The counters and values only change when the compile does
+            # different work, which is worth knowing even when it's fast.
+            for key in ("counters", "values"):
+                oldValues = old.get(key, {})
+                for counter, value in sorted(new.get(key, {}).items()):
+                    if counter in oldValues and oldValues[counter] != value:
+                        print("  %-48s %12g -> %12g" % ("%s %s" % (prefix, counter),
+                                                       oldValues[counter], value))
+
+    return regressions
+
+def main():
+    parser = argparse.ArgumentParser(description = "Compile benchmark for the BSP tools.")
+    parser.add_argument("--bindir", required = True, help = "Directory containing pcsg, pbsp, pvis and prad")
+    parser.add_argument("--manifest", required = True, help = "JSON list of the maps to compile")
+    parser.add_argument("--baseline", help = "Results of an earlier run to compare against")
+    parser.add_argument("--write-baseline", action = "store_true", help = "Save the results as the new baseline")
+    parser.add_argument("--output", help = "Where to save the results of this run")
+    parser.add_argument("--workdir", help = "Where to compile the maps (a temporary directory by default)")
+    parser.add_argument("--threads", type = int, default = os.cpu_count() or 1)
+    parser.add_argument("--tolerance", type = float, default = 0.10, help = "Allowed slowdown, 0.1 is 10%%")
+    parser.add_argument("--memory-tolerance", type = float, default = 0.10, help = "Allowed memory growth")
+    parser.add_argument("--min-time", type = float, default = 0.5, help = "Ignore phases quicker than this (seconds)")
+    args = parser.parse_args()
+
+    maps = loadManifest(args.manifest)
+    if not maps:
+        print("No maps in %s" % args.manifest)
+        return 1
+
+    workdir = args.workdir or tempfile.mkdtemp(prefix = "bspbench")
+    results = {"threads": args.threads, "maps": {}}
+
+    try:
+        for name, source, toolArgs in maps:
+            print("Compiling %s" % name)
+            results["maps"][name] = compileMap(args.bindir, workdir, name, source, toolArgs, args.threads)
+    except RuntimeError as e:
+        print("ERROR: %s" % e)
+        return 2
+    finally:
+        if not args.workdir:
+            shutil.rmtree(workdir, ignore_errors = True)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent = 2, sort_keys = True)
+
+    if args.baseline and args.write_baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent = 2, sort_keys = True)
+        print("Wrote baseline to %s" % args.baseline)
+        return 0
+
+    if args.baseline and os.path.isfile(args.baseline):
+        with open(args.baseline, "r") as f:
+            baseline = json.load(f)
+        if baseline.get("threads") != args.threads:
+            print("Warning: the baseline was compiled with %s threads" % baseline.get("threads"))
+
+        print("Comparing against %s" % args.baseline)
+        regressions = compareReports(results, baseline, args.tolerance,
+                                     args.memory_tolerance, args.min_time)
+        if regressions:
+            print("%d compile time regression(s)" % len(regressions))
+            return 1
+        print("No regressions")
+
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
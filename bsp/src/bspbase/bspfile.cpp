@@ -341,7 +341,7 @@ static void SwapBSPFile(bspdata_t *data, const bool todisk)
 //  CopyLump
 //      balh
 // =====================================================================================
-static int CopyLump(int lump, void *dest, int size, const dheader_t *const header)
+static int CopyLump(int lump, void *dest, int size, const dheader_t *const header, const byte *const image)
 {
         int length, ofs;
 
@@ -359,89 +359,168 @@ static int CopyLump(int lump, void *dest, int size, const dheader_t *const heade
         //        hlassume( g_max_map_texref > length, assume_MAX_MAP_MIPTEX );
         //}
 
-        memcpy(dest, (byte *)header + ofs, length);
+        memcpy(dest, image + ofs, length);
 
         return length / size;
 }
 
 template <class T>
-static int CopyLump(int lump, pvector<T> &dest, const dheader_t *const header)
+static int CopyLump(int lump, pvector<T> &dest, const dheader_t *const header, const byte *const image)
 {
         dest.resize(header->lumps[lump].filelen / sizeof(T));
-        return CopyLump(lump, dest.data(), sizeof(T), header);
+        return CopyLump(lump, dest.data(), sizeof(T), header, image);
 }
 
-// =====================================================================================
-//  LoadBSPFile
-//      balh
-// =====================================================================================
-bspdata_t *LoadBSPFile(const char *const filename)
+// Element size of every lump, and the room bspdata_t has for it (0 if it grows).
+typedef struct
 {
-        dheader_t *header;
-        LoadFile(filename, (char **)&header);
-        return LoadBSPImage(header);
-}
+        int lump;
+        int size;
+        size_t capacity;
+} lumpformat_t;
+
+#define FIXED_LUMP(lump, array) { lump, (int)sizeof(bspdata_t::array[0]), sizeof(bspdata_t::array) }
+#define VECTOR_LUMP(lump, vector) { lump, (int)sizeof(decltype(bspdata_t::vector)::value_type), 0 }
+
+static const lumpformat_t s_lumpformats[] =
+{
+        FIXED_LUMP(LUMP_MODELS, dmodels),
+        FIXED_LUMP(LUMP_VERTEXES, dvertexes),
+        FIXED_LUMP(LUMP_PLANES, dplanes),
+        FIXED_LUMP(LUMP_LEAFS, dleafs),
+        FIXED_LUMP(LUMP_NODES, dnodes),
+        FIXED_LUMP(LUMP_TEXINFO, texinfo),
+        FIXED_LUMP(LUMP_FACES, dfaces),
+        FIXED_LUMP(LUMP_MARKSURFACES, dmarksurfaces),
+        FIXED_LUMP(LUMP_SURFEDGES, dsurfedges),
+        FIXED_LUMP(LUMP_EDGES, dedges),
+        FIXED_LUMP(LUMP_TEXTURES, dtexrefs),
+        FIXED_LUMP(LUMP_VISIBILITY, dvisdata),
+        FIXED_LUMP(LUMP_ENTITIES, dentdata),
+        VECTOR_LUMP(LUMP_BRUSHES, dbrushes),
+        VECTOR_LUMP(LUMP_BRUSHSIDES, dbrushsides),
+        VECTOR_LUMP(LUMP_LEAFBRUSHES, dleafbrushes),
+        VECTOR_LUMP(LUMP_LEAFAMBIENTINDEX, leafambientindex),
+        VECTOR_LUMP(LUMP_LEAFAMBIENTLIGHTING, leafambientlighting),
+        VECTOR_LUMP(LUMP_LEAFAMBIENTSH, leafambientsh),
+        VECTOR_LUMP(LUMP_BOUNCEDLIGHTING, bouncedlightdata),
+        VECTOR_LUMP(LUMP_DIRECTLIGHTING, lightdata),
+        VECTOR_LUMP(LUMP_DIRECTSUNLIGHTING, sunlightdata),
+        VECTOR_LUMP(LUMP_STATICPROPS, dstaticprops),
+        VECTOR_LUMP(LUMP_STATICPROPVERTEXDATA, dstaticpropvertexdatas),
+        VECTOR_LUMP(LUMP_STATICPROPLIGHTING, staticproplighting),
+        VECTOR_LUMP(LUMP_VERTNORMALS, vertnormals),
+        VECTOR_LUMP(LUMP_VERTNORMALINDICES, vertnormalindices),
+        VECTOR_LUMP(LUMP_CUBEMAPDATA, cubemapdata),
+        VECTOR_LUMP(LUMP_CUBEMAPS, cubemaps),
+};
+
+#undef FIXED_LUMP
+#undef VECTOR_LUMP
 
 // =====================================================================================
-//  LoadBSPImage
-//      balh
+//  ValidateBSPImage
+//      Checks a swapped header against the image it came from, so that nothing is
+//      read or written out of bounds when the lumps are copied out.
 // =====================================================================================
-bspdata_t *LoadBSPImage(dheader_t *const header)
+static bool ValidateBSPImage(const dheader_t *const header, size_t length)
 {
-        unsigned int i;
-
-        // swap the header
-        for (i = 0; i < sizeof(dheader_t) / 4; i++)
+        if (header->ident != PBSP_MAGIC)
         {
-                ((int *)header)[i] = LittleLong(((int *)header)[i]);
+                Warning("Not a valid PBSP file. Ident of file is %i, not %i", header->ident, PBSP_MAGIC);
+                return false;
         }
 
-        if (header->ident != PBSP_MAGIC)
+        if (header->version != BSPVERSION)
         {
-                Error("Not a valid PBSP file. Ident of file is %i, not %i", header->ident, PBSP_MAGIC);
+                Warning("BSP is version %i, not %i", header->version, BSPVERSION);
+                return false;
         }
 
-        if (header->version != BSPVERSION)
+        for (size_t i = 0; i < sizeof(s_lumpformats) / sizeof(s_lumpformats[0]); i++)
         {
-                Error("BSP is version %i, not %i", header->version, BSPVERSION);
+                const lumpformat_t *fmt = &s_lumpformats[i];
+                const lump_t *lump = &header->lumps[fmt->lump];
+
+                if (lump->fileofs < 0 || lump->filelen < 0 ||
+                    (size_t)lump->fileofs + (size_t)lump->filelen > length)
+                {
+                        Warning("BSP lump %i (offset %i, length %i) is outside of the file", fmt->lump,
+                                lump->fileofs, lump->filelen);
+                        return false;
+                }
+                if (lump->fileofs & 3)
+                {
+                        Warning("BSP lump %i is misaligned (offset %i)", fmt->lump, lump->fileofs);
+                        return false;
+                }
+                if (lump->filelen % fmt->size)
+                {
+                        Warning("BSP lump %i has odd length %i for elements of %i bytes", fmt->lump,
+                                lump->filelen, fmt->size);
+                        return false;
+                }
+                if (fmt->capacity && (size_t)lump->filelen > fmt->capacity)
+                {
+                        Warning("BSP lump %i is too big (%i bytes, max %u)", fmt->lump, lump->filelen,
+                                (unsigned)fmt->capacity);
+                        return false;
+                }
         }
 
+        return true;
+}
+
+// =====================================================================================
+//  CopyBSPLumps
+//      Copies every lump of the image into a new bspdata_t.
+// =====================================================================================
+static bspdata_t *CopyBSPLumps(const dheader_t *const header, const byte *const image)
+{
         bspdata_t *data = new bspdata_t;
 
-        data->nummodels = CopyLump(LUMP_MODELS, data->dmodels, sizeof(dmodel_t), header);
-        data->numvertexes = CopyLump(LUMP_VERTEXES, data->dvertexes, sizeof(dvertex_t), header);
-        data->numplanes = CopyLump(LUMP_PLANES, data->dplanes, sizeof(dplane_t), header);
-        data->numleafs = CopyLump(LUMP_LEAFS, data->dleafs, sizeof(dleaf_t), header);
-        data->numnodes = CopyLump(LUMP_NODES, data->dnodes, sizeof(dnode_t), header);
-        data->numtexinfo = CopyLump(LUMP_TEXINFO, data->texinfo, sizeof(texinfo_t), header);
-        data->numfaces = CopyLump(LUMP_FACES, data->dfaces, sizeof(dface_t), header);
+        data->nummodels = CopyLump(LUMP_MODELS, data->dmodels, sizeof(dmodel_t), header, image);
+        data->numvertexes = CopyLump(LUMP_VERTEXES, data->dvertexes, sizeof(dvertex_t), header, image);
+        data->numplanes = CopyLump(LUMP_PLANES, data->dplanes, sizeof(dplane_t), header, image);
+        data->numleafs = CopyLump(LUMP_LEAFS, data->dleafs, sizeof(dleaf_t), header, image);
+        data->numnodes = CopyLump(LUMP_NODES, data->dnodes, sizeof(dnode_t), header, image);
+        data->numtexinfo = CopyLump(LUMP_TEXINFO, data->texinfo, sizeof(texinfo_t), header, image);
+        data->numfaces = CopyLump(LUMP_FACES, data->dfaces, sizeof(dface_t), header, image);
         //data->numorigfaces = CopyLump( LUMP_ORIGFACES, data->dorigfaces, sizeof( dface_t ), header );
-        data->nummarksurfaces = CopyLump(LUMP_MARKSURFACES, data->dmarksurfaces, sizeof(data->dmarksurfaces[0]), header);
-        data->numsurfedges = CopyLump(LUMP_SURFEDGES, data->dsurfedges, sizeof(data->dsurfedges[0]), header);
-        data->numedges = CopyLump(LUMP_EDGES, data->dedges, sizeof(dedge_t), header);
-        data->numtexrefs = CopyLump(LUMP_TEXTURES, data->dtexrefs, sizeof(texref_t), header);
-        data->visdatasize = CopyLump(LUMP_VISIBILITY, data->dvisdata, 1, header);
-        data->entdatasize = CopyLump(LUMP_ENTITIES, data->dentdata, 1, header);
+        data->nummarksurfaces = CopyLump(LUMP_MARKSURFACES, data->dmarksurfaces, sizeof(data->dmarksurfaces[0]), header, image);
+        data->numsurfedges = CopyLump(LUMP_SURFEDGES, data->dsurfedges, sizeof(data->dsurfedges[0]), header, image);
+        data->numedges = CopyLump(LUMP_EDGES, data->dedges, sizeof(dedge_t), header, image);
+        data->numtexrefs = CopyLump(LUMP_TEXTURES, data->dtexrefs, sizeof(texref_t), header, image);
+        data->visdatasize = CopyLump(LUMP_VISIBILITY, data->dvisdata, 1, header, image);
+        data->entdatasize = CopyLump(LUMP_ENTITIES, data->dentdata, 1, header, image);
 
         // new lumps uses STL vectors and templates!
-        CopyLump(LUMP_BRUSHES, data->dbrushes, header);
-        CopyLump(LUMP_BRUSHSIDES, data->dbrushsides, header);
-        CopyLump(LUMP_LEAFBRUSHES, data->dleafbrushes, header);
-        CopyLump(LUMP_LEAFAMBIENTINDEX, data->leafambientindex, header);
-        CopyLump(LUMP_LEAFAMBIENTLIGHTING, data->leafambientlighting, header);
-        CopyLump(LUMP_BOUNCEDLIGHTING, data->bouncedlightdata, header);
-        CopyLump(LUMP_DIRECTLIGHTING, data->lightdata, header);
-        CopyLump(LUMP_DIRECTSUNLIGHTING, data->sunlightdata, header);
-        CopyLump(LUMP_STATICPROPS, data->dstaticprops, header);
-        CopyLump(LUMP_STATICPROPVERTEXDATA, data->dstaticpropvertexdatas, header);
-        CopyLump(LUMP_STATICPROPLIGHTING, data->staticproplighting, header);
-        CopyLump(LUMP_VERTNORMALS, data->vertnormals, header);
-        CopyLump(LUMP_VERTNORMALINDICES, data->vertnormalindices, header);
-        CopyLump(LUMP_CUBEMAPDATA, data->cubemapdata, header);
-        CopyLump(LUMP_CUBEMAPS, data->cubemaps, header);
+        CopyLump(LUMP_BRUSHES, data->dbrushes, header, image);
+        CopyLump(LUMP_BRUSHSIDES, data->dbrushsides, header, image);
+        CopyLump(LUMP_LEAFBRUSHES, data->dleafbrushes, header, image);
+        CopyLump(LUMP_LEAFAMBIENTINDEX, data->leafambientindex, header, image);
+        CopyLump(LUMP_LEAFAMBIENTLIGHTING, data->leafambientlighting, header, image);
+        CopyLump(LUMP_LEAFAMBIENTSH, data->leafambientsh, header, image);
+        CopyLump(LUMP_BOUNCEDLIGHTING, data->bouncedlightdata, header, image);
+        CopyLump(LUMP_DIRECTLIGHTING, data->lightdata, header, image);
+        CopyLump(LUMP_DIRECTSUNLIGHTING, data->sunlightdata, header, image);
+        CopyLump(LUMP_STATICPROPS, data->dstaticprops, header, image);
+        CopyLump(LUMP_STATICPROPVERTEXDATA, data->dstaticpropvertexdatas, header, image);
+        CopyLump(LUMP_STATICPROPLIGHTING, data->staticproplighting, header, image);
+        CopyLump(LUMP_VERTNORMALS, data->vertnormals, header, image);
+        CopyLump(LUMP_VERTNORMALINDICES, data->vertnormalindices, header, image);
+        CopyLump(LUMP_CUBEMAPDATA, data->cubemapdata, header, image);
+        CopyLump(LUMP_CUBEMAPS, data->cubemaps, header, image);
 
-        Free(header); // everything has been copied out
+        return data;
+}
 
+// =====================================================================================
+//  FinishBSPLoad
+//      Swaps the copied lumps to native byte order and checksums them.
+// =====================================================================================
+static void FinishBSPLoad(bspdata_t *data)
+{
         //
         // swap everything
         //
@@ -462,6 +541,96 @@ bspdata_t *LoadBSPImage(dheader_t *const header)
         data->dvisdata_checksum = FastChecksum(data->dvisdata, data->visdatasize * sizeof(data->dvisdata[0]));
         data->dlightdata_checksum = FastChecksum(data->lightdata.data(), data->lightdata.size() * sizeof(colorrgbexp32_t));
         data->dentdata_checksum = FastChecksum(data->dentdata, data->entdatasize * sizeof(data->dentdata[0]));
+}
+
+// =====================================================================================
+//  LoadBSPFile
+//      balh
+// =====================================================================================
+bspdata_t *LoadBSPFile(const char *const filename)
+{
+        filemapping_t mapping;
+        if (MapFile(filename, 0, 0, &mapping))
+        {
+                // copy the lumps straight out of the page cache
+                bspdata_t *data = LoadBSPImage(mapping.data, mapping.length);
+                UnmapFile(&mapping);
+                if (!data)
+                {
+                        Error("%s is not a valid BSP file", filename);
+                }
+                return data;
+        }
+
+        dheader_t *header;
+        LoadFile(filename, (char **)&header);
+        return LoadBSPImage(header);
+}
+
+// =====================================================================================
+//  LoadBSPImage
+//      balh
+// =====================================================================================
+bspdata_t *LoadBSPImage(dheader_t *const header)
+{
+        unsigned int i;
+
+        // swap the header
+        for (i = 0; i < sizeof(dheader_t) / 4; i++)
+        {
+                ((int *)header)[i] = LittleLong(((int *)header)[i]);
+        }
+
+        if (header->ident != PBSP_MAGIC)
+        {
+                Error("Not a valid PBSP file. Ident of file is %i, not %i", header->ident, PBSP_MAGIC);
+        }
+
+        if (header->version != BSPVERSION)
+        {
+                Error("BSP is version %i, not %i", header->version, BSPVERSION);
+        }
+
+        bspdata_t *data = CopyBSPLumps(header, (const byte *)header);
+
+        Free(header); // everything has been copied out
+
+        FinishBSPLoad(data);
+
+        return data;
+}
+
+// =====================================================================================
+//  LoadBSPImage
+//      Loads from a read-only image of the whole file, such as a memory mapping,
+//      without touching the image.  The header and every lump are checked against
+//      the size of the image first; returns NULL if the file is damaged.
+// =====================================================================================
+bspdata_t *LoadBSPImage(const void *const image, size_t length)
+{
+        dheader_t header;
+        unsigned int i;
+
+        if (length < sizeof(dheader_t))
+        {
+                Warning("BSP file is too small (%u bytes)", (unsigned)length);
+                return NULL;
+        }
+
+        // swap a copy of the header, the image itself may be read-only
+        memcpy(&header, image, sizeof(dheader_t));
+        for (i = 0; i < sizeof(dheader_t) / 4; i++)
+        {
+                ((int *)&header)[i] = LittleLong(((int *)&header)[i]);
+        }
+
+        if (!ValidateBSPImage(&header, length))
+        {
+                return NULL;
+        }
+
+        bspdata_t *data = CopyBSPLumps(&header, (const byte *)image);
+        FinishBSPLoad(data);
 
         return data;
 }
@@ -532,6 +701,7 @@ void WriteBSPFile(bspdata_t *data, const char *const filename)
         AddLump(LUMP_LEAFBRUSHES, data->dleafbrushes, header, bspfile);
         AddLump(LUMP_LEAFAMBIENTINDEX, data->leafambientindex, header, bspfile);
         AddLump(LUMP_LEAFAMBIENTLIGHTING, data->leafambientlighting, header, bspfile);
+        AddLump(LUMP_LEAFAMBIENTSH, data->leafambientsh, header, bspfile);
         AddLump(LUMP_BOUNCEDLIGHTING, data->bouncedlightdata, header, bspfile);
         AddLump(LUMP_DIRECTLIGHTING, data->lightdata, header, bspfile);
         AddLump(LUMP_DIRECTSUNLIGHTING, data->sunlightdata, header, bspfile);
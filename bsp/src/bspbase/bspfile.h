@@ -103,7 +103,7 @@ class CKeyValues;
 #define MAX_LIGHTSTYLES 64
 //=============================================================================
 
-#define BSPVERSION 33
+#define BSPVERSION 34
 #define TOOLVERSION 4
 
 // One hammer unit is 1/16th of a foot.
@@ -151,6 +151,7 @@ enum
         LUMP_VERTNORMALINDICES,
         LUMP_CUBEMAPDATA,
         LUMP_CUBEMAPS,
+        LUMP_LEAFAMBIENTSH,
 
         HEADER_LUMPS,
 };
@@ -292,6 +293,17 @@ struct dleafambientlighting_t
         unsigned char x, y, z, pad; // pad is unused
 };
 
+// An ambient sample stored as L1 spherical harmonics, already convolved
+// with the cosine lobe and kept in the form color(n) = dc + dot(dir, n).
+// Each linear term is a fraction of twice dc, which it can never exceed.
+struct dleafambientsh_t
+{
+        colorrgbexp32_t dc;
+        signed char dir[3][3]; // [axis][channel], scaled to -127..127
+        // fixed point fraction of leaf bounds
+        unsigned char x, y, z;
+};
+
 struct dleafambientindex_t
 {
         unsigned short num_ambient_samples;
@@ -492,6 +504,7 @@ struct bspdata_t
         int dsurfedges_checksum;
 
         pvector<dleafambientlighting_t> leafambientlighting;
+        pvector<dleafambientsh_t> leafambientsh;
         pvector<dleafambientindex_t> leafambientindex;
         pvector<dbrush_t> dbrushes;
         pvector<dbrushside_t> dbrushsides;
@@ -520,6 +533,7 @@ extern _BSPEXPORT int CompressVis(const byte *const src, const unsigned int src_
                                   byte *dest, unsigned int dest_length);
 
 extern _BSPEXPORT bspdata_t *LoadBSPImage(dheader_t *header);
+extern _BSPEXPORT bspdata_t *LoadBSPImage(const void *image, size_t length);
 extern _BSPEXPORT bspdata_t *LoadBSPFile(const char *const filename);
 extern _BSPEXPORT void WriteBSPFile(bspdata_t *data, const char *const filename);
 extern _BSPEXPORT void PrintBSPFileSizes(bspdata_t *data);
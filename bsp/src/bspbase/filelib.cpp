@@ -3,6 +3,8 @@
 #endif
 
 #ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #include <sys/stat.h>
 #include <io.h>
 #include <fcntl.h>
@@ -18,6 +20,11 @@
 #endif
 #endif
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "filelib.h"
 #include "messages.h"
 #include "log.h"
@@ -207,3 +214,125 @@ void SaveFile(const char *const filename, const void *const buffer, int count)
         SafeWrite(f, buffer, count);
         fclose(f);
 }
+
+/*
+* ==============
+* MapFile
+*
+* Maps length bytes of the file starting at start read-only, or everything
+* from start to the end of the file if length is 0.  Returns false if the file
+* can't be mapped, in which case the caller should read it instead.
+* ==============
+*/
+bool MapFile(const char *const filename, size_t start, size_t length, filemapping_t *mapping)
+{
+        size_t filesize;
+        size_t viewstart;
+
+        memset(mapping, 0, sizeof(*mapping));
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+                return false;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+                CloseHandle(file);
+                return false;
+        }
+        filesize = (size_t)size.QuadPart;
+
+        // views have to start on the allocation granularity
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+#define MAP_ALIGNMENT ((size_t)info.dwAllocationGranularity)
+#else
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+                return false;
+        }
+
+        struct stat filestat;
+        if (fstat(fd, &filestat) != 0)
+        {
+                close(fd);
+                return false;
+        }
+        filesize = (size_t)filestat.st_size;
+
+#define MAP_ALIGNMENT ((size_t)sysconf(_SC_PAGESIZE))
+#endif
+
+        if (!length && start < filesize)
+        {
+                length = filesize - start;
+        }
+        if (!length || start + length > filesize)
+        {
+#ifdef _WIN32
+                CloseHandle(file);
+#else
+                close(fd);
+#endif
+                return false;
+        }
+
+        viewstart = start - start % MAP_ALIGNMENT;
+        mapping->viewlength = length + (start - viewstart);
+#undef MAP_ALIGNMENT
+
+#ifdef _WIN32
+        HANDLE filemap = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!filemap)
+        {
+                return false;
+        }
+        mapping->view = MapViewOfFile(filemap, FILE_MAP_READ, (DWORD)((unsigned long long)viewstart >> 32),
+                                      (DWORD)viewstart, mapping->viewlength);
+        CloseHandle(filemap); // the view keeps the mapping alive
+        if (!mapping->view)
+        {
+                return false;
+        }
+#else
+        void *view = mmap(NULL, mapping->viewlength, PROT_READ, MAP_PRIVATE, fd, (off_t)viewstart);
+        close(fd); // the mapping keeps the file open
+        if (view == MAP_FAILED)
+        {
+                return false;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(view, mapping->viewlength, MADV_SEQUENTIAL);
+#endif
+        mapping->view = view;
+#endif
+
+        mapping->data = (const unsigned char *)mapping->view + (start - viewstart);
+        mapping->length = length;
+        return true;
+}
+
+/*
+* ==============
+* UnmapFile
+* ==============
+*/
+void UnmapFile(filemapping_t *mapping)
+{
+        if (mapping->view)
+        {
+#ifdef _WIN32
+                UnmapViewOfFile(mapping->view);
+#else
+                munmap(mapping->view, mapping->viewlength);
+#endif
+        }
+        memset(mapping, 0, sizeof(*mapping));
+}
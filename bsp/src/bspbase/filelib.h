@@ -20,4 +20,16 @@ extern _BSPEXPORT void SafeWrite(FILE *f, const void *const buffer, int count);
 extern _BSPEXPORT int LoadFile(const char *const filename, char **bufferptr);
 extern _BSPEXPORT void SaveFile(const char *const filename, const void *const buffer, int count);
 
+// Read-only memory mapping of (part of) a file.
+typedef struct
+{
+        const unsigned char *data;                          // first byte of the requested region
+        size_t length;
+        void *view;                                         // the mapping, starts on a page boundary
+        size_t viewlength;
+} filemapping_t;
+
+extern _BSPEXPORT bool MapFile(const char *const filename, size_t start, size_t length, filemapping_t *mapping);
+extern _BSPEXPORT void UnmapFile(filemapping_t *mapping);
+
 #endif //**/ FILELIB_H__
@@ -0,0 +1,304 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file profile.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "cmdlib.h"
+#include "messages.h"
+#include "log.h"
+#include "mathlib.h"
+#include "threads.h"
+#include "profile.h"
+
+#include <string>
+
+typedef struct
+{
+        std::string     name;                              // full name, "Parent:Child"
+        int             parent;
+        double          start;
+        double          elapsed;
+        size_t          peakmem;
+} profilephase_t;
+
+typedef struct
+{
+        std::string     name;
+        int             phase;
+        double          elapsed;
+        int             threads;
+        int             items;
+        double          busy;
+        double          maxbusy;
+} profilerun_t;
+
+char g_profilefile[_MAX_PATH] = "";
+
+static pvector<profilephase_t> s_phases;
+static pvector<profilerun_t> s_runs;
+static pvector<std::pair<std::string, double> > s_values;
+static int s_curphase = -1;
+
+static pvector<ProfileCounter *> &GetProfileCounters()
+{
+        // Constructed on first use, the counters register themselves during
+        // static initialization.
+        static pvector<ProfileCounter *> counters;
+        return counters;
+}
+
+ProfileCounter::ProfileCounter( const char *name ) :
+        _name( name )
+{
+        memset( _counts, 0, sizeof( _counts ) );
+        GetProfileCounters().push_back( this );
+}
+
+int64_t ProfileCounter::get_total() const
+{
+        int64_t total = 0;
+        for ( int i = 0; i < MAX_THREADS; i++ )
+        {
+                total += _counts[i].count;
+        }
+        return total;
+}
+
+// =====================================================================================
+//  GetPeakMemoryUsage
+//      High-water mark of the process' resident memory, in bytes.
+// =====================================================================================
+size_t GetPeakMemoryUsage()
+{
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS pmc;
+        if ( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+        {
+                return pmc.PeakWorkingSetSize;
+        }
+        return 0;
+#else
+        struct rusage usage;
+        if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+        {
+                return 0;
+        }
+#ifdef __APPLE__
+        return (size_t)usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// =====================================================================================
+//  ProfileStart
+// =====================================================================================
+void ProfileStart()
+{
+        s_phases.clear();
+        s_runs.clear();
+        s_values.clear();
+        s_curphase = -1;
+}
+
+// =====================================================================================
+//  ProfileBeginPhase
+//      Phases nest; the new phase is a child of the one currently running.
+// =====================================================================================
+void ProfileBeginPhase( const char *name )
+{
+        profilephase_t phase;
+
+        if ( s_curphase >= 0 )
+        {
+                phase.name = s_phases[s_curphase].name + ":" + name;
+        }
+        else
+        {
+                phase.name = name;
+        }
+        phase.parent = s_curphase;
+        phase.start = I_FloatTime();
+        phase.elapsed = 0;
+        phase.peakmem = 0;
+
+        s_curphase = (int)s_phases.size();
+        s_phases.push_back( phase );
+}
+
+// =====================================================================================
+//  ProfileEndPhase
+// =====================================================================================
+void ProfileEndPhase()
+{
+        if ( s_curphase < 0 )
+        {
+                Developer( DEVELOPER_LEVEL_ERROR, "ProfileEndPhase called without a phase\n" );
+                return;
+        }
+
+        profilephase_t &phase = s_phases[s_curphase];
+        phase.elapsed = I_FloatTime() - phase.start;
+        phase.peakmem = GetPeakMemoryUsage();
+        s_curphase = phase.parent;
+}
+
+// =====================================================================================
+//  ProfileSetValue
+//      Records a single figure of the compile, such as the number of patches.
+// =====================================================================================
+void ProfileSetValue( const char *name, double value )
+{
+        for ( size_t i = 0; i < s_values.size(); i++ )
+        {
+                if ( s_values[i].first == name )
+                {
+                        s_values[i].second = value;
+                        return;
+                }
+        }
+        s_values.push_back( std::pair<std::string, double>( name, value ) );
+}
+
+// =====================================================================================
+//  ProfileThreadRun
+//      Called by RunThreadsOn() once the threads have been collected.
+// =====================================================================================
+void ProfileThreadRun( const char *name, double start, double end )
+{
+        profilerun_t run;
+        int numthreads;
+        const threadstats_t *stats = GetThreadStats( numthreads );
+
+        run.name = name;
+        run.phase = s_curphase;
+        run.elapsed = end - start;
+        run.threads = numthreads;
+        run.items = 0;
+        run.busy = 0;
+        run.maxbusy = 0;
+        for ( int i = 0; i < numthreads; i++ )
+        {
+                run.items += stats[i].items;
+                run.busy += stats[i].busy;
+                run.maxbusy = qmax( run.maxbusy, stats[i].busy );
+        }
+
+        s_runs.push_back( run );
+}
+
+static void WriteJSONString( FILE *f, const char *s )
+{
+        fputc( '"', f );
+        for ( ; *s; s++ )
+        {
+                if ( *s == '"' || *s == '\\' )
+                {
+                        fputc( '\\', f );
+                        fputc( *s, f );
+                }
+                else if ( (unsigned char)*s < 0x20 )
+                {
+                        fprintf( f, "\\u%04x", (unsigned char)*s );
+                }
+                else
+                {
+                        fputc( *s, f );
+                }
+        }
+        fputc( '"', f );
+}
+
+// =====================================================================================
+//  ProfileWrite
+//      Writes the report to g_profilefile, if -profile was given.
+// =====================================================================================
+void ProfileWrite( double elapsed )
+{
+        size_t i;
+
+        if ( !g_profilefile[0] )
+        {
+                return;
+        }
+
+        // close anything still running, e.g. when the tool bailed out early
+        while ( s_curphase >= 0 )
+        {
+                ProfileEndPhase();
+        }
+
+        FILE *f = fopen( g_profilefile, "w" );
+        if ( !f )
+        {
+                Warning( "Couldn't write profile to %s\n", g_profilefile );
+                return;
+        }
+
+        fprintf( f, "{\n  \"tool\": " );
+        WriteJSONString( f, g_Program );
+        fprintf( f, ",\n  \"map\": " );
+        WriteJSONString( f, g_Mapname );
+        fprintf( f, ",\n  \"threads\": %d,\n", g_numthreads );
+        fprintf( f, "  \"elapsed\": %.4f,\n", elapsed );
+        fprintf( f, "  \"peak_memory\": %llu,\n", (unsigned long long)GetPeakMemoryUsage() );
+
+        fprintf( f, "  \"phases\": [" );
+        for ( i = 0; i < s_phases.size(); i++ )
+        {
+                fprintf( f, "%s\n    { \"name\": ", i ? "," : "" );
+                WriteJSONString( f, s_phases[i].name.c_str() );
+                fprintf( f, ", \"elapsed\": %.4f, \"peak_memory\": %llu }",
+                         s_phases[i].elapsed, (unsigned long long)s_phases[i].peakmem );
+        }
+        fprintf( f, "\n  ],\n" );
+
+        fprintf( f, "  \"thread_runs\": [" );
+        for ( i = 0; i < s_runs.size(); i++ )
+        {
+                const profilerun_t &run = s_runs[i];
+                fprintf( f, "%s\n    { \"name\": ", i ? "," : "" );
+                WriteJSONString( f, run.name.c_str() );
+                fprintf( f, ", \"phase\": " );
+                WriteJSONString( f, run.phase >= 0 ? s_phases[run.phase].name.c_str() : "" );
+                fprintf( f, ", \"elapsed\": %.4f, \"threads\": %d, \"items\": %d, \"busy\": %.4f, \"max_busy\": %.4f }",
+                         run.elapsed, run.threads, run.items, run.busy, run.maxbusy );
+        }
+        fprintf( f, "\n  ],\n" );
+
+        pvector<ProfileCounter *> &counters = GetProfileCounters();
+        fprintf( f, "  \"counters\": {" );
+        for ( i = 0; i < counters.size(); i++ )
+        {
+                fprintf( f, "%s\n    ", i ? "," : "" );
+                WriteJSONString( f, counters[i]->get_name() );
+                fprintf( f, ": %lld", (long long)counters[i]->get_total() );
+        }
+        fprintf( f, "\n  },\n" );
+
+        fprintf( f, "  \"values\": {" );
+        for ( i = 0; i < s_values.size(); i++ )
+        {
+                fprintf( f, "%s\n    ", i ? "," : "" );
+                WriteJSONString( f, s_values[i].first.c_str() );
+                fprintf( f, ": %.17g", s_values[i].second );
+        }
+        fprintf( f, "\n  }\n}\n" );
+
+        fclose( f );
+
+        Log( "Wrote compile profile to %s\n", g_profilefile );
+}
@@ -0,0 +1,77 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file profile.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ * @desc Compile profile shared by the compile tools.
+ *
+ *       With -profile <file>, a tool writes a JSON report of its run: the
+ *       time and memory high-water mark of each phase, the load balance of
+ *       every RunThreadsOn() call made in it, and the totals of the work
+ *       counters (rays traced, portals flowed, ...).  The reports are what
+ *       the compile benchmark (CompileBenchmark.py) compares against its
+ *       baseline.
+ */
+
+#ifndef PROFILE_H__
+#define PROFILE_H__
+#include "cmdlib.h"
+
+#if _MSC_VER >= 1000
+#pragma once
+#endif
+
+#include "threads.h"
+
+#include <stdint.h>
+
+// A work counter that every thread can bump without synchronizing, declared
+// statically like a PStatCollector:
+//
+//   static ProfileCounter rays_counter( "RadWorld:RaysTraced" );
+//   rays_counter.add( 4 );
+//
+// Each thread counts into its own cache line; the counts are only summed when
+// the report is written.
+class _BSPEXPORT ProfileCounter
+{
+public:
+        ProfileCounter( const char *name );
+
+        inline void add( int64_t count )
+        {
+                _counts[GetCurrentThreadNumber()].count += count;
+        }
+        int64_t get_total() const;
+
+        inline const char *get_name() const
+        {
+                return _name;
+        }
+
+private:
+        struct threadcount_t
+        {
+                int64_t count;
+                char pad[64 - sizeof( int64_t )];
+        };
+
+        const char *_name;
+        threadcount_t _counts[MAX_THREADS];
+};
+
+extern _BSPEXPORT char g_profilefile[_MAX_PATH];           // "-profile" report, empty when off
+
+extern _BSPEXPORT void     ProfileStart();
+extern _BSPEXPORT void     ProfileBeginPhase( const char *name );
+extern _BSPEXPORT void     ProfileEndPhase();
+extern _BSPEXPORT void     ProfileSetValue( const char *name, double value );
+extern _BSPEXPORT void     ProfileThreadRun( const char *name, double start, double end );
+extern _BSPEXPORT void     ProfileWrite( double elapsed );
+
+extern _BSPEXPORT size_t   GetPeakMemoryUsage();
+
+#endif // PROFILE_H__
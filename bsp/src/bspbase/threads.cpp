@@ -13,6 +13,7 @@
 #include "log.h"
 #include "threads.h"
 #include "blockmem.h"
+#include "profile.h"
 
 #ifdef __GNUC__
 #ifdef HAVE_SYS_TIME_H
@@ -28,18 +29,30 @@
 #endif
 
 #include "hlassert.h"
+#include "mathlib.h"
+
+#include <atomicAdjust.h>
+
+// Index of the BSPThread running on the calling thread, or -1 for the main
+// thread.  Looked up on every work item, so it must not require a search.
+static thread_local int t_threadnum = -1;
 
 BSPThread::BSPThread() : Thread("bspthread", "bspthread_sync"),
     _func(nullptr),
     _val(0),
-    _finished(false)
+    _finished(false),
+    _start_time(0.0),
+    _finish_time(0.0)
 {
 }
 
 void BSPThread::thread_main()
 {
     //Thread::thread_main();
+    t_threadnum = _val;
+    _start_time = I_FloatTime();
     (*_func)(_val);
+    _finish_time = I_FloatTime();
     _finished = true;
 }
 
@@ -65,128 +78,179 @@ pvector<PT(BSPThread)> g_threadhandles;
 #define THREADTIMES_SIZE 100
 #define THREADTIMES_SIZEf (float)(THREADTIMES_SIZE)
 
-static int dispatch = 0;
+// Upper bound on the number of items claimed at once for each cost hint.
+static const int s_maxchunk[] = {256, 16, 1};
+// Each claim takes at most 1/(CHUNK_DIVISOR * numthreads) of the remaining
+// work, so chunks shrink towards the end of the run.
+#define CHUNK_DIVISOR 4
+
+// The range of work items currently owned by one thread.  Only the owning
+// thread touches it, padded out so neighbouring threads don't share a line.
+struct threadwork_t
+{
+    int next;
+    int end;
+    int items;
+    int chunks;
+    char pad[64 - 4 * sizeof(int)];
+};
+
+static AtomicAdjust::Integer dispatch = 0;
+static AtomicAdjust::Integer oldf = 0;
 static int workcount = 0;
-static int oldf = 0;
+static int maxchunk = 1;
 static bool pacifier = false;
 static bool threaded = false;
 static double threadstart = 0;
 static double threadtimes[THREADTIMES_SIZE];
-
-int GetThreadWork()
+static pvector<threadwork_t> threadwork;
+static pvector<threadstats_t> threadstats;
+
+// =====================================================================================
+//  UpdatePacifier
+//      Called with the number of items handed out so far.  Only the thread that
+//      advances the percentage prints, and it does so without holding any lock.
+// =====================================================================================
+static void UpdatePacifier(int done)
 {
-    int r, f, i;
+    int i, f, old;
     double ct, finish, finish2, finish3;
     static const char *s1 = NULL; // avoid frequent call of Localize() in PrintConsole
     static const char *s2 = NULL;
 
-    ThreadLock();
-    if (s1 == NULL)
-        s1 = Localize("  (%d%%: est. time to completion %ld/%ld/%ld secs)   ");
-    if (s2 == NULL)
-        s2 = Localize("  (%d%%: est. time to completion <1 sec)   ");
-
-    if (dispatch == 0)
+    f = (int)((long long)THREADTIMES_SIZE * done / workcount);
+    old = (int)AtomicAdjust::get(oldf);
+    if (f <= old)
     {
-        oldf = 0;
-    }
-
-    if (dispatch > workcount)
-    {
-        Developer(DEVELOPER_LEVEL_ERROR, "dispatch > workcount!!!\n");
-        ThreadUnlock();
-        return -1;
-    }
-    if (dispatch == workcount)
-    {
-        Developer(DEVELOPER_LEVEL_MESSAGE, "dispatch == workcount, work is complete\n");
-        ThreadUnlock();
-        return -1;
+        return;
     }
-    if (dispatch < 0)
+    if (AtomicAdjust::compare_and_exchange(oldf, old, f) != old)
     {
-        Developer(DEVELOPER_LEVEL_ERROR, "negative dispatch!!!\n");
-        ThreadUnlock();
-        return -1;
+        // Another thread is reporting this step.
+        return;
     }
 
-    f = THREADTIMES_SIZE * dispatch / workcount;
     if (pacifier)
     {
-        printf("\r%6d /%6d", dispatch, workcount);
+        if (s1 == NULL)
+            s1 = Localize("  (%d%%: est. time to completion %ld/%ld/%ld secs)   ");
+        if (s2 == NULL)
+            s2 = Localize("  (%d%%: est. time to completion <1 sec)   ");
+
+        printf("\r%6d /%6d", done, workcount);
 
-        if (f != oldf)
+        ct = I_FloatTime();
+        /* Fill in current time for threadtimes record */
+        for (i = old; i <= f && i < THREADTIMES_SIZE; i++)
         {
-            ct = I_FloatTime();
-            /* Fill in current time for threadtimes record */
-            for (i = oldf; i <= f; i++)
+            if (threadtimes[i] < 1)
             {
-                if (threadtimes[i] < 1)
-                {
-                    threadtimes[i] = ct;
-                }
+                threadtimes[i] = ct;
             }
-            oldf = f;
+        }
+
+        if (f > 10 && f < THREADTIMES_SIZE)
+        {
+            finish = (ct - threadtimes[0]) * (THREADTIMES_SIZEf - f) / f;
+            finish2 = 10.0 * (ct - threadtimes[f - 10]) * (THREADTIMES_SIZEf - f) / THREADTIMES_SIZEf;
+            finish3 = THREADTIMES_SIZEf * (ct - threadtimes[f - 1]) * (THREADTIMES_SIZEf - f) / THREADTIMES_SIZEf;
 
-            if (f > 10)
+            if (finish > 1.0)
+            {
+                printf(s1, f, (long)(finish), (long)(finish2),
+                       (long)(finish3));
+            }
+            else
             {
-                finish = (ct - threadtimes[0]) * (THREADTIMES_SIZEf - f) / f;
-                finish2 = 10.0 * (ct - threadtimes[f - 10]) * (THREADTIMES_SIZEf - f) / THREADTIMES_SIZEf;
-                finish3 = THREADTIMES_SIZEf * (ct - threadtimes[f - 1]) * (THREADTIMES_SIZEf - f) / THREADTIMES_SIZEf;
-
-                if (finish > 1.0)
-                {
-                    printf(s1, f, (long)(finish), (long)(finish2),
-                           (long)(finish3));
-                }
-                else
-                {
-                    printf(s2, f);
-                }
+                printf(s2, f);
             }
         }
     }
     else
     {
-        if (f != oldf)
+        // A single claim may step over several marks.
+        for (i = old + 1; i <= f; i++)
         {
-            oldf = f;
-            switch (f)
+            if (i % 10 == 0)
             {
-            case 10:
-            case 20:
-            case 30:
-            case 40:
-            case 50:
-            case 60:
-            case 70:
-            case 80:
-            case 90:
-            case 100:
-                /*
-                case 5:
-                case 15:
-                case 25:
-                case 35:
-                case 45:
-                case 55:
-                case 65:
-                case 75:
-                case 85:
-                case 95:
-                */
-                printf("%d%%...", f);
-            default:
-                break;
+                printf("%d%%...", i);
             }
         }
     }
+}
 
-    r = dispatch;
-    dispatch++;
+// =====================================================================================
+//  ClaimThreadWork
+//      Grabs the next chunk of items off the shared counter for the calling thread.
+// =====================================================================================
+static bool ClaimThreadWork(threadwork_t &tw)
+{
+    int remaining, chunk, start;
 
-    ThreadUnlock();
-    return r;
+    remaining = workcount - (int)AtomicAdjust::get(dispatch);
+    if (remaining <= 0)
+    {
+        return false;
+    }
+
+    chunk = remaining / (CHUNK_DIVISOR * g_numthreads);
+    chunk = qmax(1, qmin(chunk, maxchunk));
+
+    // The counter may run past workcount when several threads claim the last
+    // items at once; whatever lies past the end is simply dropped.
+    start = (int)AtomicAdjust::add(dispatch, chunk) - chunk;
+    if (start >= workcount)
+    {
+        return false;
+    }
+
+    tw.next = start;
+    tw.end = qmin(start + chunk, workcount);
+    tw.chunks++;
+
+    UpdatePacifier(tw.end);
+
+    return true;
+}
+
+int GetThreadWork()
+{
+    if (threadwork.empty())
+    {
+        Developer(DEVELOPER_LEVEL_ERROR, "GetThreadWork called outside of RunThreadsOn!!!\n");
+        return -1;
+    }
+
+    threadwork_t &tw = threadwork[t_threadnum < 0 ? 0 : t_threadnum];
+    if (tw.next >= tw.end && !ClaimThreadWork(tw))
+    {
+        Developer(DEVELOPER_LEVEL_MESSAGE, "dispatch == workcount, work is complete\n");
+        return -1;
+    }
+
+    tw.items++;
+    return tw.next++;
+}
+
+const threadstats_t *GetThreadStats(int &numthreads)
+{
+    numthreads = (int)threadstats.size();
+    return threadstats.data();
+}
+
+// Name of the next run in the compile profile, set by the NamedRunThreadsOn
+// macros.
+static const char *s_runname = NULL;
+
+void SetThreadRunName(const char *name)
+{
+    s_runname = name;
+}
+
+static void ProfileLastRun(double start, double end)
+{
+    ProfileThreadRun(s_runname ? s_runname : "RunThreadsOn", start, end);
+    s_runname = NULL;
 }
 
 q_threadfunction *workfunction;
@@ -209,10 +273,10 @@ static void ThreadWorkerFunction(int unused)
 #pragma warning(pop)
 #endif
 
-void RunThreadsOnIndividual(int workcnt, bool showpacifier, q_threadfunction func)
+void RunThreadsOnIndividual(int workcnt, bool showpacifier, q_threadfunction func, q_threadcost cost)
 {
     workfunction = func;
-    RunThreadsOn(workcnt, showpacifier, ThreadWorkerFunction);
+    RunThreadsOn(workcnt, showpacifier, ThreadWorkerFunction, cost);
 }
 
 #ifndef SINGLE_THREADED
@@ -226,20 +290,7 @@ int g_numthreads = DEFAULT_NUMTHREADS;
 
 int GetCurrentThreadNumber()
 {
-    Thread *th = Thread::get_current_thread();
-
-    int num = 0;
-
-    for (size_t i = 0; i < g_threadhandles.size(); i++)
-    {
-        if (g_threadhandles[i] == th)
-        {
-            num = i;
-            break;
-        }
-    }
-
-    return num;
+    return t_threadnum < 0 ? 0 : t_threadnum;
 }
 
 void ThreadSetPriority(ThreadPriority type)
@@ -260,7 +311,7 @@ void ThreadSetDefault()
 #elif defined(__GNUC__)
         g_numthreads = DEFAULT_NUMTHREADS;
 #endif
-        if (g_numthreads < 1 || g_numthreads > 32)
+        if (g_numthreads < 1 || g_numthreads > MAX_THREADS)
         {
             g_numthreads = 1;
         }
@@ -287,9 +338,41 @@ void ThreadUnlock()
 
 q_threadfunction *q_entry;
 
-void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
+// =====================================================================================
+//  CollectThreadStats
+//      Fills in threadstats from the threads of the run that just finished.
+// =====================================================================================
+static void CollectThreadStats(double start, double end)
+{
+    int i;
+    double busy = 0;
+
+    threadstats.resize(g_threadhandles.size());
+    for (i = 0; i < (int)g_threadhandles.size(); i++)
+    {
+        threadstats_t &ts = threadstats[i];
+        ts.items = threadwork[i].items;
+        ts.chunks = threadwork[i].chunks;
+        ts.busy = g_threadhandles[i]->get_finish_time() - g_threadhandles[i]->get_start_time();
+        ts.idle = qmax(0.0, (end - start) - ts.busy);
+        busy += ts.busy;
+    }
+
+    if (g_threadhandles.size() > 1 && end > start)
+    {
+        Verbose("%d threads, %.0f%% busy\n", (int)g_threadhandles.size(),
+                100.0 * busy / ((end - start) * g_threadhandles.size()));
+        for (i = 0; i < (int)threadstats.size(); i++)
+        {
+            Verbose("  thread %3d: busy %8.2fs idle %8.2fs %8d items %6d chunks\n", i,
+                    threadstats[i].busy, threadstats[i].idle, threadstats[i].items,
+                    threadstats[i].chunks);
+        }
+    }
+}
+
+void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func, q_threadcost cost)
 {
-    string threadid[MAX_THREADS];
     int i;
     double start, end;
 
@@ -301,18 +384,22 @@ void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
     {
         threadtimes[i] = 0;
     }
-    dispatch = 0;
+    AtomicAdjust::set(dispatch, 0);
+    AtomicAdjust::set(oldf, 0);
     workcount = workcnt;
-    oldf = -1;
+    maxchunk = s_maxchunk[cost];
     pacifier = showpacifier;
     threaded = true;
     q_entry = func;
 
-    if (workcount < dispatch)
+    hlassume(workcount >= 0, assume_BadWorkcount);
+
+    threadwork.assign(g_numthreads, threadwork_t());
+    for (i = 0; i < g_numthreads; i++)
     {
-        Developer(DEVELOPER_LEVEL_ERROR, "RunThreadsOn: Workcount(%i) < dispatch(%i)\n", workcount, dispatch);
+        threadwork[i].next = threadwork[i].end = 0;
+        threadwork[i].items = threadwork[i].chunks = 0;
     }
-    hlassume(workcount >= dispatch, assume_BadWorkcount);
 
     //
     // Create all the threads (suspended)
@@ -331,7 +418,7 @@ void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
     // Start all the threads
     for (i = 0; i < g_threadhandles.size(); i++)
     {
-        if (!g_threadhandles[i]->start(g_threadpriority, false))
+        if (!g_threadhandles[i]->start(g_threadpriority, true))
         {
             Fatal(assume_THREAD_ERROR, "Unable to start thread #%d", i);
         }
@@ -340,14 +427,8 @@ void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
     // Wait for threads to complete
     for (i = 0; i < g_threadhandles.size(); i++)
     {
-        Developer(DEVELOPER_LEVEL_MESSAGE, "WaitForSingleObject on thread #%d [%08X]\n", i, g_threadhandles[i]);
-        while (true)
-        {
-            if (!g_threadhandles[i]->is_started())
-                break;
-            if (g_threadhandles[i]->is_finished())
-                break;
-        }
+        Developer(DEVELOPER_LEVEL_MESSAGE, "Joining thread #%d [%p]\n", i, g_threadhandles[i].p());
+        g_threadhandles[i]->join();
     }
 
     q_entry = NULL;
@@ -358,6 +439,10 @@ void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
         printf("\r%60s\r", "");
     }
     Log(" (%.2f seconds)\n", end - start);
+
+    CollectThreadStats(start, end);
+    ProfileLastRun(start, end);
+    threadwork.clear();
 }
 
 #endif /*SINGLE_THREADED */
@@ -394,14 +479,18 @@ void ThreadUnlock()
 {
 }
 
-void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
+void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func, q_threadcost cost)
 {
     int i;
     double start, end;
 
-    dispatch = 0;
+    AtomicAdjust::set(dispatch, 0);
+    AtomicAdjust::set(oldf, 0);
     workcount = workcnt;
-    oldf = -1;
+    maxchunk = s_maxchunk[cost];
+    threadwork.assign(1, threadwork_t());
+    threadwork[0].next = threadwork[0].end = 0;
+    threadwork[0].items = threadwork[0].chunks = 0;
     pacifier = showpacifier;
     threadstart = I_FloatTime();
     start = threadstart;
@@ -424,6 +513,14 @@ void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction func)
     }
 
     Log(" (%.2f seconds)\n", end - start);
+
+    threadstats.resize(1);
+    threadstats[0].items = threadwork[0].items;
+    threadstats[0].chunks = threadwork[0].chunks;
+    threadstats[0].busy = end - start;
+    threadstats[0].idle = 0;
+    ProfileLastRun(start, end);
+    threadwork.clear();
 }
 
 #endif
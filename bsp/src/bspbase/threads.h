@@ -12,10 +12,31 @@
 #pragma once
 #endif
 
-#define MAX_THREADS 64
+#define MAX_THREADS 256
 
 typedef void q_threadfunction(int);
 
+// Hint to the work dispatcher about the cost of a single work item.  Work is
+// handed out to the threads in chunks claimed from a shared atomic counter;
+// cheap items are claimed in large chunks so the threads rarely touch the
+// counter, expensive or irregular items are claimed one at a time so the
+// threads stay balanced near the end of the run.
+typedef enum
+{
+        THREADCOST_CHEAP,
+        THREADCOST_NORMAL,
+        THREADCOST_EXPENSIVE
+} q_threadcost;
+
+// Per-thread timing of the last RunThreadsOn() call.
+typedef struct
+{
+        int             items;                             // work items handed to the thread
+        int             chunks;                            // times the thread claimed a chunk from the counter
+        double          busy;                              // seconds spent in the thread function
+        double          idle;                              // seconds of the run spent starting up or waiting on the others
+} threadstats_t;
+
 #ifdef _WIN32
 #define DEFAULT_NUMTHREADS -1
 #endif
@@ -31,6 +52,15 @@ public:
         void set_value(int val);
         volatile bool is_finished() const;
 
+        INLINE double get_start_time() const
+        {
+                return _start_time;
+        }
+        INLINE double get_finish_time() const
+        {
+                return _finish_time;
+        }
+
 protected:
         virtual void thread_main();
 
@@ -38,6 +68,8 @@ private:
         q_threadfunction *_func;
         int _val;
         volatile bool _finished;
+        double _start_time;
+        double _finish_time;
 };
 
 #define DEFAULT_THREAD_PRIORITY TP_normal
@@ -55,8 +87,15 @@ extern _BSPEXPORT int GetThreadWork();
 extern _BSPEXPORT void ThreadLock();
 extern _BSPEXPORT void ThreadUnlock();
 
-extern _BSPEXPORT void RunThreadsOnIndividual(int workcnt, bool showpacifier, q_threadfunction);
-extern _BSPEXPORT void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction);
+extern _BSPEXPORT void RunThreadsOnIndividual(int workcnt, bool showpacifier, q_threadfunction,
+                                              q_threadcost cost = THREADCOST_NORMAL);
+extern _BSPEXPORT void RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction,
+                                    q_threadcost cost = THREADCOST_NORMAL);
+
+extern _BSPEXPORT const threadstats_t *GetThreadStats(int &numthreads);
+
+// Names the next RunThreadsOn() call in the compile profile.
+extern _BSPEXPORT void SetThreadRunName(const char *name);
 
 #ifdef ZHLT_NETVIS
 extern _BSPEXPORT void threads_InitCrit();
@@ -66,12 +105,26 @@ extern _BSPEXPORT void threads_UninitCrit();
 #define NamedRunThreadsOn(n, p, f)        \
         {                                 \
                 printf("%-20s ", #f ":"); \
+                SetThreadRunName(#f);     \
                 RunThreadsOn(n, p, f);    \
         }
 #define NamedRunThreadsOnIndividual(n, p, f)     \
         {                                        \
                 printf("%-20s ", #f ":");        \
+                SetThreadRunName(#f);            \
                 RunThreadsOnIndividual(n, p, f); \
         }
+#define NamedRunThreadsOnCost(n, p, f, c)        \
+        {                                        \
+                printf("%-20s ", #f ":");        \
+                SetThreadRunName(#f);            \
+                RunThreadsOn(n, p, f, c);        \
+        }
+#define NamedRunThreadsOnIndividualCost(n, p, f, c)     \
+        {                                               \
+                printf("%-20s ", #f ":");               \
+                SetThreadRunName(#f);                   \
+                RunThreadsOnIndividual(n, p, f, c);     \
+        }
 
 #endif //**/ THREADS_H__
@@ -34,8 +34,11 @@
 #include <shader.h>
 #include <textNode.h>
 #include <virtualFileSystem.h>
+#include <genericThread.h>
+#include <mutexHolder.h>
 
 #include <bitset>
+#include <thread>
 
 #include "aux_data_attrib.h"
 #include "bsp_trace.h"
@@ -64,6 +67,9 @@ static PStatCollector
     loadcubemap_collector("AmbientProbes:UpdateNodes:LoadCubemap");
 static PStatCollector
     findcubemap_collector("AmbientProbes:UpdateNodes:FindCubemap");
+static PStatCollector probe_nodes_collector("Ambient probe nodes");
+static PStatCollector probe_relit_collector("Ambient probe nodes:Relit");
+static PStatCollector probe_traces_collector("Ambient probe traces");
 
 static ConfigVariableBool
     cfg_lightaverage("light-average", true,
@@ -87,6 +93,22 @@ static ConfigVariableDouble
     r_ambientfactor("r_ambientfactor", 5.0,
                     "Boost ambient cube by no more than this factor.");
 
+static ConfigVariableInt ambient_probe_threads(
+    "ambient-probe-threads", -1,
+    "Number of worker threads that update the lighting of dynamic nodes, in "
+    "addition to the cull thread.  -1 picks one based on the number of CPUs.");
+static ConfigVariableInt ambient_probe_min_batch(
+    "ambient-probe-min-batch", 16,
+    "Fewer dynamic nodes than this are updated on the cull thread alone.");
+static ConfigVariableInt ambient_probe_blend_count(
+    "ambient-probe-blend-count", 4,
+    "How many of the nearest ambient probes in its leaf are blended together "
+    "to light a dynamic node.  1 uses the nearest probe alone.");
+static ConfigVariableDouble ambient_probe_relight_distance(
+    "ambient-probe-relight-distance", 0.5,
+    "How far a node can move within its leaf before its ambient probe, "
+    "cubemap and visible lights are looked up again.");
+
 using std::cos;
 using std::sin;
 
@@ -101,7 +123,20 @@ AmbientProbeManager() :
     _level(nullptr), _sunlight(nullptr),
     //_light_kdtree( nullptr ),
     //_probe_kdtree( nullptr ),
-    _envmap_kdtree(nullptr) {
+    _envmap_kdtree(nullptr),
+    _stats_frame(-1),
+    _batch_cvar(_batch_mutex),
+    _done_cvar(_batch_mutex),
+    _batch(nullptr),
+    _batch_time(0.0),
+    _batch_next(0),
+    _batch_remaining(0),
+    _batch_generation(0),
+    _threads_generation(0),
+    _threads_exit(false),
+    _threads_failed(false),
+    _num_relit(0),
+    _num_traces(0) {
   dummy_light->id = -1;
   dummy_light->leaf = 0;
   dummy_light->type = 0;
@@ -111,7 +146,24 @@ AmbientProbeManager::AmbientProbeManager(BSPLevel *loader) :
     _level(loader), _sunlight(nullptr),
     //_light_kdtree( nullptr ),
     //_probe_kdtree( nullptr ),
-    _envmap_kdtree(nullptr) {
+    _envmap_kdtree(nullptr),
+    _stats_frame(-1),
+    _batch_cvar(_batch_mutex),
+    _done_cvar(_batch_mutex),
+    _batch(nullptr),
+    _batch_time(0.0),
+    _batch_next(0),
+    _batch_remaining(0),
+    _batch_generation(0),
+    _threads_generation(0),
+    _threads_exit(false),
+    _threads_failed(false),
+    _num_relit(0),
+    _num_traces(0) {
+}
+
+AmbientProbeManager::~AmbientProbeManager() {
+  stop_threads();
 }
 
 INLINE int lighttype_from_classname(const char *classname) {
@@ -249,9 +301,8 @@ void AmbientProbeManager::process_ambient_probes() {
     vector<vector<double> > probe_points;
 
     for (int j = 0; j < ambidx->num_ambient_samples; j++) {
-      dleafambientlighting_t *light =
-          &bspdata
-               ->leafambientlighting[ambidx->first_ambient_sample + j];
+      dleafambientsh_t *light =
+          &bspdata->leafambientsh[ambidx->first_ambient_sample + j];
       PT(ambientprobe_t)
       probe = new ambientprobe_t;
       probe->leaf = i;
@@ -270,10 +321,15 @@ void AmbientProbeManager::process_ambient_probes() {
       }
       if (match) continue;
 
-      probe->cube = PTA_LVecBase3::empty_array(6);
-      for (int k = 0; k < 6; k++) {
-        probe->cube.set_element(
-            k, color_shift_pixel(&light->cube.color[k], 2.2));
+      // Keep the harmonics linear so that they blend correctly; they are
+      // gamma encoded once they have been evaluated into an ambient cube.
+      LVector3 dc;
+      ColorRGBExp32ToVector(light->dc, dc);
+      dc /= 255.0;
+      for (int ch = 0; ch < 3; ch++) {
+        PN_stdfloat scale = dc[ch] * 2.0f / 127.0f;
+        probe->sh[ch].set(dc[ch], light->dir[0][ch] * scale,
+                          light->dir[1][ch] * scale, light->dir[2][ch] * scale);
       }
 #ifdef VISUALIZE_AMBPROBES
       PT(TextNode)
@@ -417,26 +473,18 @@ INLINE void apply_lightdatas(int n, const light_t *light,
   if (active) input->active_lights++;
 }
 
+/**
+ * Returns the state that supplies the lighting of the indicated node to its
+ * shader.  If should_update is true, the node is also queued for the next
+ * update_nodes(), which fills in the lighting before the frame is drawn.
+ */
 const RenderState *AmbientProbeManager::update_node(PandaNode *node,
                                                     CPT(TransformState)
                                                         curr_trans,
                                                     bool should_update) {
-  PStatTimer timer(updatenode_collector);
-
-  MutexHolder holder(_cache_mutex);
-
   if (!node || !curr_trans) { return nullptr; }
 
-  // By default, the lighting position is the position of the node.
-  // An effect can be applied to offset the lighting position.
-  if (node->has_effect(LightingOriginEffect::get_class_type())) {
-    const LightingOriginEffect *effect =
-        DCAST(LightingOriginEffect,
-              node->get_effect(LightingOriginEffect::get_class_type()));
-    LQuaternion quat = curr_trans->get_norm_quat();
-    LVector3 world_offset = quat.xform(effect->get_lighting_origin());
-    curr_trans = curr_trans->set_pos(curr_trans->get_pos() + world_offset);
-  }
+  MutexHolder holder(_cache_mutex);
 
   BSPLoader *loader = _level->get_loader();
 
@@ -448,7 +496,7 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
   if (!input) {
     input = new CNodeShaderInput;
     input->state_with_input = RenderState::make(AuxDataAttrib::make(input));
-    input->last_transform = curr_trans;
+    input->last_transform = nullptr;
     input->level_context = loader->get_level_context();
     node->set_user_data(input);
     new_instance = true;
@@ -461,6 +509,289 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
     return input->state_with_input;
   }
 
+  // By default, the lighting position is the position of the node.
+  // An effect can be applied to offset the lighting position.
+  if (node->has_effect(LightingOriginEffect::get_class_type())) {
+    const LightingOriginEffect *effect =
+        DCAST(LightingOriginEffect,
+              node->get_effect(LightingOriginEffect::get_class_type()));
+    LQuaternion quat = curr_trans->get_norm_quat();
+    LVector3 world_offset = quat.xform(effect->get_lighting_origin());
+    curr_trans = curr_trans->set_pos(curr_trans->get_pos() + world_offset);
+  }
+
+  bool ambient_boost = node->has_effect(AmbientBoostEffect::get_class_type());
+
+  if (input->pending_index >= 0 &&
+      input->pending_index < (int)_pending_nodes.size() &&
+      _pending_nodes[input->pending_index].input == input) {
+    // Already queued by another camera, lighting only needs to be computed
+    // once.
+    nodeupdate_t &update = _pending_nodes[input->pending_index];
+    update.transform = curr_trans;
+    update.ambient_boost = ambient_boost;
+    update.new_instance = update.new_instance || new_instance;
+  } else {
+    nodeupdate_t update;
+    update.input = input;
+    update.transform = curr_trans;
+    update.ambient_boost = ambient_boost;
+    update.new_instance = new_instance;
+    input->pending_index = (int)_pending_nodes.size();
+    _pending_nodes.push_back(update);
+  }
+
+  return input->state_with_input;
+}
+
+/**
+ * Computes the lighting of all the nodes queued by update_node() since the
+ * last call.  The nodes are independent of each other, so they are spread
+ * over the worker threads.
+ */
+void AmbientProbeManager::update_nodes() {
+  pvector<nodeupdate_t> batch;
+  {
+    MutexHolder holder(_cache_mutex);
+    batch.swap(_pending_nodes);
+  }
+
+  int frame = ClockObject::get_global_clock()->get_frame_count();
+  if (frame != _stats_frame) {
+    _stats_frame = frame;
+    probe_nodes_collector.clear_level();
+    probe_relit_collector.clear_level();
+    probe_traces_collector.clear_level();
+  }
+
+  if (batch.empty()) {
+    return;
+  }
+
+  PStatTimer timer(updatenode_collector);
+
+  AtomicAdjust::set(_num_relit, 0);
+  AtomicAdjust::set(_num_traces, 0);
+
+  int num_threads = ambient_probe_threads.get_value();
+  if (num_threads < 0) {
+    num_threads = std::min((int)std::thread::hardware_concurrency() - 1, 4);
+  }
+  if (!Thread::is_threading_supported() || _threads_failed ||
+      (int)batch.size() < ambient_probe_min_batch.get_value()) {
+    num_threads = 0;
+  }
+
+  if (num_threads > 0) {
+    start_threads(num_threads);
+    if (_threads_failed) {
+      num_threads = 0;
+    }
+  }
+
+  {
+    MutexHolder holder(_batch_mutex);
+    // The workers share a single batch, so only one update may run at once.
+    nassertv(_batch == nullptr);
+    _batch = &batch;
+    _batch_time = ClockObject::get_global_clock()->get_frame_time();
+    AtomicAdjust::set(_batch_next, 0);
+    if (num_threads > 0) {
+      _batch_remaining = (int)_threads.size();
+      _batch_generation++;
+      _batch_cvar.notify_all();
+    }
+  }
+
+  // This thread works on the batch too.
+  run_batch();
+
+  {
+    MutexHolder holder(_batch_mutex);
+    while (_batch_remaining > 0) {
+      _done_cvar.wait();
+    }
+    _batch = nullptr;
+  }
+
+  probe_nodes_collector.add_level((double)batch.size());
+  probe_relit_collector.add_level((double)AtomicAdjust::get(_num_relit));
+  probe_traces_collector.add_level((double)AtomicAdjust::get(_num_traces));
+}
+
+/**
+ * Updates nodes of the current batch until there are none left.
+ */
+void AmbientProbeManager::run_batch() {
+  pvector<nodeupdate_t> &batch = *_batch;
+  AtomicAdjust::Integer num_nodes = (AtomicAdjust::Integer)batch.size();
+
+  while (true) {
+    AtomicAdjust::Integer i = AtomicAdjust::add(_batch_next, 1) - 1;
+    if (i >= num_nodes) {
+      break;
+    }
+    update_node_lighting(batch[i], _batch_time);
+  }
+}
+
+void AmbientProbeManager::thread_main(void *data) {
+  ((AmbientProbeManager *)data)->worker_main();
+}
+
+/**
+ * The loop of a worker thread: waits for a batch, helps to update it, and
+ * reports back when it runs out of nodes.
+ */
+void AmbientProbeManager::worker_main() {
+  int generation = 0;
+  {
+    MutexHolder holder(_batch_mutex);
+    generation = _threads_generation;
+  }
+
+  while (true) {
+    {
+      MutexHolder holder(_batch_mutex);
+      while (_batch_generation == generation && !_threads_exit) {
+        _batch_cvar.wait();
+      }
+      if (_threads_exit) {
+        return;
+      }
+      generation = _batch_generation;
+    }
+
+    run_batch();
+
+    {
+      MutexHolder holder(_batch_mutex);
+      if (--_batch_remaining == 0) {
+        _done_cvar.notify();
+      }
+    }
+  }
+}
+
+void AmbientProbeManager::start_threads(int num_threads) {
+  if ((int)_threads.size() == num_threads) {
+    return;
+  }
+
+  stop_threads();
+
+  {
+    MutexHolder holder(_batch_mutex);
+    _threads_exit = false;
+    _threads_generation = _batch_generation;
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    std::ostringstream name;
+    name << "AmbientProbes-" << i;
+    PT(GenericThread) thread = new GenericThread(name.str(), "AmbientProbes",
+                                                 &thread_main, this);
+    if (!thread->start(TP_normal, true)) {
+      // Don't try again every frame.
+      bsploader_cat.warning()
+        << "Could not start ambient probe threads, updating on one thread\n";
+      stop_threads();
+      _threads_failed = true;
+      return;
+    }
+    _threads.push_back(thread);
+  }
+}
+
+void AmbientProbeManager::stop_threads() {
+  if (_threads.empty()) {
+    return;
+  }
+
+  {
+    MutexHolder holder(_batch_mutex);
+    _threads_exit = true;
+    _batch_cvar.notify_all();
+  }
+
+  for (size_t i = 0; i < _threads.size(); i++) {
+    _threads[i]->join();
+  }
+  _threads.clear();
+}
+
+/**
+ * Blends the spherical harmonics of the probes nearest to the given point,
+ * weighted by inverse distance, and evaluates them along the six axes into a
+ * gamma encoded ambient cube.  Returns the nearest of the probes.
+ */
+ambientprobe_t *AmbientProbeManager::
+blend_probes(KDTree *tree, const pvector<PT(ambientprobe_t)> &probes,
+             const LPoint3 &pos, LVector3 *cube) const {
+  int count = std::max(1, ambient_probe_blend_count.get_value());
+  count = std::min(count, (int)probes.size());
+
+  std::vector<double> data = { pos[0], pos[1], pos[2] };
+  std::unordered_map<unsigned int, double> nearest = tree->query(data, count);
+
+  ambientprobe_t *closest = nullptr;
+  double closest_dist = DBL_MAX;
+  float total_weight = 0.0f;
+  fltx4 sh[3] = { Four_Zeros, Four_Zeros, Four_Zeros };
+  for (const auto &it : nearest) {
+    ambientprobe_t *probe = probes[it.first];
+    if (it.second < closest_dist) {
+      closest_dist = it.second;
+      closest = probe;
+    }
+
+    // Don't let a node sitting right on top of a probe divide by zero.
+    float weight = 1.0f / (float)std::max(it.second, 0.01);
+    fltx4 weight4 = ReplicateX4(weight);
+    for (int ch = 0; ch < 3; ch++) {
+      sh[ch] = MaddSIMD(LoadUnalignedSIMD(probe->sh[ch].get_data()), weight4, sh[ch]);
+    }
+    total_weight += weight;
+  }
+
+  if (closest == nullptr) {
+    return nullptr;
+  }
+
+  // dc + (x, y, z) and dc - (x, y, z) give the positive and negative sides of
+  // every axis at once.
+  fltx4 inv_weight = ReplicateX4(1.0f / total_weight);
+  ALIGN_16BYTE float pos_sides[3][4] ALIGN16_POST;
+  ALIGN_16BYTE float neg_sides[3][4] ALIGN16_POST;
+  for (int ch = 0; ch < 3; ch++) {
+    fltx4 coeffs = MulSIMD(sh[ch], inv_weight);
+    fltx4 dc = SplatXSIMD(coeffs);
+    StoreAlignedSIMD(pos_sides[ch], MaxSIMD(AddSIMD(dc, coeffs), Four_Zeros));
+    StoreAlignedSIMD(neg_sides[ch], MaxSIMD(SubSIMD(dc, coeffs), Four_Zeros));
+  }
+
+  for (int axis = 0; axis < 3; axis++) {
+    for (int ch = 0; ch < 3; ch++) {
+      cube[axis * 2][ch] = gamma_encode(pos_sides[ch][axis + 1], 2.2);
+      cube[axis * 2 + 1][ch] = gamma_encode(neg_sides[ch][axis + 1], 2.2);
+    }
+  }
+
+  return closest;
+}
+
+/**
+ * Computes the lighting of a single node.  This runs on the worker threads,
+ * so it may only touch the node's own shader input and the (read-only)
+ * lighting data of the level.
+ */
+void AmbientProbeManager::update_node_lighting(nodeupdate_t &update, double now) {
+  CNodeShaderInput *input = update.input;
+  CPT(TransformState) curr_trans = update.transform;
+  bool new_instance = update.new_instance;
+
+  BSPLoader *loader = _level->get_loader();
+
   input->cubemap_changed = false;
 
   // Is it even necessary to update anything?
@@ -485,9 +816,9 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
     input->level_context = loader->get_level_context();
     average_lighting = false;
     pos_changed = true;
+    input->leaf = -1;
   }
 
-  double now = ClockObject::get_global_clock()->get_frame_time();
   float dt = now - input->lighting_time;
   if (dt <= 0.0) {
     dt = 0.0;
@@ -503,24 +834,42 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
   // be in the incorrect leaf, giving incorrect ambient.
   curr_net[2] += ON_EPSILON;
 
-  int leaf_id = _level->find_leaf(curr_net);
-
+  // The probe, cubemap and lights only have to be looked up again once the
+  // node has left its leaf or moved a fair distance within it.  The lights
+  // in the PVS of a leaf never change.
+  bool relight = false;
+  int leaf_id = input->leaf;
   if (pos_changed) {
+    leaf_id = _level->find_leaf(curr_net);
+    PN_stdfloat relight_dist = ambient_probe_relight_distance.get_value();
+    relight = (leaf_id != input->leaf ||
+               (curr_net - input->lighting_pos).length_squared() >= relight_dist * relight_dist);
+  }
+
+  int traces = 0;
+
+  if (relight) {
+    AtomicAdjust::inc(_num_relit);
+    input->leaf = leaf_id;
+    input->lighting_pos = curr_net;
+
     // Update ambient cube
-    if (_probes[leaf_id].size() > 0) {
+    int probes_idx = _probes.find(leaf_id);
+    if (probes_idx != -1 && _probes.get_data(probes_idx).size() > 0) {
+      const pvector<PT(ambientprobe_t)> &leaf_probes = _probes.get_data(probes_idx);
       update_ac_collector.start();
-      ambientprobe_t *sample = find_closest_in_kdtree(
-          get_probe_kdtree(leaf_id), curr_net, _probes[leaf_id]);
+      ambientprobe_t *sample = blend_probes(
+          get_probe_kdtree(leaf_id), leaf_probes, curr_net, input->probe_cube);
       input->amb_probe = sample;
       update_ac_collector.stop();
 
 #ifdef VISUALIZE_AMBPROBES
       std::cout << "Box colors:" << std::endl;
       for (int i = 0; i < 6; i++) {
-        std::cout << "\t" << sample->cube[i] << std::endl;
+        std::cout << "\t" << input->probe_cube[i] << std::endl;
       }
-      for (size_t j = 0; j < _probes[leaf_id].size(); j++) {
-        _probes[leaf_id][j]->visnode.set_color_scale(LColor(0, 0, 1, 1), 1);
+      for (size_t j = 0; j < leaf_probes.size(); j++) {
+        leaf_probes[j]->visnode.set_color_scale(LColor(0, 0, 1, 1), 1);
       }
       if (!sample->visnode.is_empty()) {
         sample->visnode.set_color_scale(LColor(0, 1, 0, 1), 1);
@@ -546,11 +895,22 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
             cm->cubemap_tex->get_ram_image(),
             cm->cubemap_tex->get_ram_image_compression(),
             cm->cubemap_tex->get_ram_image_size());
+        // Take the prefiltered mip levels along, if the cubemap has them.
+        input->cubemap_tex->clear_ram_mipmap_images();
+        int num_mips = cm->cubemap_tex->get_num_ram_mipmap_images();
+        for (int n = 1; n < num_mips; n++) {
+          input->cubemap_tex->set_ram_mipmap_image(
+              n, cm->cubemap_tex->get_ram_mipmap_image(n),
+              cm->cubemap_tex->get_ram_mipmap_page_size(n));
+        }
+        input->cubemap_tex->set_minfilter(cm->cubemap_tex->get_minfilter());
         input->cubemap_changed = true;
         loadcubemap_collector.stop();
       }
     }
+  }
 
+  if (pos_changed) {
     // Cache the last position.
     input->last_transform = curr_trans;
   }
@@ -562,18 +922,18 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
     // Interpolate ambient probe colors
     LVector3 delta(0);
     for (int i = 0; i < 6; i++) {
-      delta = input->amb_probe->cube[i] - input->boxcolor[i];
+      delta = input->probe_cube[i] - input->boxcolor[i];
       if (average_lighting && delta.length_squared() >= EQUAL_EPSILON) {
         delta *= atten_factor;
         ambientcube_changed = true;
       }
-      input->boxcolor[i] = input->amb_probe->cube[i] - delta;
+      input->boxcolor[i] = input->probe_cube[i] - delta;
     }
   }
   interp_ac_collector.stop();
 
   update_locallights_collector.start();
-  if (pos_changed) {
+  if (relight) {
     input->occluded_lights.reset();
 
     // Update local light sources
@@ -587,6 +947,7 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
               });
 
     int sky_idx = -1;
+    traces++;
     if (is_sky_visible(curr_net)) {
       // If we hit the sky from current position, sunlight takes
       // precedence over all other local light sources.
@@ -636,8 +997,9 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
 
     bool occluded = false;
 
-    if (pos_changed) {
-      if (i != input->sky_idx && !is_light_visible(curr_net, light)) {
+    if (relight && i != input->sky_idx) {
+      traces++;
+      if (!is_light_visible(curr_net, light)) {
         // The light is occluded, don't add it.
         input->occluded_lights.set(i);
         occluded = true;
@@ -714,7 +1076,7 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
   ambientboost_collector.start();
   // If we have any lights and want to do ambient boost
   if (lights_updated > 0 && r_ambientboost.get_value() &&
-      node->has_effect(AmbientBoostEffect::get_class_type())) {
+      update.ambient_boost) {
     if (pos_changed || ambientcube_changed) {
       static const LVector3 lum_coeff(0.3, 0.59, 0.11);
       float avg_cube_luminance = 0.0;
@@ -776,7 +1138,7 @@ const RenderState *AmbientProbeManager::update_node(PandaNode *node,
 
   ambientboost_collector.stop();
 
-  return input->state_with_input;
+  AtomicAdjust::add(_num_traces, traces);
 }
 
 INLINE void xform_light(light_t *light, const LMatrix4 &cam_mat) {
@@ -814,6 +1176,8 @@ void AmbientProbeManager::xform_lights(const TransformState *cam_trans) {
 void AmbientProbeManager::cleanup() {
   MutexHolder holder(_cache_mutex);
 
+  _pending_nodes.clear();
+
   _sunlight = nullptr;
   //_probe_kdtree = nullptr;
   //_light_kdtree = nullptr;
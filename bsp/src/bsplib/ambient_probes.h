@@ -22,6 +22,10 @@
 #include "cullableObject.h"
 #include "shaderAttrib.h"
 #include "updateSeq.h"
+#include "pmutex.h"
+#include "conditionVar.h"
+#include "atomicAdjust.h"
+#include "thread.h"
 #include "cubemaps.h"
 
 #include <unordered_map>
@@ -33,7 +37,7 @@
 
 class BSPLevel;
 struct dleafambientindex_t;
-struct dleafambientlighting_t;
+struct dleafambientsh_t;
 
 enum
 {
@@ -48,7 +52,9 @@ class EXPCL_PANDABSP ambientprobe_t : public ReferenceCount
 public:
         int leaf;
         LPoint3 pos;
-        PTA_LVecBase3 cube;
+        // Linear L1 spherical harmonics of the probe's irradiance, one per
+        // color channel: the dc term followed by the x, y and z terms.
+        LVecBase4f sh[3];
         NodePath visnode;
 };
 
@@ -90,6 +96,9 @@ public:
         // and then boost.
         LVector3 boxcolor[6];
         LVector3 boxcolor_boosted[6];
+        // The ambient cube blended from the probes around the node, which
+        // boxcolor is interpolated towards.
+        LVector3 probe_cube[6];
         bool ambient_boost;
 
         PTA_int light_count;
@@ -114,6 +123,14 @@ public:
         int sky_idx;
         std::bitset<0xFFF> occluded_lights;
 
+        // The leaf and position the probe, cubemap and lights were last
+        // looked up at.
+        int leaf;
+        LPoint3 lighting_pos;
+
+        // Index into the AmbientProbeManager's queue of nodes to update.
+        int pending_index;
+
         CPT( RenderState ) state_with_input;
         CPT( TransformState ) last_transform;
 
@@ -152,10 +169,13 @@ public:
 		cubemap_tex->setup_cube_map( 32, Texture::T_unsigned_byte, Texture::F_rgb8 );
                 cubemap_tex->clear_image();
                 sky_idx = -1;
+                leaf = -1;
+                pending_index = -1;
                 active_lights = 0;
                 ambient_boost = false;
                 memset( boxcolor, 0, sizeof( LVector3 ) * 6 );
                 memset( boxcolor_boosted, 0, sizeof( LVector3 ) * 6 );
+                memset( probe_cube, 0, sizeof( LVector3 ) * 6 );
 
                 lighting_time = LIGHTING_UNINITIALIZED;
         }
@@ -167,6 +187,9 @@ public:
                 amb_probe( other.amb_probe ),
                 locallights( other.locallights ),
                 sky_idx( other.sky_idx ),
+                leaf( other.leaf ),
+                lighting_pos( other.lighting_pos ),
+                pending_index( -1 ),
                 active_lights( other.active_lights ),
                 occluded_lights( other.occluded_lights ),
                 cubemap_tex( other.cubemap_tex ),
@@ -179,6 +202,8 @@ public:
                 //light_data = PTA_LMatrix4f::empty_array( MAX_TOTAL_LIGHTS );
                 //light_ids = PTA_int::empty_array( MAX_TOTAL_LIGHTS );
 
+                memcpy( probe_cube, other.probe_cube, sizeof( LVector3 ) * 6 );
+
                 light_type.set_data( other.light_type.get_data() );
                 ambient_cube.set_data( other.ambient_cube.get_data() );
                 light_type.set_data( other.light_type.get_data() );
@@ -197,10 +222,12 @@ class EXPCL_PANDABSP AmbientProbeManager
 public:
         AmbientProbeManager();
         AmbientProbeManager( BSPLevel *level );
+        ~AmbientProbeManager();
 
         void process_ambient_probes();
 
 	const RenderState *update_node( PandaNode *node, CPT( TransformState ) net_ts, bool should_update = true );
+        void update_nodes();
 
         void load_cubemaps();
 
@@ -240,9 +267,27 @@ public:
         void xform_lights( const TransformState *cam_trans );
 
 private:
+        struct nodeupdate_t
+        {
+                PT( CNodeShaderInput ) input;
+                CPT( TransformState ) transform;
+                bool ambient_boost;
+                bool new_instance;
+        };
+
         INLINE bool is_sky_visible( const LPoint3 &point );
         INLINE bool is_light_visible( const LPoint3 &point, const light_t *light );
 
+        void update_node_lighting( nodeupdate_t &update, double now );
+        ambientprobe_t *blend_probes( KDTree *tree, const pvector<PT( ambientprobe_t )> &probes,
+                                      const LPoint3 &pos, LVector3 *cube ) const;
+
+        void run_batch();
+        void worker_main();
+        static void thread_main( void *data );
+        void start_threads( int num_threads );
+        void stop_threads();
+
 private:
         BSPLevel *_level;
 
@@ -264,7 +309,31 @@ private:
 
         double _last_garbage_collect_time;
 
+        // Protects the queue of nodes to update.
         Mutex _cache_mutex;
+        pvector<nodeupdate_t> _pending_nodes;
+        int _stats_frame;
+
+        // The worker threads, and the batch of nodes they are working on.
+        pvector<PT( Thread )> _threads;
+        Mutex _batch_mutex;
+        ConditionVar _batch_cvar;
+        ConditionVar _done_cvar;
+        pvector<nodeupdate_t> *_batch;
+        double _batch_time;
+        AtomicAdjust::Integer _batch_next;
+        int _batch_remaining;
+        int _batch_generation;
+        // The batch generation the current threads were started at.  They
+        // wait for the batch after it, even if they get going late.
+        int _threads_generation;
+        bool _threads_exit;
+        // A thread failed to start, so the batches are updated on the calling
+        // thread only.
+        bool _threads_failed;
+
+        AtomicAdjust::Integer _num_relit;
+        AtomicAdjust::Integer _num_traces;
 
 public:
         friend class NodeWeakCallback;
@@ -0,0 +1,181 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_cubemap_cache.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#include "bsp_cubemap_cache.h"
+#include "bsp_geom_cache.h"
+#include "cubemap_prefilter.h"
+#include "bsploader.h"
+#include "bamReader.h"
+#include "bamWriter.h"
+#include "datagram.h"
+#include "datagramIterator.h"
+
+TypeHandle BSPCubemapCache::_type_handle;
+
+// Bump this whenever the contents of the cache or the way the cubemaps are
+// filtered changes, so that stale records get rebuilt.
+static const uint16_t cubemap_cache_version = 1;
+
+static const std::string cubemap_cache_extension = "bspcubemaps";
+
+BSPCubemapCache::
+BSPCubemapCache(uint64_t hash) :
+  _version(cubemap_cache_version),
+  _hash(hash) {
+}
+
+/**
+ * Returns the prefiltered cubemaps of the BSP file with the indicated hash
+ * from the model cache, or NULL if there are none, or they are out of date.
+ */
+PT(BSPCubemapCache) BSPCubemapCache::
+read(const Filename &bsp_filename, uint64_t hash) {
+  PT(BSPCubemapCache) cubemaps = DCAST(BSPCubemapCache,
+    BSPGeomCache::read_record(bsp_filename, cubemap_cache_extension, get_class_type()));
+  if (cubemaps == nullptr ||
+      !BSPGeomCache::check_record(bsp_filename, cubemap_cache_extension,
+                                  cubemaps->_version == cubemap_cache_version &&
+                                  cubemaps->_hash == hash)) {
+    return nullptr;
+  }
+
+  return cubemaps;
+}
+
+/**
+ * Stores the prefiltered cubemaps of the BSP file in the model cache.
+ */
+bool BSPCubemapCache::
+write(const Filename &bsp_filename) {
+  return BSPGeomCache::write_record(bsp_filename, cubemap_cache_extension, this,
+                                    vector_string());
+}
+
+/**
+ * Adds the mip levels of the cubemap at the indicated position.  The
+ * prefilter must be done.
+ */
+void BSPCubemapCache::
+add_cubemap(const LPoint3 &pos, const CubemapPrefilter *prefilter) {
+  Entry entry;
+  entry.pos = pos;
+  entry.size = prefilter->get_size();
+  entry.num_mips = prefilter->get_num_mips();
+
+  for (int mip = 1; mip < entry.num_mips; mip++) {
+    int size = prefilter->get_mip_size(mip);
+    for (int face = 0; face < 6; face++) {
+      const LVecBase3f *texels = prefilter->get_mip(face, mip);
+      for (int i = 0; i < size * size; i++) {
+        colorrgbexp32_t out;
+        VectorToColorRGBExp32(LCAST(PN_stdfloat, texels[i]), out);
+        entry.texels.push_back(out);
+      }
+    }
+  }
+
+  _cubemaps.push_back(std::move(entry));
+}
+
+/**
+ * Loads the mip levels of the cubemap at the indicated position into the
+ * texture, which already has level 0.  Returns false if there is no cubemap
+ * of that size at that position in the cache.
+ */
+bool BSPCubemapCache::
+load_cubemap(const LPoint3 &pos, int size, Texture *tex) const {
+  const Entry *entry = nullptr;
+  for (size_t i = 0; i < _cubemaps.size(); i++) {
+    if (_cubemaps[i].pos == pos && _cubemaps[i].size == size) {
+      entry = &_cubemaps[i];
+      break;
+    }
+  }
+  if (entry == nullptr) {
+    return false;
+  }
+
+  pvector<LVecBase3f> texels;
+  size_t offset = 0;
+  for (int mip = 1; mip < entry->num_mips; mip++) {
+    int mip_size = std::max(1, size >> mip);
+    texels.resize(mip_size * mip_size);
+    for (int face = 0; face < 6; face++) {
+      nassertr(offset + texels.size() <= entry->texels.size(), false);
+      for (size_t i = 0; i < texels.size(); i++) {
+        LVector3 color;
+        ColorRGBExp32ToVector(entry->texels[offset++], color);
+        texels[i] = LCAST(float, color);
+      }
+      CubemapPrefilter::load_mip(tex, face, mip, mip_size, texels.data());
+    }
+  }
+
+  return true;
+}
+
+void BSPCubemapCache::
+register_with_read_factory() {
+  BamReader::get_factory()->register_factory(get_class_type(), make_from_bam);
+}
+
+void BSPCubemapCache::
+write_datagram(BamWriter *manager, Datagram &dg) {
+  TypedWritable::write_datagram(manager, dg);
+
+  dg.add_uint16(_version);
+  dg.add_uint64(_hash);
+
+  dg.add_uint16((uint16_t)_cubemaps.size());
+  for (size_t i = 0; i < _cubemaps.size(); i++) {
+    const Entry &entry = _cubemaps[i];
+    entry.pos.write_datagram(dg);
+    dg.add_int32(entry.size);
+    dg.add_uint8((uint8_t)entry.num_mips);
+    dg.add_uint32((uint32_t)entry.texels.size());
+    dg.append_data(entry.texels.data(), entry.texels.size() * sizeof(colorrgbexp32_t));
+  }
+}
+
+TypedWritable *BSPCubemapCache::
+make_from_bam(const FactoryParams &params) {
+  BSPCubemapCache *cubemaps = new BSPCubemapCache;
+  DatagramIterator scan;
+  BamReader *manager;
+
+  parse_params(params, scan, manager);
+  cubemaps->fillin(scan, manager);
+
+  return cubemaps;
+}
+
+void BSPCubemapCache::
+fillin(DatagramIterator &scan, BamReader *manager) {
+  TypedWritable::fillin(scan, manager);
+
+  _version = scan.get_uint16();
+  if (_version != cubemap_cache_version) {
+    // Written by a different version, don't try to make sense of the rest.
+    return;
+  }
+  _hash = scan.get_uint64();
+
+  _cubemaps.resize(scan.get_uint16());
+  for (size_t i = 0; i < _cubemaps.size(); i++) {
+    Entry &entry = _cubemaps[i];
+    entry.pos.read_datagram(scan);
+    entry.size = scan.get_int32();
+    entry.num_mips = scan.get_uint8();
+    entry.texels.resize(scan.get_uint32());
+    scan.extract_bytes((unsigned char *)entry.texels.data(),
+                       entry.texels.size() * sizeof(colorrgbexp32_t));
+  }
+}
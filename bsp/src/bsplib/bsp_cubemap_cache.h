@@ -0,0 +1,95 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_cubemap_cache.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#ifndef BSP_CUBEMAP_CACHE_H
+#define BSP_CUBEMAP_CACHE_H
+
+#include "config_bsplib.h"
+#include "typedWritableReferenceCount.h"
+#include "texture.h"
+#include "luse.h"
+
+#ifndef CPPPARSER
+#include "mathlib.h"
+#else
+struct colorrgbexp32_t;
+#endif
+
+#include <stdint.h>
+
+class CubemapPrefilter;
+
+/**
+ * The prefiltered mip levels of the environment cubemaps of a level (see
+ * CubemapPrefilter), kept in the model cache as the "bspcubemaps" record of
+ * the BSP file, next to the cached level geometry (see BSPGeomCache).
+ *
+ * Level 0 of each cubemap is in the BSP file itself, so only the levels below
+ * it are stored.  They are stored as RGBE, like the cubemaps in the BSP file,
+ * which is a third of the size of the floating point texels.
+ */
+class EXPCL_PANDABSP BSPCubemapCache : public TypedWritableReferenceCount {
+public:
+  BSPCubemapCache(uint64_t hash = 0);
+
+  static PT(BSPCubemapCache) read(const Filename &bsp_filename, uint64_t hash);
+  bool write(const Filename &bsp_filename);
+
+  void add_cubemap(const LPoint3 &pos, const CubemapPrefilter *prefilter);
+  bool load_cubemap(const LPoint3 &pos, int size, Texture *tex) const;
+
+  INLINE int get_num_cubemaps() const {
+    return (int)_cubemaps.size();
+  }
+
+private:
+  struct Entry {
+    LPoint3 pos;
+    int size;
+    int num_mips;
+    // Mip levels 1 and up, all six faces of each level.
+    pvector<colorrgbexp32_t> texels;
+  };
+
+  uint16_t _version;
+  uint64_t _hash;
+  pvector<Entry> _cubemaps;
+
+public:
+  static void register_with_read_factory();
+  virtual void write_datagram(BamWriter *manager, Datagram &dg);
+
+protected:
+  static TypedWritable *make_from_bam(const FactoryParams &params);
+  void fillin(DatagramIterator &scan, BamReader *manager);
+
+public:
+  static TypeHandle get_class_type() {
+    return _type_handle;
+  }
+  static void init_type() {
+    TypedWritableReferenceCount::init_type();
+    register_type(_type_handle, "BSPCubemapCache",
+                  TypedWritableReferenceCount::get_class_type());
+  }
+  virtual TypeHandle get_type() const {
+    return get_class_type();
+  }
+  virtual TypeHandle force_init_type() {
+    init_type();
+    return get_class_type();
+  }
+
+private:
+  static TypeHandle _type_handle;
+};
+
+#endif // BSP_CUBEMAP_CACHE_H
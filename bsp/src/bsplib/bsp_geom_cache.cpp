@@ -0,0 +1,436 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_geom_cache.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#include "bsp_geom_cache.h"
+#include "bsploader.h"
+#include "bamCache.h"
+#include "bamCacheRecord.h"
+#include "bamReader.h"
+#include "bamWriter.h"
+#include "datagram.h"
+#include "datagramIterator.h"
+#include "configVariableBool.h"
+
+#include <string.h>
+
+TypeHandle BSPGeomCache::_type_handle;
+
+// Bump this whenever the contents of the cache or the way the level geometry
+// is built changes, so that stale records get rebuilt.
+static const uint16_t geom_cache_version = 1;
+
+static ConfigVariableBool bsp_geom_cache("bsp_geom_cache", true,
+  PRC_DESC("Keep the render-ready geometry of loaded levels in the model "
+           "cache, so that loading the same level again is mostly I/O. "
+           "Only has an effect when model-cache-dir is set."));
+
+BSPGeomCache::
+BSPGeomCache(uint64_t hash) :
+  _version(geom_cache_version),
+  _hash(hash),
+  _props(nullptr),
+  _num_palettes_read(0),
+  _num_cubemaps_read(0),
+  _num_models_read(0),
+  _has_props_read(false),
+  _num_leafs_read(0) {
+}
+
+/**
+ * Returns true if level geometry should be read from and written to the
+ * model cache.
+ */
+bool BSPGeomCache::
+is_enabled() {
+  if (!bsp_geom_cache) {
+    return false;
+  }
+
+  BamCache *cache = BamCache::get_global_ptr();
+  return cache->get_active() && cache->get_cache_models();
+}
+
+/**
+ * Returns a hash of the contents of a BSP file, which the cache records are
+ * keyed on.
+ */
+uint64_t BSPGeomCache::
+hash_file(const void *image, size_t length) {
+  const unsigned char *data = (const unsigned char *)image;
+
+  // FNV-1a, eight bytes at a time.
+  uint64_t hash = 14695981039346656037ull ^ (uint64_t)length;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 1099511628211ull;
+  }
+  for (; i < length; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+
+  // Mix the high bits back down.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/**
+ * Returns the data of the model cache record with the indicated extension
+ * for the BSP file, or NULL if the cache is off, there is no such record, or
+ * it doesn't hold an object of the indicated type.  The caller still has to
+ * check that the data is up to date, see check_record().
+ */
+PT(TypedWritableReferenceCount) BSPGeomCache::
+read_record(const Filename &bsp_filename, const std::string &extension, TypeHandle type) {
+  if (!is_enabled()) {
+    return nullptr;
+  }
+
+  BamCache *cache = BamCache::get_global_ptr();
+  PT(BamCacheRecord) record = cache->lookup(bsp_filename, extension);
+  if (record == nullptr || !record->has_data()) {
+    return nullptr;
+  }
+
+  if (!record->get_data()->is_of_type(type)) {
+    return nullptr;
+  }
+
+  return DCAST(TypedWritableReferenceCount, record->get_data());
+}
+
+/**
+ * Reports whether the record read with read_record() is used, and returns
+ * up_to_date.
+ */
+bool BSPGeomCache::
+check_record(const Filename &bsp_filename, const std::string &extension, bool up_to_date) {
+  if (!up_to_date) {
+    bsploader_cat.info()
+      << "Cached " << extension << " for " << bsp_filename << " is out of date\n";
+    return false;
+  }
+
+  bsploader_cat.info()
+    << "Using cached " << extension << " for " << bsp_filename << "\n";
+  return true;
+}
+
+/**
+ * Stores the data as the model cache record with the indicated extension for
+ * the BSP file.  The record becomes stale when the BSP file or any of the
+ * dependent files change.
+ */
+bool BSPGeomCache::
+write_record(const Filename &bsp_filename, const std::string &extension,
+             TypedWritableReferenceCount *data, const vector_string &dependent_files) {
+  if (!is_enabled()) {
+    return false;
+  }
+
+  BamCache *cache = BamCache::get_global_ptr();
+  PT(BamCacheRecord) record = cache->lookup(bsp_filename, extension);
+  if (record == nullptr) {
+    return false;
+  }
+
+  record->add_dependent_file(bsp_filename);
+  for (size_t i = 0; i < dependent_files.size(); i++) {
+    record->add_dependent_file(Filename(dependent_files[i]));
+  }
+
+  record->set_data(data);
+  if (!cache->store(record)) {
+    bsploader_cat.warning()
+      << "Could not write " << extension << " for " << bsp_filename << " to the model cache\n";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Returns the cache record of the indicated kind for the BSP file, or NULL if
+ * there is none, or it is out of date.
+ */
+PT(BSPGeomCache) BSPGeomCache::
+read(const Filename &bsp_filename, const std::string &extension, uint64_t hash) {
+  PT(BSPGeomCache) geom = DCAST(BSPGeomCache, read_record(bsp_filename, extension, get_class_type()));
+  if (geom == nullptr ||
+      !check_record(bsp_filename, extension,
+                    geom->_version == geom_cache_version && geom->_hash == hash)) {
+    return nullptr;
+  }
+
+  return geom;
+}
+
+/**
+ * Stores this record of the indicated kind for the BSP file in the model
+ * cache.  The record becomes stale when the BSP file or any of the
+ * dependent files (materials, textures, models) change.
+ */
+bool BSPGeomCache::
+write(const Filename &bsp_filename, const std::string &extension,
+      const vector_string &dependent_files) {
+  return write_record(bsp_filename, extension, this, dependent_files);
+}
+
+/**
+ * Records the lightmap palettes and the palette entry of each face.
+ */
+void BSPGeomCache::
+set_lightmaps(const LightmapPaletteDirectory *dir) {
+  _palettes.clear();
+  _palette_sizes.clear();
+  for (size_t i = 0; i < dir->palettes.size(); i++) {
+    const LightmapPalette *pal = dir->palettes[i];
+    _palettes.push_back(pal->texture);
+    _palette_sizes.push_back(LVecBase2i(pal->size[0], pal->size[1]));
+  }
+
+  _faces.resize(dir->face_palette_entries.size());
+  for (size_t i = 0; i < dir->face_palette_entries.size(); i++) {
+    const LightmapPalette::Entry *entry = dir->face_palette_entries[i];
+    FaceEntry &face = _faces[i];
+    face.palette = -1;
+    face.offset[0] = face.offset[1] = 0;
+    if (entry == nullptr) {
+      continue;
+    }
+
+    for (size_t j = 0; j < dir->palettes.size(); j++) {
+      if (dir->palettes[j] == entry->palette) {
+        face.palette = (int)j;
+        break;
+      }
+    }
+    face.offset[0] = entry->offset[0];
+    face.offset[1] = entry->offset[1];
+  }
+}
+
+/**
+ * Rebuilds the lightmap palette directory from the cache, as
+ * LightmapPalettizer::palettize_lightmaps() would have made it.
+ */
+PT(LightmapPaletteDirectory) BSPGeomCache::
+make_lightmap_dir() const {
+  PT(LightmapPaletteDirectory) dir = new LightmapPaletteDirectory;
+
+  for (size_t i = 0; i < _palettes.size(); i++) {
+    PT(LightmapPalette) pal = new LightmapPalette;
+    pal->texture = _palettes[i];
+    pal->size[0] = _palette_sizes[i][0];
+    pal->size[1] = _palette_sizes[i][1];
+    dir->palettes.push_back(pal);
+  }
+
+  dir->face_palette_entries.resize(_faces.size(), nullptr);
+  for (size_t i = 0; i < _faces.size(); i++) {
+    const FaceEntry &face = _faces[i];
+    if (face.palette < 0 || face.palette >= (int)dir->palettes.size()) {
+      continue;
+    }
+
+    LightmapPalette *pal = dir->palettes[face.palette];
+    PT(LightmapPalette::Entry) entry = new LightmapPalette::Entry;
+    entry->palette = pal;
+    entry->facenum = (int)i;
+    entry->offset[0] = face.offset[0];
+    entry->offset[1] = face.offset[1];
+    pal->entries.push_back(entry);
+    dir->face_palette_entries[i] = entry;
+  }
+
+  return dir;
+}
+
+/**
+ * Makes a stand-in texture for each of the level's cubemaps.
+ */
+void BSPGeomCache::
+set_cubemaps(const pvector<PT(cubemap_t)> &cubemaps) {
+  _cubemaps.clear();
+  for (size_t i = 0; i < cubemaps.size(); i++) {
+    PT(Texture) tex = new Texture("bsp-cache-cubemap");
+    tex->setup_2d_texture(1, 1, Texture::T_unsigned_byte, Texture::F_rgb);
+    tex->make_ram_image();
+    _cubemaps.push_back(tex);
+  }
+}
+
+/**
+ * Replaces the level's cubemaps with the stand-ins on a copy of the geometry
+ * that is about to be written.
+ */
+void BSPGeomCache::
+hide_cubemaps(const NodePath &root, const pvector<PT(cubemap_t)> &cubemaps) const {
+  nassertv(cubemaps.size() == _cubemaps.size());
+  NodePath np(root);
+  for (size_t i = 0; i < cubemaps.size(); i++) {
+    np.replace_texture(cubemaps[i]->cubemap_tex, _cubemaps[i]);
+  }
+}
+
+/**
+ * Puts the level's cubemaps back in place of the stand-ins on geometry read
+ * from the cache.  Returns false if the cache was written for a different
+ * set of cubemaps.
+ */
+bool BSPGeomCache::
+restore_cubemaps(const NodePath &root, const pvector<PT(cubemap_t)> &cubemaps) const {
+  if (cubemaps.size() != _cubemaps.size()) {
+    return false;
+  }
+
+  NodePath np(root);
+  for (size_t i = 0; i < cubemaps.size(); i++) {
+    if (_cubemaps[i] != nullptr) {
+      np.replace_texture(_cubemaps[i], cubemaps[i]->cubemap_tex);
+    }
+  }
+  return true;
+}
+
+void BSPGeomCache::
+register_with_read_factory() {
+  BamReader::get_factory()->register_factory(get_class_type(), make_from_bam);
+}
+
+void BSPGeomCache::
+write_datagram(BamWriter *manager, Datagram &dg) {
+  TypedWritable::write_datagram(manager, dg);
+
+  dg.add_uint16(_version);
+  dg.add_uint64(_hash);
+
+  dg.add_uint16((uint16_t)_palettes.size());
+  for (size_t i = 0; i < _palettes.size(); i++) {
+    manager->write_pointer(dg, _palettes[i]);
+    dg.add_int32(_palette_sizes[i][0]);
+    dg.add_int32(_palette_sizes[i][1]);
+  }
+
+  dg.add_uint32((uint32_t)_faces.size());
+  for (size_t i = 0; i < _faces.size(); i++) {
+    dg.add_int16((int16_t)_faces[i].palette);
+    dg.add_int32(_faces[i].offset[0]);
+    dg.add_int32(_faces[i].offset[1]);
+  }
+
+  dg.add_uint16((uint16_t)_cubemaps.size());
+  for (size_t i = 0; i < _cubemaps.size(); i++) {
+    manager->write_pointer(dg, _cubemaps[i]);
+  }
+
+  dg.add_uint32((uint32_t)_models.size());
+  for (size_t i = 0; i < _models.size(); i++) {
+    manager->write_pointer(dg, _models[i]);
+  }
+
+  dg.add_bool(_props != nullptr);
+  if (_props != nullptr) {
+    manager->write_pointer(dg, _props);
+  }
+
+  dg.add_uint32((uint32_t)_leafs.size());
+  for (size_t i = 0; i < _leafs.size(); i++) {
+    manager->write_pointer(dg, _leafs[i]);
+  }
+}
+
+int BSPGeomCache::
+complete_pointers(TypedWritable **p_list, BamReader *manager) {
+  int pi = TypedWritable::complete_pointers(p_list, manager);
+
+  _palettes.resize(_num_palettes_read);
+  for (int i = 0; i < _num_palettes_read; i++) {
+    _palettes[i] = DCAST(Texture, p_list[pi++]);
+  }
+
+  _cubemaps.resize(_num_cubemaps_read);
+  for (int i = 0; i < _num_cubemaps_read; i++) {
+    _cubemaps[i] = DCAST(Texture, p_list[pi++]);
+  }
+
+  _models.resize(_num_models_read);
+  for (int i = 0; i < _num_models_read; i++) {
+    _models[i] = DCAST(PandaNode, p_list[pi++]);
+  }
+
+  if (_has_props_read) {
+    _props = DCAST(PandaNode, p_list[pi++]);
+  }
+
+  _leafs.resize(_num_leafs_read);
+  for (int i = 0; i < _num_leafs_read; i++) {
+    _leafs[i] = DCAST(GeomNode, p_list[pi++]);
+  }
+
+  return pi;
+}
+
+TypedWritable *BSPGeomCache::
+make_from_bam(const FactoryParams &params) {
+  BSPGeomCache *geom = new BSPGeomCache;
+  DatagramIterator scan;
+  BamReader *manager;
+
+  parse_params(params, scan, manager);
+  geom->fillin(scan, manager);
+
+  return geom;
+}
+
+void BSPGeomCache::
+fillin(DatagramIterator &scan, BamReader *manager) {
+  TypedWritable::fillin(scan, manager);
+
+  _version = scan.get_uint16();
+  if (_version != geom_cache_version) {
+    // Written by a different version, don't try to make sense of the rest.
+    return;
+  }
+  _hash = scan.get_uint64();
+
+  _num_palettes_read = scan.get_uint16();
+  _palette_sizes.resize(_num_palettes_read);
+  for (int i = 0; i < _num_palettes_read; i++) {
+    manager->read_pointer(scan);
+    _palette_sizes[i][0] = scan.get_int32();
+    _palette_sizes[i][1] = scan.get_int32();
+  }
+
+  _faces.resize(scan.get_uint32());
+  for (size_t i = 0; i < _faces.size(); i++) {
+    _faces[i].palette = scan.get_int16();
+    _faces[i].offset[0] = scan.get_int32();
+    _faces[i].offset[1] = scan.get_int32();
+  }
+
+  _num_cubemaps_read = scan.get_uint16();
+  manager->read_pointers(scan, _num_cubemaps_read);
+
+  _num_models_read = scan.get_uint32();
+  manager->read_pointers(scan, _num_models_read);
+
+  _has_props_read = scan.get_bool();
+  if (_has_props_read) {
+    manager->read_pointer(scan);
+  }
+
+  _num_leafs_read = scan.get_uint32();
+  manager->read_pointers(scan, _num_leafs_read);
+}
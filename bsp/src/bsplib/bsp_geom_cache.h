@@ -0,0 +1,157 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_geom_cache.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#ifndef BSP_GEOM_CACHE_H
+#define BSP_GEOM_CACHE_H
+
+#include "config_bsplib.h"
+#include "typedWritableReferenceCount.h"
+#include "pandaNode.h"
+#include "geomNode.h"
+#include "nodePath.h"
+#include "texture.h"
+#include "lightmap_palettes.h"
+#include "cubemaps.h"
+
+#include <stdint.h>
+
+class BamCacheRecord;
+
+/**
+ * Render-ready geometry of a level, kept in the model cache (BamCache) next
+ * to the other cached models, so that loading the same map again doesn't
+ * have to palettize the lightmaps, build the faces, light the static props or
+ * batch the world geometry per leaf.
+ *
+ * A map has two records: the "bspgeom" record holds the lightmap palettes,
+ * the faces of every brush model and the static props as they are at the end
+ * of BSPLevel::load(), and the "bspleafs" record holds the per-leaf world
+ * batches made by BSPLevel::do_optimizations().  A record is only used if it
+ * was written by the same cache version for a BSP file with the same hash.
+ *
+ * The cubemaps are owned by the level and rendered at runtime, so the
+ * geometry is written with a small stand-in texture in place of each one,
+ * and the stand-ins are swapped back for the level's cubemaps on load.
+ */
+class EXPCL_PANDABSP BSPGeomCache : public TypedWritableReferenceCount {
+public:
+  BSPGeomCache(uint64_t hash = 0);
+
+  static bool is_enabled();
+  static uint64_t hash_file(const void *image, size_t length);
+
+  static PT(BSPGeomCache) read(const Filename &bsp_filename, const std::string &extension,
+                               uint64_t hash);
+  bool write(const Filename &bsp_filename, const std::string &extension,
+             const vector_string &dependent_files);
+
+  // Shared with the other records kept for a BSP file, see BSPCubemapCache.
+  static PT(TypedWritableReferenceCount) read_record(const Filename &bsp_filename,
+                                                     const std::string &extension,
+                                                     TypeHandle type);
+  static bool check_record(const Filename &bsp_filename, const std::string &extension,
+                           bool up_to_date);
+  static bool write_record(const Filename &bsp_filename, const std::string &extension,
+                           TypedWritableReferenceCount *data,
+                           const vector_string &dependent_files);
+
+  void set_lightmaps(const LightmapPaletteDirectory *dir);
+  PT(LightmapPaletteDirectory) make_lightmap_dir() const;
+
+  void set_cubemaps(const pvector<PT(cubemap_t)> &cubemaps);
+  void hide_cubemaps(const NodePath &root, const pvector<PT(cubemap_t)> &cubemaps) const;
+  bool restore_cubemaps(const NodePath &root, const pvector<PT(cubemap_t)> &cubemaps) const;
+
+  INLINE void add_model(PandaNode *model) {
+    _models.push_back(model);
+  }
+  INLINE int get_num_models() const {
+    return (int)_models.size();
+  }
+  INLINE PandaNode *get_model(int n) const {
+    return _models[n];
+  }
+
+  INLINE void set_props(PandaNode *props) {
+    _props = props;
+  }
+  INLINE PandaNode *get_props() const {
+    return _props;
+  }
+
+  INLINE void add_leaf(GeomNode *leaf) {
+    _leafs.push_back(leaf);
+  }
+  INLINE int get_num_leafs() const {
+    return (int)_leafs.size();
+  }
+  INLINE GeomNode *get_leaf(int n) const {
+    return _leafs[n];
+  }
+
+private:
+  struct FaceEntry {
+    int palette;
+    int offset[2];
+  };
+
+  uint16_t _version;
+  uint64_t _hash;
+
+  pvector<PT(Texture)> _palettes;
+  pvector<LVecBase2i> _palette_sizes;
+  pvector<FaceEntry> _faces;
+
+  pvector<PT(Texture)> _cubemaps;
+
+  pvector<PT(PandaNode)> _models;
+  PT(PandaNode) _props;
+  pvector<PT(GeomNode)> _leafs;
+
+public:
+  static void register_with_read_factory();
+  virtual void write_datagram(BamWriter *manager, Datagram &dg);
+  virtual int complete_pointers(TypedWritable **p_list, BamReader *manager);
+
+protected:
+  static TypedWritable *make_from_bam(const FactoryParams &params);
+  void fillin(DatagramIterator &scan, BamReader *manager);
+
+private:
+  // Counts read by fillin(), for complete_pointers().
+  int _num_palettes_read;
+  int _num_cubemaps_read;
+  int _num_models_read;
+  bool _has_props_read;
+  int _num_leafs_read;
+
+public:
+  static TypeHandle get_class_type() {
+    return _type_handle;
+  }
+  static void init_type() {
+    TypedWritableReferenceCount::init_type();
+    register_type(_type_handle, "BSPGeomCache",
+                  TypedWritableReferenceCount::get_class_type());
+  }
+  virtual TypeHandle get_type() const {
+    return get_class_type();
+  }
+  virtual TypeHandle force_init_type() {
+    init_type();
+    return get_class_type();
+  }
+
+private:
+  static TypeHandle _type_handle;
+};
+
+#endif // BSP_GEOM_CACHE_H
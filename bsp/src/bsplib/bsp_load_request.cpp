@@ -0,0 +1,116 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_load_request.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#include "bsp_load_request.h"
+#include "bsploader.h"
+#include "bsplevel.h"
+
+TypeHandle BSPLoadRequest::_type_handle;
+
+// How far along the load is at the start of each phase.  Building the faces
+// and the static props is most of the work.
+static const float phase_progress[] = {
+  0.0f,  // P_queued
+  0.0f,  // P_reading
+  0.1f,  // P_entities
+  0.15f, // P_geometry
+  0.55f, // P_props
+  0.8f,  // P_lighting
+  0.85f, // P_collision
+  0.95f, // P_loaded
+  0.95f, // P_activating
+  1.0f,  // P_done
+  1.0f,  // P_failed
+};
+
+/**
+ *
+ */
+BSPLoadRequest::
+BSPLoadRequest(BSPLoader *loader, const Filename &filename,
+               bool is_transition, bool activate) :
+  AsyncTask(filename.get_basename_wo_extension()),
+  _loader(loader),
+  _filename(filename),
+  _is_transition(is_transition),
+  _activate(activate),
+  _phase(P_queued) {
+}
+
+/**
+ *
+ */
+BSPLoadRequest::
+~BSPLoadRequest() {
+}
+
+/**
+ * Returns a number from 0 to 1 telling how far along the load is.
+ */
+float BSPLoadRequest::
+get_progress() const {
+  return phase_progress[get_phase()];
+}
+
+/**
+ * Returns the level that was loaded, or nullptr if the load hasn't finished
+ * yet or has failed.
+ */
+BSPLevel *BSPLoadRequest::
+get_level() const {
+  Phase phase = get_phase();
+  if (phase != P_loaded && phase != P_activating && phase != P_done) {
+    return nullptr;
+  }
+  return _level;
+}
+
+/**
+ * Returns the name of the task chain that BSP levels are built on.  It only
+ * has one thread, since the BSP entity parser is not reentrant, which also
+ * means loads are built in the order they were requested.
+ */
+const char *BSPLoadRequest::
+get_chain_name() {
+  return "bsp_loader";
+}
+
+/**
+ * Builds the level on the loader thread, then hops over to the main thread to
+ * activate it.
+ */
+AsyncTask::DoneStatus BSPLoadRequest::
+do_task() {
+  Phase phase = get_phase();
+
+  if (phase == P_queued) {
+    _level = _loader->read_level(_filename, this);
+    if (_level == nullptr) {
+      set_phase(P_failed);
+      return DS_done;
+    }
+
+    set_phase(P_loaded);
+    if (!_activate) {
+      return DS_done;
+    }
+
+    // The rest has to happen on the main thread.
+    set_task_chain("default");
+    return DS_cont;
+  }
+
+  if (phase == P_loaded) {
+    _loader->activate(this);
+  }
+
+  return DS_done;
+}
@@ -0,0 +1,132 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_load_request.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#ifndef BSP_LOAD_REQUEST_H
+#define BSP_LOAD_REQUEST_H
+
+#include "config_bsplib.h"
+#include "asyncTask.h"
+#include "filename.h"
+#include "atomicAdjust.h"
+
+class BSPLoader;
+class BSPLevel;
+
+/**
+ * A single asynchronous BSP level load, made by BSPLoader::read_async().
+ *
+ * The request first runs on the BSP loader task chain, in its own thread,
+ * where it reads the file and builds the whole level (entities, visibility,
+ * geometry, static props, ambient probes and collision data) without touching
+ * the active level.  It then moves itself to the default task chain, so the
+ * last step -- cleaning up the old level, making the new one active and
+ * loading its entities -- runs on the main thread with the rest of the frame.
+ *
+ * A request made with activate set to false stops once the level is built.
+ * The level is kept on the request until it is handed to
+ * BSPLoader::activate(), which is how a server can load the next map while
+ * the current one is still being played.
+ */
+class EXPCL_PANDABSP BSPLoadRequest : public AsyncTask {
+PUBLISHED:
+  enum Phase {
+    P_queued,
+    P_reading,
+    P_entities,
+    P_geometry,
+    P_props,
+    P_lighting,
+    P_collision,
+    P_loaded,
+    P_activating,
+    P_done,
+    P_failed,
+  };
+
+  BSPLoadRequest(BSPLoader *loader, const Filename &filename,
+                 bool is_transition, bool activate);
+  virtual ~BSPLoadRequest();
+
+  INLINE const Filename &get_filename() const {
+    return _filename;
+  }
+  INLINE bool is_transition() const {
+    return _is_transition;
+  }
+  INLINE bool get_activate() const {
+    return _activate;
+  }
+
+  INLINE Phase get_phase() const {
+    return (Phase)AtomicAdjust::get(_phase);
+  }
+  float get_progress() const;
+
+  // True once the level has been built and can be activated.
+  INLINE bool is_ready() const {
+    return get_phase() == P_loaded;
+  }
+  INLINE bool is_activated() const {
+    return get_phase() == P_done;
+  }
+  INLINE bool has_failed() const {
+    return get_phase() == P_failed;
+  }
+
+  BSPLevel *get_level() const;
+
+  MAKE_PROPERTY(filename, get_filename);
+  MAKE_PROPERTY(phase, get_phase);
+  MAKE_PROPERTY(progress, get_progress);
+
+public:
+  INLINE void set_phase(Phase phase) {
+    AtomicAdjust::set(_phase, (AtomicAdjust::Integer)phase);
+  }
+
+  static const char *get_chain_name();
+
+protected:
+  virtual DoneStatus do_task();
+
+private:
+  BSPLoader *_loader;
+  Filename _filename;
+  bool _is_transition;
+  bool _activate;
+
+  PT(BSPLevel) _level;
+  AtomicAdjust::Integer _phase;
+
+  friend class BSPLoader;
+
+public:
+  static TypeHandle get_class_type() {
+    return _type_handle;
+  }
+  static void init_type() {
+    AsyncTask::init_type();
+    register_type(_type_handle, "BSPLoadRequest",
+                  AsyncTask::get_class_type());
+  }
+  virtual TypeHandle get_type() const {
+    return get_class_type();
+  }
+  virtual TypeHandle force_init_type() {
+    init_type();
+    return get_class_type();
+  }
+
+private:
+  static TypeHandle _type_handle;
+};
+
+#endif // BSP_LOAD_REQUEST_H
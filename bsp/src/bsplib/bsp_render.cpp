@@ -214,6 +214,11 @@ static PStatCollector wsp_record_collector( "Cull:BSP:WorldSpawn:RecordGeom" );
 static PStatCollector wsp_trav_collector( "Cull:BSP:WorldSpawn:TraverseLeafs" );
 static PStatCollector wsp_geom_traverse_collector( "Cull:BSP:WorldSpawn:TraverseLeafGeoms" );
 static PStatCollector wsp_make_cullableobject_collector( "Cull:BSP:WorldSpawn:MakeCullableObject" );
+static PStatCollector wsp_compose_collector( "Cull:BSP:WorldSpawn:ComposeStates" );
+
+static ConfigVariableBool bsp_cluster_states( "bsp_cluster_states", true,
+        PRC_DESC( "Remember the states of the world batches composed for each camera, "
+                  "instead of composing them again for every batch every frame." ) );
 
 void BSPCullTraverser::traverse_below( CullTraverserData &data )
 {
@@ -250,38 +255,49 @@ void BSPCullTraverser::traverse_below( CullTraverserData &data )
 
 			keep_going = false;
 
-			bool should_render = level->_curr_leaf_idx != 0;
+			bool should_render = level->_curr_leaf_idx != 0 &&
+				level->_curr_leaf_idx < (int)level->_leaf_world_clusters.size();
 
-			if ( should_render )
+			WorldCluster *cluster = should_render ? level->_leaf_world_clusters[level->_curr_leaf_idx].p() : nullptr;
+			if ( cluster )
 			{
-				const GeomNode::Geoms &world_geoms = level->_leaf_world_geoms[level->_curr_leaf_idx];
+				const WorldCluster::Batches &batches = cluster->get_batches();
+				int num_batches = (int)batches.size();
+
+				CPT( WorldCluster::ComposedStates ) composed;
+				if ( bsp_cluster_states )
+				{
+					wsp_compose_collector.start();
+					composed = cluster->get_composed_states( data._state );
+					wsp_compose_collector.stop();
+				}
+
+				bool shadow = has_camera_bits( CAMERA_SHADOW );
 
-				int num_world_geoms = world_geoms.get_num_geoms();
-				for ( int i = 0; i < num_world_geoms; i++ )
+				for ( int i = 0; i < num_batches; i++ )
 				{
-					const RenderState *world_state = data._state->compose( world_geoms.get_geom_state( i ) );
+					const WorldCluster::Batch &batch = batches[i];
 
-					if ( has_camera_bits( CAMERA_SHADOW ) )
+					if ( shadow && batch.skybox )
 					{
-						const BSPMaterialAttrib *bma;
-						world_state->get_attrib( bma );
-						if ( bma )
-						{
-							const BSPMaterial *mat = bma->get_material();
-							if ( mat && mat->is_skybox() )
-							{
-								// This is a terrible hack to make skybox
-								// faces not render to shadow maps.
-								continue;
-							}
-						}
+						// This is a terrible hack to make skybox
+						// faces not render to shadow maps.
+						continue;
 					}
 
-					const Geom *world_geom = world_geoms.get_geom( i );
+					CPT( RenderState ) world_state;
+					if ( composed )
+					{
+						world_state = composed->states[i];
+					}
+					else
+					{
+						world_state = data._state->compose( batch.state );
+					}
 
 					wsp_ctest_collector.start();
 					const GeometricBoundingVolume *geom_gbv;
-					if ( !geom_cull_test( world_geom, world_state, data, geom_gbv, current_thread, needs_culling() ) )
+					if ( !geom_cull_test( batch.geom, world_state, data, geom_gbv, current_thread, needs_culling() ) )
 					{
 						// Geom culled away by view frustum or clip planes.
 						wsp_ctest_collector.stop();
@@ -291,8 +307,10 @@ void BSPCullTraverser::traverse_below( CullTraverserData &data )
 
 					wsp_make_cullableobject_collector.start();
 					// Go ahead and render this worldspawn Geom.
+					// CullableObjects come from a deleted chain, so this
+					// doesn't hit the heap.
 					CullableObject *object = new CullableObject(
-						std::move( world_geom ), std::move( world_state ),
+						CPT( Geom )( batch.geom ), std::move( world_state ),
 						internal_transform );
 					wsp_make_cullableobject_collector.stop();
 					wsp_record_collector.start();
@@ -420,6 +438,13 @@ bool BSPRender::cull_callback( CullTraverser *trav, CullTraverserData &data )
         bsp_trav.traverse_below( data );
         bsp_trav.end_traverse();
 
+        if ( level )
+        {
+                // Light the dynamic nodes that were found during the traversal.
+                // This has to be done before the frame is drawn.
+                level->get_ambient_probe_mgr()->update_nodes();
+        }
+
         // No need for CullTraverser to go further down this node,
         // the BSPCullTraverser has already handled it.
         return false;
@@ -449,6 +474,11 @@ BSPProp::BSPProp( const std::string &name ) :
 {
 }
 
+PandaNode *BSPProp::make_copy() const
+{
+        return new BSPProp( *this );
+}
+
 bool BSPProp::safe_to_combine() const
 {
         return true;
@@ -459,6 +489,24 @@ bool BSPProp::safe_to_flatten() const
         return true;
 }
 
+void BSPProp::register_with_read_factory()
+{
+        BamReader::get_factory()->register_factory( get_class_type(), make_from_bam );
+}
+
+TypedWritable *BSPProp::make_from_bam( const FactoryParams &params )
+{
+        // Static props are written to the level geometry cache.
+        BSPProp *node = new BSPProp( "" );
+        DatagramIterator scan;
+        BamReader *manager;
+
+        parse_params( params, scan, manager );
+        node->fillin( scan, manager );
+
+        return node;
+}
+
 BSPModel::BSPModel( const std::string &name ) :
         ModelNode( name )
 {
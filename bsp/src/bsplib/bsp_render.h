@@ -108,8 +108,14 @@ PUBLISHED:
         BSPProp( const std::string &name );
 
 public:
+        virtual PandaNode *make_copy() const;
         virtual bool safe_to_combine() const;
         virtual bool safe_to_flatten() const;
+
+        static void register_with_read_factory();
+
+protected:
+        static TypedWritable *make_from_bam( const FactoryParams &params );
 };
 
 class EXPCL_PANDABSP BSPModel : public ModelNode
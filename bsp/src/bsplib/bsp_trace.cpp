@@ -704,6 +704,259 @@ void CM_BoxTrace(const Ray &ray, int headnode, int brushmask, bool compute_endpo
         }
 }
 
+// Packet tracing: four rays sharing one hull are walked down the tree together.
+// Every lane keeps its own Trace and its own [p1f, p2f] interval, the plane tests
+// at each node are done for all four lanes at once, and lanes only part ways with
+// the packet when they end up on different sides of a splitting plane.
+
+static INLINE int CM_CountLanes(int mask)
+{
+        return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+}
+
+static INLINE fltx4 CM_Clamp01(const fltx4 &f)
+{
+        return MinSIMD(MaxSIMD(f, Four_Zeros), Four_Ones);
+}
+
+/**
+ * Narrows each lane's segment to the sub-interval [a, b] (given as fractions of
+ * the lane's current segment).
+ */
+static INLINE void CM_NarrowSegment4(const fltx4 &p1f, const fltx4 &p2f,
+                                     const FourVectors &p1, const FourVectors &p2,
+                                     const fltx4 &a, const fltx4 &b,
+                                     fltx4 &out_p1f, fltx4 &out_p2f,
+                                     FourVectors &out_p1, FourVectors &out_p2)
+{
+        fltx4 df = SubSIMD(p2f, p1f);
+        out_p1f = MaddSIMD(df, a, p1f);
+        out_p2f = MaddSIMD(df, b, p1f);
+        for (int i = 0; i < 3; i++)
+        {
+                fltx4 d = SubSIMD(p2[i], p1[i]);
+                out_p1[i] = MaddSIMD(d, a, p1[i]);
+                out_p2[i] = MaddSIMD(d, b, p1[i]);
+        }
+}
+
+template <bool IS_POINT>
+void CM_RecursiveHullCheck4(Trace *traces, int active, bool any_hit, int num,
+                            const fltx4 &p1f, const fltx4 &p2f,
+                            const FourVectors &p1, const FourVectors &p2)
+{
+        // drop lanes that already hit something nearer
+        for (int i = 0; i < 4; i++)
+        {
+                if (!(active & (1 << i)))
+                        continue;
+                const Trace &trace = traces[i];
+                if (trace.fraction <= SubFloat(p1f, i) || (any_hit && trace.has_hit()))
+                        active &= ~(1 << i);
+        }
+        if (!active)
+        {
+                return;
+        }
+
+        // the hull is shared across the packet, so any lane's extents will do
+        const LVector3 &extents = traces[0].extents;
+        const bspdata_t *bspdata = traces[0].bspdata->bspdata;
+
+        fltx4 t1 = Four_Zeros, t2 = Four_Zeros;
+        fltx4 offset = Four_Zeros;
+        fltx4 front_mask = Four_Zeros, back_mask = Four_Zeros;
+        int front = 0, back = 0;
+        const dnode_t *node = nullptr;
+
+        while (num >= 0)
+        {
+                node = bspdata->dnodes + num;
+                const dplane_t *plane = bspdata->dplanes + node->planenum;
+                int type = plane->type;
+                fltx4 dist = ReplicateX4(plane->dist);
+
+                if (type < 3)
+                {
+                        t1 = SubSIMD(p1[type], dist);
+                        t2 = SubSIMD(p2[type], dist);
+                        offset = ReplicateX4(extents[type]);
+                }
+                else
+                {
+                        LVector3 normal(plane->normal[0], plane->normal[1], plane->normal[2]);
+                        t1 = SubSIMD(p1 * normal, dist);
+                        t2 = SubSIMD(p2 * normal, dist);
+                        if (IS_POINT)
+                        {
+                                offset = Four_Zeros;
+                        }
+                        else
+                        {
+                                offset = ReplicateX4(DotProductAbsD(extents, plane->normal));
+                        }
+                }
+
+                // see which sides each lane needs to consider
+                fltx4 neg_offset = NegSIMD(offset);
+                front_mask = AndSIMD(CmpGtSIMD(t1, offset), CmpGtSIMD(t2, offset));
+                back_mask = AndSIMD(CmpLtSIMD(t1, neg_offset), CmpLtSIMD(t2, neg_offset));
+                front = TestSignSIMD(front_mask) & active;
+                back = TestSignSIMD(back_mask) & active;
+
+                if (front == active)
+                {
+                        num = node->children[0];
+                        continue;
+                }
+                if (back == active)
+                {
+                        num = node->children[1];
+                        continue;
+                }
+                break;
+        }
+
+        // if < 0, we are in a leaf node
+        if (num < 0)
+        {
+                for (int i = 0; i < 4; i++)
+                {
+                        if (active & (1 << i))
+                        {
+                                CM_TraceToLeaf<IS_POINT>(&traces[i], ~num, SubFloat(p1f, i), SubFloat(p2f, i));
+                        }
+                }
+                return;
+        }
+
+        // The packet straddles this node.  Work out, per lane, which part of its segment
+        // lies on each side of the plane, putting the crosspoints DIST_EPSILON on the
+        // near side exactly like the single ray path does.
+        fltx4 equal = CmpEqSIMD(t1, t2);
+        fltx4 reversed = CmpLtSIMD(t1, t2);
+        fltx4 idist = DivSIMD(Four_Ones, MaskedAssign(equal, Four_Ones, SubSIMD(t1, t2)));
+        fltx4 offset_eps = AddSIMD(offset, Four_DistEpsilons);
+        fltx4 frac_front = CM_Clamp01(MulSIMD(AddSIMD(t1, offset_eps), idist));
+        fltx4 frac_back = CM_Clamp01(MulSIMD(SubSIMD(t1, offset_eps), idist));
+
+        // front child: lanes going front to back keep [0, frac], back to front keep [frac, 1]
+        fltx4 front_a = MaskedAssign(reversed, frac_front, Four_Zeros);
+        fltx4 front_b = MaskedAssign(reversed, Four_Ones, frac_front);
+        front_b = MaskedAssign(OrSIMD(equal, front_mask), Four_Ones, front_b);
+        front_a = MaskedAssign(front_mask, Four_Zeros, front_a);
+
+        // back child: the mirror image
+        fltx4 back_a = MaskedAssign(reversed, Four_Zeros, frac_back);
+        fltx4 back_b = MaskedAssign(reversed, frac_back, Four_Ones);
+        back_a = MaskedAssign(OrSIMD(equal, back_mask), Four_Zeros, back_a);
+        back_b = MaskedAssign(back_mask, Four_Ones, back_b);
+
+        fltx4 p1f_front, p2f_front, p1f_back, p2f_back;
+        FourVectors p1_front, p2_front, p1_back, p2_back;
+        CM_NarrowSegment4(p1f, p2f, p1, p2, front_a, front_b, p1f_front, p2f_front, p1_front, p2_front);
+        CM_NarrowSegment4(p1f, p2f, p1, p2, back_a, back_b, p1f_back, p2f_back, p1_back, p2_back);
+
+        int front_lanes = active & ~back;
+        int back_lanes = active & ~front;
+
+        // visit the side most of the straddling lanes start on first, so they can
+        // cull the far side with an earlier hit
+        int straddle = active & ~(front | back);
+        int start_back = TestSignSIMD(reversed) & straddle;
+        if (CM_CountLanes(start_back) * 2 > CM_CountLanes(straddle))
+        {
+                CM_RecursiveHullCheck4<IS_POINT>(traces, back_lanes, any_hit, node->children[1],
+                                                 p1f_back, p2f_back, p1_back, p2_back);
+                CM_RecursiveHullCheck4<IS_POINT>(traces, front_lanes, any_hit, node->children[0],
+                                                 p1f_front, p2f_front, p1_front, p2_front);
+        }
+        else
+        {
+                CM_RecursiveHullCheck4<IS_POINT>(traces, front_lanes, any_hit, node->children[0],
+                                                 p1f_front, p2f_front, p1_front, p2_front);
+                CM_RecursiveHullCheck4<IS_POINT>(traces, back_lanes, any_hit, node->children[1],
+                                                 p1f_back, p2f_back, p1_back, p2_back);
+        }
+}
+
+static PStatCollector bt4_collector("BSP:CM_BoxTrace4");
+
+/**
+ * Traces up to four rays/box sweeps at once along the BSP tree.  All of the traces share
+ * the same hull (mins/maxs) and brush contents mask.  Only the first `num_lanes` lanes of
+ * the start and end vectors are used, and the results are written to traces[0..num_lanes).
+ *
+ * If any_hit is true, a lane stops descending the tree as soon as it hits anything, which
+ * is all a line of sight query needs.  The fraction is then not guaranteed to be the
+ * nearest hit.
+ */
+void CM_BoxTrace4(const FourVectors &start, const FourVectors &end, int num_lanes,
+                  const LVector3 &mins, const LVector3 &maxs, int headnode, int brushmask,
+                  bool any_hit, bool compute_endpoint, const collbspdata_t *bspdata, Trace *traces)
+{
+        PStatTimer timer(bt4_collector);
+
+        nassertv(num_lanes > 0 && num_lanes <= 4);
+
+        FourVectors p1, p2;
+        p1.DuplicateVector(LVector3::zero());
+        p2.DuplicateVector(LVector3::zero());
+
+        int active = 0;
+        bool is_point = true;
+
+        for (int i = 0; i < num_lanes; i++)
+        {
+                Ray ray(LPoint3(SubFloat(start.x, i), SubFloat(start.y, i), SubFloat(start.z, i)),
+                        LPoint3(SubFloat(end.x, i), SubFloat(end.y, i), SubFloat(end.z, i)),
+                        mins, maxs);
+
+                Trace &trace = traces[i];
+                trace.contents = brushmask;
+                trace.start_pos = ray.start;
+                trace.end_pos = ray.start + ray.delta;
+                trace.extents = ray.extents;
+                trace.delta = ray.delta;
+                trace.inv_delta = ray.inv_delta();
+                trace.mins = -ray.extents;
+                trace.maxs = ray.extents;
+                trace.is_point = ray.is_ray;
+                trace.bspdata = (collbspdata_t *)bspdata;
+
+                is_point = ray.is_ray;
+
+                for (int j = 0; j < 3; j++)
+                {
+                        SubFloat(p1[j], i) = trace.start_pos[j];
+                        SubFloat(p2[j], i) = trace.end_pos[j];
+                }
+
+                active |= 1 << i;
+        }
+
+        // general sweeping through the world
+        if (is_point)
+        {
+                CM_RecursiveHullCheck4<true>(traces, active, any_hit, headnode, Four_Zeros, Four_Ones, p1, p2);
+        }
+        else
+        {
+                CM_RecursiveHullCheck4<false>(traces, active, any_hit, headnode, Four_Zeros, Four_Ones, p1, p2);
+        }
+
+        if (compute_endpoint)
+        {
+                for (int i = 0; i < num_lanes; i++)
+                {
+                        Ray ray(LPoint3(SubFloat(start.x, i), SubFloat(start.y, i), SubFloat(start.z, i)),
+                                LPoint3(SubFloat(end.x, i), SubFloat(end.y, i), SubFloat(end.z, i)),
+                                mins, maxs);
+                        CM_ComputeTraceEndpoints(ray, &traces[i]);
+                }
+        }
+}
+
 collbspdata_t *SetupCollisionBSPData(const bspdata_t *bspdata)
 {
         collbspdata_t *cdata = new collbspdata_t;
@@ -59,6 +59,10 @@ extern EXPCL_PANDABSP collbspdata_t *SetupCollisionBSPData( const bspdata_t *bsp
 extern EXPCL_PANDABSP void CM_BoxTrace( const Ray &ray, int headnode, int brushmask,
                          bool compute_endpoint, const collbspdata_t *bspdata, Trace &trace );
 
+extern EXPCL_PANDABSP void CM_BoxTrace4( const FourVectors &start, const FourVectors &end, int num_lanes,
+                          const LVector3 &mins, const LVector3 &maxs, int headnode, int brushmask,
+                          bool any_hit, bool compute_endpoint, const collbspdata_t *bspdata, Trace *traces );
+
 class BSPLevel;
 
 enum
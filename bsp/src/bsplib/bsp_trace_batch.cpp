@@ -0,0 +1,156 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_trace_batch.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#include "bsp_trace_batch.h"
+#include "bsp_trace.h"
+
+#include <pStatTimer.h>
+#include <pStatCollector.h>
+
+static PStatCollector batch_collector("BSP:TraceBatch");
+
+/**
+ *
+ */
+BSPTraceBatch::BSPTraceBatch() :
+  _num_traces(0),
+  _mins(0),
+  _maxs(0),
+  _contents(CONTENTS_SOLID),
+  _any_hit(false),
+  _num_hits(0) {
+}
+
+/**
+ * Removes all of the traces and their results.  The hull, contents mask and
+ * any_hit flag are kept.
+ */
+void BSPTraceBatch::clear() {
+  _num_traces = 0;
+  for (int i = 0; i < 3; i++) {
+    _start[i].clear();
+    _end[i].clear();
+  }
+  _fractions.clear();
+  _end_pos.clear();
+  _hit_normals.clear();
+  _hit_contents.clear();
+  _start_solid.clear();
+  _num_hits = 0;
+}
+
+/**
+ * Reserves room for the indicated number of traces, so that a batch that is
+ * refilled every frame doesn't reallocate.
+ */
+void BSPTraceBatch::reserve(int num_traces) {
+  size_t padded = (num_traces + 3) & ~3;
+  for (int i = 0; i < 3; i++) {
+    _start[i].reserve(padded);
+    _end[i].reserve(padded);
+  }
+}
+
+/**
+ * Adds a single trace from `start` to `end` to the batch.
+ */
+void BSPTraceBatch::add_trace(const LPoint3 &start, const LPoint3 &end) {
+  for (int i = 0; i < 3; i++) {
+    _start[i].push_back(start[i] * 16);
+    _end[i].push_back(end[i] * 16);
+  }
+  _num_traces++;
+}
+
+/**
+ * Replaces the traces in the batch with one trace for each pair of start and
+ * end points.  This is the cheap way to fill a batch from Python, since the
+ * whole array crosses the binding at once.
+ */
+void BSPTraceBatch::set_traces(const PTA_LVecBase3f &starts, const PTA_LVecBase3f &ends) {
+  nassertv(starts.size() == ends.size());
+
+  clear();
+  reserve((int)starts.size());
+
+  for (size_t n = 0; n < starts.size(); n++) {
+    for (int i = 0; i < 3; i++) {
+      _start[i].push_back(starts[n][i] * 16);
+      _end[i].push_back(ends[n][i] * 16);
+    }
+  }
+  _num_traces = (int)starts.size();
+}
+
+/**
+ * Runs all of the traces in the batch against the collision BSP tree, starting
+ * at the indicated node.  Use BSPLevel::trace_batch() instead of calling this
+ * directly.
+ */
+void BSPTraceBatch::run(const collbspdata_t *colldata, int headnode) {
+  PStatTimer timer(batch_collector);
+
+  nassertv(colldata != nullptr);
+
+  // Pad the inputs out to whole packets so every load below is in bounds.
+  size_t padded = (_num_traces + 3) & ~3;
+  for (int i = 0; i < 3; i++) {
+    _start[i].resize(padded, 0.0f);
+    _end[i].resize(padded, 0.0f);
+  }
+
+  _fractions = PTA_float::empty_array(_num_traces);
+  _end_pos = PTA_LVecBase3f::empty_array(_num_traces);
+  _hit_normals.resize(_num_traces);
+  _hit_contents.resize(_num_traces);
+  _start_solid.resize(_num_traces);
+  _num_hits = 0;
+
+  LVector3 mins = _mins * 16;
+  LVector3 maxs = _maxs * 16;
+
+  for (int first = 0; first < _num_traces; first += 4) {
+    int num_lanes = std::min(4, _num_traces - first);
+
+    FourVectors start, end;
+    for (int i = 0; i < 3; i++) {
+      start[i] = LoadUnalignedSIMD(&_start[i][first]);
+      end[i] = LoadUnalignedSIMD(&_end[i][first]);
+    }
+
+    Trace traces[4];
+    CM_BoxTrace4(start, end, num_lanes, mins, maxs, headnode, _contents,
+                 _any_hit, true, colldata, traces);
+
+    for (int i = 0; i < num_lanes; i++) {
+      const Trace &trace = traces[i];
+      int n = first + i;
+
+      _fractions[n] = trace.fraction;
+      _end_pos[n] = trace.end_pos / 16;
+      _start_solid[n] = trace.start_solid;
+      if (trace.has_hit()) {
+        _hit_normals[n] = LVector3(trace.plane.normal[0], trace.plane.normal[1], trace.plane.normal[2]);
+        _hit_contents[n] = trace.hit_contents;
+        _num_hits++;
+      } else {
+        _hit_normals[n] = LVector3::zero();
+        _hit_contents[n] = CONTENTS_EMPTY;
+      }
+    }
+  }
+
+  // Drop the padding again, so traces added after this go in the right slot.
+  for (int i = 0; i < 3; i++) {
+    _start[i].resize(_num_traces);
+    _end[i].resize(_num_traces);
+  }
+}
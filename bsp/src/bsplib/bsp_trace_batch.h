@@ -0,0 +1,136 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file bsp_trace_batch.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#ifndef BSP_TRACE_BATCH_H
+#define BSP_TRACE_BATCH_H
+
+#include "config_bsplib.h"
+#include "referenceCount.h"
+#include "luse.h"
+#include "pta_float.h"
+#include "pta_LVecBase3.h"
+
+struct collbspdata_t;
+
+/**
+ * A batch of line or box traces against the collision BSP tree of a level.
+ *
+ * The traces are stored structure-of-arrays and run four at a time: the
+ * packets walk the node tree together with the plane tests done for all four
+ * lanes at once (see CM_BoxTrace4).  All traces in a batch share the same
+ * hull and contents mask, so a batch of line of sight checks for a group of
+ * NPCs or a batch of hull sweeps for a group of movers is one call, from C++
+ * or from Python.
+ *
+ * Positions are in Panda units, as with BSPLevel::trace_line().
+ */
+class EXPCL_PANDABSP BSPTraceBatch : public ReferenceCount {
+PUBLISHED:
+  BSPTraceBatch();
+
+  void clear();
+  void reserve(int num_traces);
+
+  void add_trace(const LPoint3 &start, const LPoint3 &end);
+  void set_traces(const PTA_LVecBase3f &starts, const PTA_LVecBase3f &ends);
+  INLINE int get_num_traces() const {
+    return _num_traces;
+  }
+
+  INLINE void set_hull(const LPoint3 &mins, const LPoint3 &maxs) {
+    _mins = mins;
+    _maxs = maxs;
+  }
+  INLINE void clear_hull() {
+    _mins = _maxs = LPoint3::zero();
+  }
+  INLINE const LPoint3 &get_hull_mins() const {
+    return _mins;
+  }
+  INLINE const LPoint3 &get_hull_maxs() const {
+    return _maxs;
+  }
+
+  INLINE void set_contents(int mask) {
+    _contents = mask;
+  }
+  INLINE int get_contents() const {
+    return _contents;
+  }
+
+  // With any_hit on, a trace stops at the first thing it hits instead of
+  // looking for the nearest hit, which is all a line of sight check needs.
+  INLINE void set_any_hit(bool flag) {
+    _any_hit = flag;
+  }
+  INLINE bool get_any_hit() const {
+    return _any_hit;
+  }
+
+  INLINE bool has_hit(int n) const {
+    nassertr(n >= 0 && n < (int)_fractions.size(), false);
+    return _fractions[n] != 1.0f;
+  }
+  INLINE float get_fraction(int n) const {
+    nassertr(n >= 0 && n < (int)_fractions.size(), 1.0f);
+    return _fractions[n];
+  }
+  INLINE LPoint3 get_end_pos(int n) const {
+    nassertr(n >= 0 && n < (int)_fractions.size(), LPoint3::zero());
+    return _end_pos[n];
+  }
+  INLINE LVector3 get_hit_normal(int n) const {
+    nassertr(n >= 0 && n < (int)_fractions.size(), LVector3::zero());
+    return _hit_normals[n];
+  }
+  INLINE int get_hit_contents(int n) const {
+    nassertr(n >= 0 && n < (int)_fractions.size(), 0);
+    return _hit_contents[n];
+  }
+  INLINE bool get_start_solid(int n) const {
+    nassertr(n >= 0 && n < (int)_fractions.size(), false);
+    return _start_solid[n] != 0;
+  }
+  INLINE int get_num_hits() const {
+    return _num_hits;
+  }
+
+  INLINE CPTA_float get_fractions() const {
+    return _fractions;
+  }
+  INLINE CPTA_LVecBase3f get_end_positions() const {
+    return _end_pos;
+  }
+
+public:
+  void run(const collbspdata_t *colldata, int headnode);
+
+private:
+  int _num_traces;
+
+  // Structure-of-arrays inputs in hammer units, padded to a multiple of 4.
+  pvector<float> _start[3];
+  pvector<float> _end[3];
+
+  LPoint3 _mins;
+  LPoint3 _maxs;
+  int _contents;
+  bool _any_hit;
+
+  PTA_float _fractions;
+  PTA_LVecBase3f _end_pos;
+  pvector<LVector3> _hit_normals;
+  pvector<int> _hit_contents;
+  pvector<unsigned char> _start_solid;
+  int _num_hits;
+};
+
+#endif // BSP_TRACE_BATCH_H
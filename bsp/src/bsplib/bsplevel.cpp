@@ -2,11 +2,6 @@
 #include "sceneGraphReducer.h"
 #include "bspfile.h"
 #include "lineSegs.h"
-#include "eggVertex.h"
-#include "eggVertexPool.h"
-#include "eggPolygon.h"
-#include "eggData.h"
-#include "load_egg_file.h"
 #include "bspMaterialAttrib.h"
 #include "bsp_render.h"
 #include "shader_generator.h"
@@ -15,16 +10,27 @@
 #include "static_props.h"
 #include "geomVertexWriter.h"
 #include "geomVertexData.h"
+#include "geomVertexFormat.h"
+#include "geomTriangles.h"
+#include "geomNode.h"
 #include "graphicsOutput.h"
 #include "graphicsEngine.h"
 #include "camera.h"
 #include "directionalLight.h"
 #include "bsploader.h"
+#include "bsp_load_request.h"
 #include "bulletTriangleMesh.h"
 #include "bulletTriangleMeshShape.h"
 #include "bulletWorld.h"
 #include "hdr.h"
 #include "rayTraceHitResult.h"
+#include "virtualFileSystem.h"
+#include "config_putil.h"
+#include "lightMutexHolder.h"
+#include "configVariableInt.h"
+#include "graphicsPipeSelection.h"
+#include "cubemap_prefilter.h"
+#include "bsp_cubemap_cache.h"
 
 NotifyCategoryDeclNoExport(bsplevel);
 NotifyCategoryDef(bsplevel, "");
@@ -36,6 +42,10 @@ static ConfigVariableBool bsp_lightmaps("bsp_lightmaps", true);
 static ConfigVariableBool bsp_cull("bsp_cull", true);
 static ConfigVariableBool bsp_leafvis("bsp_leafvis", false);
 static ConfigVariableBool bsp_csm("bsp_csm", true);
+static ConfigVariableBool bsp_prop_instancing("bsp_prop_instancing", true);
+static ConfigVariableInt bsp_prop_instancing_min("bsp_prop_instancing_min", 4);
+static ConfigVariableBool bsp_cubemap_prefilter("bsp_cubemap_prefilter", true);
+static ConfigVariableBool bsp_precache_shaders("bsp_precache_shaders", true);
 
 static const pvector<std::string> world_entities =
 {
@@ -108,6 +118,61 @@ size_t BSPFaceAttrib::get_hash_impl() const {
   return hash;
 }
 
+WorldCluster::
+WorldCluster(const GeomNode *node) :
+  _node(node),
+  _next_composed(0) {
+
+  GeomNode::Geoms geoms = node->get_geoms();
+  _batches.reserve(geoms.get_num_geoms());
+  for (int i = 0; i < geoms.get_num_geoms(); i++) {
+    Batch batch;
+    batch.geom = geoms.get_geom(i);
+    batch.state = geoms.get_geom_state(i);
+
+    // Skybox faces are never rendered into the shadow maps.
+    const BSPMaterialAttrib *bma;
+    const BSPMaterial *mat = nullptr;
+    if (batch.state->get_attrib(bma)) {
+      mat = bma->get_material();
+    }
+    batch.skybox = (mat != nullptr && mat->is_skybox());
+
+    _batches.push_back(batch);
+  }
+
+  // Record the batches in the order the state-sorted bins will draw them in.
+  std::stable_sort(_batches.begin(), _batches.end(),
+                   [](const Batch &a, const Batch &b) {
+                     return a.state->compare_sort(*b.state) < 0;
+                   });
+}
+
+/**
+ * Returns the states of the batches composed onto the indicated state.
+ */
+CPT(WorldCluster::ComposedStates) WorldCluster::
+get_composed_states(const RenderState *parent) {
+  LightMutexHolder holder(_lock);
+
+  for (int i = 0; i < num_composed_states; i++) {
+    if (_composed[i] != nullptr && _composed[i]->parent == parent) {
+      return _composed[i];
+    }
+  }
+
+  PT(ComposedStates) composed = new ComposedStates;
+  composed->parent = parent;
+  composed->states.reserve(_batches.size());
+  for (size_t i = 0; i < _batches.size(); i++) {
+    composed->states.push_back(parent->compose(_batches[i].state));
+  }
+
+  _composed[_next_composed] = composed;
+  _next_composed = (_next_composed + 1) % num_composed_states;
+  return composed;
+}
+
 BSPLevel::
 BSPLevel(BSPLoader *loader) :
   _loader(loader),
@@ -117,12 +182,32 @@ BSPLevel(BSPLoader *loader) :
   _amb_probe_mgr(this),
   _decal_mgr(this),
   _shadow_dir(LVector3(0, 1, 0)),
+  _has_planar_reflection(false),
+  _planar_reflection_height(0.0f),
+  _activated(false),
   _light_environment(nullptr),
   _bspdata(nullptr),
   _colldata(nullptr),
+  _file_hash(0),
   _trace(new BSPTrace(this)) {
 }
 
+/**
+ * A level that was loaded but never activated, such as one that was loaded
+ * with activate=false and then dropped, is never cleaned up, so free what
+ * load() allocated here.
+ */
+BSPLevel::
+~BSPLevel() {
+  if (_colldata)
+    delete _colldata;
+  _colldata = nullptr;
+
+  if (_bspdata)
+    delete _bspdata;
+  _bspdata = nullptr;
+}
+
 // Due to some imprecision, we will expand the leaf AABBs just a tiny bit
 // as a compensation. 1.0 seems like a lot, but it is defined in Hammer space
 // where 1 Hammer unit is 0.0625 Panda units.
@@ -267,41 +352,91 @@ LTexCoord BSPLevel::get_lightcoords(int facenum, const LVector3 &point) {
   return lightcoord;
 }
 
-PT(EggVertex) BSPLevel::make_vertex_ai(EggVertexPool *vpool, EggPolygon *poly, dedge_t *edge, int k) {
-  dvertex_t *vert = &_bspdata->dvertexes[edge->v[k]];
-  float *vpos = vert->point;
-  PT(EggVertex) v = new EggVertex;
-  v->set_pos(LPoint3d(vpos[0], vpos[1], vpos[2]));
-  return v;
+/**
+ * Fills in the vertices of the face in counter-clockwise order, which is the
+ * order Panda wants for front faces.
+ */
+void BSPLevel::get_face_vertices(const dface_t *face, pvector<dvertex_t *> &verts) const {
+  verts.clear();
+  for (int j = face->numedges - 1; j >= 0; j--) {
+    int surf_edge = _bspdata->dsurfedges[face->firstedge + j];
+    dedge_t *edge;
+    int index;
+    if (surf_edge >= 0) {
+      edge = &_bspdata->dedges[surf_edge];
+      index = 0;
+    } else {
+      edge = &_bspdata->dedges[-surf_edge];
+      index = 1;
+    }
+    verts.push_back(&_bspdata->dvertexes[edge->v[index]]);
+  }
 }
 
-PT(EggVertex) BSPLevel::make_vertex(EggVertexPool *vpool, EggPolygon *poly,
-                                     dedge_t *edge, texinfo_t *texinfo,
-                                     dface_t *face, int k, Texture *tex) {
-  int facenum = face - _bspdata->dfaces;
-  dvertex_t *vert = &_bspdata->dvertexes[edge->v[k]];
-  float *vpos = vert->point;
-  PT(EggVertex) v = new EggVertex;
-  v->set_pos(LPoint3d(vpos[0], vpos[1], vpos[2]));
+/**
+ * Returns the vertex format of the brush faces: position, normal, texture and
+ * lightmap coordinates, and the tangent space of the texture coordinates.
+ */
+static const GeomVertexFormat *get_face_format() {
+  static CPT(GeomVertexFormat) format = nullptr;
+  if (format == nullptr) {
+    PT(GeomVertexArrayFormat) array = new GeomVertexArrayFormat;
+    array->add_column(InternalName::get_vertex(), 3, GeomEnums::NT_stdfloat, GeomEnums::C_point);
+    array->add_column(InternalName::get_normal(), 3, GeomEnums::NT_stdfloat, GeomEnums::C_normal);
+    array->add_column(InternalName::get_texcoord(), 2, GeomEnums::NT_stdfloat, GeomEnums::C_texcoord);
+    array->add_column(InternalName::get_texcoord_name("lightmap"), 2, GeomEnums::NT_stdfloat, GeomEnums::C_texcoord);
+    array->add_column(InternalName::get_tangent(), 3, GeomEnums::NT_stdfloat, GeomEnums::C_vector);
+    array->add_column(InternalName::get_binormal(), 3, GeomEnums::NT_stdfloat, GeomEnums::C_vector);
+    PT(GeomVertexFormat) new_format = new GeomVertexFormat;
+    new_format->add_array(array);
+    format = GeomVertexFormat::register_format(new_format);
+  }
+  return format;
+}
 
-  // The widths and heights are retrieved from the actual loaded textures that were referenced.
-  double df_width = 1.0;
-  double df_height = 1.0;
-  if (tex != nullptr) {
-    df_width = tex->get_orig_file_x_size();
-    df_height = tex->get_orig_file_y_size();
+/**
+ * Computes the tangent and binormal at vertex i of a face from the triangle it
+ * forms with its neighbors.  This is the same math as
+ * EggGroupNode::recompute_tangent_binormal(), which the faces used to go
+ * through.
+ */
+static void calc_tangent_binormal(const pvector<LPoint3> &points, const pvector<LTexCoord> &uvs,
+                                  size_t i, const LNormal &normal,
+                                  LVector3 &tangent, LVector3 &binormal) {
+  size_t count = points.size();
+  size_t i2 = (i + 1) % count;
+  size_t i3 = (i + count - 1) % count;
+
+  LVector3 e1 = points[i2] - points[i];
+  LVector3 e2 = points[i3] - points[i];
+  PN_stdfloat s1 = uvs[i2][0] - uvs[i][0];
+  PN_stdfloat s2 = uvs[i3][0] - uvs[i][0];
+  PN_stdfloat t1 = uvs[i2][1] - uvs[i][1];
+  PN_stdfloat t2 = uvs[i3][1] - uvs[i][1];
+
+  LVector3 sdir(0), tdir(0);
+  PN_stdfloat denom = s1 * t2 - s2 * t1;
+  if (denom != 0.0f) {
+    PN_stdfloat r = 1.0f / denom;
+    sdir = (e1 * t2 - e2 * t1) * r;
+    tdir = (e2 * s1 - e1 * s2) * r;
   }
 
-  // Texture and lightmap coordinates
-  LTexCoord uv = get_vertex_uv(texinfo, vert);
-  LTexCoord luv = get_lightcoords(facenum, LVector3(vpos[0], vpos[1], vpos[2]));
-  LTexCoordd df_uv(uv.get_x() / df_width, -uv.get_y() / df_height);
-  LTexCoordd lm_uv(luv[0], luv[1]);
+  if (!sdir.normalize()) {
+    sdir.set(1, 0, 0);
+  }
+  if (!tdir.normalize()) {
+    tdir = sdir.cross(LVector3(0, 0, -1));
+  }
 
-  v->set_uv(df_uv);
-  v->set_uv("lightmap", lm_uv);
+  tangent = sdir - normal * normal.dot(sdir);
+  tangent.normalize();
 
-  return v;
+  binormal = normal.cross(tangent);
+  if (binormal.dot(tdir) < 0.0f) {
+    binormal = -binormal;
+  }
+  binormal.normalize();
 }
 
 void BSPLevel::make_brush_model_collisions(int explicit_modelnum) {
@@ -437,13 +572,13 @@ NodePath BSPLevel::make_model_faces(int modelnum) {
   ss << "model-faces-" << modelnum;
   NodePath ret(ss.str());
 
-  for (int facenum = mdl->firstface; facenum < mdl->firstface + mdl->numfaces; facenum++) {
-    PT(EggData) data = new EggData;
-    PT(EggVertexPool) vpool = new EggVertexPool("facevpool");
-    data->add_child(vpool);
+  // All of the faces of the model share one vertex table.
+  PT(GeomVertexData) vdata = new GeomVertexData(ss.str(), GeomVertexFormat::get_v3(),
+                                                GeomEnums::UH_static);
+  GeomVertexWriter vwriter(vdata, InternalName::get_vertex());
+  pvector<dvertex_t *> verts;
 
-    PT(EggPolygon) poly = new EggPolygon;
-    data->add_child(poly);
+  for (int facenum = mdl->firstface; facenum < mdl->firstface + mdl->numfaces; facenum++) {
     dface_t *face = _bspdata->dfaces + facenum;
     texinfo_t *texinfo = &_bspdata->texinfo[face->texinfo];
     texref_t *texref = &_bspdata->dtexrefs[texinfo->texref];
@@ -455,40 +590,42 @@ NodePath BSPLevel::make_model_faces(int modelnum) {
       continue;
     }
 
-    for (int j = face->numedges - 1; j >= 0; j--) {
-      int surf_edge = _bspdata->dsurfedges[face->firstedge + j];
-
-      dedge_t *edge;
-      int index;
-      if (surf_edge >= 0) {
-        edge = &_bspdata->dedges[surf_edge];
-        index = 0;
-      }
-
-      else {
-        edge = &_bspdata->dedges[-surf_edge];
-        index = 1;
-      }
+    get_face_vertices(face, verts);
+    if (verts.size() < 3) {
+      continue;
+    }
 
-      PT(EggVertex) v = make_vertex_ai(vpool, poly, edge, index);
-      vpool->add_vertex(v);
-      poly->add_vertex(v);
+    int first_row = vdata->get_num_rows();
+    LNormal norm(0);
+    for (size_t j = 0; j < verts.size(); j++) {
+      const float *p0 = verts[j]->point;
+      const float *p1 = verts[(j + 1) % verts.size()]->point;
+      vwriter.add_data3f(p0[0], p0[1], p0[2]);
+
+      // Newell's method, like EggPolygon::calculate_normal().
+      norm[0] += (p0[1] - p1[1]) * (p0[2] + p1[2]);
+      norm[1] += (p0[2] - p1[2]) * (p0[0] + p1[0]);
+      norm[2] += (p0[0] - p1[0]) * (p0[1] + p1[1]);
     }
+    norm.normalize();
 
-    data->remove_unused_vertices(true);
-    data->remove_invalid_primitives(true);
+    PT(GeomTriangles) tris = new GeomTriangles(GeomEnums::UH_static);
+    for (size_t j = 1; j + 1 < verts.size(); j++) {
+      tris->add_vertices(first_row, first_row + (int)j, first_row + (int)j + 1);
+    }
+    PT(Geom) geom = new Geom(vdata);
+    geom->add_primitive(tris);
 
-    LNormald norm;
-    poly->calculate_normal(norm);
     int face_type = BSPFaceAttrib::FACETYPE_WALL;
-    if (norm.almost_equal(LNormald::up(), 0.5))
+    if (norm.almost_equal(LNormal::up(), 0.5))
       face_type = BSPFaceAttrib::FACETYPE_FLOOR;
 
-    NodePath geom = ret.attach_new_node(load_egg_data(data));
-    geom.set_attrib(BSPFaceAttrib::make(bspmat->get_surface_prop(), face_type));
-    geom.set_attrib(BSPMaterialAttrib::make(bspmat));
-    geom.clear_model_nodes();
-    geom.flatten_strong();
+    PT(GeomNode) gn = new GeomNode("face");
+    gn->add_geom(geom);
+    NodePath geomnp = ret.attach_new_node(gn);
+    geomnp.set_attrib(BSPFaceAttrib::make(bspmat->get_surface_prop(), face_type));
+    geomnp.set_attrib(BSPMaterialAttrib::make(bspmat));
+    geomnp.flatten_strong();
   }
 
   return ret;
@@ -625,6 +762,15 @@ void BSPLevel::make_faces() {
 
   _model_data.resize(_bspdata->nummodels);
 
+  // Many faces share a material, only look each one up once.
+  pvector<CPT(BSPMaterial)> texref_materials(_bspdata->numtexrefs);
+  pvector<PT(Texture)> texref_textures(_bspdata->numtexrefs);
+
+  pvector<dvertex_t *> verts;
+  pvector<LPoint3> points;
+  pvector<LNormal> normals;
+  pvector<LTexCoord> uvs;
+
   // In BSP files, models are brushes that have been grouped together to be used as an entity.
   // We can group all of the face GeomNodes of the model to a root node.
   for (int modelnum = 0; modelnum < _bspdata->nummodels; modelnum++) {
@@ -642,43 +788,63 @@ void BSPLevel::make_faces() {
     mdata.model_root = modelroot;
     mdata.origin = center;
     mdata.origin_matrix = LMatrix4f::translate_mat(center);
-    NodePath rbcnp = NodePath(mdata.decal_rbc);
+    NodePath decalnp = NodePath(mdata.decal_pool->get_node());
     if (modelnum != 0) {
-      rbcnp.reparent_to(mdata.model_root);
+      decalnp.reparent_to(mdata.model_root);
     } else {
-      rbcnp.reparent_to(_result);
+      decalnp.reparent_to(_result);
     }
     // Decals should not cast shadows
-    rbcnp.hide(CAMERA_SHADOW);
-    rbcnp.clear_transform();
+    decalnp.hide(CAMERA_SHADOW);
+    decalnp.clear_transform();
 
     _model_data[modelnum] = mdata;
 
+    // The vertices of all the faces in the model go straight into one shared
+    // vertex table.  Each face still gets its own Geom indexing into it, as the
+    // world faces are culled and batched per leaf later on.
+    PT(GeomVertexData) vdata = new GeomVertexData(modelroot.get_name(), get_face_format(),
+                                                  GeomEnums::UH_static);
+    int numverts = 0;
     for (int facenum = firstface; facenum < firstface + numfaces; facenum++) {
-      PT(EggData) data = new EggData;
-      PT(EggVertexPool) vpool = new EggVertexPool("facevpool");
-      data->add_child(vpool);
+      numverts += _bspdata->dfaces[facenum].numedges;
+    }
+    if (_geom_cache == nullptr) {
+      vdata->reserve_num_rows(numverts);
+    }
+
+    GeomVertexWriter vwriter(vdata, InternalName::get_vertex());
+    GeomVertexWriter nwriter(vdata, InternalName::get_normal());
+    GeomVertexWriter twriter(vdata, InternalName::get_texcoord());
+    GeomVertexWriter lwriter(vdata, InternalName::get_texcoord_name("lightmap"));
+    GeomVertexWriter tanwriter(vdata, InternalName::get_tangent());
+    GeomVertexWriter binwriter(vdata, InternalName::get_binormal());
 
+    for (int facenum = firstface; facenum < firstface + numfaces; facenum++) {
       dface_t *face = &_bspdata->dfaces[facenum];
       _dface_dmodels[face] = model;
 
-      PT(EggPolygon) poly = new EggPolygon;
-      data->add_child(poly);
-
       texinfo_t *texinfo = &_bspdata->texinfo[face->texinfo];
 
       texref_t *texref = &_bspdata->dtexrefs[texinfo->texref];
 
-      CPT(BSPMaterial) bspmat = BSPMaterial::get_from_file(std::string(texref->name));
+      CPT(BSPMaterial) &bspmat = texref_materials[texinfo->texref];
+      bool first_use = (bspmat == nullptr);
+      if (first_use) {
+        bspmat = BSPMaterial::get_from_file(std::string(texref->name));
+      }
       if (bspmat->is_lightmapped() &&
           bspmat->has_keyvalue("$planarreflection") &&
           bspmat->get_keyvalue_int("$planarreflection") != 0 &&
           !bspmat->has_keyvalue("$envmap")) {
-        dplane_t *plane = _bspdata->dplanes + face->planenum;
-        LVector3 planevec = LVector3(plane->normal[0],
-                                     plane->normal[1],
-                                     plane->normal[2]);
-        BSPShaderGenerator::ptr()->get_planar_reflections()->setup(planevec, plane->dist / 16.0);
+        if (!_has_planar_reflection) {
+          dplane_t *plane = _bspdata->dplanes + face->planenum;
+          _planar_reflection_normal = LVector3(plane->normal[0],
+                                               plane->normal[1],
+                                               plane->normal[2]);
+          _planar_reflection_height = plane->dist / 16.0;
+          _has_planar_reflection = true;
+        }
       }
       contents_t contents = ContentsFromName(bspmat->get_contents().c_str());
       if ((contents & (CONTENTS_SOLID | CONTENTS_WATER | CONTENTS_SKY | CONTENTS_TRANSLUCENT)) == 0) {
@@ -687,8 +853,6 @@ void BSPLevel::make_faces() {
 
       bool skip = false;
 
-      bool mat_normalmap = bspmat->has_keyvalue("$bumpmap");
-
       bool has_lighting = (face->lightofs != -1 && bsp_lightmaps) && !skip && bspmat->get_shader() == "LightmappedGeneric";
       if (has_lighting &&
           bspmat->has_keyvalue("$lightmapped") &&
@@ -696,61 +860,86 @@ void BSPLevel::make_faces() {
         has_lighting = false;
       }
 
-      bool has_texture = !skip;
+      dface_lightmap_info_t lminfo;
+      init_dface_lightmap_info(&lminfo, facenum);
+      _face_lightmap_info[facenum] = lminfo;
+
+      if (_geom_cache != nullptr) {
+        // The geometry comes from the cache.
+        continue;
+      }
 
       // HACKHACK:
       // Read the material's $basetexture and alpha to determine
       // if a TransparencyAttrib is needed, and to get the size of the
       // texture for brush face texcoords
-      PT(Texture) tex = nullptr;
-      if (bspmat->has_keyvalue("$basetexture")) {
+      Texture *tex = texref_textures[texinfo->texref];
+      if (first_use && bspmat->has_keyvalue("$basetexture")) {
         tex = TexturePool::load_texture(bspmat->get_keyvalue("$basetexture"));
+        texref_textures[texinfo->texref] = tex;
       }
       bool has_transparency = bspmat->has_transparency();
 
-      dface_lightmap_info_t lminfo;
-      init_dface_lightmap_info(&lminfo, facenum);
-      _face_lightmap_info[facenum] = lminfo;
-      LVertexd centroid(0);
-      int verts = 0;
+      get_face_vertices(face, verts);
+      if (verts.size() < 3) {
+        continue;
+      }
 
-      for (int j = face->numedges - 1; j >= 0; j--) {
-        LNormald normal(0);
-        if (face_vertnormalindices[facenum] != -1) {
-          int vert_normal_idx = face_vertnormalindices[facenum] + j;
-          vec3_t normalf_v;
-          VectorCopy(_bspdata->vertnormals[_bspdata->vertnormalindices[vert_normal_idx]].point, normalf_v);
-          normal = LNormald(normalf_v[0], normalf_v[1], normalf_v[2]);
-        }
+      // The widths and heights are retrieved from the actual loaded textures that were referenced.
+      PN_stdfloat df_width = 1.0f;
+      PN_stdfloat df_height = 1.0f;
+      if (tex != nullptr) {
+        df_width = tex->get_orig_file_x_size();
+        df_height = tex->get_orig_file_y_size();
+      }
 
-        int surf_edge = _bspdata->dsurfedges[face->firstedge + j];
-        dedge_t *edge;
-        int index;
-        if (surf_edge >= 0) {
-          edge = &_bspdata->dedges[surf_edge];
-          index = 0;
-        } else {
-          edge = &_bspdata->dedges[-surf_edge];
-          index = 1;
+      points.clear();
+      normals.clear();
+      uvs.clear();
+      LPoint3 centroid(0);
+      for (size_t i = 0; i < verts.size(); i++) {
+        const float *vpos = verts[i]->point;
+        points.push_back(LPoint3(vpos[0], vpos[1], vpos[2]));
+        centroid += points.back();
+
+        // The vertices are in reverse edge order.
+        LNormal normal(0);
+        if (face_vertnormalindices[facenum] != -1) {
+          int vert_normal_idx = face_vertnormalindices[facenum] + face->numedges - 1 - (int)i;
+          const float *vnormal = _bspdata->vertnormals[_bspdata->vertnormalindices[vert_normal_idx]].point;
+          normal.set(vnormal[0], vnormal[1], vnormal[2]);
         }
+        normals.push_back(normal);
 
-        PT(EggVertex) v = make_vertex(vpool, poly, edge, texinfo,
-                                      face, index, tex);
-        v->set_normal(normal);
-        vpool->add_vertex(v);
-        poly->add_vertex(v);
-        centroid += v->get_pos3();
-        verts++;
+        LTexCoord uv = get_vertex_uv(texinfo, verts[i]);
+        uvs.push_back(LTexCoord(uv[0] / df_width, -uv[1] / df_height));
+      }
+      centroid /= (PN_stdfloat)verts.size();
+
+      int first_row = vdata->get_num_rows();
+      for (size_t i = 0; i < verts.size(); i++) {
+        LVector3 tangent, binormal;
+        calc_tangent_binormal(points, uvs, i, normals[i], tangent, binormal);
+
+        vwriter.add_data3(points[i]);
+        nwriter.add_data3(normals[i]);
+        twriter.add_data2(uvs[i]);
+        lwriter.add_data2(get_lightcoords(facenum, points[i]));
+        tanwriter.add_data3(tangent);
+        binwriter.add_data3(binormal);
       }
 
-      data->remove_unused_vertices(true);
-      data->remove_invalid_primitives(true);
-
-      centroid /= verts;
-
-      data->recompute_tangent_binormal(GlobPattern("*"));
+      PT(GeomTriangles) tris = new GeomTriangles(GeomEnums::UH_static);
+      for (size_t i = 1; i + 1 < verts.size(); i++) {
+        tris->add_vertices(first_row, first_row + (int)i, first_row + (int)i + 1);
+      }
+      PT(Geom) geom = new Geom(vdata);
+      geom->add_primitive(tris);
+      geom->set_bounds_type(BoundingVolume::BT_box);
 
-      NodePath faceroot = _result.attach_new_node(load_egg_data(data));
+      PT(GeomNode) gn = new GeomNode("face");
+      gn->add_geom(geom);
+      NodePath faceroot = _result.attach_new_node(gn);
 
       if (has_transparency) {
         faceroot.set_transparency(TransparencyAttrib::M_dual, 1);
@@ -781,8 +970,7 @@ void BSPLevel::make_faces() {
           // material wants us to use a cubemap_tex embedded in the level.
           // find the closest one to the center of the face.
           centroid /= 16.0; // move from hammer space into panda space
-          cubemap_t *cm = find_closest_cubemap(
-            LPoint3(centroid[0], centroid[1], centroid[2]));
+          cubemap_t *cm = find_closest_cubemap(centroid);
           if (cm) {
             faceroot.set_texture(TextureStages::get_cubemap(),
                                  cm->cubemap_tex);
@@ -792,27 +980,146 @@ void BSPLevel::make_faces() {
 
       faceroot.set_attrib(BSPMaterialAttrib::make(bspmat));
 
-      NodePathCollection gn_npc = faceroot.find_all_matches("**/+GeomNode");
-      for (int i = 0; i < gn_npc.get_num_paths(); i++) {
-        NodePath gnnp = gn_npc.get_path(i);
-        PT(GeomNode) gn = DCAST(GeomNode, gnnp.node());
-        for (int j = 0; j < gn->get_num_geoms(); j++) {
-          PT(Geom) geom = gn->modify_geom(j);
-          geom->set_bounds_type(BoundingVolume::BT_box);
-          gn->set_geom(j, geom);
-        }
-      }
-
       if (skip) {
         faceroot.hide();
       }
     }
+
+    if (_geom_cache != nullptr) {
+      NodePath(_geom_cache->get_model(modelnum)).get_children().reparent_to(modelroot);
+    }
   }
 
   //bsplevel_cat.info()
   //  << "Finished making faces.\n";
 }
 
+/**
+ * Returns the hash the geometry cache records of this level are keyed on.
+ * Besides the BSP file itself, the geometry depends on whether lightmaps are
+ * enabled and on whether static props are instanced, since instanced props
+ * are left out of the cache.
+ */
+uint64_t BSPLevel::get_geom_cache_hash() const {
+  return _file_hash ^ (bsp_lightmaps ? 0 : 0x9e3779b97f4a7c15ull) ^
+    (use_prop_instancing() ? 0xc2b2ae3d27d4eb4full : 0);
+}
+
+/**
+ * Fills in the files besides the BSP file that the cached geometry was built
+ * from: the materials and base textures of the faces, and the static prop
+ * models.
+ */
+void BSPLevel::get_geom_cache_dependents(vector_string &files) const {
+  VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
+  const DSearchPath &search_path = get_model_path();
+
+  for (int i = 0; i < _bspdata->numtexrefs; i++) {
+    Filename matfile = Filename(std::string(_bspdata->dtexrefs[i].name));
+    const BSPMaterial *bspmat = BSPMaterial::get_from_file(matfile);
+    if (vfs->resolve_filename(matfile, search_path)) {
+      files.push_back(matfile.get_fullpath());
+    }
+    if (bspmat->has_keyvalue("$basetexture")) {
+      Filename texfile = Filename(bspmat->get_keyvalue("$basetexture"));
+      if (vfs->resolve_filename(texfile, search_path)) {
+        files.push_back(texfile.get_fullpath());
+      }
+    }
+  }
+
+  for (size_t i = 0; i < _bspdata->dstaticprops.size(); i++) {
+    Filename propfile = Filename(_bspdata->dstaticprops[i].name);
+    if (vfs->resolve_filename(propfile, search_path)) {
+      files.push_back(propfile.get_fullpath());
+    }
+  }
+}
+
+/**
+ * Looks for the geometry of an earlier load of this level in the model cache.
+ * If it is there, sets up the lightmap palettes from it and keeps it around
+ * for make_faces() and load() to use instead of building the faces and props,
+ * and returns true.
+ */
+bool BSPLevel::read_geom_cache() {
+  _geom_cache = BSPGeomCache::read(_map_file, "bspgeom", get_geom_cache_hash());
+  if (_geom_cache == nullptr) {
+    return false;
+  }
+
+  const pvector<PT(cubemap_t)> &cubemaps = _amb_probe_mgr.get_cubemaps();
+
+  bool valid = (_geom_cache->get_num_models() == _bspdata->nummodels &&
+                _geom_cache->get_props() != nullptr);
+  for (int i = 0; valid && i < _geom_cache->get_num_models(); i++) {
+    valid = _geom_cache->restore_cubemaps(NodePath(_geom_cache->get_model(i)), cubemaps);
+  }
+  if (valid) {
+    valid = _geom_cache->restore_cubemaps(NodePath(_geom_cache->get_props()), cubemaps);
+  }
+
+  PT(LightmapPaletteDirectory) dir;
+  if (valid) {
+    dir = _geom_cache->make_lightmap_dir();
+    valid = ((int)dir->face_palette_entries.size() == _bspdata->numfaces);
+  }
+
+  if (!valid) {
+    bsplevel_cat.warning()
+      << "Cached geometry of " << _map_file << " doesn't match the level, rebuilding\n";
+    _geom_cache = nullptr;
+    return false;
+  }
+
+  _lightmap_dir = dir;
+  return true;
+}
+
+/**
+ * Stores the lightmap palettes, faces and static props that were just built
+ * in the model cache, for the next time this level is loaded.
+ */
+void BSPLevel::write_geom_cache() {
+  if (!BSPGeomCache::is_enabled() || _lightmap_dir == nullptr) {
+    return;
+  }
+
+  const pvector<PT(cubemap_t)> &cubemaps = _amb_probe_mgr.get_cubemaps();
+
+  PT(BSPGeomCache) cache = new BSPGeomCache(get_geom_cache_hash());
+  cache->set_lightmaps(_lightmap_dir);
+  cache->set_cubemaps(cubemaps);
+
+  for (int modelnum = 0; modelnum < _bspdata->nummodels; modelnum++) {
+    const brush_model_data_t &mdata = _model_data[modelnum];
+    NodePath model("model-" + std::to_string(modelnum));
+
+    NodePathCollection children = mdata.model_root.get_children();
+    for (int i = 0; i < children.get_num_paths(); i++) {
+      if (children[i].node() == mdata.decal_pool->get_node()) {
+        continue;
+      }
+      children[i].copy_to(model);
+    }
+
+    cache->hide_cubemaps(model, cubemaps);
+    cache->add_model(model.node());
+  }
+
+  NodePath props("props");
+  NodePathCollection npc = _result.find_all_matches("+BSPProp");
+  for (int i = 0; i < npc.get_num_paths(); i++) {
+    npc[i].copy_to(props);
+  }
+  cache->hide_cubemaps(props, cubemaps);
+  cache->set_props(props.node());
+
+  vector_string files;
+  get_geom_cache_dependents(files);
+  cache->write(_map_file, "bspgeom", files);
+}
+
 LColor color_from_rgb_scalar(vec_t *color) {
   double scalar = color[3];
   return LColor(color[0] * scalar / 255.0,
@@ -916,10 +1223,361 @@ void BSPLevel::clear_model_nodes_below(const NodePath &top) {
   }
 }
 
-void BSPLevel::load_static_props() {
+#ifdef CIO
+/**
+ * Returns true if the indicated state is textured with one of the fake drop
+ * shadows that come with the props.
+ */
+static bool is_drop_shadow_state(const RenderState *state) {
+  const TextureAttrib *tattr;
+  if (!state->get_attrib(tattr) || tattr->get_num_on_stages() == 0) {
+    return false;
+  }
+  Texture *tex = tattr->get_on_texture(tattr->get_on_stage(0));
+  return (tex->get_name().find("square_drop_shadow") != string::npos ||
+          tex->get_name().find("drop-shadow") != string::npos);
+}
+#endif
+
+/**
+ * Returns true if copies of the same static prop should be drawn with one
+ * instanced draw call per Geom instead of one prop node each.  This needs a
+ * GSG that can do hardware instancing.
+ */
+bool BSPLevel::use_prop_instancing() const {
+  if (_loader->is_ai() || !bsp_prop_instancing) {
+    return false;
+  }
+
+  BSPShaderGenerator *shgen = BSPShaderGenerator::ptr();
+  return (shgen != nullptr && shgen->get_gsg() != nullptr &&
+          shgen->get_gsg()->get_supports_geometry_instancing());
+}
+
+/**
+ * Returns true if the indicated prop may be drawn as an instance.  Each
+ * instance has its own transform and baked vertex lighting, but props that are
+ * lit dynamically need their own ambient probe and lights, so those are left
+ * as separate nodes.
+ */
+static bool is_prop_instanceable(const dstaticprop_t *prop) {
+  if ((prop->flags & STATICPROPFLAGS_DYNAMICLIGHTING) != 0) {
+    return false;
+  }
+  if ((prop->flags & STATICPROPFLAGS_STATICLIGHTING) != 0) {
+    return prop->first_vertex_data != -1;
+  }
+  return (prop->flags & STATICPROPFLAGS_NOLIGHTING) != 0;
+}
+
+/**
+ * Props are instanced together if they are the same model, with the same
+ * render flags, in the same leaf.  Keeping each group to a single leaf keeps
+ * the PVS culling of the props about as tight as it is for separate nodes.
+ */
+struct PropInstanceKey {
+  std::string name;
+  unsigned short flags;
+  int leaf;
+
+  bool operator < (const PropInstanceKey &other) const {
+    if (leaf != other.leaf) {
+      return leaf < other.leaf;
+    }
+    if (flags != other.flags) {
+      return flags < other.flags;
+    }
+    return name < other.name;
+  }
+};
+
+/**
+ * Builds a single instanced node for a group of props that share the same
+ * model.  The model is loaded once, and each of its Geoms is drawn once for
+ * all of the props, with the transform of each prop and its baked vertex
+ * lighting read from buffer textures in the vertex shader (see
+ * common_instancing_vert.inc.glsl).
+ *
+ * Props that can't be part of the group, such as ones whose lighting samples
+ * don't match the model, are added to rejected so that they can be loaded the
+ * regular way.  If the model itself can't be instanced, all of the props are
+ * rejected.
+ */
+void BSPLevel::make_instanced_props(const pvector<int> &propnums, pvector<int> &rejected) {
+  const dstaticprop_t *first = &_bspdata->dstaticprops[propnums[0]];
+
+  PT(PandaNode) proproot = Loader::get_global_ptr()->load_sync(first->name);
+  if (proproot == nullptr) {
+    // The regular path will complain about it.
+    rejected = propnums;
+    return;
+  }
+
+  NodePath propmdl(proproot);
+  propmdl.clear_model_nodes();
+  propmdl.flatten_light();
+
+  bool static_lighting = (first->flags & STATICPROPFLAGS_STATICLIGHTING) != 0;
+#ifdef CIO
+  bool strip_shadows = (first->flags & (STATICPROPFLAGS_LIGHTMAPSHADOWS | STATICPROPFLAGS_REALSHADOWS)) != 0;
+#endif
+
+  struct InstancedGeom {
+    CPT(Geom) geom;
+    CPT(RenderState) state;
+    bool lit;
+    bool skip;
+  };
+
+  // Collect the Geoms in the same order as the regular path does, which is
+  // the order the lighting samples were baked in.
+  pvector<InstancedGeom> geoms;
+  bool use_cubemap = false;
+  pvector<PT(GeomNode)> geomnodes = BuildGeomNodes(propmdl);
+  for (size_t i = 0; i < geomnodes.size(); i++) {
+    GeomNode *gn = geomnodes[i];
+    NodePath gnp = NodePath::any_path(gn);
+    CPT(RenderState) net_state = gnp.get_state(propmdl);
+    CPT(TransformState) net_transform = gnp.get_transform(propmdl);
+
+    bool lit = (gn->get_name() != "__lightsource__");
+#ifdef CIO
+    bool has_shadow = false;
+    for (int j = 0; j < gn->get_num_geoms(); j++) {
+      if (is_drop_shadow_state(gn->get_geom_state(j))) {
+        has_shadow = true;
+      }
+    }
+    lit = lit && !has_shadow;
+#endif
+
+    for (int j = 0; j < gn->get_num_geoms(); j++) {
+      InstancedGeom igeom;
+      igeom.geom = gn->get_geom(j);
+      igeom.state = net_state->compose(gn->get_geom_state(j));
+      igeom.lit = lit;
+      igeom.skip = false;
+#ifdef CIO
+      igeom.skip = strip_shadows && has_shadow;
+#endif
+
+      if (!net_transform->is_identity()) {
+        PT(Geom) xformed = igeom.geom->make_copy();
+        xformed->transform_vertices(net_transform->get_mat());
+        igeom.geom = xformed;
+      }
+
+      // Only VertexLitGeneric knows how to draw instances.
+      const BSPMaterialAttrib *bma;
+      igeom.state->get_attrib_def(bma);
+      if (!igeom.skip &&
+          (bma->get_material() == nullptr || bma->has_override_shader() ||
+           bma->get_material()->get_shader() != "VertexLitGeneric")) {
+        rejected = propnums;
+        return;
+      }
+      if (bma->get_material() != nullptr && bma->get_material()->has_env_cubemap()) {
+        use_cubemap = true;
+      }
+
+      geoms.push_back(igeom);
+    }
+  }
+
+  // Weed out the props whose baked lighting doesn't line up with the model.
+  pvector<int> instances;
+  for (size_t i = 0; i < propnums.size(); i++) {
+    const dstaticprop_t *prop = &_bspdata->dstaticprops[propnums[i]];
+    bool valid = true;
+    if (static_lighting) {
+      valid = (prop->num_vertex_datas == (int)geoms.size());
+      for (int j = 0; valid && j < prop->num_vertex_datas; j++) {
+        const dstaticpropvertexdata_t *dvdata = &_bspdata->dstaticpropvertexdatas[prop->first_vertex_data + j];
+        valid = (dvdata->num_lighting_samples == geoms[j].geom->get_vertex_data()->get_num_rows());
+      }
+    }
+    if (valid) {
+      instances.push_back(propnums[i]);
+    } else {
+      rejected.push_back(propnums[i]);
+    }
+  }
+
+  if ((int)instances.size() < std::max(2, bsp_prop_instancing_min.get_value())) {
+    rejected = propnums;
+    return;
+  }
+
+  int num_instances = (int)instances.size();
+
+  LPoint3 mdl_mins, mdl_maxs;
+  propmdl.calc_tight_bounds(mdl_mins, mdl_maxs);
+
+  // Three texels per instance, holding the columns of its transform.
+  PT(Texture) instance_data = new Texture(first->name + std::string("-instances"));
+  instance_data->setup_buffer_texture(num_instances * 3, Texture::T_float, Texture::F_rgba32,
+                                      GeomEnums::UH_static);
+  PTA_uchar image = instance_data->modify_ram_image();
+  LVecBase4f *columns = (LVecBase4f *)image.p();
+
+  LPoint3 mins(1e24), maxs(-1e24);
+  LPoint3 center(0);
+  for (int i = 0; i < num_instances; i++) {
+    const dstaticprop_t *prop = &_bspdata->dstaticprops[instances[i]];
+
+    LPoint3 pos;
+    VectorCopy(prop->pos, pos);
+    LVector3 hpr;
+    VectorCopy(prop->hpr, hpr);
+    LVector3 scale;
+    VectorCopy(prop->scale, scale);
+    pos /= 16.0;
+
+    CPT(TransformState) ts = TransformState::make_pos_hpr_scale(
+      pos, LVecBase3(hpr[1] - 90, hpr[0], hpr[2]), scale);
+    const LMatrix4 &mat = ts->get_mat();
+    for (int j = 0; j < 3; j++) {
+      columns[i * 3 + j] = LCAST(float, mat.get_col(j));
+    }
+
+    for (int j = 0; j < 8; j++) {
+      LPoint3 corner((j & 1) ? mdl_maxs[0] : mdl_mins[0],
+                     (j & 2) ? mdl_maxs[1] : mdl_mins[1],
+                     (j & 4) ? mdl_maxs[2] : mdl_mins[2]);
+      corner = mat.xform_point(corner);
+      mins = mins.fmin(corner);
+      maxs = maxs.fmax(corner);
+    }
+    center += pos;
+  }
+  center /= num_instances;
+  PT(BoundingBox) bounds = new BoundingBox(mins, maxs);
+
+  PT(ModelNode) groupnode = new ModelNode(std::string("instanced-") + first->name);
+  groupnode->set_preserve_transform(ModelNode::PT_local);
+  NodePath groupnp = _result.attach_new_node(groupnode);
+  groupnp.set_shader_auto(1);
+  groupnp.set_shader_input("instanceData", instance_data);
+  groupnp.set_instance_count(num_instances);
+  groupnp.set_attrib(StaticPropAttrib::make(static_lighting));
+
+  if (static_lighting || (first->flags & STATICPROPFLAGS_NOLIGHTING) != 0) {
+    groupnp.set_light_off(1);
+  }
+  if (first->flags & STATICPROPFLAGS_DOUBLESIDE) {
+    groupnp.set_two_sided(true, 1);
+  }
+  if ((first->flags & STATICPROPFLAGS_LIGHTMAPSHADOWS) == 0 &&
+      (first->flags & STATICPROPFLAGS_REALSHADOWS) != 0) {
+    groupnp.show_through(CAMERA_SHADOW);
+  }
+  if (use_cubemap) {
+    // The whole group has to share one cubemap, so pick the one closest to
+    // the middle of it.
+    cubemap_t *cm = find_closest_cubemap(center);
+    if (cm) {
+      groupnp.set_texture(TextureStages::get_cubemap(), cm->cubemap_tex);
+    }
+  }
+
+  // One node per Geom, since each Geom has its own lighting buffer.
+  for (size_t i = 0; i < geoms.size(); i++) {
+    const InstancedGeom &igeom = geoms[i];
+    if (igeom.skip) {
+      continue;
+    }
+
+    PT(GeomNode) gn = new GeomNode(groupnode->get_name());
+    gn->add_geom(igeom.geom->make_copy(), igeom.state);
+    gn->set_bounds(bounds);
+    NodePath gnp = groupnp.attach_new_node(gn);
+
+    if (!static_lighting || !igeom.lit) {
+      continue;
+    }
+
+    int num_rows = igeom.geom->get_vertex_data()->get_num_rows();
+    PT(Texture) lighting = new Texture(gn->get_name() + "-lighting");
+    lighting->setup_buffer_texture(num_instances * num_rows, Texture::T_float, Texture::F_rgba32,
+                                   GeomEnums::UH_static);
+    PTA_uchar lighting_image = lighting->modify_ram_image();
+    LVecBase4f *samples = (LVecBase4f *)lighting_image.p();
+
+    for (int j = 0; j < num_instances; j++) {
+      const dstaticprop_t *prop = &_bspdata->dstaticprops[instances[j]];
+      const dstaticpropvertexdata_t *dvdata = &_bspdata->dstaticpropvertexdatas[prop->first_vertex_data + i];
+      for (int k = 0; k < num_rows; k++) {
+        colorrgbexp32_t *sample = &_bspdata->staticproplighting[dvdata->first_lighting_sample + k];
+        LVector3 vtx_rgb;
+        ColorRGBExp32ToVector(*sample, vtx_rgb);
+        vtx_rgb /= 255.0f;
+        samples[j * num_rows + k] = LVecBase4f(vtx_rgb[0], vtx_rgb[1], vtx_rgb[2], 1.0f);
+      }
+    }
+
+    gnp.set_shader_input("instanceLighting", lighting);
+    gnp.set_shader_input("instanceVertexCount", LVecBase4i(num_rows, 0, 0, 0));
+  }
+}
+
+/**
+ * Loads the static props of the level.  If instanced_only is true, the rest
+ * of the props came out of the geometry cache, and only the instanced groups
+ * are built: the instance data lives in shader inputs, which can't be written
+ * to a bam file.
+ */
+void BSPLevel::load_static_props(bool instanced_only) {
   SimpleHashMap<int, NodePath, int_hash> leaf2props;
 
-  for (size_t propnum = 0; propnum < _bspdata->dstaticprops.size(); propnum++) {
+  size_t num_props = _bspdata->dstaticprops.size();
+  pvector<bool> instanced(num_props, false);
+
+  if (use_prop_instancing()) {
+    pmap<PropInstanceKey, pvector<int> > groups;
+    for (size_t propnum = 0; propnum < num_props; propnum++) {
+      const dstaticprop_t *prop = &_bspdata->dstaticprops[propnum];
+      if (!is_prop_instanceable(prop)) {
+        continue;
+      }
+
+      LPoint3 pos;
+      VectorCopy(prop->pos, pos);
+
+      PropInstanceKey key;
+      key.name = prop->name;
+      key.flags = prop->flags & (STATICPROPFLAGS_STATICLIGHTING | STATICPROPFLAGS_NOLIGHTING |
+                                 STATICPROPFLAGS_DOUBLESIDE | STATICPROPFLAGS_REALSHADOWS |
+                                 STATICPROPFLAGS_LIGHTMAPSHADOWS);
+      key.leaf = find_leaf(pos / 16.0);
+      groups[key].push_back((int)propnum);
+    }
+
+    for (auto itr = groups.begin(); itr != groups.end(); ++itr) {
+      const pvector<int> &propnums = itr->second;
+      if ((int)propnums.size() < bsp_prop_instancing_min) {
+        continue;
+      }
+
+      pvector<int> rejected;
+      make_instanced_props(propnums, rejected);
+      for (int propnum : propnums) {
+        instanced[propnum] = true;
+      }
+      for (int propnum : rejected) {
+        instanced[propnum] = false;
+      }
+    }
+  }
+
+  if (instanced_only) {
+    return;
+  }
+
+  for (size_t propnum = 0; propnum < num_props; propnum++) {
+    if (instanced[propnum]) {
+      continue;
+    }
+
     dstaticprop_t *prop = &_bspdata->dstaticprops[propnum];
 
     PT(BSPProp) propnode = new BSPProp(prop->name);
@@ -1059,18 +1717,10 @@ void BSPLevel::load_static_props() {
           for (int j = 0; j < res.geomnode->get_num_geoms(); j++) {
             const RenderState *state = res.geomnode->get_geom_state(j);
 #ifdef CIO
-            const TextureAttrib *tattr;
-            if (state->get_attrib(tattr)) {
-              if (tattr->get_num_on_stages() == 0) {
-                continue;
-              }
-              Texture *tex = tattr->get_on_texture(tattr->get_on_stage(0));
-              if (tex->get_name().find("square_drop_shadow") != string::npos ||
-                  tex->get_name().find("drop-shadow") != string::npos) {
-                // don't apply vertex lighting to a shadow model
-                shadow_skip = true;
-                break;
-              }
+            if (is_drop_shadow_state(state)) {
+              // don't apply vertex lighting to a shadow model
+              shadow_skip = true;
+              break;
             }
 #endif
             const BSPMaterialAttrib *bma;
@@ -1122,17 +1772,9 @@ void BSPLevel::load_static_props() {
         NodePath np = npc[i];
         GeomNode *gn = DCAST(GeomNode, np.node());
         for (int j = 0; j < gn->get_num_geoms(); j++) {
-          const RenderState *state = gn->get_geom_state(j);
-          const TextureAttrib *tattr;
-          if (state->get_attrib(tattr)) {
-            if (tattr->get_num_on_stages() == 0) {
-              continue;
-            }
-            Texture *tex = tattr->get_on_texture(tattr->get_on_stage(0));
-            if (tex->get_name().find("square_drop_shadow") != string::npos ||
-                tex->get_name().find("drop-shadow") != string::npos) {
-              np.remove_node();
-            }
+          if (is_drop_shadow_state(gn->get_geom_state(j))) {
+            np.remove_node();
+            break;
           }
         }
       }
@@ -1330,7 +1972,7 @@ void BSPLevel::do_optimizations() {
         child.flatten_strong();
       }
 
-      mdata.decal_rbc->clear_transform();
+      mdata.decal_pool->get_node()->clear_transform();
     }
   }
 
@@ -1357,46 +1999,111 @@ void BSPLevel::do_optimizations() {
     CPT(RenderState) node_state = npgn.get_net_state();
 
     int numvisleafs = _bspdata->dmodels[0].visleafs + 1;
+    int pvs_size = (_bspdata->dmodels[0].visleafs + 7) / 8;
 
-    // List of potentially visible Geoms in each leaf
+    // The batches of potentially visible Geoms for each leaf
     // ( concatenation of Geoms in that leaf + Geoms of leafs in PVS )
-    _leaf_world_geoms.clear();
-    _leaf_world_geoms.resize(numvisleafs + 1);
+    _leaf_world_clusters.clear();
+    _leaf_world_clusters.resize(numvisleafs + 1);
+
+    // The batches depend on which entities got merged into the world, so
+    // they are cached separately from the faces.  Leafs of the same cluster
+    // share their node in the cache.
+    const pvector<PT(cubemap_t)> &cubemaps = _amb_probe_mgr.get_cubemaps();
+    PT(BSPGeomCache) leaf_cache = BSPGeomCache::read(_map_file, "bspleafs", get_geom_cache_hash());
+    if (leaf_cache != nullptr) {
+      bool valid = (leaf_cache->get_num_leafs() == numvisleafs);
+      pmap<const GeomNode *, PT(WorldCluster)> cached_clusters;
+      for (int leafnum = 1; valid && leafnum < numvisleafs; leafnum++) {
+        GeomNode *lgn = leaf_cache->get_leaf(leafnum);
+        PT(WorldCluster) &cluster = cached_clusters[lgn];
+        if (cluster == nullptr) {
+          valid = leaf_cache->restore_cubemaps(NodePath(lgn), cubemaps);
+          cluster = new WorldCluster(lgn);
+        }
+        _leaf_world_clusters[leafnum] = cluster;
+      }
+      if (!valid) {
+        _leaf_world_clusters.clear();
+        _leaf_world_clusters.resize(numvisleafs + 1);
+        leaf_cache = nullptr;
+      }
+    }
+
+    PT(BSPGeomCache) new_leaf_cache;
+    pmap<const WorldCluster *, PT(GeomNode)> new_cache_nodes;
+    if (leaf_cache == nullptr && BSPGeomCache::is_enabled()) {
+      new_leaf_cache = new BSPGeomCache(get_geom_cache_hash());
+      new_leaf_cache->set_cubemaps(cubemaps);
+      new_leaf_cache->add_leaf(new GeomNode("leafnode"));
+    }
 
-    for (int leafnum = 1; leafnum < numvisleafs; leafnum++) {
-      // Build a list of worldspawn Geoms that we can render from this leaf.
-      // We will then flatten those Geoms into as few batches as possible.
+    // Leafs with the same PVS can see the same world Geoms, so the batches
+    // only have to be built once for each distinct PVS.
+    pmap<std::string, PT(WorldCluster)> pvs_clusters;
 
-      PT(GeomNode) lgn = new GeomNode("leafnode");
-      NodePath leafnode(lgn);
+    for (int leafnum = 1; leafnum < numvisleafs && leaf_cache == nullptr; leafnum++) {
+      PT(WorldCluster) &cluster = pvs_clusters[std::string((const char *)_leaf_pvs[leafnum], pvs_size)];
 
-      for (int geomnum = 0; geomnum < num_geoms; geomnum++) {
-        const Geom *geom = gn->get_geom(geomnum);
+      if (cluster == nullptr) {
+        // Build a list of worldspawn Geoms that we can render from this leaf.
+        // We will then flatten those Geoms into as few batches as possible.
 
-        // We are going to assume that world Geoms are already in world space
-        // ( and they definitely should be )
-        CPT(GeometricBoundingVolume) geom_gbv = geom->get_bounds()
-          ->as_geometric_bounding_volume();
+        PT(GeomNode) lgn = new GeomNode("leafnode");
+        NodePath leafnode(lgn);
 
-        for (size_t pvsidx = 1; pvsidx < numvisleafs; pvsidx++) {
-          if (!is_cluster_visible(leafnum, pvsidx))
-            continue;
+        for (int geomnum = 0; geomnum < num_geoms; geomnum++) {
+          const Geom *geom = gn->get_geom(geomnum);
 
-          BoundingBox *leaf_bounds = _leaf_bboxs[pvsidx];
+          // We are going to assume that world Geoms are already in world space
+          // ( and they definitely should be )
+          CPT(GeometricBoundingVolume) geom_gbv = geom->get_bounds()
+            ->as_geometric_bounding_volume();
 
-          if (leaf_bounds->contains(geom_gbv) != BoundingVolume::IF_no_intersection) {
-            lgn->add_geom(gn->modify_geom(geomnum), gn->get_geom_state(geomnum));
-            break;
+          for (size_t pvsidx = 1; pvsidx < numvisleafs; pvsidx++) {
+            if (!is_cluster_visible(leafnum, pvsidx))
+              continue;
+
+            BoundingBox *leaf_bounds = _leaf_bboxs[pvsidx];
+
+            if (leaf_bounds->contains(geom_gbv) != BoundingVolume::IF_no_intersection) {
+              lgn->add_geom(gn->modify_geom(geomnum), gn->get_geom_state(geomnum));
+              break;
+            }
           }
         }
+
+        // aggressively combine all geoms visibible from this leaf
+        leafnode.clear_model_nodes();
+        leafnode.flatten_strong();
+
+        // We've created a batched list of Geoms to render when we are in this cluster.
+        cluster = new WorldCluster(lgn);
+
+        if (new_leaf_cache != nullptr) {
+          PT(GeomNode) cached = DCAST(GeomNode, lgn->make_copy());
+          new_leaf_cache->hide_cubemaps(NodePath(cached), cubemaps);
+          new_cache_nodes[cluster] = cached;
+        }
       }
 
-      // aggressively combine all geoms visibible from this leaf
-      leafnode.clear_model_nodes();
-      leafnode.flatten_strong();
+      _leaf_world_clusters[leafnum] = cluster;
 
-      // We've created a batched list of Geoms to render when we are in this leaf.
-      _leaf_world_geoms[leafnum] = lgn->get_geoms();
+      if (new_leaf_cache != nullptr) {
+        new_leaf_cache->add_leaf(new_cache_nodes[cluster]);
+      }
+    }
+
+    if (leaf_cache == nullptr) {
+      bsplevel_cat.info()
+        << "Built " << pvs_clusters.size() << " world clusters for "
+        << numvisleafs - 1 << " leafs.\n";
+    }
+
+    if (new_leaf_cache != nullptr) {
+      vector_string files;
+      get_geom_cache_dependents(files);
+      new_leaf_cache->write(_map_file, "bspleafs", files);
     }
   }
 
@@ -1445,8 +2152,77 @@ cubemap_t *BSPLevel::find_closest_cubemap(const LPoint3 &pos) {
 
 void BSPLevel::load_cubemaps() {
   _amb_probe_mgr.load_cubemaps();
+  prefilter_cubemaps();
 }
 
+/**
+ * Gives each of the level's cubemaps its prefiltered mip levels.  They come
+ * from the model cache if this version of the level has been filtered
+ * before, otherwise all of the cubemaps are filtered now, in parallel, and
+ * the result is cached.
+ *
+ * Without the model cache, the filtered mips would be thrown away after
+ * every load, so the cubemaps keep the mips the driver generates instead.
+ */
+void BSPLevel::prefilter_cubemaps() {
+  const pvector<PT(cubemap_t)> &cubemaps = _amb_probe_mgr.get_cubemaps();
+  if (!bsp_cubemap_prefilter || !BSPGeomCache::is_enabled() || cubemaps.empty()) {
+    return;
+  }
+
+  PT(BSPCubemapCache) cache = BSPCubemapCache::read(_map_file, _file_hash);
+  if (cache != nullptr) {
+    bool loaded = true;
+    for (size_t i = 0; loaded && i < cubemaps.size(); i++) {
+      const cubemap_t *cm = cubemaps[i];
+      if (cm->has_full_cubemap) {
+        loaded = cache->load_cubemap(LPoint3(cm->pos), cm->size, cm->cubemap_tex);
+      }
+    }
+    if (loaded) {
+      return;
+    }
+  }
+
+  pvector<PT(CubemapPrefilter)> prefilters(cubemaps.size());
+  for (size_t i = 0; i < cubemaps.size(); i++) {
+    const cubemap_t *cm = cubemaps[i];
+    if (!cm->has_full_cubemap) {
+      continue;
+    }
+    prefilters[i] = new CubemapPrefilter(cm->size);
+    for (int j = 0; j < 6; j++) {
+      prefilters[i]->set_face(j, cm->cubemap_images[j]);
+    }
+    prefilters[i]->start();
+  }
+
+  cache = new BSPCubemapCache(_file_hash);
+  for (size_t i = 0; i < cubemaps.size(); i++) {
+    if (prefilters[i] == nullptr) {
+      continue;
+    }
+    prefilters[i]->wait();
+    prefilters[i]->store(cubemaps[i]->cubemap_tex);
+    cache->add_cubemap(LPoint3(cubemaps[i]->pos), prefilters[i]);
+  }
+  cache->write(_map_file);
+}
+
+/**
+ * Renders the env_cubemaps of the level and saves them to the BSP file.
+ *
+ * All six faces of a cubemap are rendered in the same frame, side by side in
+ * one offscreen buffer, and each cubemap is prefiltered on the CPU (see
+ * CubemapPrefilter) while the next one renders.  The prefiltered mip levels
+ * are stored in the model cache for the new BSP file, so that loading the
+ * level doesn't have to filter them again.
+ *
+ * If window is NULL, the cubemaps are rendered by the tinydisplay software
+ * renderer, so that they can be built on a machine without a GPU.  Our
+ * shaders don't run there, so the result is only a rough preview of the
+ * lighting.
+ */
 void BSPLevel::build_cubemaps(const NodePath &render, GraphicsOutput *win) {
   if (!_bspdata)
     return;
@@ -1458,33 +2234,47 @@ void BSPLevel::build_cubemaps(const NodePath &render, GraphicsOutput *win) {
 
   _bspdata->cubemapdata.clear();
 
-  // make the camera that will render the 6 faces of each cubemap_tex
-  PT(Camera) cam = new Camera("cubemap_cam");
-  cam->set_initial_state(render.get_state());
-  PT(PerspectiveLens) lens = new PerspectiveLens;
-  lens->set_fov(90, 90);
-  cam->set_lens(lens);
-  cam->set_scene(_result);
-  NodePath camnp = _result.attach_new_node(cam);
-
   FrameBufferProperties fbprops;
   fbprops.set_rgb_color(true);
   fbprops.set_depth_bits(24);
-  fbprops.set_rgba_bits(16, 16, 16, 8);
-  fbprops.set_force_hardware(true);
   fbprops.set_srgb_color(false);
+
+  GraphicsEngine *engine;
+  PT(GraphicsPipe) pipe;
+  bool software = (win == nullptr);
+  if (software) {
+    pipe = GraphicsPipeSelection::get_global_ptr()->make_module_pipe("p3tinydisplay");
+    if (pipe == nullptr) {
+      bsplevel_cat.error()
+        << "Can't build cubemaps without a window, tinydisplay is not available\n";
+      return;
+    }
+    engine = GraphicsEngine::get_global_ptr();
+    fbprops.set_rgba_bits(8, 8, 8, 8);
+    fbprops.set_force_software(true);
+  } else {
+    engine = win->get_engine();
+    pipe = win->get_pipe();
+    fbprops.set_rgba_bits(16, 16, 16, 8);
+    fbprops.set_force_hardware(true);
+  }
+
+  // Only our shaders know about the exposure adjustment.
+  bool can_expose = (!software && shgen != nullptr);
+
+  int max_size = 1;
+  for (size_t i = 0; i < _bspdata->cubemaps.size(); i++) {
+    max_size = std::max(max_size, _bspdata->cubemaps[i].size);
+  }
+
   WindowProperties winprops;
-  winprops.set_size(LVector2i(128, 128));
-  int flags = GraphicsPipe::BF_refuse_window | GraphicsPipe::BF_size_square;
-  PT(GraphicsOutput) buf = win->get_engine()->make_output(win->get_pipe(), "cubemap-render",
-                                                           0, fbprops, winprops, flags,
-                                                           win->get_gsg(), win);
+  winprops.set_size(LVector2i(max_size * 6, max_size));
+  int flags = GraphicsPipe::BF_refuse_window;
+  PT(GraphicsOutput) buf = engine->make_output(pipe, "cubemap-render",
+                                               0, fbprops, winprops, flags,
+                                               software ? nullptr : win->get_gsg(), win);
   nassertv(buf != nullptr);
   PT(GraphicsBuffer) cmbuf = DCAST(GraphicsBuffer, buf);
-  PT(DisplayRegion) dr = buf->make_display_region();
-  dr->set_camera(camnp);
-
-  dcubemap_t *cm;
 
   static const LVector3 dirs[6] = {
 
@@ -1497,46 +2287,72 @@ void BSPLevel::build_cubemaps(const NodePath &render, GraphicsOutput *win) {
 
   };
 
+  // make the cameras that render the 6 faces of each cubemap_tex, each into
+  // its own sixth of the buffer
+  NodePath rig = _result.attach_new_node("cubemap_rig");
+  PT(PerspectiveLens) lens = new PerspectiveLens;
+  lens->set_fov(90, 90);
+  PT(DisplayRegion) drs[6];
+  for (int j = 0; j < 6; j++) {
+    PT(Camera) cam = new Camera("cubemap_cam");
+    cam->set_initial_state(render.get_state());
+    cam->set_lens(lens);
+    cam->set_scene(_result);
+    NodePath camnp = rig.attach_new_node(cam);
+    camnp.set_hpr(dirs[j]);
+
+    drs[j] = buf->make_display_region(j / 6.0f, (j + 1) / 6.0f, 0.0f, 1.0f);
+    drs[j]->set_camera(camnp);
+  }
+
   // Disable auto-exposure, we will automatically adjust exposure
   // when rendering the cubemaps.
   bool old_hdr_auto_exposure = hdr_auto_exposure;
   hdr_auto_exposure = false;
 
+  // The filtered mip levels only have somewhere to go if there is a model
+  // cache.
+  bool prefilter = bsp_cubemap_prefilter && BSPGeomCache::is_enabled();
+  pvector<PT(CubemapPrefilter)> prefilters(_bspdata->cubemaps.size());
+
   for (size_t i = 0; i < _bspdata->cubemaps.size(); i++) {
-    cm = &_bspdata->cubemaps[i];
-    camnp.set_pos(cm->pos[0] / 16.0, cm->pos[1] / 16.0, cm->pos[2] / 16.0);
-    cmbuf->set_size(cm->size, cm->size);
+    dcubemap_t *cm = &_bspdata->cubemaps[i];
+    rig.set_pos(cm->pos[0] / 16.0, cm->pos[1] / 16.0, cm->pos[2] / 16.0);
+    cmbuf->set_size(cm->size * 6, cm->size);
 
+    PNMImage hdr_maps[6];
     for (int j = 0; j < 6; j++) {
-      //PNMFileTypeTGA ftype;
-
-      PNMImage hdr_map(cm->size, cm->size);
-      hdr_map.fill(0);
-      hdr_map.set_color_space(ColorSpace::CS_linear);
-      hdr_map.set_maxval(USHRT_MAX);
-
-      camnp.set_hpr(dirs[j]);
+      hdr_maps[j] = PNMImage(cm->size, cm->size);
+      hdr_maps[j].fill(0);
+      hdr_maps[j].set_color_space(ColorSpace::CS_linear);
+      hdr_maps[j].set_maxval(USHRT_MAX);
+    }
 
-      // We are going to need to render multiple exposures
-      float exposure = 16.0f;
-      bool over_exposed_texels = true;
-      while (over_exposed_texels && (exposure > 0.05f)) {
+    // We are going to need to render multiple exposures
+    float exposure = can_expose ? 16.0f : 1.0f;
+    bool over_exposed_texels = true;
+    while (over_exposed_texels && (exposure > 0.05f)) {
+      if (can_expose) {
         shgen->set_exposure_adustment(exposure);
+      }
 
-        win->get_engine()->render_frame();
-        win->get_engine()->sync_frame();
+      engine->render_frame();
+      engine->sync_frame();
 
-        PNMImage ldr_map(cm->size, cm->size);
-        ldr_map.set_color_space(ColorSpace::CS_linear);
-        ldr_map.set_maxval(USHRT_MAX);
-        buf->get_screenshot(ldr_map);
+      PNMImage ldr_map(cm->size * 6, cm->size);
+      ldr_map.set_color_space(ColorSpace::CS_linear);
+      ldr_map.set_maxval(USHRT_MAX);
+      buf->get_screenshot(ldr_map);
 
-        float scale = 1.0f / exposure;
-        over_exposed_texels = false;
+      float scale = 1.0f / exposure;
+      over_exposed_texels = false;
 
+      for (int j = 0; j < 6; j++) {
+        PNMImage &hdr_map = hdr_maps[j];
+        int x_offset = j * cm->size;
         for (int x = 0; x < hdr_map.get_x_size(); x++) {
           for (int y = 0; y < hdr_map.get_y_size(); y++) {
-            LRGBColorf ldr_col = ldr_map.get_xel(x, y);
+            LRGBColorf ldr_col = ldr_map.get_xel(x_offset + x, y);
             LRGBColorf hdr_col = hdr_map.get_xel(x, y);
             for (int c = 0; c < 3; c++) {
               float texel = ldr_col[c];
@@ -1549,19 +2365,17 @@ void BSPLevel::build_cubemaps(const NodePath &render, GraphicsOutput *win) {
             hdr_map.set_xel(x, y, hdr_col);
           }
         }
+      }
 
-        exposure *= 0.75f;
-
-        //if ( dumpcubemaps )
-        //{
-        //	ldr_map.apply_exponent( 1.0 / 2.2 );
-        //	std::ostringstream ldrname;
-        //	ldrname << "CM_" << cm->pos[0] << "." << cm->pos[1] << "." << cm->pos[2] << "_" << j << ".ldr.tga";
-        //	ldr_map.write( Filename::from_os_specific( ldrname.str() ), &ftype );
-        //}
+      if (!can_expose) {
+        break;
       }
+      exposure *= 0.75f;
+    }
 
-      // save out the cubemap_tex face
+    // save out the cubemap_tex faces
+    for (int j = 0; j < 6; j++) {
+      const PNMImage &hdr_map = hdr_maps[j];
       cm->imgofs[j] = _bspdata->cubemapdata.size();
       for (int y = 0; y < hdr_map.get_y_size(); y++) {
         for (int x = 0; x < hdr_map.get_x_size(); x++) {
@@ -1571,20 +2385,23 @@ void BSPLevel::build_cubemaps(const NodePath &render, GraphicsOutput *win) {
           _bspdata->cubemapdata.push_back(out);
         }
       }
+    }
 
-      //if ( dumpcubemaps )
-      //{
-      //	hdr_map.apply_exponent( 1.0 / 2.2 );
-      //	std::ostringstream hdrname;
-      //	hdrname << "CM_" << cm->pos[0] << "." << cm->pos[1] << "." << cm->pos[2] << "_" << j << ".hdr.tga";
-      //	hdr_map.write( Filename::from_os_specific( hdrname.str() ), &ftype );
-      //}
+    // Filter the mip levels while the next cubemap renders.
+    if (prefilter) {
+      prefilters[i] = new CubemapPrefilter(cm->size);
+      for (int j = 0; j < 6; j++) {
+        prefilters[i]->set_face(j, hdr_maps[j]);
+      }
+      prefilters[i]->start();
     }
   }
 
-  buf->remove_display_region(dr);
-  win->get_engine()->remove_window(buf);
-  camnp.remove_node();
+  for (int j = 0; j < 6; j++) {
+    buf->remove_display_region(drs[j]);
+  }
+  engine->remove_window(buf);
+  rig.remove_node();
 
   hdr_auto_exposure = old_hdr_auto_exposure;
 
@@ -1592,6 +2409,31 @@ void BSPLevel::build_cubemaps(const NodePath &render, GraphicsOutput *win) {
   bsplevel_cat.info()
     << "Saving BSP file...\n";
   WriteBSPFile(_bspdata, _map_file.to_os_specific().c_str());
+
+  // Cache the mip levels for the file that was just written.
+  if (prefilter) {
+    PT(BSPCubemapCache) cache;
+    vector_uchar data;
+    if (VirtualFileSystem::get_global_ptr()->read_file(_map_file, data, true)) {
+      cache = new BSPCubemapCache(BSPGeomCache::hash_file(data.data(), data.size()));
+    }
+
+    for (size_t i = 0; i < prefilters.size(); i++) {
+      const dcubemap_t *cm = &_bspdata->cubemaps[i];
+      prefilters[i]->wait();
+      if (cache != nullptr) {
+        cache->add_cubemap(LPoint3(cm->pos[0] / 16.0, cm->pos[1] / 16.0, cm->pos[2] / 16.0), prefilters[i]);
+      }
+    }
+
+    if (cache != nullptr) {
+      cache->write(_map_file);
+    } else {
+      bsplevel_cat.warning()
+        << "Could not read back " << _map_file << " to cache its cubemap mip levels\n";
+    }
+  }
+
   bsplevel_cat.info()
     << "Done.\n";
 
@@ -1662,6 +2504,19 @@ LPoint3 BSPLevel::clip_line(const LPoint3 &start, const LPoint3 &end) {
   return clipped;
 }
 
+/**
+ * Runs a batch of line or box traces against the brushes of the indicated
+ * brush model (the world by default), four at a time.  The results are
+ * stored on the batch.
+ */
+void BSPLevel::trace_batch(BSPTraceBatch *batch, int modelnum) {
+  nassertv(batch != nullptr);
+  nassertv(_colldata != nullptr);
+  nassertv(modelnum >= 0 && modelnum < _bspdata->nummodels);
+
+  batch->run(_colldata, _bspdata->dmodels[modelnum].headnode[0]);
+}
+
 int BSPLevel::get_brush_triangle_model_fast(BulletRigidBodyNode *rbnode, int triangle_idx) {
   auto nodeitr = _brush_collision_data.find(rbnode);
   if (nodeitr == _brush_collision_data.end())
@@ -1682,9 +2537,18 @@ void BSPLevel::remove_physics(const NodePath &root) {
   }
 }
 
-bool BSPLevel::load(bspdata_t *data) {
+/**
+ * Builds the level from the indicated BSP data.  This doesn't touch anything
+ * outside of the level, so it may be run on a loader thread while another
+ * level is active; the level is hooked up to the shader generator later on,
+ * by activate().  The progress is reported to the request, if one is given.
+ */
+bool BSPLevel::load(bspdata_t *data, BSPLoadRequest *request) {
   bool ai = _loader->is_ai();
-  BSPShaderGenerator *shgen = BSPShaderGenerator::ptr();
+
+  if (request != nullptr) {
+    request->set_phase(BSPLoadRequest::P_entities);
+  }
 
   PT(BSPRoot) root = new BSPRoot("maproot");
   _result = NodePath(root);
@@ -1724,10 +2588,27 @@ bool BSPLevel::load(bspdata_t *data) {
     _leaf_bboxs[i] = bbox;
   }
 
+  if (request != nullptr) {
+    request->set_phase(BSPLoadRequest::P_geometry);
+  }
+
   load_geometry();
 
   if (!ai) {
-    load_static_props();
+    if (request != nullptr) {
+      request->set_phase(BSPLoadRequest::P_props);
+    }
+
+    if (_geom_cache != nullptr) {
+      // The static props were cached along with the faces.
+      NodePath(_geom_cache->get_props()).get_children().reparent_to(_result);
+      _geom_cache = nullptr;
+      // Instanced props aren't cached.
+      load_static_props(true);
+    } else {
+      load_static_props();
+      write_geom_cache();
+    }
 
     if (bsp_leafvis) {
       Randomizer random;
@@ -1743,6 +2624,10 @@ bool BSPLevel::load(bspdata_t *data) {
       }
     }
 
+    if (request != nullptr) {
+      request->set_phase(BSPLoadRequest::P_lighting);
+    }
+
     _amb_probe_mgr.process_ambient_probes();
 
     // Don't let the static brushes cast depth-map shadows,
@@ -1750,7 +2635,7 @@ bool BSPLevel::load(bspdata_t *data) {
     //get_model( 0 ).hide( CAMBITS_SHADOW );
 
     // Check if we are casting cascaded shadows
-    if (bsp_csm && shgen && _amb_probe_mgr.get_sunlight()) {
+    if (bsp_csm && _amb_probe_mgr.get_sunlight()) {
       _shadow_dir = -_amb_probe_mgr.get_sunlight()->direction.get_xyz();
 
       // Create a fake DirectionalLight to contain the direction
@@ -1758,24 +2643,69 @@ bool BSPLevel::load(bspdata_t *data) {
       dl->set_direction(_shadow_dir);
       // Keep a reference to the fake light
       _fake_dl = NodePath(dl);
-      shgen->set_sun_light(_fake_dl);
-    } else {
-      // No cascaded shadows
-      shgen->set_sun_light(NodePath());
     }
   }
 
+  if (request != nullptr) {
+    request->set_phase(BSPLoadRequest::P_collision);
+  }
+
   _colldata = SetupCollisionBSPData(_bspdata);
 
   setup_raytrace_environment();
 
+  // Generate the shaders here rather than in activate(), so that it happens
+  // on the loader thread.
+  if (bsp_precache_shaders) {
+    precache_shaders();
+  }
+
   return true;
 }
 
+/**
+ * Hooks the loaded level up to the shader generator.  Called on the main
+ * thread when the level becomes the active level, after the previous level
+ * has been cleaned up.
+ */
+void BSPLevel::activate() {
+  _activated = true;
+
+  BSPShaderGenerator *shgen = BSPShaderGenerator::ptr();
+  if (_loader->is_ai() || !shgen) {
+    return;
+  }
+
+  if (_has_planar_reflection) {
+    shgen->get_planar_reflections()->setup(_planar_reflection_normal, _planar_reflection_height);
+  }
+
+  // Cascaded shadows follow the sun, if there is one.
+  shgen->set_sun_light(_fake_dl);
+}
+
+/**
+ * Generates the shaders for every material in the level up front, rather
+ * than the first time each one comes into view.  Also warms the shader cache
+ * for the next session; see BSPShaderGenerator::precache_shaders().
+ */
+int BSPLevel::precache_shaders() {
+  BSPShaderGenerator *shgen = BSPShaderGenerator::ptr();
+  if (_loader->is_ai() || !shgen || _result.is_empty()) {
+    return 0;
+  }
+
+  // The shader generator is only told about our sun once we are activated,
+  // so go by the level's own.
+  return shgen->precache_shaders(_result, !_fake_dl.is_empty());
+}
+
 void BSPLevel::cleanup(bool is_transition) {
   bool ai = _loader->is_ai();
 
-  if (!ai)
+  // A level that was built but never activated doesn't own the shader
+  // generator's state, the active level does.
+  if (!ai && _activated)
     BSPShaderGenerator::ptr()->get_planar_reflections()->shutdown();
 
   for (auto itr = _brush_collision_data.begin(); itr != _brush_collision_data.end(); itr++) {
@@ -1809,7 +2739,7 @@ void BSPLevel::cleanup(bool is_transition) {
   // when the ref count is gone.
   //
   //_leaf_pvs.clear();
-  //_leaf_world_geoms.clear();
+  //_leaf_world_clusters.clear();
   //_visible_leafs.clear();
   //_leaf_bboxs.clear();
   //_visible_leaf_bboxs.clear();
@@ -1823,8 +2753,9 @@ void BSPLevel::cleanup(bool is_transition) {
 
   if (!_fake_dl.is_empty())
     _fake_dl.remove_node();
-  if (bsp_csm && BSPShaderGenerator::ptr())
+  if (bsp_csm && _activated && BSPShaderGenerator::ptr())
     BSPShaderGenerator::ptr()->set_sun_light(NodePath());
+  _activated = false;
 
   if (!_result.is_empty())
     _result.remove_node();
@@ -18,17 +18,17 @@
 #include "lightmap_palettes.h"
 #include "ambient_probes.h"
 #include "cubemaps.h"
-#include "rigidBodyCombiner.h"
 #include "decals.h"
 #include "bsp_trace.h"
-#include "eggVertex.h"
+#include "bsp_trace_batch.h"
+#include "bsp_geom_cache.h"
 #include "bspMaterial.h"
 #include "bulletRigidBodyNode.h"
+#include "lightMutex.h"
 
 class BulletWorld;
 class BSPLoader;
-class EggVertexPool;
-class EggPolygon;
+class BSPLoadRequest;
 class GraphicsOutput;
 
 struct texinfo_s;
@@ -144,18 +144,64 @@ struct brush_model_data_t {
   LPoint3 origin;
   LMatrix4f origin_matrix;
   NodePath model_root;
-  PT(RigidBodyCombiner) decal_rbc;
+  PT(DecalPool) decal_pool;
 
   brush_model_data_t() {
-    decal_rbc = new RigidBodyCombiner("decal-rbc");
+    decal_pool = new DecalPool;
   }
 };
 
+/**
+ * The worldspawn geometry that is potentially visible from a cluster of leafs
+ * sharing the same PVS, merged into as few batches as possible and sorted by
+ * state.  The per-frame cull of the world walks this list.
+ */
+class EXPCL_PANDABSP WorldCluster : public ReferenceCount {
+public:
+  struct Batch {
+    CPT(Geom) geom;
+    CPT(RenderState) state;
+    bool skybox;
+  };
+  typedef pvector<Batch> Batches;
+
+  // The states of the batches composed onto the state the world is rendered
+  // with.
+  class ComposedStates : public ReferenceCount {
+  public:
+    CPT(RenderState) parent;
+    pvector<CPT(RenderState)> states;
+  };
+
+  WorldCluster(const GeomNode *node);
+
+  INLINE const Batches &get_batches() const {
+    return _batches;
+  }
+  INLINE const GeomNode *get_node() const {
+    return _node;
+  }
+
+  CPT(ComposedStates) get_composed_states(const RenderState *parent);
+
+private:
+  CPT(GeomNode) _node;
+  Batches _batches;
+
+  // Every camera renders the world with its own state, remember the last few
+  // so they don't have to be composed per batch every frame.
+  enum { num_composed_states = 4 };
+  CPT(ComposedStates) _composed[num_composed_states];
+  int _next_composed;
+  LightMutex _lock;
+};
+
 /**
  * An instance of a loaded BSP level.
  */
 class EXPCL_PANDABSP BSPLevel : public ReferenceCount {
 PUBLISHED:
+  virtual ~BSPLevel();
 
   void remove_physics(const NodePath &root);
   BulletWorld *get_physics_world() const;
@@ -187,6 +233,12 @@ PUBLISHED:
                           int flags = 0) {
     _decal_mgr.decal_trace(decal_material, decal_scale, rotate, start, end, decal_color, flags);
   }
+  INLINE void begin_decal_batch() {
+    _decal_mgr.begin_batch();
+  }
+  INLINE void end_decal_batch() {
+    _decal_mgr.end_batch();
+  }
 
   Texture *get_closest_cubemap_texture(const LPoint3 &pos);
 
@@ -195,6 +247,7 @@ PUBLISHED:
 
   bool trace_line(const LPoint3 &start, const LPoint3 &end);
   LPoint3 clip_line(const LPoint3 &start, const LPoint3 &end);
+  void trace_batch(BSPTraceBatch *batch, int modelnum = 0);
 
   NodePath get_model(int modelnum) const;
 
@@ -234,6 +287,14 @@ PUBLISHED:
 
   void build_cubemaps(const NodePath &render, GraphicsOutput *window);
 
+  int precache_shaders();
+
+  // The hash of the BSP file contents, or 0 if it wasn't hashed because the
+  // model cache is disabled.  Things built from the level can be keyed by it.
+  INLINE uint64_t get_file_hash() const {
+    return _file_hash;
+  }
+
   BSPLoader *get_loader() const {
     return _loader;
   }
@@ -286,8 +347,10 @@ protected:
   BSPLevel(BSPLoader *loader);
 
   void set_filename(const Filename &file);
+  void set_file_hash(uint64_t hash);
 
-  virtual bool load(bspdata_t *bspdata);
+  virtual bool load(bspdata_t *bspdata, BSPLoadRequest *request = nullptr);
+  virtual void activate();
   virtual void cleanup(bool is_transition);
 
   virtual void load_geometry() = 0;
@@ -305,20 +368,25 @@ protected:
 
   void make_brush_model_collisions(int modelnum = -1);
 
-  void load_static_props();
+  bool use_prop_instancing() const;
+  void load_static_props(bool instanced_only = false);
+  void make_instanced_props(const pvector<int> &propnums, pvector<int> &rejected);
   void load_cubemaps();
+  void prefilter_cubemaps();
 
   LTexCoord get_vertex_uv(texinfo_t *texinfo, dvertex_t *vert, bool lightmap = false) const;
 
-  PT(EggVertex) make_vertex(EggVertexPool *vpool, EggPolygon *poly,
-                            dedge_t *edge, texinfo_t *texinfo,
-                            dface_t *face, int k, Texture *tex);
-  PT(EggVertex) make_vertex_ai(EggVertexPool *vpool, EggPolygon *poly, dedge_t *edge, int k);
+  void get_face_vertices(const dface_t *face, pvector<dvertex_t *> &verts) const;
 
   cubemap_t *find_closest_cubemap(const LPoint3 &pos);
 
   void init_dface_lightmap_info(dface_lightmap_info_t *info, int facenum);
 
+  uint64_t get_geom_cache_hash() const;
+  void get_geom_cache_dependents(vector_string &files) const;
+  bool read_geom_cache();
+  void write_geom_cache();
+
 protected:
   BSPLoader *_loader;
 
@@ -329,6 +397,14 @@ protected:
 
   NodePath _fake_dl;
   LVector3 _shadow_dir;
+
+  // The first planar reflective surface found while building the faces.  It
+  // is handed to the shader generator when the level is activated.
+  bool _has_planar_reflection;
+  LVector3 _planar_reflection_normal;
+  float _planar_reflection_height;
+
+  bool _activated;
   entity_t *_light_environment;
 
   bool _has_pvs_data;
@@ -344,6 +420,10 @@ protected:
   int _curr_leaf_idx;
 
   Filename _map_file;
+  uint64_t _file_hash;
+
+  // Geometry of an earlier load of this map, while it is being restored.
+  PT(BSPGeomCache) _geom_cache;
 
   std::unordered_map<const dface_t *, const dmodel_t *> _dface_dmodels;
 
@@ -368,9 +448,9 @@ protected:
   typedef pmap<PT(BulletRigidBodyNode), TriangleIndex2BSPCollisionData_t> BSPCollisionData_t;
   BSPCollisionData_t _brush_collision_data;
 
-  // A per-leaf list of world Geoms.
-  // This list of Geoms will be rendered for the current leaf.
-  pvector<GeomNode::Geoms> _leaf_world_geoms;
+  // The world batches to render for each leaf.  Leafs with the same PVS
+  // share a cluster.
+  pvector<PT(WorldCluster)> _leaf_world_clusters;
 
   friend class BSPLoader;
   friend class BSPCullTraverser;
@@ -380,3 +460,8 @@ INLINE void BSPLevel::
 set_filename(const Filename &file) {
   _map_file = file;
 }
+
+INLINE void BSPLevel::
+set_file_hash(uint64_t hash) {
+  _file_hash = hash;
+}
@@ -12,9 +12,17 @@
 #include "bsploader.h"
 #include "dSearchPath.h"
 #include "virtualFileSystem.h"
+#include "configVariableBool.h"
+#include "filelib.h"
+#include "bsp_geom_cache.h"
+#include "asyncTaskManager.h"
 
 NotifyCategoryDef(bsploader, "");
 
+static ConfigVariableBool bsp_mmap("bsp_mmap", true,
+  PRC_DESC("Memory map BSP files when loading them, rather than reading them "
+           "into memory first."));
+
 BSPLoader *BSPLoader::_global_ptr = nullptr;
 
 void BSPLoader::cleanup(bool is_transition) {
@@ -31,9 +39,78 @@ void BSPLoader::cleanup(bool is_transition) {
   set_level(nullptr);
 }
 
+/**
+ * Loads the indicated BSP file and makes it the active level, all on the
+ * calling thread.  The current level is cleaned up first.
+ */
 bool BSPLoader::read(const Filename &file, bool is_transition) {
   cleanup(is_transition);
 
+  PT(BSPLevel) level = read_level(file);
+  if (level == nullptr) {
+    return false;
+  }
+
+  return activate_level(level, is_transition);
+}
+
+/**
+ * Starts loading the indicated BSP file in the background and returns the
+ * request, which can be awaited and polled for progress.
+ *
+ * The level is built on the BSP loader thread while the current level stays
+ * active.  If activate is true, the request then makes it the active level
+ * on the main thread by itself; otherwise the level waits on the request
+ * until it is passed to activate().
+ */
+PT(BSPLoadRequest) BSPLoader::
+read_async(const Filename &file, bool is_transition, bool activate) {
+  AsyncTaskManager *task_mgr = AsyncTaskManager::get_global_ptr();
+  AsyncTaskChain *chain = task_mgr->find_task_chain(BSPLoadRequest::get_chain_name());
+  if (chain == nullptr) {
+    chain = task_mgr->make_task_chain(BSPLoadRequest::get_chain_name());
+    chain->set_num_threads(1);
+    chain->set_thread_priority(TP_low);
+  }
+
+  PT(BSPLoadRequest) request = new BSPLoadRequest(this, file, is_transition, activate);
+  request->set_task_chain(BSPLoadRequest::get_chain_name());
+  task_mgr->add(request);
+  return request;
+}
+
+/**
+ * Makes the level built by the indicated request the active level, cleaning
+ * up the current one.  Must be called on the main thread, once the request
+ * is ready.  Returns true on success.
+ */
+bool BSPLoader::
+activate(BSPLoadRequest *request) {
+  nassertr(request != nullptr, false);
+  nassertr_always(request->is_ready(), false);
+
+  request->set_phase(BSPLoadRequest::P_activating);
+  if (!activate_level(request->_level, request->is_transition())) {
+    request->set_phase(BSPLoadRequest::P_failed);
+    request->_level = nullptr;
+    return false;
+  }
+
+  request->set_phase(BSPLoadRequest::P_done);
+  return true;
+}
+
+/**
+ * Reads the indicated BSP file and builds a level from it, without touching
+ * the active level, so this may be called from any thread.  The progress is
+ * reported to the request, if one is given.  Returns nullptr on failure.
+ */
+PT(BSPLevel) BSPLoader::
+read_level(const Filename &file, BSPLoadRequest *request) {
+  if (request != nullptr) {
+    request->set_phase(BSPLoadRequest::P_reading);
+  }
+
   dtexdata_init();
 
   VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
@@ -59,33 +136,76 @@ bool BSPLoader::read(const Filename &file, bool is_transition) {
     bsploader_cat.error()
       << "Could not find BSP `" << file << "` on model-path " << get_model_path()
       << "\n";
-      return false;
+      return nullptr;
   }
 
   bsploader_cat.info()
     << "Reading " << load_filename.get_fullpath() << "...\n";
 
-  string data;
-  vfs->read_file(load_filename, data, true);
-  int length = data.length();
-  char *buffer = new char[length + 1];
-  memcpy(buffer, data.c_str(), length);
-  bspdata_t *bspdata = LoadBSPImage((dheader_t *)buffer);
+  bspdata_t *bspdata = nullptr;
+  bool hash_file = BSPGeomCache::is_enabled();
+  uint64_t hash = 0;
+
+  // If the BSP is a plain file on disk, or stored uncompressed in a mounted
+  // Multifile, map it and copy the lumps straight out of the page cache.
+  // Otherwise read it into one temporary buffer.
+  PT(VirtualFile) vfile = vfs->get_file(load_filename);
+  SubfileInfo info;
+  filemapping_t mapping;
+  if (bsp_mmap && vfile != nullptr && vfile->get_system_info(info) &&
+      MapFile(info.get_filename().to_os_specific().c_str(), info.get_start(), info.get_size(), &mapping)) {
+    bspdata = LoadBSPImage(mapping.data, mapping.length);
+    if (hash_file) {
+      hash = BSPGeomCache::hash_file(mapping.data, mapping.length);
+    }
+    UnmapFile(&mapping);
+
+  } else {
+    vector_uchar data;
+    if (!vfs->read_file(load_filename, data, true)) {
+      bsploader_cat.error()
+        << "Could not read " << load_filename << "\n";
+      return nullptr;
+    }
+    bspdata = LoadBSPImage(data.data(), data.size());
+    if (hash_file) {
+      hash = BSPGeomCache::hash_file(data.data(), data.size());
+    }
+  }
+
+  if (bspdata == nullptr) {
+    bsploader_cat.error()
+      << load_filename << " is not a valid BSP file\n";
+    return nullptr;
+  }
 
   PT(BSPLevel) level = make_level();
   if (!level) {
-    return false;
+    return nullptr;
   }
   level->set_filename(load_filename);
-  if (!level->load(bspdata)) {
+  level->set_file_hash(hash);
+  if (!level->load(bspdata, request)) {
     level->cleanup(false);
-    return false;
+    return nullptr;
   }
 
+  return level;
+}
+
+/**
+ * Makes the indicated level, which has been built by read_level(), the active
+ * level and loads its entities.  The current level is cleaned up first.
+ */
+bool BSPLoader::
+activate_level(BSPLevel *level, bool is_transition) {
+  cleanup(is_transition);
+
   inc_level_context();
 
   // Make this the active level.
   set_level(level);
+  level->activate();
 
   load_entities();
 
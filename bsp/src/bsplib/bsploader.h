@@ -16,6 +16,7 @@
 #include "filename.h"
 #include "cycleData.h"
 #include "bsplevel.h"
+#include "bsp_load_request.h"
 
 NotifyCategoryDeclNoExport(bsploader);
 
@@ -34,6 +35,9 @@ PUBLISHED:
   }
 
   virtual bool read(const Filename &file, bool is_transition = false);
+  PT(BSPLoadRequest) read_async(const Filename &file, bool is_transition = false,
+                                bool activate = true);
+  bool activate(BSPLoadRequest *request);
 
   void set_ai(bool ai);
   INLINE bool is_ai() const {
@@ -56,7 +60,11 @@ PUBLISHED:
   static void set_global_ptr(BSPLoader *ptr);
   static BSPLoader *get_global_ptr();
 
+public:
+  PT(BSPLevel) read_level(const Filename &file, BSPLoadRequest *request = nullptr);
+
 protected:
+  virtual bool activate_level(BSPLevel *level, bool is_transition);
   virtual void cleanup_entities(bool is_transition);
   virtual void load_entities() = 0;
   virtual PT(BSPLevel) make_level();
@@ -13,6 +13,9 @@
 
 #include "bsploader.h"
 #include "bsp_render.h"
+#include "bsp_geom_cache.h"
+#include "bsp_cubemap_cache.h"
+#include "bsp_load_request.h"
 #include "shader_generator.h"
 #include "shader_spec.h"
 #include "aux_data_attrib.h"
@@ -63,6 +66,7 @@ init_libbsplib() {
   BSPCullTraverser::init_type();
   BSPRoot::init_type();
   BSPProp::init_type();
+  BSPProp::register_with_read_factory();
   BSPModel::init_type();
   BSPShaderGenerator::init_type();
   GlowNode::init_type();
@@ -73,6 +77,7 @@ init_libbsplib() {
 
   AuxDataAttrib::init_type();
   StaticPropAttrib::init_type();
+  StaticPropAttrib::register_with_read_factory();
   BloomAttrib::init_type();
 
   ShaderSpec::init_type();
@@ -80,6 +85,12 @@ init_libbsplib() {
   BoundingKDOP::init_type();
 
   BSPTextureFilter::init_type();
+
+  BSPGeomCache::init_type();
+  BSPGeomCache::register_with_read_factory();
+  BSPCubemapCache::init_type();
+  BSPCubemapCache::register_with_read_factory();
+  BSPLoadRequest::init_type();
   TexturePool::get_global_ptr()->register_filter(new BSPTextureFilter);
 
   DynamicRender::init_type();
@@ -0,0 +1,373 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file cubemap_prefilter.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#include "cubemap_prefilter.h"
+#include "asyncTaskManager.h"
+#include "genericAsyncTask.h"
+#include "configVariableInt.h"
+#include "thread.h"
+#include "mathNumbers.h"
+
+#include <thread>
+
+static ConfigVariableInt cubemap_prefilter_threads(
+  "bsp_cubemap_prefilter_threads", -1,
+  PRC_DESC("Number of threads that build the mip levels of the environment "
+           "cubemaps.  -1 picks one based on the number of CPUs."));
+
+static ConfigVariableInt cubemap_prefilter_samples(
+  "bsp_cubemap_prefilter_samples", 64,
+  PRC_DESC("Number of GGX samples taken for each texel of a prefiltered "
+           "cubemap mip level."));
+
+/**
+ * Returns the direction through the point (s, t) of a cube map face, using
+ * the OpenGL cube map conventions.  s and t run from 0 to 1.
+ */
+static LVector3f face_dir(int face, float s, float t) {
+  float sc = s * 2.0f - 1.0f;
+  float tc = t * 2.0f - 1.0f;
+  switch (face) {
+  case 0:
+    return LVector3f(1.0f, -tc, -sc);
+  case 1:
+    return LVector3f(-1.0f, -tc, sc);
+  case 2:
+    return LVector3f(sc, 1.0f, tc);
+  case 3:
+    return LVector3f(sc, -1.0f, -tc);
+  case 4:
+    return LVector3f(sc, -tc, 1.0f);
+  default:
+    return LVector3f(-sc, -tc, -1.0f);
+  }
+}
+
+/**
+ * The inverse of face_dir(): finds the face that the direction points into,
+ * and the point (s, t) on it.
+ */
+static int dir_face(const LVector3f &dir, float &s, float &t) {
+  float ax = fabsf(dir[0]);
+  float ay = fabsf(dir[1]);
+  float az = fabsf(dir[2]);
+
+  int face;
+  float ma, sc, tc;
+  if (ax >= ay && ax >= az) {
+    face = dir[0] > 0.0f ? 0 : 1;
+    ma = ax;
+    sc = dir[0] > 0.0f ? -dir[2] : dir[2];
+    tc = -dir[1];
+  } else if (ay >= az) {
+    face = dir[1] > 0.0f ? 2 : 3;
+    ma = ay;
+    sc = dir[0];
+    tc = dir[1] > 0.0f ? dir[2] : -dir[2];
+  } else {
+    face = dir[2] > 0.0f ? 4 : 5;
+    ma = az;
+    sc = dir[2] > 0.0f ? dir[0] : -dir[0];
+    tc = -dir[1];
+  }
+
+  s = (sc / ma + 1.0f) * 0.5f;
+  t = (tc / ma + 1.0f) * 0.5f;
+  return face;
+}
+
+static float radical_inverse(unsigned int bits) {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return (float)bits * 2.3283064365386963e-10f;
+}
+
+/**
+ *
+ */
+CubemapPrefilter::
+CubemapPrefilter(int size) :
+  _size(size),
+  _num_mips(get_num_mips(size)) {
+
+  for (int i = 0; i < 6; i++) {
+    _jobs[i].prefilter = this;
+    _jobs[i].face = i;
+  }
+}
+
+/**
+ *
+ */
+CubemapPrefilter::
+~CubemapPrefilter() {
+  // The tasks point back at us.
+  wait();
+}
+
+/**
+ * Returns the number of mip levels of a cubemap of the indicated size, all
+ * the way down to 1x1.
+ */
+int CubemapPrefilter::
+get_num_mips(int size) {
+  int num_mips = 1;
+  while ((size >> num_mips) > 0 && num_mips < 16) {
+    num_mips++;
+  }
+  return num_mips;
+}
+
+/**
+ * Sets the image of one face of the cubemap, which becomes mip level 0.  The
+ * image is expected to be in linear space, and may be brighter than 1.
+ */
+void CubemapPrefilter::
+set_face(int face, const PNMImage &image) {
+  nassertv(face >= 0 && face < 6);
+  nassertv(image.get_x_size() == _size && image.get_y_size() == _size);
+
+  pvector<LVecBase3f> &level = _sources[face][0];
+  level.resize(_size * _size);
+  for (int y = 0; y < _size; y++) {
+    for (int x = 0; x < _size; x++) {
+      level[y * _size + x] = image.get_xel(x, y);
+    }
+  }
+}
+
+/**
+ * Starts filtering the cubemap.  All six faces must have been set.  If the
+ * platform has no threads, the filtering is done before this returns.
+ */
+void CubemapPrefilter::
+start() {
+  build_sources();
+
+  if (!Thread::is_threading_supported()) {
+    for (int i = 0; i < 6; i++) {
+      filter_face(i);
+    }
+    return;
+  }
+
+  AsyncTaskManager *task_mgr = AsyncTaskManager::get_global_ptr();
+  AsyncTaskChain *chain = task_mgr->find_task_chain(get_chain_name());
+  if (chain == nullptr) {
+    int num_threads = cubemap_prefilter_threads.get_value();
+    if (num_threads < 0) {
+      num_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    }
+    chain = task_mgr->make_task_chain(get_chain_name());
+    chain->set_num_threads(std::max(num_threads, 1));
+    chain->set_thread_priority(TP_low);
+  }
+
+  for (int i = 0; i < 6; i++) {
+    _tasks[i] = new GenericAsyncTask("prefilter-face", &face_task, &_jobs[i]);
+    _tasks[i]->set_task_chain(get_chain_name());
+    task_mgr->add(_tasks[i]);
+  }
+}
+
+/**
+ * Waits for the filtering started by start() to finish.
+ */
+void CubemapPrefilter::
+wait() {
+  for (int i = 0; i < 6; i++) {
+    if (_tasks[i] != nullptr) {
+      _tasks[i]->wait();
+      _tasks[i] = nullptr;
+    }
+  }
+}
+
+/**
+ * Loads the prefiltered mip levels into the indicated cube map texture, which
+ * already has level 0.  The texture is set up to be sampled with mipmaps.
+ */
+void CubemapPrefilter::
+store(Texture *tex) const {
+  for (int mip = 1; mip < _num_mips; mip++) {
+    for (int face = 0; face < 6; face++) {
+      load_mip(tex, face, mip, get_mip_size(mip), get_mip(face, mip));
+    }
+  }
+}
+
+/**
+ * Loads one face of one mip level of a cube map texture from linear colors.
+ * The colors are stored the same way the cubemaps are loaded from the BSP
+ * file.
+ */
+void CubemapPrefilter::
+load_mip(Texture *tex, int face, int mip, int size, const LVecBase3f *texels) {
+  PNMImage img(size, size);
+  img.set_color_space(ColorSpace::CS_linear);
+  img.set_maxval(USHRT_MAX);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      img.set_xel(x, y, texels[y * size + x]);
+    }
+  }
+  tex->load(img, face, mip);
+  tex->set_minfilter(SamplerState::FT_linear_mipmap_linear);
+}
+
+/**
+ * Returns the name of the task chain the faces are filtered on.
+ */
+const char *CubemapPrefilter::
+get_chain_name() {
+  return "cubemap_prefilter";
+}
+
+/**
+ *
+ */
+AsyncTask::DoneStatus CubemapPrefilter::
+face_task(GenericAsyncTask *task, void *data) {
+  FaceJob *job = (FaceJob *)data;
+  job->prefilter->filter_face(job->face);
+  return AsyncTask::DS_done;
+}
+
+/**
+ * Makes the box filtered chain of each face that filter_face() samples from.
+ */
+void CubemapPrefilter::
+build_sources() {
+  for (int face = 0; face < 6; face++) {
+    nassertv(_sources[face][0].size() == (size_t)(_size * _size));
+
+    for (int mip = 1; mip < _num_mips; mip++) {
+      const pvector<LVecBase3f> &src = _sources[face][mip - 1];
+      int src_size = get_mip_size(mip - 1);
+      int size = get_mip_size(mip);
+
+      pvector<LVecBase3f> &dest = _sources[face][mip];
+      dest.resize(size * size);
+      for (int y = 0; y < size; y++) {
+        int y0 = std::min(y * 2, src_size - 1);
+        int y1 = std::min(y * 2 + 1, src_size - 1);
+        for (int x = 0; x < size; x++) {
+          int x0 = std::min(x * 2, src_size - 1);
+          int x1 = std::min(x * 2 + 1, src_size - 1);
+          dest[y * size + x] = (src[y0 * src_size + x0] + src[y0 * src_size + x1] +
+                                src[y1 * src_size + x0] + src[y1 * src_size + x1]) * 0.25f;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Convolves one face of each mip level with the GGX lobe of its roughness,
+ * assuming the view direction is the same as the normal.  Runs on a thread of
+ * the prefilter task chain, and only reads the source levels, so the faces
+ * don't get in each other's way.
+ */
+void CubemapPrefilter::
+filter_face(int face) {
+  _mips[face][0] = _sources[face][0];
+
+  int num_samples = std::max(cubemap_prefilter_samples.get_value(), 1);
+  float texel_solid_angle = 4.0f * MathNumbers::pi_f / (6.0f * _size * _size);
+
+  struct Sample {
+    // The light direction in the tangent space of the normal.
+    LVector3f dir;
+    float weight;
+    int level;
+  };
+  pvector<Sample> samples;
+  samples.reserve(num_samples);
+
+  for (int mip = 1; mip < _num_mips; mip++) {
+    float roughness = std::min((float)mip / (float)(num_roughness_mips - 1), 1.0f);
+    float alpha = roughness * roughness;
+    float alpha2 = alpha * alpha;
+
+    // The sample directions are the same for every texel of the level.
+    samples.clear();
+    for (int i = 0; i < num_samples; i++) {
+      float u = (float)i / (float)num_samples;
+      float v = radical_inverse((unsigned int)i);
+
+      float phi = 2.0f * MathNumbers::pi_f * u;
+      float cos_theta = sqrtf((1.0f - v) / (1.0f + (alpha2 - 1.0f) * v));
+      float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+      LVector3f h(sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta);
+
+      Sample sample;
+      sample.dir = h * (2.0f * cos_theta) - LVector3f(0.0f, 0.0f, 1.0f);
+      sample.weight = sample.dir[2];
+      if (sample.weight <= 0.0f) {
+        continue;
+      }
+
+      // Read from the source level whose texels cover about as much of the
+      // sphere as the sample does.
+      float d = (cos_theta * cos_theta) * (alpha2 - 1.0f) + 1.0f;
+      float pdf = alpha2 / (MathNumbers::pi_f * d * d) * 0.25f;
+      float sample_solid_angle = 1.0f / (num_samples * pdf + 0.0001f);
+      float level = 0.5f * log2f(sample_solid_angle / texel_solid_angle) + 1.0f;
+      sample.level = std::min(std::max((int)(level + 0.5f), 0), _num_mips - 1);
+
+      samples.push_back(sample);
+    }
+
+    int size = get_mip_size(mip);
+    pvector<LVecBase3f> &dest = _mips[face][mip];
+    dest.resize(size * size);
+
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        // Row 0 of the image is the top of the face, the last row of the
+        // texture.
+        LVector3f n = face_dir(face, (x + 0.5f) / size, 1.0f - (y + 0.5f) / size);
+        n.normalize();
+
+        LVector3f up = fabsf(n[2]) < 0.999f ? LVector3f::unit_z() : LVector3f::unit_x();
+        LVector3f tx = up.cross(n);
+        tx.normalize();
+        LVector3f ty = n.cross(tx);
+
+        LVecBase3f total(0.0f);
+        float total_weight = 0.0f;
+        for (const Sample &sample : samples) {
+          LVector3f l = tx * sample.dir[0] + ty * sample.dir[1] + n * sample.dir[2];
+          total += this->sample(l, sample.level) * sample.weight;
+          total_weight += sample.weight;
+        }
+
+        dest[y * size + x] = total_weight > 0.0f ? total / total_weight : total;
+      }
+    }
+  }
+}
+
+/**
+ * Returns the texel of the indicated source level in the direction.
+ */
+const LVecBase3f &CubemapPrefilter::
+sample(const LVector3f &dir, int level) const {
+  float s, t;
+  int face = dir_face(dir, s, t);
+  int size = get_mip_size(level);
+  int x = std::min(std::max((int)(s * size), 0), size - 1);
+  int y = std::min(std::max((int)((1.0f - t) * size), 0), size - 1);
+  return _sources[face][level][y * size + x];
+}
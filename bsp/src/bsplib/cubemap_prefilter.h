@@ -0,0 +1,94 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file cubemap_prefilter.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ */
+
+#ifndef CUBEMAP_PREFILTER_H
+#define CUBEMAP_PREFILTER_H
+
+#include "config_bsplib.h"
+#include "referenceCount.h"
+#include "asyncTask.h"
+#include "pnmImage.h"
+#include "texture.h"
+#include "luse.h"
+
+class GenericAsyncTask;
+
+/**
+ * Builds the mip levels of an environment cubemap on the CPU.
+ *
+ * The shaders pick the mip level of the cubemap from the roughness of the
+ * surface (see SampleCubeMapLod() in common_lighting_frag.inc.glsl), so mip
+ * level n has to be the cubemap convolved with the GGX lobe of roughness
+ * n / (num_roughness_mips - 1) rather than a plain box filter, which is what
+ * the driver would generate.
+ *
+ * The six faces are filtered in parallel, one task each on the cubemap
+ * prefilter task chain.  start() returns right away, so the caller can get
+ * on with the next cubemap while the faces are filtered.
+ */
+class EXPCL_PANDABSP CubemapPrefilter : public ReferenceCount {
+public:
+  // Must match CUBEMAP_MIPS in common_lighting_frag.inc.glsl.
+  static const int num_roughness_mips = 8;
+
+  CubemapPrefilter(int size);
+  ~CubemapPrefilter();
+
+  void set_face(int face, const PNMImage &image);
+
+  void start();
+  void wait();
+
+  INLINE int get_size() const {
+    return _size;
+  }
+  INLINE int get_num_mips() const {
+    return _num_mips;
+  }
+  INLINE int get_mip_size(int mip) const {
+    return std::max(1, _size >> mip);
+  }
+  INLINE const LVecBase3f *get_mip(int face, int mip) const {
+    return _mips[face][mip].data();
+  }
+
+  void store(Texture *tex) const;
+
+  static int get_num_mips(int size);
+  static void load_mip(Texture *tex, int face, int mip, int size, const LVecBase3f *texels);
+  static const char *get_chain_name();
+
+private:
+  struct FaceJob {
+    CubemapPrefilter *prefilter;
+    int face;
+  };
+
+  static AsyncTask::DoneStatus face_task(GenericAsyncTask *task, void *data);
+
+  void build_sources();
+  void filter_face(int face);
+  const LVecBase3f &sample(const LVector3f &dir, int level) const;
+
+  int _size;
+  int _num_mips;
+
+  // Box filtered copies of the input, which the samples are read from.  A
+  // sample that covers a lot of the sphere reads a smaller level, so that a
+  // few samples per texel are enough.
+  pvector<LVecBase3f> _sources[6][16];
+  pvector<LVecBase3f> _mips[6][16];
+
+  FaceJob _jobs[6];
+  PT(AsyncTask) _tasks[6];
+};
+
+#endif // CUBEMAP_PREFILTER_H
@@ -40,7 +40,6 @@
 #include <depthWriteAttrib.h>
 #include <colorWriteAttrib.h>
 #include <cullFaceAttrib.h>
-#include <rigidBodyCombiner.h>
 #include <bulletWorld.h>
 #include <bulletClosestHitRayResult.h>
 #include <bitMask.h>
@@ -54,10 +53,12 @@ static PStatCollector decal_node_collector("BSP:DecalTrace:DecalNode");
 static PStatCollector decal_state_collector("BSP:DecalTrace:DecalState");
 static PStatCollector decal_add_geom_collector("BSP:DecalTrace:InsertGeometry");
 static PStatCollector decal_init_collector("BSP:DecalTrace:InitDecalInfo");
-static PStatCollector decal_collect("BSP:DecalTrace:BatchDecals");
 
 static ConfigVariableInt decals_max("decals_max", 20);
 static ConfigVariableBool decals_remove_overlapping("decals_remove_overlapping", true);
+static ConfigVariableInt decals_pool_size("decals_pool_size", 4096,
+    "The number of vertices in the ring of each decal material on each brush "
+    "model.  Once a ring is full, new decals overwrite the oldest ones in it.");
 
 static const int MAX_DECALCLIPVERT = 48;
 static const float DECAL_CLIP_EPSILON = 0.01f;
@@ -160,20 +161,6 @@ struct decalinfo_t
             }
         }
 
-        const GeomVertexFormat *format;
-        if (lightmap)
-        {
-            format = get_decal_format_lightmap();
-        }
-        else
-        {
-            format = get_decal_format_no_lightmap();
-        }
-        vdata = new GeomVertexData("decal", format, GeomEnums::UH_static);
-        vdata->reserve_num_rows(256);
-        vdata_row_count = 0;
-
-        geom = new Geom(vdata);
     }
 
     void change_surface(const dface_t *dface)
@@ -205,11 +192,9 @@ struct decalinfo_t
     bool lightmap;
     bool bumped_lightmap;
 
-    int vdata_row_count;
-    PT(GeomVertexData)
-    vdata;
-    PT(Geom)
-    geom;
+    // The clipped polygons, in model space.
+    pvector<DecalPool::Vertex> verts;
+    pvector<int> poly_sizes;
 };
 
 // Template classes for the clipper.
@@ -471,23 +456,7 @@ void R_DecalSurface(const dface_t *face, decalinfo_t *pinfo)
         return;
 
     ////////////////////////////////////////////////////////////////////////////////////
-    // Generate the decal geometry
-
-    int first_row = pinfo->vdata_row_count;
-    GeomVertexWriter vtx_writer(pinfo->vdata, InternalName::get_vertex());
-    vtx_writer.set_row(first_row);
-    GeomVertexWriter norm_writer(pinfo->vdata, InternalName::get_normal());
-    norm_writer.set_row(first_row);
-    GeomVertexWriter uv_writer(pinfo->vdata, InternalName::get_texcoord());
-    uv_writer.set_row(first_row);
-    GeomVertexWriter col_writer(pinfo->vdata, InternalName::get_color());
-    col_writer.set_row(first_row);
-    GeomVertexWriter lm_uv_writer;
-    if (pinfo->lightmap)
-    {
-        lm_uv_writer = GeomVertexWriter(pinfo->vdata, in_texcoord_lightmap);
-        lm_uv_writer.set_row(first_row);
-    }
+    // Generate the decal polygon; the pool triangulates it when it is written.
 
     LVector3 local_normal = pinfo->decal_world_to_model.xform_vec(pinfo->surface_normal);
 
@@ -495,32 +464,18 @@ void R_DecalSurface(const dface_t *face, decalinfo_t *pinfo)
     {
         decalvert_t *cvert = g_DecalClipVerts + i;
 
-        LPoint3 local_pos = pinfo->decal_world_to_model.xform_point(cvert->position / 16.0f);
-        vtx_writer.add_data3f(local_pos);
-        norm_writer.add_data3f(local_normal);
-        uv_writer.add_data2f(cvert->coords);
-        col_writer.add_data4f(pinfo->decal_color);
+        DecalPool::Vertex vert;
+        vert.pos = pinfo->decal_world_to_model.xform_point(cvert->position / 16.0f);
+        vert.normal = local_normal;
+        vert.coords = cvert->coords;
         if (pinfo->lightmap)
         {
-            lm_uv_writer.add_data2f(level->get_lightcoords(facenum, cvert->position));
+            vert.lightmap_coords = level->get_lightcoords(facenum, cvert->position);
         }
-
-        pinfo->vdata_row_count++;
+        pinfo->verts.push_back(vert);
     }
 
-    PT(GeomTriangles)
-    tris = new GeomTriangles(GeomEnums::UH_static);
-    int ntris = pinfo->vert_count - 2;
-    for (int tri = 0; tri < ntris; tri++)
-    {
-        tris->add_vertices(
-            first_row,
-            first_row + ((tri + 1) % pinfo->vert_count),
-            first_row + ((tri + 2) % pinfo->vert_count));
-        tris->close_primitive();
-    }
-
-    pinfo->geom->add_primitive(tris);
+    pinfo->poly_sizes.push_back(pinfo->vert_count);
 }
 
 void R_DecalNodeSurfaces(const dnode_t *pnode, decalinfo_t *info)
@@ -774,23 +729,76 @@ void DecalManager::decal_trace(const std::string &decal_material, const LPoint2
 
     decal_state_collector.stop();
 
-    decal_add_geom_collector.start();
-    PT(GeomNode)
-    decal_geomnode = new GeomNode("decal");
-    decal_geomnode->add_geom(info.geom, decal_state);
-    NodePath decalnp = NodePath(decal_geomnode);
-    NodePath rbcnp = NodePath(mdata.decal_rbc);
-    decalnp.reparent_to(rbcnp);
-    decal_add_geom_collector.stop();
+    if (info.verts.empty() || mdata.decal_pool == nullptr)
+        return;
 
     ///////////////////////////////////////////////////////////////////////////////////////
 
-    LPoint3 mins, maxs;
-    //decalnp.calc_tight_bounds( mins, maxs );
-    PT(BoundingBox)
-    bounds = new BoundingBox(mins, maxs);
+    LPoint3 mins = info.verts[0].pos;
+    LPoint3 maxs = mins;
+    for (size_t i = 1; i < info.verts.size(); i++)
+    {
+        const LPoint3 &pos = info.verts[i].pos;
+        mins = mins.fmin(pos);
+        maxs = maxs.fmax(pos);
+    }
+
+    PendingDecal pending;
+    pending.decal = new Decal;
+    pending.decal->bounds = new BoundingBox(mins, maxs);
+    pending.decal->flags = flags;
+    pending.decal->brush_modelnum = merged_modelnum;
+    pending.pool = mdata.decal_pool;
+    pending.state = decal_state;
+    pending.lightmap = info.lightmap;
+    pending.color = decal_color;
+    pending.verts.swap(info.verts);
+    pending.poly_sizes.swap(info.poly_sizes);
+    _pending.push_back(pending);
+
+    if (_batch_depth == 0)
+    {
+        flush_pending();
+    }
+}
+
+/**
+ * Holds back the decals traced from here on until end_batch(), so that the
+ * impacts of a whole volley are written into the pools together.
+ */
+void DecalManager::begin_batch()
+{
+    _batch_depth++;
+}
+
+/**
+ * Writes the decals traced since the matching begin_batch().
+ */
+void DecalManager::end_batch()
+{
+    nassertv(_batch_depth > 0);
+    if (--_batch_depth == 0)
+    {
+        flush_pending();
+    }
+}
+
+void DecalManager::flush_pending()
+{
+    PStatTimer timer(decal_add_geom_collector);
 
-    if (decals_remove_overlapping.get_value() && (flags & DECALFLAGS_STATIC) == 0)
+    for (size_t i = 0; i < _pending.size(); i++)
+    {
+        add_decal(_pending[i]);
+    }
+    _pending.clear();
+}
+
+void DecalManager::add_decal(PendingDecal &pending)
+{
+    Decal *decal = pending.decal;
+
+    if (decals_remove_overlapping.get_value() && (decal->flags & DECALFLAGS_STATIC) == 0)
     {
         for (int i = (int)_decals.size() - 1; i >= 0; i--)
         {
@@ -800,49 +808,57 @@ void DecalManager::decal_trace(const std::string &decal_material, const LPoint2
             //
             // Only remove this decal if it is smaller than the decal
             // we are wanting to create over it, and it is not a static
-            // decal (placed by the level designer, etc).
-            if (other->bounds->contains(bounds) != BoundingVolume::IF_no_intersection &&
-                    other->bounds->get_volume() <= bounds->get_volume() &&
+            // decal (placed by the level designer, etc).  The bounds are
+            // in the space of the brush model, so only decals in the same
+            // pool can be compared.
+            if (other->pool == pending.pool &&
+                    other->bounds->contains(decal->bounds) != BoundingVolume::IF_no_intersection &&
+                    other->bounds->get_volume() <= decal->bounds->get_volume() &&
                     (other->flags & DECALFLAGS_STATIC) == 0)
             {
-                if (!other->decalnp.is_empty())
-                    other->decalnp.remove_node();
-                if (other->brush_modelnum != merged_modelnum)
-                    _level->get_brush_model_data(other->brush_modelnum).decal_rbc->collect();
-                _decals.erase(std::find(_decals.begin(), _decals.end(), other));
+                remove_decal(other);
+                _decals.erase(_decals.begin() + i);
             }
         }
     }
 
-    if (_decals.size() == decals_max.get_value())
+    if (!_decals.empty() && (int)_decals.size() >= decals_max.get_value())
     {
         // Remove the oldest decal to make space for the new one.
-        Decal *d = _decals.back();
-        if (!d->decalnp.is_empty())
+        remove_decal(_decals.back());
+        _decals.pop_back();
+    }
+
+    pvector<Decal *> evicted;
+    if (!pending.pool->add_decal(decal, pending.state, pending.lightmap, pending.color,
+                                 pending.verts, pending.poly_sizes, evicted))
+    {
+        return;
+    }
+
+    // The pool has already overwritten these.
+    for (size_t i = 0; i < evicted.size(); i++)
+    {
+        for (int j = (int)_decals.size() - 1; j >= 0; j--)
         {
-            d->decalnp.remove_node();
-            if (d->brush_modelnum != merged_modelnum)
-                _level->get_brush_model_data(d->brush_modelnum).decal_rbc->collect();
+            if (_decals[j] == evicted[i])
+            {
+                _decals.erase(_decals.begin() + j);
+                break;
+            }
         }
-        _decals.pop_back();
     }
 
-    PT(Decal)
-    decal = new Decal;
-    decal->decalnp = decalnp;
-    decal->bounds = bounds;
-    decal->flags = flags;
-    decal->brush_modelnum = merged_modelnum;
-    if ((flags & DECALFLAGS_STATIC) != 0)
+    if ((decal->flags & DECALFLAGS_STATIC) != 0)
         _map_decals.push_back(decal);
     else
         _decals.push_front(decal);
+}
 
-    decal_collect.start();
-    mdata.decal_rbc->collect();
-    //_decal_rbc->collect();
-    decal_collect.stop();
-    //_decal_rbc->get_internal_scene().ls();
+void DecalManager::remove_decal(Decal *decal)
+{
+    if (decal->pool != nullptr)
+        decal->pool->remove_decal(decal);
 }
 
 void DecalManager::studio_decal_trace(const std::string &decal_material, const LPoint2 &decal_scale,
@@ -853,35 +869,301 @@ void DecalManager::studio_decal_trace(const std::string &decal_material, const L
 
 void DecalManager::cleanup()
 {
+    _pending.clear();
+    _batch_depth = 0;
+
     for (size_t i = 0; i < _decals.size(); i++)
     {
-        Decal *d = _decals[i];
-        if (!d->decalnp.is_empty())
-            d->decalnp.remove_node();
+        remove_decal(_decals[i]);
     }
     _decals.clear();
 
     for (size_t i = 0; i < _map_decals.size(); i++)
     {
-        Decal *d = _map_decals[i];
-        if (!d->decalnp.is_empty())
-            d->decalnp.remove_node();
+        remove_decal(_map_decals[i]);
     }
     _map_decals.clear();
 
     if (!_decal_root.is_empty())
         _decal_root.remove_node();
-    _decal_rbc = nullptr;
 }
 
 void DecalManager::init()
 {
-    _decal_rbc = new RigidBodyCombiner("decal-root");
-    _decal_root = NodePath(_decal_rbc);
+    _decal_root = NodePath("decal-root");
     _decal_root.reparent_to(_level->get_result());
     _decal_root.hide(CAMERA_SHADOW);
 }
 
-DecalManager::DecalManager(BSPLevel *loader) : _level(loader)
+DecalManager::DecalManager(BSPLevel *loader) :
+    _level(loader),
+    _batch_depth(0)
 {
 }
+
+DecalPool::DecalPool() :
+    _node(new GeomNode("decals")),
+    _has_bounds(false)
+{
+}
+
+/**
+ * Writes the clipped polygons of the decal into the ring of its render state,
+ * overwriting the oldest decals in it if there is no more room.  The decals
+ * that were overwritten are added to evicted.  Returns false if the decal
+ * could not be added at all.
+ */
+bool DecalPool::add_decal(Decal *decal, const RenderState *state, bool lightmap,
+                          const LColorf &color, const pvector<Vertex> &verts,
+                          const pvector<int> &poly_sizes, pvector<Decal *> &evicted)
+{
+    int num_rows = (int)verts.size();
+    if (num_rows == 0)
+        return false;
+
+    int ring_index = find_ring(state, lightmap, (decal->flags & DECALFLAGS_STATIC) != 0);
+    int first_row = alloc_rows(ring_index, num_rows, evicted);
+    if (first_row < 0)
+        return false;
+
+    Ring &ring = _rings[ring_index];
+
+    {
+        GeomVertexWriter vtx_writer(ring.vdata, InternalName::get_vertex());
+        vtx_writer.set_row(first_row);
+        GeomVertexWriter norm_writer(ring.vdata, InternalName::get_normal());
+        norm_writer.set_row(first_row);
+        GeomVertexWriter uv_writer(ring.vdata, InternalName::get_texcoord());
+        uv_writer.set_row(first_row);
+        GeomVertexWriter col_writer(ring.vdata, InternalName::get_color());
+        col_writer.set_row(first_row);
+        GeomVertexWriter lm_uv_writer;
+        if (lightmap)
+        {
+            lm_uv_writer = GeomVertexWriter(ring.vdata, in_texcoord_lightmap);
+            lm_uv_writer.set_row(first_row);
+        }
+
+        for (int i = 0; i < num_rows; i++)
+        {
+            const Vertex &vert = verts[i];
+            vtx_writer.set_data3f(vert.pos);
+            norm_writer.set_data3f(vert.normal);
+            uv_writer.set_data2f(vert.coords);
+            col_writer.set_data4f(color);
+            if (lightmap)
+            {
+                lm_uv_writer.set_data2f(vert.lightmap_coords);
+            }
+        }
+    }
+
+    // Every row of the decal owns three index slots, which is more than
+    // enough for the fan of each polygon.  The slots left over stay
+    // degenerate.
+    PT(GeomVertexArrayData) indices = ring.tris->modify_vertices();
+    GeomVertexWriter index_writer(indices, 0);
+    index_writer.set_row(first_row * 3);
+    int poly_start = first_row;
+    int num_indices = 0;
+    for (size_t i = 0; i < poly_sizes.size(); i++)
+    {
+        int ntris = poly_sizes[i] - 2;
+        for (int tri = 0; tri < ntris; tri++)
+        {
+            index_writer.set_data1i(poly_start);
+            index_writer.set_data1i(poly_start + tri + 1);
+            index_writer.set_data1i(poly_start + tri + 2);
+            num_indices += 3;
+        }
+        poly_start += poly_sizes[i];
+    }
+    for (; num_indices < num_rows * 3; num_indices++)
+    {
+        index_writer.set_data1i(first_row);
+    }
+
+    decal->pool = this;
+    decal->ring = ring_index;
+    decal->first_row = first_row;
+    decal->num_rows = num_rows;
+    ring.decals.push_back(decal);
+
+    extend_bounds(verts);
+
+    return true;
+}
+
+/**
+ * Takes the decal's triangles out of the pool.  Its rows are reused once the
+ * ring comes back around to them.
+ */
+void DecalPool::remove_decal(Decal *decal)
+{
+    nassertv(decal->pool == this);
+
+    Ring &ring = _rings[decal->ring];
+    pdeque<Decal *>::iterator it = std::find(ring.decals.begin(), ring.decals.end(), decal);
+    if (it != ring.decals.end())
+    {
+        ring.decals.erase(it);
+    }
+    clear_indices(ring, decal->first_row, decal->num_rows);
+
+    // This may be the last reference to the pool, so it has to come last.
+    decal->pool = nullptr;
+}
+
+/**
+ * Returns the ring that holds the decals of the given state, creating it if
+ * it doesn't exist yet.
+ */
+int DecalPool::find_ring(const RenderState *state, bool lightmap, bool is_static)
+{
+    for (size_t i = 0; i < _rings.size(); i++)
+    {
+        const Ring &ring = _rings[i];
+        if (ring.state == state && ring.lightmap == lightmap && ring.is_static == is_static)
+        {
+            return (int)i;
+        }
+    }
+
+    Ring ring;
+    ring.state = state;
+    ring.lightmap = lightmap;
+    ring.is_static = is_static;
+    ring.capacity = 0;
+    ring.head = 0;
+    ring.vdata = new GeomVertexData("decals",
+                                    lightmap ? get_decal_format_lightmap() : get_decal_format_no_lightmap(),
+                                    GeomEnums::UH_dynamic);
+    ring.tris = new GeomTriangles(GeomEnums::UH_dynamic);
+    grow_ring(ring, is_static ? 256 : std::max(decals_pool_size.get_value(), MAX_DECALCLIPVERT));
+
+    ring.geom = new Geom(ring.vdata);
+    ring.geom->add_primitive(ring.tris);
+    _node->add_geom(ring.geom, state);
+
+    _rings.push_back(ring);
+    return (int)_rings.size() - 1;
+}
+
+/**
+ * Finds room for the given number of rows in the ring and returns the first
+ * one, or -1 if the decal is bigger than the whole ring.
+ */
+int DecalPool::alloc_rows(int ring_index, int num_rows, pvector<Decal *> &evicted)
+{
+    Ring &ring = _rings[ring_index];
+
+    if (ring.is_static)
+    {
+        // Static decals are never overwritten, the ring just gets bigger.
+        if (ring.head + num_rows > ring.capacity)
+        {
+            grow_ring(ring, std::max(ring.capacity * 2, ring.head + num_rows));
+        }
+        int first_row = ring.head;
+        ring.head += num_rows;
+        return first_row;
+    }
+
+    if (num_rows > ring.capacity)
+    {
+        return -1;
+    }
+
+    // Take the rows after the head, or go back around to the start if the
+    // decal doesn't fit before the end of the ring.  In that case the rows
+    // between the head and the end are given up as well.
+    int first_row = ring.head;
+    int end_row = ring.head + num_rows;
+    bool wrapped = false;
+    if (end_row > ring.capacity)
+    {
+        first_row = 0;
+        end_row = num_rows;
+        wrapped = true;
+    }
+
+    // The decals are kept in the order they were written, so the ones in
+    // the way are always the oldest.
+    while (!ring.decals.empty())
+    {
+        Decal *oldest = ring.decals.front();
+        bool overlaps = (oldest->first_row < end_row &&
+                         oldest->first_row + oldest->num_rows > first_row) ||
+                        (wrapped && oldest->first_row >= ring.head);
+        if (!overlaps)
+        {
+            break;
+        }
+
+        ring.decals.pop_front();
+        clear_indices(ring, oldest->first_row, oldest->num_rows);
+        oldest->pool = nullptr;
+        evicted.push_back(oldest);
+    }
+
+    ring.head = end_row;
+    return first_row;
+}
+
+/**
+ * Resizes the ring to hold the given number of rows.  New rows and their
+ * index slots are zeroed, which leaves them as degenerate triangles.
+ */
+void DecalPool::grow_ring(Ring &ring, int capacity)
+{
+    ring.vdata->set_num_rows(capacity);
+    if (capacity > 0xffff)
+    {
+        ring.tris->set_index_type(GeomEnums::NT_uint32);
+    }
+    PT(GeomVertexArrayData) indices = ring.tris->modify_vertices();
+    indices->set_num_rows(capacity * 3);
+    ring.capacity = capacity;
+}
+
+/**
+ * Collapses the triangles of the given rows onto a single vertex.
+ */
+void DecalPool::clear_indices(Ring &ring, int first_row, int num_rows)
+{
+    PT(GeomVertexArrayData) indices = ring.tris->modify_vertices();
+    GeomVertexWriter index_writer(indices, 0);
+    index_writer.set_row(first_row * 3);
+    for (int i = 0; i < num_rows * 3; i++)
+    {
+        index_writer.set_data1i(0);
+    }
+}
+
+/**
+ * The bounds only ever grow until the pool is cleared, which saves having to
+ * go over the vertices of the rings again when a decal is overwritten.
+ */
+void DecalPool::extend_bounds(const pvector<Vertex> &verts)
+{
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        if (!_has_bounds)
+        {
+            _mins = _maxs = verts[i].pos;
+            _has_bounds = true;
+        }
+        else
+        {
+            _mins = _mins.fmin(verts[i].pos);
+            _maxs = _maxs.fmax(verts[i].pos);
+        }
+    }
+
+    PT(BoundingBox) bounds = new BoundingBox(_mins, _maxs);
+    for (size_t i = 0; i < _rings.size(); i++)
+    {
+        _rings[i].geom->set_bounds(bounds);
+    }
+    _node->set_bounds(bounds);
+}
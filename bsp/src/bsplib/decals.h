@@ -18,9 +18,12 @@
 #include "pvector.h"
 #include "nodePath.h"
 #include "boundingBox.h"
-#include "rigidBodyCombiner.h"
+#include "geomNode.h"
+#include "geomVertexData.h"
+#include "geomTriangles.h"
 
 class BSPLevel;
+class Decal;
 
 enum
 {
@@ -28,10 +31,73 @@ enum
 	DECALFLAGS_STATIC = 1 << 0,
 };
 
+/**
+ * The decal geometry of a brush model.  Decals are grouped by render state,
+ * and the decals of each state are written into a fixed-size ring of
+ * vertices which overwrites its oldest decals in place once it is full, so
+ * that adding or removing a decal never rebuilds the model's decal geometry.
+ * Static decals get rings of their own which grow instead, so that they are
+ * never overwritten.
+ */
+class EXPCL_PANDABSP DecalPool : public ReferenceCount
+{
+public:
+	struct Vertex
+	{
+		LPoint3 pos;
+		LVector3 normal;
+		LVector2 coords;
+		LTexCoord lightmap_coords;
+	};
+
+	DecalPool();
+
+	bool add_decal(Decal *decal, const RenderState *state, bool lightmap,
+				   const LColorf &color, const pvector<Vertex> &verts,
+				   const pvector<int> &poly_sizes, pvector<Decal *> &evicted);
+	void remove_decal(Decal *decal);
+
+	INLINE GeomNode *get_node() const
+	{
+		return _node;
+	}
+
+private:
+	struct Ring
+	{
+		CPT(RenderState) state;
+		bool lightmap;
+		bool is_static;
+		PT(Geom) geom;
+		PT(GeomVertexData) vdata;
+		PT(GeomTriangles) tris;
+		int capacity;
+		int head;
+		// The decals in the ring, oldest first.
+		pdeque<Decal *> decals;
+	};
+
+	int find_ring(const RenderState *state, bool lightmap, bool is_static);
+	int alloc_rows(int ring, int num_rows, pvector<Decal *> &evicted);
+	void grow_ring(Ring &ring, int capacity);
+	void clear_indices(Ring &ring, int first_row, int num_rows);
+	void extend_bounds(const pvector<Vertex> &verts);
+
+	pvector<Ring> _rings;
+	PT(GeomNode) _node;
+	LPoint3 _mins, _maxs;
+	bool _has_bounds;
+};
+
 class Decal : public ReferenceCount
 {
 public:
-	NodePath decalnp;
+	// Where the decal's vertices live in the pool of its brush model.
+	PT(DecalPool) pool;
+	int ring;
+	int first_row;
+	int num_rows;
+
 	PT(BoundingBox)
 	bounds;
 	int flags;
@@ -55,6 +121,11 @@ public:
 							float rotate, const LPoint3 &start, const LPoint3 &end,
 							const LColorf &decal_color = LColorf(1), const int flags = 0);
 
+	// Decals traced between these are clipped as they come in, but only
+	// written into the pools once the batch ends.
+	void begin_batch();
+	void end_batch();
+
 	void cleanup();
 
 	INLINE NodePath get_decal_root() const
@@ -63,12 +134,28 @@ public:
 	}
 
 private:
-	PT(RigidBodyCombiner)
-	_decal_rbc;
+	struct PendingDecal
+	{
+		PT(Decal) decal;
+		PT(DecalPool) pool;
+		CPT(RenderState) state;
+		bool lightmap;
+		LColorf color;
+		pvector<DecalPool::Vertex> verts;
+		pvector<int> poly_sizes;
+	};
+
+	void flush_pending();
+	void add_decal(PendingDecal &pending);
+	void remove_decal(Decal *decal);
+
 	NodePath _decal_root;
 	BSPLevel *_level;
 	pdeque<PT(Decal)> _decals;
 	pvector<PT(Decal)> _map_decals;
+
+	int _batch_depth;
+	pvector<PendingDecal> _pending;
 };
 
 #endif // BSP_DECALS_H
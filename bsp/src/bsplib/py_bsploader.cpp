@@ -146,8 +146,8 @@ remove_py_entity(PyObject *obj) {
 }
 
 bool Py_BSPLoader::
-read(const Filename &filename, bool is_transition) {
-  if (!BSPLoader::read(filename, is_transition)) {
+activate_level(BSPLevel *level, bool is_transition) {
+  if (!BSPLoader::activate_level(level, is_transition)) {
     return false;
   }
 
@@ -202,8 +202,10 @@ void Py_CL_BSPLevel::
 load_geometry() {
   load_cubemaps();
 
-  LightmapPalettizer lmp(this);
-  _lightmap_dir = lmp.palettize_lightmaps();
+  if (!read_geom_cache()) {
+    LightmapPalettizer lmp(this);
+    _lightmap_dir = lmp.palettize_lightmaps();
+  }
 
   make_faces();
   SceneGraphReducer gr;
@@ -310,8 +312,8 @@ load_entities() {
         brush_model_data_t &model_data = level->get_brush_model_data(modelnum);
         model_data.model_root = level->get_model(0);
         model_data.merged_modelnum = 0;
-        NodePath(model_data.decal_rbc).remove_node();
-        model_data.decal_rbc = nullptr;
+        NodePath(model_data.decal_pool->get_node()).remove_node();
+        model_data.decal_pool = nullptr;
 
         dmodel_t *mdl = &bspdata->dmodels[modelnum];
 
@@ -349,8 +351,8 @@ load_entities() {
           brush_model_data_t &world_model = level->get_brush_model_data(0);
           brush_model_data_t &model_data = level->get_brush_model_data(modelnum);
           model_data.model_root = world_model.model_root;
-          NodePath(model_data.decal_rbc).remove_node();
-          model_data.decal_rbc = world_model.decal_rbc;
+          NodePath(model_data.decal_pool->get_node()).remove_node();
+          model_data.decal_pool = world_model.decal_pool;
           model_data.merged_modelnum = 0;
           continue;
         }
@@ -517,8 +519,8 @@ load_entities() {
 }
 
 bool Py_AI_BSPLoader::
-read(const Filename &filename, bool is_transition) {
-  if (!Py_BSPLoader::read(filename, is_transition)) {
+activate_level(BSPLevel *level, bool is_transition) {
+  if (!Py_BSPLoader::activate_level(level, is_transition)) {
     return false;
   }
 
@@ -37,7 +37,8 @@ PUBLISHED:
 
   void remove_py_entity(PyObject *ent);
 
-  virtual bool read(const Filename &filename, bool is_transition = false);
+protected:
+  virtual bool activate_level(BSPLevel *level, bool is_transition);
 
 protected:
   pvector<PT(EntityDef)> _entities;
@@ -87,9 +88,8 @@ PUBLISHED:
     _transition_source_landmark = NodePath();
   }
 
-  virtual bool read(const Filename &filename, bool is_transition = false);
-
 protected:
+  virtual bool activate_level(BSPLevel *level, bool is_transition);
   virtual void cleanup_entities(bool is_transition);
   virtual void load_entities();
 
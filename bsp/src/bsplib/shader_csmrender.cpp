@@ -30,6 +30,7 @@ void CSMRenderSpec::setup_permutations( ShaderPermutations &result,
         conf->alpha.add_permutations( result );
 
         add_hw_skinning( anim, result );
+        add_instancing( state, result );
 
         result.add_input( ShaderInput( "split_mvps", generator->get_pssm_rig()->get_mvp_array() ) );
 }
@@ -16,5 +16,5 @@ void DecalModulateSpec::setup_permutations( ShaderPermutations &result,
 	UnlitGenericSpec::setup_permutations( result, mat, state, anim, generator );
 	ULGConfig *conf = (ULGConfig *)get_shader_config( mat );
 	enable_srgb_read( conf->basetexture.base_texture, false );
-	result.add_permutation( "IS_DECAL_MODULATE" );
+	result.add_permutation( SHADER_FEATURE( "IS_DECAL_MODULATE" ) );
 }
@@ -60,7 +60,7 @@ SHADERFEATURE_SETUP_FUNC( RimLightFeature )
 {
         if ( has_feature && ConfigVariableBool( "mat_rimlight", true ) )
         {
-                perms.add_permutation( "RIMLIGHT" );
+                perms.add_permutation( SHADER_FEATURE( "RIMLIGHT" ) );
                 perms.add_input( ShaderInput( "rimlightParams", LVector2( boost, exponent ) ) );
         }
 }
@@ -143,7 +143,7 @@ SHADERFEATURE_SETUP_FUNC( BaseTextureFeature )
 {
         if ( has_feature && base_texture )
         {
-                perms.add_permutation( "BASETEXTURE" );
+                perms.add_permutation( SHADER_FEATURE( "BASETEXTURE" ) );
                 perms.add_input( ShaderInput( "baseTextureSampler", base_texture ) );
         }
 }
@@ -172,11 +172,11 @@ SHADERFEATURE_SETUP_FUNC( AlphaFeature )
         {
                 if ( !translucent && alpha != -1 )
                 {
-                        perms.add_permutation( "ALPHA", convert_to_string( alpha ) );
+                        perms.add_permutation( SHADER_FEATURE( "ALPHA" ), convert_to_string( alpha ) );
                 }
                 else if ( translucent )
                 {
-                        perms.add_permutation( "TRANSLUCENT" );
+                        perms.add_permutation( SHADER_FEATURE( "TRANSLUCENT" ) );
                 }
         }
 }
@@ -209,7 +209,7 @@ SHADERFEATURE_SETUP_FUNC( EnvmapFeature )
 {
         if ( has_feature && ConfigVariableBool( "mat_envmaps", true ) )
         {
-                perms.add_permutation( "ENVMAP" );
+                perms.add_permutation( SHADER_FEATURE( "ENVMAP" ) );
 
                 // if no envmap texture,
                 // we expect it to be filled in by the closest env_cubemap.
@@ -251,7 +251,7 @@ SHADERFEATURE_SETUP_FUNC( DetailFeature )
 {
         if ( has_feature && detail_texture )
         {
-                perms.add_permutation( "DETAIL" );
+                perms.add_permutation( SHADER_FEATURE( "DETAIL" ) );
                 perms.add_input( ShaderInput( "detailSampler", detail_texture ) );
 
                 perms.add_input( ShaderInput( "detailParams",
@@ -283,7 +283,7 @@ SHADERFEATURE_SETUP_FUNC( HalfLambertFeature )
 {
         if ( has_feature && halflambert )
         {
-                perms.add_permutation( "HALFLAMBERT" );
+                perms.add_permutation( SHADER_FEATURE( "HALFLAMBERT" ) );
         }
 }
 
@@ -303,7 +303,7 @@ SHADERFEATURE_SETUP_FUNC( BumpmapFeature )
 {
         if ( has_feature && bump_tex )
         {
-                perms.add_permutation( "BUMPMAP" );
+                perms.add_permutation( SHADER_FEATURE( "BUMPMAP" ) );
                 perms.add_input( ShaderInput( "bumpSampler", bump_tex ) );
         }
 }
@@ -327,7 +327,7 @@ SHADERFEATURE_SETUP_FUNC( LightwarpFeature )
 {
         if ( has_feature && lightwarp_tex )
         {
-                perms.add_permutation( "LIGHTWARP" );
+                perms.add_permutation( SHADER_FEATURE( "LIGHTWARP" ) );
                 perms.add_input( ShaderInput( "lightwarpSampler", lightwarp_tex ) );
         }
 }
@@ -352,7 +352,7 @@ SHADERFEATURE_SETUP_FUNC( SelfIllumFeature )
 {
         if ( has_feature )
         {
-                perms.add_permutation( "SELFILLUM" );
+                perms.add_permutation( SHADER_FEATURE( "SELFILLUM" ) );
                 perms.add_input( ShaderInput( "selfillumTint", selfillumtint ) );
         }
 }
@@ -390,14 +390,14 @@ SHADERFEATURE_SETUP_FUNC( ARME_Feature )
 {
         if ( arme_texture )
         {
-                perms.add_permutation( "ARME" );
+                perms.add_permutation( SHADER_FEATURE( "ARME" ) );
                 perms.add_input( ShaderInput( "armeSampler", arme_texture ) );
         }
         else
         {
-                perms.add_permutation( "AO", convert_to_string( ao ) );
-                perms.add_permutation( "ROUGHNESS", convert_to_string( roughness ) );
-                perms.add_permutation( "METALLIC", convert_to_string( metallic ) );
-                perms.add_permutation( "EMISSIVE", convert_to_string( emissive ) );
+                perms.add_permutation( SHADER_FEATURE( "AO" ), convert_to_string( ao ) );
+                perms.add_permutation( SHADER_FEATURE( "ROUGHNESS" ), convert_to_string( roughness ) );
+                perms.add_permutation( SHADER_FEATURE( "METALLIC" ), convert_to_string( metallic ) );
+                perms.add_permutation( SHADER_FEATURE( "EMISSIVE" ), convert_to_string( emissive ) );
         }
 }
@@ -44,11 +44,26 @@
 #include <colorScaleAttrib.h>
 #include <cullBinAttrib.h>
 #include <lens.h>
+#include <bamCache.h>
+#include <bamCacheRecord.h>
+#include <preparedGraphicsObjects.h>
+#include <geomNode.h>
+#include <pset.h>
+#include "bsp_geom_cache.h"
 
 using namespace std;
 
 static LightMutex cubemap_mutex("CubemapMutex");
 static LightMutex synthesize_mutex("SynthesizeMutex");
+static LightMutex shader_cache_mutex("ShaderCacheMutex");
+
+struct PendingCompiledShader {
+  PT(Shader) shader;
+  PT(BamCacheRecord) record;
+};
+// Shaders that are waiting for the GSG to compile them, so their program
+// binary can be stored in the model cache.
+static pvector<PendingCompiledShader> pending_compiled_shaders;
 
 static PStatCollector findmatshader_collector("*:Munge:BSPShaderGen:FindMatShader");
 static PStatCollector lookup_collector("*:Munge:BSPShaderGen:Lookup");
@@ -56,6 +71,7 @@ static PStatCollector synthesize_collector("*:Munge:BSPShaderGen:CreateShader");
 static PStatCollector gen_perms_collector("*:Munge:BSPShaderGen:SetupPermutations");
 static PStatCollector complete_perms_collector("*:Munge:BSPShaderGen:CompletePermutations");
 static PStatCollector make_attrib_collector("*:Munge:BSPShaderGen:SetupShaderAttrib");
+static PStatCollector precache_collector("App:BSPShaderGen:Precache");
 
 ConfigVariableInt pssm_splits("pssm-splits", 3);
 ConfigVariableInt pssm_size("pssm-size", 1024);
@@ -70,6 +86,11 @@ ConfigVariableBool normal_offset_uv_space("pssm-normal-offset-uv-space", true);
 ConfigVariableColor ambient_light_identifier("pssm-ambient-light-identifier", LColor(0.5, 0.5, 0.5, 1));
 ConfigVariableColor ambient_light_min("pssm-ambient-light-min", LColor(0, 0, 0, 1));
 ConfigVariableDouble ambient_light_scale("pssm-ambient-light-scale", 1.0);
+static ConfigVariableBool bsp_shader_cache("bsp_shader_cache", true,
+  PRC_DESC("Set this true to keep the generated shaders in the model cache, "
+           "so that they don't have to be generated and compiled again in "
+           "the next session.  The program binaries are only kept if "
+           "model-cache-compiled-shaders is also true."));
 
 TypeHandle BSPShaderGenerator::_type_handle;
 PT(Texture) BSPShaderGenerator::_identity_cubemap = nullptr;
@@ -242,6 +263,8 @@ void BSPShaderGenerator::set_sun_light(const NodePath &np) {
 void BSPShaderGenerator::update() {
   _planar_reflections->update();
 
+  store_compiled_shaders();
+
   if (want_pssm) {
     if (_sunlight.is_empty() & _has_shadow_sunlight) {
       _has_shadow_sunlight = false;
@@ -294,11 +317,36 @@ CPT(RenderAttrib) apply_node_inputs(const RenderState *rs, CPT(RenderAttrib) sha
     shattr = DCAST(ShaderAttrib, shattr)->set_shader_inputs(inputs);
   }
 
+  // The generated attrib replaces the node's own, so carry over what instanced
+  // geometry needs to be drawn.
+  const ShaderAttrib *node_sa;
+  rs->get_attrib_def(node_sa);
+  if (node_sa->get_instance_count() > 0) {
+    shattr = DCAST(ShaderAttrib, shattr)->set_instance_count(node_sa->get_instance_count());
+    static const char *instance_inputs[] = { "instanceData", "instanceLighting", "instanceVertexCount" };
+    for (const char *name : instance_inputs) {
+      const ShaderInput &input = node_sa->get_shader_input(name);
+      if (input != ShaderInput::get_blank()) {
+        shattr = DCAST(ShaderAttrib, shattr)->set_shader_input(input);
+      }
+    }
+  }
+
   return shattr;
 }
 
 CPT(ShaderAttrib) BSPShaderGenerator::synthesize_shader(const RenderState *rs,
                                                         const GeomVertexAnimationSpec &anim) {
+  return do_synthesize_shader(rs, anim, _has_shadow_sunlight);
+}
+
+/**
+ * Does the work of synthesize_shader(), with the permutations set up for the
+ * indicated sun shadow state rather than the generator's own.
+ */
+CPT(ShaderAttrib) BSPShaderGenerator::do_synthesize_shader(const RenderState *rs,
+                                                           const GeomVertexAnimationSpec &anim,
+                                                           bool shadow_sunlight) {
   LightMutexHolder holder(synthesize_mutex);
 
   findmatshader_collector.start();
@@ -343,6 +391,7 @@ CPT(ShaderAttrib) BSPShaderGenerator::synthesize_shader(const RenderState *rs,
   findmatshader_collector.stop();
 
   PT(ShaderPermutations) permutations = new ShaderPermutations;
+  permutations->shadow_sunlight = shadow_sunlight;
   ShaderSpec *spec;
 
   spec = _shaders[shader_name];
@@ -421,25 +470,242 @@ Texture *BSPShaderGenerator::get_identity_cubemap() {
   return _identity_cubemap;
 }
 
-CPT(Shader) BSPShaderGenerator::make_shader(const ShaderSpec * spec, const ShaderPermutations * perms) {
-  std::ostringstream vshader, gshader, fshader;
+/**
+ * Returns the Shader for the #defines of the indicated permutation.
+ *
+ * Permutations that only differ in their inputs or flags share the same
+ * Shader, so the source only has to be put together once for each set of
+ * #defines.  The preprocessed shaders are also kept in the model cache, along
+ * with the program binary once the GSG has compiled them (if
+ * model-cache-compiled-shaders is on), so that a permutation does not have to
+ * be preprocessed and compiled again in the next session.
+ */
+CPT(Shader) BSPShaderGenerator::make_shader(ShaderSpec *spec, const ShaderPermutations *perms) {
+  LightMutexHolder holder(shader_cache_mutex);
 
-  // Slip the defines into the shader source.
-  if (spec->_vertex.has) {
-    vshader << spec->_vertex.before_defines
-      << "\n" << perms->permutations
-      << spec->_vertex.after_defines;
+#ifdef SHADER_PERMS_UNORDERED_MAP
+  auto itr = spec->_feature_shaders.find(perms);
+  if (itr != spec->_feature_shaders.end()) {
+    return itr->second;
   }
-  if (spec->_geom.has) {
-    gshader << spec->_geom.before_defines
-      << "\n" << perms->permutations
-      << spec->_geom.after_defines;
+#endif
+
+  std::string defines = perms->get_defines();
+
+  PT(BamCacheRecord) record;
+  PT(Shader) shader = read_cached_shader(spec, defines, record);
+
+  if (shader == nullptr) {
+    std::ostringstream vshader, gshader, fshader;
+
+    // Slip the defines into the shader source.
+    if (spec->_vertex.has) {
+      vshader << spec->_vertex.before_defines
+        << "\n" << defines
+        << spec->_vertex.after_defines;
+    }
+    if (spec->_geom.has) {
+      gshader << spec->_geom.before_defines
+        << "\n" << defines
+        << spec->_geom.after_defines;
+    }
+    if (spec->_pixel.has) {
+      fshader << spec->_pixel.before_defines
+        << "\n" << defines
+        << spec->_pixel.after_defines;
+    }
+
+    shader = Shader::make(Shader::SL_GLSL, vshader.str(), fshader.str(), gshader.str());
+    if (shader == nullptr) {
+      return nullptr;
+    }
+
+    if (record != nullptr) {
+      record->set_data(shader);
+      BamCache::get_global_ptr()->store(record);
+      record->clear_data();
+    }
+  }
+
+  if (record != nullptr && BamCache::get_global_ptr()->get_cache_compiled_shaders()) {
+    unsigned int format;
+    std::string binary;
+    if (!shader->get_compiled(format, binary)) {
+      // Have the GSG hand us the program binary when it compiles the shader,
+      // store_compiled_shaders() writes it to the cache record afterwards.
+      shader->set_cache_compiled_shader(true);
+      pending_compiled_shaders.push_back({ shader, record });
+    }
+  }
+
+#ifdef SHADER_PERMS_UNORDERED_MAP
+  spec->_feature_shaders[perms] = shader;
+#endif
+
+  return shader;
+}
+
+/**
+ * Looks up the shader with the indicated #defines in the model cache.  Fills
+ * in the cache record for the shader, which the shader should be stored in if
+ * it is not there yet, or NULL if the shader cache is off.
+ */
+PT(Shader) BSPShaderGenerator::
+read_cached_shader(const ShaderSpec *spec, const std::string &defines, PT(BamCacheRecord) &record) {
+  record = nullptr;
+
+  BamCache *cache = BamCache::get_global_ptr();
+  if (!bsp_shader_cache || !cache->get_active()) {
+    return nullptr;
   }
-  if (spec->_pixel.has) {
-    fshader << spec->_pixel.before_defines
-      << "\n" << perms->permutations
-      << spec->_pixel.after_defines;
+
+  // The record is named after the shader and a hash of the sources and the
+  // defines, so any change to either simply misses the old record.
+  const Filename &source = spec->_vertex.has ? spec->_vertex.filename : spec->_pixel.filename;
+  std::ostringstream strm;
+  strm << spec->get_name() << "-" << std::hex << spec->_source_hash
+    << "-" << BSPGeomCache::hash_file(defines.data(), defines.size()) << ".glsl";
+  Filename cache_filename(source.get_dirname(), strm.str());
+
+  record = cache->lookup(cache_filename, "bspshader");
+  if (record == nullptr || !record->has_data()) {
+    return nullptr;
+  }
+
+  if (!record->get_data()->is_of_type(Shader::get_class_type())) {
+    return nullptr;
   }
 
-  return Shader::make(Shader::SL_GLSL, vshader.str(), fshader.str(), gshader.str());
+  PT(Shader) shader = DCAST(Shader, record->get_data());
+  record->clear_data();
+
+  if (bspShaderGenerator_cat.is_debug()) {
+    bspShaderGenerator_cat.debug()
+      << "Using cached " << cache_filename << "\n";
+  }
+
+  return shader;
+}
+
+/**
+ * Writes the program binaries of the shaders that have been compiled by the
+ * GSG since the last call to their records in the model cache.
+ */
+void BSPShaderGenerator::store_compiled_shaders() {
+  LightMutexHolder holder(shader_cache_mutex);
+
+  if (pending_compiled_shaders.empty() || _gsg == nullptr) {
+    return;
+  }
+
+  BamCache *cache = BamCache::get_global_ptr();
+  PreparedGraphicsObjects *prepared_objects = _gsg->get_prepared_objects();
+
+  size_t i = 0;
+  while (i < pending_compiled_shaders.size()) {
+    PendingCompiledShader &pending = pending_compiled_shaders[i];
+
+    unsigned int format;
+    std::string binary;
+    if (pending.shader->get_compiled(format, binary)) {
+      pending.record->set_data(pending.shader);
+      cache->store(pending.record);
+      pending.record->clear_data();
+
+    } else if (!pending.shader->is_prepared(prepared_objects)) {
+      // Not compiled yet.
+      i++;
+      continue;
+    }
+
+    // Either it's stored now, or the driver has no binary to give us.
+    pending.shader->set_cache_compiled_shader(false);
+    pending_compiled_shaders.erase(pending_compiled_shaders.begin() + i);
+  }
+}
+
+/**
+ * Generates the shaders of everything below the indicated node, as seen by
+ * the main camera and the shadow cameras, and has the GSG compile them on the
+ * next frame.  This is meant to be done while the level is loading, so that
+ * the shaders aren't generated and compiled the first time they come into
+ * view.  As the shaders are kept in the model cache, running this once over a
+ * level ahead of time (for instance from a tool that loads every level) also
+ * warms the cache for the next session.
+ *
+ * shadow_sunlight is whether the sun of the level casts shadows.  The level
+ * may not be the active one yet, so this is used in place of the state the
+ * generator was last given by set_sun_light().
+ *
+ * Returns the number of distinct states that were gone over.
+ */
+int BSPShaderGenerator::precache_shaders(const NodePath &root, bool shadow_sunlight) {
+  PStatTimer timer(precache_collector);
+
+  // The states the cameras start the traversal with.
+  pvector<CPT(RenderState)> camera_states;
+  if (!_camera.is_empty() && _camera.node()->is_of_type(Camera::get_class_type())) {
+    camera_states.push_back(DCAST(Camera, _camera.node())->get_initial_state());
+  } else {
+    camera_states.push_back(RenderState::make_empty());
+  }
+  if (_pssm_layered_buffer != nullptr) {
+    camera_states.push_back(DCAST(Camera, _pssm_rig->get_camera(0).node())->get_initial_state());
+  }
+
+  // If the level isn't in the scene yet, it will end up below render.
+  CPT(RenderState) root_state = root.get_net_state();
+  if (!_render.is_empty() && !_render.is_ancestor_of(root)) {
+    root_state = _render.get_net_state()->compose(root_state);
+  }
+
+  pset<std::pair<CPT(RenderState), GeomVertexAnimationSpec> > states;
+  pvector<std::pair<NodePath, CPT(RenderState)> > stack;
+  stack.push_back(std::make_pair(root, root_state));
+
+  while (!stack.empty()) {
+    NodePath np = stack.back().first;
+    CPT(RenderState) state = stack.back().second;
+    stack.pop_back();
+
+    PandaNode *node = np.node();
+    if (node->is_geom_node()) {
+      GeomNode *gn = DCAST(GeomNode, node);
+      int num_geoms = gn->get_num_geoms();
+      for (int i = 0; i < num_geoms; i++) {
+        CPT(RenderState) geom_state = state->compose(gn->get_geom_state(i));
+        const GeomVertexAnimationSpec &anim =
+          gn->get_geom(i)->get_vertex_data()->get_format()->get_animation();
+        for (size_t j = 0; j < camera_states.size(); j++) {
+          states.insert(std::make_pair(camera_states[j]->compose(geom_state), anim));
+        }
+      }
+    }
+
+    int num_children = np.get_num_children();
+    for (int i = 0; i < num_children; i++) {
+      NodePath child = np.get_child(i);
+      stack.push_back(std::make_pair(child, state->compose(child.get_state())));
+    }
+  }
+
+  PreparedGraphicsObjects *prepared_objects = _gsg != nullptr ? _gsg->get_prepared_objects() : nullptr;
+
+  for (auto itr = states.begin(); itr != states.end(); ++itr) {
+    const ShaderAttrib *sa;
+    itr->first->get_attrib_def(sa);
+    if (!sa->auto_shader()) {
+      continue;
+    }
+
+    CPT(ShaderAttrib) shattr = do_synthesize_shader(itr->first, itr->second, shadow_sunlight);
+    if (shattr != nullptr && shattr->get_shader() != nullptr && prepared_objects != nullptr) {
+      ((Shader *)shattr->get_shader())->prepare(prepared_objects);
+    }
+  }
+
+  bspShaderGenerator_cat.info()
+    << "Precached shaders for " << states.size() << " states below " << root << "\n";
+
+  return (int)states.size();
 }
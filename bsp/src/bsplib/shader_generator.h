@@ -27,6 +27,7 @@
 
 class PSSMCameraRig;
 class GraphicsStateGuardian;
+class BamCacheRecord;
 
 extern ConfigVariableInt pssm_splits;
 extern ConfigVariableInt pssm_size;
@@ -138,13 +139,23 @@ PUBLISHED:
         static void set_identity_cubemap( Texture *tex );
         static Texture *get_identity_cubemap();
 
-	static CPT( Shader ) make_shader( const ShaderSpec *spec, const ShaderPermutations *perms );
+	static CPT( Shader ) make_shader( ShaderSpec *spec, const ShaderPermutations *perms );
+
+        int precache_shaders( const NodePath &root, bool shadow_sunlight );
 
         void update();
 
         static BSPShaderGenerator *ptr();
 
 private:
+        CPT( ShaderAttrib ) do_synthesize_shader( const RenderState *rs,
+                                                  const GeomVertexAnimationSpec &anim,
+                                                  bool shadow_sunlight );
+
+        static PT( Shader ) read_cached_shader( const ShaderSpec *spec, const std::string &defines,
+                                                PT( BamCacheRecord ) &record );
+        void store_compiled_shaders();
+
         struct SplitShadowMap
         {
                 PT( GraphicsOutput ) buffer;
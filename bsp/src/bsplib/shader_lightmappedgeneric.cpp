@@ -64,7 +64,7 @@ void LightmappedGenericSpec::setup_permutations(ShaderPermutations &result,
   conf->detail.add_permutations(result);
 
   if (conf->_uses_planar_reflection) {
-    result.add_permutation("PLANAR_REFLECTION");
+    result.add_permutation(SHADER_FEATURE("PLANAR_REFLECTION"));
     result.add_input(ShaderInput("reflectionRTT", generator->get_planar_reflections()->get_reflection_texture()));
   }
 
@@ -75,12 +75,12 @@ void LightmappedGenericSpec::setup_permutations(ShaderPermutations &result,
     Texture *tex = tattr->get_on_texture(stage);
 
     if (stage == TextureStages::get_lightmap()) {
-      result.add_permutation("FLAT_LIGHTMAP");
-      result.add_permutation("TEXCOORD_LIGHTMAP", get_texcoord(i));
+      result.add_permutation(SHADER_FEATURE("FLAT_LIGHTMAP"));
+      result.add_permutation(SHADER_FEATURE("TEXCOORD_LIGHTMAP"), get_texcoord(i));
       result.add_input(ShaderInput("lightmapSampler", tex));
     } else if (stage == TextureStages::get_bumped_lightmap()) {
-      result.add_permutation("BUMPED_LIGHTMAP");
-      result.add_permutation("TEXCOORD_LIGHTMAP", get_texcoord(i));
+      result.add_permutation(SHADER_FEATURE("BUMPED_LIGHTMAP"));
+      result.add_permutation(SHADER_FEATURE("TEXCOORD_LIGHTMAP"), get_texcoord(i));
       result.add_input(ShaderInput("lightmapSampler", tex));
     }
 
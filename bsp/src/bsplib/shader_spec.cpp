@@ -17,10 +17,13 @@
 #include "static_props.h"
 #include "bloom_attrib.h"
 #include "postProcessDefines.h"
+#include "bsp_geom_cache.h"
 
 #include <virtualFileSystem.h>
 #include <colorBlendAttrib.h>
 #include <auxBitplaneAttrib.h>
+#include <lightMutex.h>
+#include <lightMutexHolder.h>
 
 void ShaderSpec::ShaderSource::read( const Filename &file )
 {
@@ -60,6 +63,87 @@ static ConfigVariableDouble parallax_mapping_scale
 
 TypeHandle ShaderSpec::_type_handle;
 
+static LightMutex feature_names_lock( "ShaderPermutations::feature_names" );
+static pmap<std::string, int> feature_indices;
+static vector_string feature_names;
+
+/**
+ * Returns the index of the bit that stands for the indicated #define in the
+ * feature mask of a ShaderPermutations.  The first time a #define is seen it
+ * is given the next free bit.
+ *
+ * The indices depend on the order the #defines are first seen in, so they are
+ * only meaningful in this session.  Anything that goes on disk has to use the
+ * names (see get_defines()).
+ *
+ * This takes a lock, so the setup_permutations() code should not call it for
+ * every state; use SHADER_FEATURE() there, which only calls it once.
+ */
+int ShaderPermutations::get_feature_index( const std::string &key )
+{
+	LightMutexHolder holder( feature_names_lock );
+
+	pmap<std::string, int>::const_iterator it = feature_indices.find( key );
+	if ( it != feature_indices.end() )
+	{
+		return it->second;
+	}
+
+	int index = (int)feature_names.size();
+	feature_indices[key] = index;
+	feature_names.push_back( key );
+	return index;
+}
+
+std::string ShaderPermutations::get_feature_name( int index )
+{
+	LightMutexHolder holder( feature_names_lock );
+
+	nassertr( index >= 0 && index < (int)feature_names.size(), std::string() );
+	return feature_names[index];
+}
+
+/**
+ * Builds the #define lines that are slipped into the shader source for this
+ * permutation.  The lines are sorted by name, so that the same permutation
+ * always makes the same source no matter which order the features were added
+ * in, or which order the feature indices were handed out in.
+ */
+std::string ShaderPermutations::get_defines() const
+{
+	pvector<std::pair<std::string, std::string>> defines;
+
+	size_t v = 0;
+	int num_bits = features.get_num_bits();
+	for ( int i = 0; i < num_bits; i++ )
+	{
+		if ( !features.get_bit( i ) )
+			continue;
+
+		while ( v < values.size() && values[v].first < i )
+		{
+			v++;
+		}
+		if ( v < values.size() && values[v].first == i )
+		{
+			defines.push_back( std::make_pair( get_feature_name( i ), values[v].second ) );
+		}
+		else
+		{
+			defines.push_back( std::make_pair( get_feature_name( i ), std::string( "1" ) ) );
+		}
+	}
+
+	std::sort( defines.begin(), defines.end() );
+
+	std::ostringstream strm;
+	for ( size_t i = 0; i < defines.size(); i++ )
+	{
+		strm << "#define " << defines[i].first << " " << defines[i].second << "\n";
+	}
+	return strm.str();
+}
+
 ShaderSpec::ShaderSpec( const std::string &name, const Filename &vert_file,
                         const Filename &pixel_file, const Filename &geom_file ) :
         ReferenceCount(),
@@ -76,6 +160,54 @@ void ShaderSpec::read_shader_files( const Filename &vert_file,
         _vertex.read( vert_file );
         _pixel.read( pixel_file );
         _geom.read( geom_file );
+
+        // The shader cache has to notice when an include changes too, so
+        // fold those into the hash as well.
+        pset<std::string> included;
+        _source_hash = 0;
+        const ShaderSource *sources[3] = { &_vertex, &_pixel, &_geom };
+        for ( int i = 0; i < 3; i++ )
+        {
+                if ( !sources[i]->has )
+                        continue;
+
+                const std::string &source = sources[i]->full_source;
+                _source_hash ^= BSPGeomCache::hash_file( source.data(), source.size() ) + i;
+                hash_includes( source, included, _source_hash );
+        }
+}
+
+/**
+ * Hashes the contents of every file that is pulled in by a #pragma include
+ * in the indicated source, recursively.
+ */
+void ShaderSpec::hash_includes( const std::string &source, pset<std::string> &included, uint64_t &hash )
+{
+        static const std::string pragma_include = "#pragma include";
+
+        VirtualFileSystem *vfs = VirtualFileSystem::get_global_ptr();
+
+        size_t pos = 0;
+        while ( ( pos = source.find( pragma_include, pos ) ) != std::string::npos )
+        {
+                pos += pragma_include.size();
+                size_t begin = source.find_first_of( "\"<", pos );
+                size_t end = source.find_first_of( "\">\n", begin + 1 );
+                if ( begin == std::string::npos || end == std::string::npos || source[end] == '\n' )
+                        continue;
+
+                std::string name = source.substr( begin + 1, end - begin - 1 );
+                if ( !included.insert( name ).second )
+                        continue;
+
+                Filename filename( name );
+                if ( !vfs->resolve_filename( filename, get_model_path() ) )
+                        continue;
+
+                std::string include = vfs->read_file( filename, true );
+                hash = ( hash * 1099511628211ull ) ^ BSPGeomCache::hash_file( include.data(), include.size() );
+                hash_includes( include, included, hash );
+        }
 }
 
 ShaderConfig *ShaderSpec::get_shader_config( const BSPMaterial *mat )
@@ -98,13 +230,13 @@ void ShaderSpec::setup_permutations( ShaderPermutations &result,
 	const GeomVertexAnimationSpec &anim,
 	BSPShaderGenerator *generator )
 {
-        result.add_permutation( "SHADER_QUALITY", generator->get_shader_quality() );
+        result.add_permutation( SHADER_FEATURE( "SHADER_QUALITY" ), generator->get_shader_quality() );
 
 	const LightRampAttrib *lra;
 	state->get_attrib_def( lra );
 	if ( lra->get_mode() != LightRampAttrib::LRT_default )
 	{
-		result.add_permutation( "HDR" );
+		result.add_permutation( SHADER_FEATURE( "HDR" ) );
 		result.add_input( ShaderInput( "_exposureAdjustment", generator->get_exposure_adjustment() ) );
 	}
 
@@ -116,13 +248,13 @@ void ShaderSpec::setup_permutations( ShaderPermutations &result,
 		     cba->get_operand_a() == ColorBlendAttrib::O_one &&
 		     cba->get_operand_b() == ColorBlendAttrib::O_one )
 		{
-			result.add_permutation( "BLEND_ADDITIVE" );
+			result.add_permutation( SHADER_FEATURE( "BLEND_ADDITIVE" ) );
 		}
 		else if ( cba->get_mode() == ColorBlendAttrib::M_add &&
 			  cba->get_operand_a() == ColorBlendAttrib::O_fbuffer_color &&
 			  cba->get_operand_b() == ColorBlendAttrib::O_incoming_color )
 		{
-			result.add_permutation( "BLEND_MODULATE" );
+			result.add_permutation( SHADER_FEATURE( "BLEND_MODULATE" ) );
 		}
 	}
 
@@ -130,29 +262,29 @@ void ShaderSpec::setup_permutations( ShaderPermutations &result,
 	state->get_attrib_def( spa );
 	if ( spa->has_static_lighting() )
 	{
-		result.add_permutation( "STATIC_PROP_LIGHTING" );
+		result.add_permutation( SHADER_FEATURE( "STATIC_PROP_LIGHTING" ) );
 	}
 
 	const AuxBitplaneAttrib *aba;
 	state->get_attrib_def( aba );
 	if ( ( aba->get_outputs() & AUXTEXTUREBITS_NORMAL ) != 0 )
 	{
-		result.add_permutation( "NEED_AUX_NORMAL" );
+		result.add_permutation( SHADER_FEATURE( "NEED_AUX_NORMAL" ) );
 	}
 	if ( ( aba->get_outputs() & AUXTEXTUREBITS_ARME ) != 0 )
 	{
-		result.add_permutation( "NEED_AUX_ARME" );
+		result.add_permutation( SHADER_FEATURE( "NEED_AUX_ARME" ) );
 	}
 	if ( ( aba->get_outputs() & AUXTEXTUREBITS_BLOOM ) != 0 )
 	{
-		result.add_permutation( "NEED_AUX_BLOOM" );
+		result.add_permutation( SHADER_FEATURE( "NEED_AUX_BLOOM" ) );
 	}
 
 	const BloomAttrib *ba;
 	state->get_attrib_def( ba );
 	if ( !ba->is_bloom_enabled() )
 	{
-		result.add_permutation( "NO_BLOOM" );
+		result.add_permutation( SHADER_FEATURE( "NO_BLOOM" ) );
 	}
 }
 
@@ -166,7 +298,7 @@ bool ShaderSpec::add_fog( const RenderState *rs, ShaderPermutations &perms,
         // Check for fog.
         if ( !fa->is_off() )
         {
-                perms.add_permutation( "FOG", (int)fa->get_fog()->get_mode() );
+                perms.add_permutation( SHADER_FEATURE( "FOG" ), (int)fa->get_fog()->get_mode() );
 		return true;
         }
 
@@ -183,20 +315,20 @@ void ShaderSpec::add_color( const RenderState *rs, ShaderPermutations &perms )
 
 bool ShaderSpec::add_csm( const RenderState *rs, ShaderPermutations &result, BSPShaderGenerator *generator )
 {
-        if ( generator->has_shadow_sunlight() )
+        if ( result.shadow_sunlight )
         {
-                result.add_permutation( "HAS_SHADOW_SUNLIGHT" );
-		result.add_permutation( "PSSM_SPLITS", pssm_splits.get_string_value() );
-		result.add_permutation( "DEPTH_BIAS", depth_bias.get_string_value() );
-		result.add_permutation( "NORMAL_OFFSET_SCALE", normal_offset_scale.get_string_value() );
+                result.add_permutation( SHADER_FEATURE( "HAS_SHADOW_SUNLIGHT" ) );
+		result.add_permutation( SHADER_FEATURE( "PSSM_SPLITS" ), pssm_splits.get_string_value() );
+		result.add_permutation( SHADER_FEATURE( "DEPTH_BIAS" ), depth_bias.get_string_value() );
+		result.add_permutation( SHADER_FEATURE( "NORMAL_OFFSET_SCALE" ), normal_offset_scale.get_string_value() );
 
                 float xel_size = 1.0 / pssm_size.get_value();
 
-                result.add_permutation( "SHADOW_BLUR", xel_size * softness_factor.get_value() );
-                result.add_permutation( "SHADOW_TEXEL_SIZE", xel_size );
+                result.add_permutation( SHADER_FEATURE( "SHADOW_BLUR" ), xel_size * softness_factor.get_value() );
+                result.add_permutation( SHADER_FEATURE( "SHADOW_TEXEL_SIZE" ), xel_size );
 
                 if ( normal_offset_uv_space.get_value() )
-                        result.add_permutation( "NORMAL_OFFSET_UV_SPACE" );
+                        result.add_permutation( SHADER_FEATURE( "NORMAL_OFFSET_UV_SPACE" ) );
 
                 result.add_input( ShaderInput( "pssmSplitSampler", generator->get_pssm_array_texture() ) );
                 result.add_input( ShaderInput( "pssmMVPs", generator->get_pssm_rig()->get_mvp_array() ) );
@@ -223,18 +355,42 @@ bool ShaderSpec::add_clip_planes( const RenderState *rs, ShaderPermutations &per
         const ClipPlaneAttrib *clip_plane;
         rs->get_attrib_def( clip_plane );
 
-        perms.add_permutation( "NUM_CLIP_PLANES", clip_plane->get_num_on_planes() );
+        perms.add_permutation( SHADER_FEATURE( "NUM_CLIP_PLANES" ), clip_plane->get_num_on_planes() );
 
         return clip_plane->get_num_on_planes() > 0;
 }
 
+/**
+ * Geometry that is drawn instanced (see BSPLevel::load_static_props()) carries
+ * its instance count and a buffer with the per-instance transforms on its
+ * ShaderAttrib.
+ */
+bool ShaderSpec::add_instancing( const RenderState *rs, ShaderPermutations &perms )
+{
+        const ShaderAttrib *sa;
+        rs->get_attrib_def( sa );
+        if ( sa->get_instance_count() <= 0 ||
+             sa->get_shader_input( "instanceData" ) == ShaderInput::get_blank() )
+        {
+                return false;
+        }
+
+        perms.add_permutation( SHADER_FEATURE( "INSTANCED" ) );
+        if ( sa->get_shader_input( "instanceLighting" ) != ShaderInput::get_blank() )
+        {
+                perms.add_permutation( SHADER_FEATURE( "INSTANCED_STATIC_LIGHTING" ) );
+        }
+
+        return true;
+}
+
 void ShaderSpec::add_hw_skinning( const GeomVertexAnimationSpec &anim, ShaderPermutations &perms )
 {
         // Hardware skinning?
         if ( anim.get_animation_type() == GeomEnums::AT_hardware &&
                 anim.get_num_transforms() > 0 )
         {
-		perms.add_permutation( "HARDWARE_SKINNING" );
+		perms.add_permutation( SHADER_FEATURE( "HARDWARE_SKINNING" ) );
                 int num_transforms;
                 if ( anim.get_indexed_transforms() )
                 {
@@ -244,11 +400,11 @@ void ShaderSpec::add_hw_skinning( const GeomVertexAnimationSpec &anim, ShaderPer
                 {
                         num_transforms = anim.get_num_transforms();
                 }
-                perms.add_permutation( "NUM_TRANSFORMS", num_transforms );
+                perms.add_permutation( SHADER_FEATURE( "NUM_TRANSFORMS" ), num_transforms );
 
                 if ( anim.get_indexed_transforms() )
                 {
-			perms.add_permutation( "INDEXED_TRANSFORMS" );
+			perms.add_permutation( SHADER_FEATURE( "INDEXED_TRANSFORMS" ) );
                 }
         }
 }
@@ -263,8 +419,8 @@ bool ShaderSpec::add_alpha_test( const RenderState *rs, ShaderPermutations &perm
 		alpha_test->get_mode() != RenderAttrib::M_always )
 	{
 		// Subsume the alpha test in our shader.
-		perms.add_permutation( "ALPHA_TEST", alpha_test->get_mode() );
-		perms.add_permutation( "ALPHA_TEST_REF", alpha_test->get_reference_alpha() );
+		perms.add_permutation( SHADER_FEATURE( "ALPHA_TEST" ), alpha_test->get_mode() );
+		perms.add_permutation( SHADER_FEATURE( "ALPHA_TEST_REF" ), alpha_test->get_reference_alpha() );
 
 		perms.add_flag( ShaderAttrib::F_subsume_alpha_test );
 
@@ -281,21 +437,31 @@ void ShaderSpec::r_precache( ShaderPrecacheCombos &combos )
 	int *indices = new int[n];
 	memset( indices, 0, sizeof( int ) * n );
 
+	// The combo names aren't known until now, so look them up once here.
+	vector_int features;
+	features.reserve( n );
+	for ( size_t i = 0; i < n; i++ )
+	{
+		features.push_back( ShaderPermutations::get_feature_index( combos.combos[i].combo_name ) );
+	}
+
 	int permutations = 0;
 
 	while ( 1 )
 	{
-		ShaderPermutations perms;
-		perms.local_object();
+		PT( ShaderPermutations ) perms = new ShaderPermutations;
 		for ( int i = 0; i < n; i++ )
 		{
-			if ( combos.combos[i].is_bool && combos.combos[i].min_val + indices[n] == 0 )
+			if ( combos.combos[i].is_bool && combos.combos[i].min_val + indices[i] == 0 )
 				continue;
-			perms.add_permutation( combos.combos[i].combo_name,
-					       combos.combos[i].min_val + indices[n] );
+			perms->add_permutation( features[i],
+					       combos.combos[i].min_val + indices[i] );
 		}
+		perms->complete();
 
-		BSPShaderGenerator::make_shader( this, &perms );
+		// This goes through the shader cache, so every combo that is
+		// compiled here is on disk for the next run.
+		BSPShaderGenerator::make_shader( this, perms );
 		permutations++;
 		std::cout << "\tCompiled " << permutations << " permutations\n";
 
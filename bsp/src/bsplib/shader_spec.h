@@ -15,8 +15,11 @@
 #include "referenceCount.h"
 #include "namable.h"
 #include "pmap.h"
+#include "pset.h"
 #include "shaderAttrib.h"
 #include "geomVertexAnimationSpec.h"
+#include "bitArray.h"
+#include "string_utils.h"
 
 #include <unordered_map>
 
@@ -24,6 +27,15 @@
 
 #define SHADER_PERMS_UNORDERED_MAP
 
+/**
+ * Evaluates to the feature index of the indicated #define, for passing to
+ * ShaderPermutations::add_permutation().  The name is only looked up the first
+ * time the expression runs, after that the index is read from a static, so
+ * setting up a permutation doesn't go through the table of feature names.
+ */
+#define SHADER_FEATURE( name ) \
+	( [] { static const int index = ShaderPermutations::get_feature_index( name ); return index; }() )
+
 class RenderState;
 class BSPShaderGenerator;
 class BSPMaterial;
@@ -77,8 +89,13 @@ public:
 
 /**
  * Represents a list of #defines and variable inputs to a shader that is being generated.
+ *
+ * Each #define is interned to a feature index the first time it is seen, so a
+ * permutation is keyed by a bitmask of the features that are present, plus the
+ * few defines that have a value other than 1.  The #define text itself is only
+ * built when the shader actually has to be generated (see get_defines()).
  */
-class ShaderPermutations : public ReferenceCount
+class EXPCL_PANDABSP ShaderPermutations : public ReferenceCount
 {
 #ifdef SHADER_PERMS_UNORDERED_MAP
 public:
@@ -96,22 +113,52 @@ public:
 	public:
 		INLINE bool operator ()( const CPT( ShaderPermutations ) &a, const CPT( ShaderPermutations ) &b ) const
 		{
-			return a->hash == b->hash;
+			return a->hash == b->hash && a->flags == b->flags &&
+				a->features_equal( *b ) && a->inputs == b->inputs;
+		}
+	};
+
+	// Only looks at the #defines, for sharing the Shader between permutations
+	// that differ only in their inputs or flags.
+	class FeatureHasher
+	{
+	public:
+		INLINE size_t operator ()( const CPT( ShaderPermutations ) &perms ) const
+		{
+			return perms->feature_hash;
+		}
+	};
+
+	class FeatureCompare
+	{
+	public:
+		INLINE bool operator ()( const CPT( ShaderPermutations ) &a, const CPT( ShaderPermutations ) &b ) const
+		{
+			return a->feature_hash == b->feature_hash && a->features_equal( *b );
 		}
 	};
 #endif
 
 public:
-	std::ostringstream permutations_stream;
-	std::string permutations;
+	typedef pvector<std::pair<int, std::string>> FeatureValues;
+
+	// One bit for each #define that is present, by feature index.
+	BitArray features;
+	// The #defines that have a value other than 1, sorted by feature index.
+	FeatureValues values;
 
 	int flags;
 	vector_int flag_indices;
 
 	pvector<ShaderInput> inputs;
 
+	size_t feature_hash;
 	size_t hash;
 
+	// Whether the permutation is set up for a sun that casts shadows.  This
+	// is only what the setup code goes by; the key is HAS_SHADOW_SUNLIGHT.
+	bool shadow_sunlight;
+
 PUBLISHED:
 
 	INLINE ShaderPermutations() :
@@ -120,25 +167,42 @@ PUBLISHED:
 		// This should be enough for most shaders
 		inputs.reserve( 32 );
 		flag_indices.reserve( 32 );
+		feature_hash = 0u;
 		hash = 0u;
 		flags = 0;
+		shadow_sunlight = false;
 	}
 
-        template<class T>
-        INLINE void add_permutation( const std::string &key, const T &value )
-        {
-		permutations_stream << "#define " << key << " " << value << "\n";
-        }
+	INLINE void add_permutation( int feature, const std::string &value = "1" )
+	{
+		set_feature( feature, value );
+	}
+
+	INLINE void add_permutation( int feature, int value )
+	{
+		set_feature( feature, format_string( value ) );
+	}
 
-	INLINE void add_permutation( const std::string &key, const std::string &value = "1" )
+	INLINE void add_permutation( int feature, double value )
 	{
-		add_permutation<std::string>( key, value );
+		set_feature( feature, format_string( value ) );
 	}
 
 	INLINE void complete()
 	{
-		permutations = permutations_stream.str();
-		hash = string_hash::add_hash( hash, permutations );
+		size_t num_words = features.get_num_words();
+		for ( size_t i = 0; i < num_words; i++ )
+		{
+			feature_hash = size_t_hash::add_hash( feature_hash, (size_t)features.get_word( i ).get_word() );
+		}
+		size_t num_values = values.size();
+		for ( size_t i = 0; i < num_values; i++ )
+		{
+			feature_hash = int_hash::add_hash( feature_hash, values[i].first );
+			feature_hash = string_hash::add_hash( feature_hash, values[i].second );
+		}
+
+		hash = size_t_hash::add_hash( hash, feature_hash );
 		hash = int_hash::add_hash( hash, flags );
 	}
 
@@ -158,6 +222,52 @@ PUBLISHED:
         {
 		return hash;
         }
+
+	INLINE bool has_feature( int feature ) const
+	{
+		return features.get_bit( feature );
+	}
+
+	std::string get_defines() const;
+
+	static int get_feature_index( const std::string &key );
+	static std::string get_feature_name( int index );
+
+public:
+	INLINE bool features_equal( const ShaderPermutations &other ) const
+	{
+		return features == other.features && values == other.values;
+	}
+
+private:
+	INLINE void set_feature( int index, const std::string &value )
+	{
+		features.set_bit( index );
+
+		FeatureValues::iterator it = values.begin();
+		while ( it != values.end() && it->first < index )
+		{
+			++it;
+		}
+		bool has_value = ( it != values.end() && it->first == index );
+
+		if ( value == "1" )
+		{
+			// 1 is implied by the bit, don't store it.
+			if ( has_value )
+			{
+				values.erase( it );
+			}
+		}
+		else if ( has_value )
+		{
+			it->second = value;
+		}
+		else
+		{
+			values.insert( it, std::make_pair( index, value ) );
+		}
+	}
 };
 
 /**
@@ -204,6 +314,7 @@ public:
         static bool add_csm( const RenderState *rs, ShaderPermutations &perms, BSPShaderGenerator *generator );
         static bool add_clip_planes( const RenderState *rs, ShaderPermutations &perms );
         static void add_hw_skinning( const GeomVertexAnimationSpec &anim, ShaderPermutations &perms );
+        static bool add_instancing( const RenderState *rs, ShaderPermutations &perms );
 	static bool add_alpha_test( const RenderState *rs, ShaderPermutations &perms );
 
         typedef SimpleHashMap<const BSPMaterial *, PT( ShaderConfig ), pointer_hash> ConfigCache;
@@ -217,10 +328,19 @@ public:
 #endif
         GeneratedShaders _generated_shaders;
 
+#ifdef SHADER_PERMS_UNORDERED_MAP
+	typedef std::unordered_map<CPT( ShaderPermutations ), CPT( Shader ), ShaderPermutations::FeatureHasher, ShaderPermutations::FeatureCompare> FeatureShaders;
+	FeatureShaders _feature_shaders;
+#endif
+
         ShaderSource _vertex;
         ShaderSource _pixel;
         ShaderSource _geom;
 
+	// Hash of the shader sources and every file they include, which the
+	// shaders in the on-disk shader cache are keyed on.
+	uint64_t _source_hash;
+
         static TypeHandle get_class_type()
         {
                 return _type_handle;
@@ -236,6 +356,7 @@ public:
 
 private:
 	void r_precache( ShaderPrecacheCombos &combos );
+	static void hash_includes( const std::string &source, pset<std::string> &included, uint64_t &hash );
 
         static TypeHandle _type_handle;
 };
@@ -44,7 +44,7 @@ void UnlitNoMatSpec::setup_permutations( ShaderPermutations &result,
 		{
 			// Convert from gamma to linear in shader
 			enable_srgb_read( tex, true );
-			result.add_permutation( "HAS_TEXTURE" );
+			result.add_permutation( SHADER_FEATURE( "HAS_TEXTURE" ) );
 		}
 	}
 
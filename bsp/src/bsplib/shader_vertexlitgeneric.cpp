@@ -92,7 +92,7 @@ void VertexLitGenericSpec::setup_permutations( ShaderPermutations &result,
         rs->get_attrib_def( aba );
         if ( ( aba->get_outputs() & AUXTEXTUREBITS_NORMAL ) != 0 )
 	{
-		result.add_permutation( "NEED_EYE_NORMAL" );
+		result.add_permutation( SHADER_FEATURE( "NEED_EYE_NORMAL" ) );
 	}
         add_color( rs, result );
 
@@ -109,8 +109,8 @@ void VertexLitGenericSpec::setup_permutations( ShaderPermutations &result,
 			need_world_vec = true;
 			need_world_normal = true;
 
-                        result.add_permutation( "LIGHTING" );
-			result.add_permutation( "NUM_LIGHTS", num_lights );
+                        result.add_permutation( SHADER_FEATURE( "LIGHTING" ) );
+			result.add_permutation( SHADER_FEATURE( "NUM_LIGHTS" ), (int)num_lights );
                 }
         }
         else
@@ -124,9 +124,9 @@ void VertexLitGenericSpec::setup_permutations( ShaderPermutations &result,
 			need_world_vec = true;
                         need_world_normal = true; // for ambient cube
 
-                        result.add_permutation( "LIGHTING" );
-                        result.add_permutation( "BSP_LIGHTING" );
-			result.add_permutation( "NUM_LIGHTS", MAX_TOTAL_LIGHTS );
+                        result.add_permutation( SHADER_FEATURE( "LIGHTING" ) );
+                        result.add_permutation( SHADER_FEATURE( "BSP_LIGHTING" ) );
+			result.add_permutation( SHADER_FEATURE( "NUM_LIGHTS" ), MAX_TOTAL_LIGHTS );
                 }
 
         }
@@ -172,28 +172,29 @@ void VertexLitGenericSpec::setup_permutations( ShaderPermutations &result,
 	}
 
         add_hw_skinning( anim, result );
+        add_instancing( rs, result );
 
         if ( need_world_vec )
                 need_world_position = true;
 
         if ( need_tbn )
         {
-                result.add_permutation( "NEED_TBN" );
+                result.add_permutation( SHADER_FEATURE( "NEED_TBN" ) );
         }
         if ( need_world_normal )
         {
-                result.add_permutation( "NEED_WORLD_NORMAL" );
+                result.add_permutation( SHADER_FEATURE( "NEED_WORLD_NORMAL" ) );
         }
         if ( need_world_position )
         {
-                result.add_permutation( "NEED_WORLD_POSITION" );
+                result.add_permutation( SHADER_FEATURE( "NEED_WORLD_POSITION" ) );
         }
         if ( need_eye_position )
         {
-                result.add_permutation( "NEED_EYE_POSITION" );
+                result.add_permutation( SHADER_FEATURE( "NEED_EYE_POSITION" ) );
         }
         if ( need_world_vec )
-                result.add_permutation( "NEED_WORLD_VEC" );
+                result.add_permutation( SHADER_FEATURE( "NEED_WORLD_VEC" ) );
 
         // Done!
 }
@@ -10,6 +10,9 @@
  */
 
 #include "static_props.h"
+#include "bamReader.h"
+#include "datagram.h"
+#include "datagramIterator.h"
 
 IMPLEMENT_ATTRIB( StaticPropAttrib );
 
@@ -35,4 +38,32 @@ size_t StaticPropAttrib::get_hash_impl() const
 	size_t hash = 0;
 	hash = int_hash::add_hash( hash, (int)_static_lighting );
 	return hash;
-}
\ No newline at end of file
+}
+void StaticPropAttrib::register_with_read_factory()
+{
+	BamReader::get_factory()->register_factory( get_class_type(), make_from_bam );
+}
+
+void StaticPropAttrib::write_datagram( BamWriter *manager, Datagram &dg )
+{
+	RenderAttrib::write_datagram( manager, dg );
+	dg.add_bool( _static_lighting );
+}
+
+TypedWritable *StaticPropAttrib::make_from_bam( const FactoryParams &params )
+{
+	StaticPropAttrib *attr = new StaticPropAttrib;
+	DatagramIterator scan;
+	BamReader *manager;
+
+	parse_params( params, scan, manager );
+	attr->fillin( scan, manager );
+
+	return attr;
+}
+
+void StaticPropAttrib::fillin( DatagramIterator &scan, BamReader *manager )
+{
+	RenderAttrib::fillin( scan, manager );
+	_static_lighting = scan.get_bool();
+}
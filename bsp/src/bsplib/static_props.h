@@ -13,6 +13,7 @@
 #define STATICPROPS_H
 
 #include "config_bsplib.h"
+#include "factoryParams.h"
 
 class EXPCL_PANDABSP StaticPropAttrib : public RenderAttrib {
   DECLARE_ATTRIB(StaticPropAttrib, RenderAttrib);
@@ -30,6 +31,14 @@ PUBLISHED:
     return _static_lighting;
   }
 
+public:
+  static void register_with_read_factory();
+  virtual void write_datagram(BamWriter *manager, Datagram &dg);
+
+protected:
+  static TypedWritable *make_from_bam(const FactoryParams &params);
+  void fillin(DatagramIterator &scan, BamReader *manager);
+
 private:
   bool _static_lighting;
 };
@@ -15,6 +15,7 @@
 #include "blockmem.h"
 #include "filelib.h"
 #include "threads.h"
+#include "profile.h"
 #include "winding.h"
 #include "cmdlinecfg.h"
 
@@ -215,7 +216,7 @@ extern void     WritePortalfile( node_t* headnode );
 
 //=============================================================================
 // tjunc.c
-void            tjunc( node_t* headnode );
+void            tjunc( node_t* headnode, bool threaded );
 
 //=============================================================================
 // writebsp.c
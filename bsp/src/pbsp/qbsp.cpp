@@ -1242,7 +1242,7 @@ static bool     ProcessModel()
         FreePortals( nodes );
 
         // fix tjunctions
-        tjunc( nodes );
+        tjunc( nodes, modnum == 0 );
 
         MakeFaceEdges();
 
@@ -1363,6 +1363,7 @@ static void     Usage()
         Log( "    -texdata #     : Alter maximum texture memory limit (in kb)\n" );
         Log( "    -lightdata #   : Alter maximum lighting memory limit (in kb)\n" );
         Log( "    -chart         : display bsp statitics\n" );
+        Log( "    -profile file  : Write a JSON report of the compile times to file\n" );
         Log( "    -low | -high   : run program an altered priority level\n" );
         Log( "    -nolog         : don't generate the compile logfiles\n" );
         Log( "    -threads #     : manually specify the number of threads to run\n" );
@@ -1512,9 +1513,11 @@ static void     ProcessFile( const char* const filename )
         }
 
         // load the output of csg
+        ProfileBeginPhase( "Load" );
         safe_snprintf( g_bspfilename, _MAX_PATH, "%s.bsp", filename );
         g_bspdata = LoadBSPFile( g_bspfilename );
         ParseEntities( g_bspdata );
+        ProfileEndPhase();
 
         Settings(); // AJM: moved here due to info_compile_parameters entity
 
@@ -1522,11 +1525,21 @@ static void     ProcessFile( const char* const filename )
         BeginBSPFile();
 
         // process each model individually
+        ProfileBeginPhase( "ProcessModels" );
         while ( ProcessModel() )
                 ;
+        ProfileEndPhase();
+
+        ProfileSetValue( "models", g_bspdata->nummodels );
+        ProfileSetValue( "nodes", g_bspdata->numnodes );
+        ProfileSetValue( "leafs", g_bspdata->numleafs );
+        ProfileSetValue( "faces", g_bspdata->numfaces );
+        ProfileSetValue( "edges", g_bspdata->numedges );
 
         // write the updated bsp file out
+        ProfileBeginPhase( "Write" );
         FinishBSPFile();
+        ProfileEndPhase();
 
         // Because the bsp file has been updated, these polyfiles are no longer valid.
         for ( i = 0; i < NUM_HULLS; i++ )
@@ -1575,7 +1588,7 @@ int             main( const int argc, char** argv )
                                 {
                                         if ( i + 1 < argc )	//added "1" .--vluzacn
                                         {
-                                                int             g_numthreads = atoi( argv[++i] );
+                                                g_numthreads = atoi( argv[++i] );
 
                                                 if ( g_numthreads < 1 )
                                                 {
@@ -1657,6 +1670,17 @@ int             main( const int argc, char** argv )
                                 {
                                         g_chart = true;
                                 }
+                                else if ( !strcasecmp( argv[i], "-profile" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                safe_strncpy( g_profilefile, argv[++i], _MAX_PATH );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 else if ( !strcasecmp( argv[i], "-low" ) )
                                 {
                                         g_threadpriority = TP_low;
@@ -1884,12 +1908,14 @@ int             main( const int argc, char** argv )
                         }
 
                         // BEGIN BSP
+                        ProfileStart();
                         start = I_FloatTime();
 
                         ProcessFile( g_Mapname );
 
                         end = I_FloatTime();
                         LogTimeElapsed( end - start );
+                        ProfileWrite( end - start );
                         // END BSP
 
                         FreeAllowableOutsideList();
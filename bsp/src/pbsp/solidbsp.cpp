@@ -26,6 +26,11 @@
 //  the volume of the node and pass into an adjacent node.
 #include <vector>
 #include <bitset>
+#include <algorithm>
+
+// BuildBspTree hands each thread about this many subtrees, so the threads
+// that get small ones can pick up more work.
+#define SUBTREES_PER_THREAD 4
 
 int             g_maxnode_size = DEFAULT_MAXNODE_SIZE;
 
@@ -43,12 +48,14 @@ static void UpdateStatus( void )
 {
         if ( g_reportProgress )
         {
+                ThreadLock();
                 ++g_numProcessed;
                 if ( ( g_numProcessed / 500 ) > g_numReported )
                 {
                         g_numReported = ( g_numProcessed / 500 );
                         Log( "%d...", g_numProcessed );
                 }
+                ThreadUnlock();
         }
 }
 
@@ -1567,18 +1574,23 @@ static void     CopyFacesToNode( node_t* node, surface_t* surf )
 }
 
 // =====================================================================================
-//  BuildBspTree_r
+//  BuildBspNode
+//      Partitions a single node.  Returns false if the node became a leaf.
+//      Subtrees are built on several threads at once, and the portals of a node are
+//      shared with the neighboring nodes, so they are only touched under ThreadLock.
 // =====================================================================================
-static void     BuildBspTree_r( node_t* node )
+static bool     BuildBspNode( node_t* node )
 {
         surface_t*      split;
         bool            midsplit;
         surface_t*      allsurfs;
         vec3_t			validmins, validmaxs;
 
+        ThreadLock();
         midsplit = CalcNodeBounds( node
                                    , validmins, validmaxs
         );
+        ThreadUnlock();
         if ( node->boundsbrush )
         {
                 CalcBrushBounds( node->boundsbrush, node->loosemins, node->loosemaxs );
@@ -1632,7 +1644,7 @@ static void     BuildBspTree_r( node_t* node )
         if ( !split )
         {                                                      // this is a leaf node
                 MakeLeaf( node );
-                return;
+                return false;
         }
 
         // these are final polygons
@@ -1686,8 +1698,23 @@ static void     BuildBspTree_r( node_t* node )
 
         if ( !split->detaillevel )
         {
+                ThreadLock();
                 MakeNodePortal( node );
                 SplitNodePortals( node );
+                ThreadUnlock();
+        }
+
+        return true;
+}
+
+// =====================================================================================
+//  BuildBspTree_r
+// =====================================================================================
+static void     BuildBspTree_r( node_t* node )
+{
+        if ( !BuildBspNode( node ) )
+        {
+                return;
         }
 
         // recursively do the children
@@ -1696,6 +1723,82 @@ static void     BuildBspTree_r( node_t* node )
         UpdateStatus();
 }
 
+// Subtrees handed out to the threads by SolidBSP.
+static std::vector< node_t * > g_subtrees;
+
+static void     BuildBspSubtree( int work )
+{
+        BuildBspTree_r( g_subtrees[work] );
+}
+
+// =====================================================================================
+//  BuildBspTree
+//      Partitions the top of the tree breadth first until there are enough
+//      independent subtrees to keep every thread busy, then builds the subtrees in
+//      parallel, the biggest first.  Only the world is big enough to be worth it.
+// =====================================================================================
+static void     BuildBspTree( node_t* headnode, bool threaded )
+{
+        std::vector< node_t * > level;
+        std::vector< node_t * > next;
+
+        if ( !threaded || g_numthreads <= 1 )
+        {
+                BuildBspTree_r( headnode );
+                return;
+        }
+
+        level.push_back( headnode );
+        while ( !level.empty() && (int)level.size() < g_numthreads * SUBTREES_PER_THREAD )
+        {
+                next.clear();
+                for ( size_t i = 0; i < level.size(); i++ )
+                {
+                        if ( BuildBspNode( level[i] ) )
+                        {
+                                next.push_back( level[i]->children[0] );
+                                next.push_back( level[i]->children[1] );
+                                UpdateStatus();
+                        }
+                }
+                level.swap( next );
+        }
+
+        if ( level.empty() )
+        {
+                return;
+        }
+
+        // rough guess at the size of each subtree
+        std::vector< std::pair< int, node_t * > > sized;
+        for ( size_t i = 0; i < level.size(); i++ )
+        {
+                int numfaces = 0;
+                for ( surface_t *surf = level[i]->surfaces; surf; surf = surf->next )
+                {
+                        for ( face_t *f = surf->faces; f; f = f->next )
+                        {
+                                numfaces++;
+                        }
+                }
+                sized.push_back( std::make_pair( -numfaces, level[i] ) );
+        }
+        std::stable_sort( sized.begin(), sized.end(),
+                          []( const std::pair< int, node_t * > &a, const std::pair< int, node_t * > &b )
+        {
+                return a.first < b.first;
+        } );
+
+        g_subtrees.clear();
+        for ( size_t i = 0; i < sized.size(); i++ )
+        {
+                g_subtrees.push_back( sized[i].second );
+        }
+
+        RunThreadsOn( (int)g_subtrees.size(), false, BuildBspSubtree, THREADCOST_EXPENSIVE );
+        g_subtrees.clear();
+}
+
 // =====================================================================================
 //  SolidBSP
 //      Takes a chain of surfaces plus a split type, and returns a bsp tree with faces 
@@ -1735,7 +1838,7 @@ node_t*         SolidBSP( const surfchain_t* const surfhead,
         MakeHeadnodePortals( headnode, surfhead->mins, surfhead->maxs );
 
         // recursively partition everything
-        BuildBspTree_r( headnode );
+        BuildBspTree( headnode, report_progress );
 
         double end_time = I_FloatTime();
         if ( report_progress )
@@ -139,6 +139,19 @@ static face_t*  edgefaces[MAX_MAP_EDGES][2];
 static int      firstmodeledge = 1;
 static int      firstmodelface;
 
+// edges of the current model, chained by vertex pair in ascending order so
+// that GetEdge picks the same edge the old linear search did
+#define	EDGE_HASH_SIZE	65536
+
+static int      edgehash_head[EDGE_HASH_SIZE];
+static int      edgehash_tail[EDGE_HASH_SIZE];
+static int      edgehash_next[MAX_MAP_EDGES];
+
+static inline int EdgeHash( const int v0, const int v1 )
+{
+        return (int)( ( (unsigned)v0 * 73856093u ) ^ ( (unsigned)v1 * 19349663u ) ) & ( EDGE_HASH_SIZE - 1 );
+}
+
 //============================================================================
 
 #define	NUM_HASH	4096
@@ -338,7 +351,9 @@ int             GetEdge( const vec3_t p1, const vec3_t p2, face_t* f )
 
         v1 = GetVertex( p1, f->planenum );
         v2 = GetVertex( p2, f->planenum );
-        for ( i = firstmodeledge; i < g_bspdata->numedges; i++ )
+
+        // look for the edge going the other way
+        for ( i = edgehash_head[EdgeHash( v2, v1 )]; i; i = edgehash_next[i] )
         {
                 edge = &g_bspdata->dedges[i];
                 if ( v1 == edge->v[1] && v2 == edge->v[0] && !edgefaces[i][1] && edgefaces[i][0]->contents == f->contents
@@ -353,11 +368,25 @@ int             GetEdge( const vec3_t p1, const vec3_t p2, face_t* f )
 
         // emit an edge
         hlassume( g_bspdata->numedges < MAX_MAP_EDGES, assume_MAX_MAP_EDGES );
-        edge = &g_bspdata->dedges[g_bspdata->numedges];
+        i = g_bspdata->numedges;
+        edge = &g_bspdata->dedges[i];
         g_bspdata->numedges++;
         edge->v[0] = v1;
         edge->v[1] = v2;
         edgefaces[i][0] = f;
+        edgefaces[i][1] = NULL;
+
+        int h = EdgeHash( v1, v2 );
+        edgehash_next[i] = 0;
+        if ( edgehash_tail[h] )
+        {
+                edgehash_next[edgehash_tail[h]] = i;
+        }
+        else
+        {
+                edgehash_head[h] = i;
+        }
+        edgehash_tail[h] = i;
 
         return i;
 }
@@ -368,6 +397,8 @@ int             GetEdge( const vec3_t p1, const vec3_t p2, face_t* f )
 void            MakeFaceEdges()
 {
         InitHash();
+        memset( edgehash_head, 0, sizeof( edgehash_head ) );
+        memset( edgehash_tail, 0, sizeof( edgehash_tail ) );
         firstmodeledge = g_bspdata->numedges;
         firstmodelface = g_bspdata->numfaces;
 }
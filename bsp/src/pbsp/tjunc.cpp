@@ -1,5 +1,7 @@
 #include "bsp5.h"
 
+#include <vector>
+
 typedef struct wvert_s
 {
         vec_t           t;
@@ -175,7 +177,12 @@ static bool     CanonicalVector( vec3_t vec )
         return false;
 }
 
-static wedge_t *FindEdge( const vec3_t p1, const vec3_t p2, vec_t* t1, vec_t* t2 )
+// =====================================================================================
+//  FindEdge
+//      When create is false, edges that aren't known yet return NULL instead of
+//      being added, so the lookup only reads the hash and the wedges.
+// =====================================================================================
+static wedge_t *FindEdge( const vec3_t p1, const vec3_t p2, vec_t* t1, vec_t* t2, bool create = true )
 {
         vec3_t          origin;
         vec3_t          dir;
@@ -226,6 +233,11 @@ static wedge_t *FindEdge( const vec3_t p1, const vec3_t p2, vec_t* t1, vec_t* t2
                         return w;
                 }
 
+        if ( !create )
+        {
+                return NULL;
+        }
+
         hlassume( numwedges < MAX_WEDGES, assume_MAX_WEDGES );
         w = &wedges[numwedges];
         numwedges++;
@@ -315,12 +327,14 @@ static void     AddFaceEdges( const face_t* const f )
 
 //============================================================================
 
-static byte     superfacebuf[1024 * 16];
-static face_t*  superface = (face_t*)superfacebuf;
-static int      MAX_SUPERFACEEDGES = ( sizeof( superfacebuf ) - sizeof( face_t ) + sizeof( superface->pts ) ) / sizeof( vec3_t );
-static face_t*  newlist;
+// The fix pass runs on several threads at once, so each thread builds its
+// faces in its own scratch face.
+#define SUPERFACE_BYTES	( 1024 * 16 )
 
-static void     SplitFaceForTjunc( face_t* f, face_t* original )
+static thread_local byte superfacebuf[SUPERFACE_BYTES];
+static const int MAX_SUPERFACEEDGES = ( SUPERFACE_BYTES - sizeof( face_t ) + sizeof( ( (face_t*)0 )->pts ) ) / sizeof( vec3_t );
+
+static void     SplitFaceForTjunc( face_t* f, face_t* original, face_t** newlist, int* numfaces )
 {
         int             i;
         face_t*         newface;
@@ -345,12 +359,12 @@ static void     SplitFaceForTjunc( face_t* f, face_t* original )
                                                                    // so copy it back to the original
                         *original = *f;
                         original->original = chain;
-                        original->next = newlist;
-                        newlist = original;
+                        original->next = *newlist;
+                        *newlist = original;
                         return;
                 }
 
-                tjuncfaces++;
+                ( *numfaces )++;
 
 restart:
                 // find the last corner 
@@ -402,8 +416,8 @@ restart:
 
                 newface->original = chain;
                 chain = newface;
-                newface->next = newlist;
-                newlist = newface;
+                newface->next = *newlist;
+                *newlist = newface;
                 if ( f->numpoints - firstcorner <= MAXPOINTS )
                 {
                         newface->numpoints = firstcorner + 2;
@@ -437,8 +451,9 @@ restart:
 *
 * ===============
 */
-static void     FixFaceEdges( face_t* f )
+static void     FixFaceEdges( face_t* f, face_t** newlist, int* numedges, int* numfaces )
 {
+        face_t*         superface = (face_t*)superfacebuf;
         int             i;
         int             j;
         int             k;
@@ -454,7 +469,12 @@ restart:
         {
                 j = ( i + 1 ) % superface->numpoints;
 
-                w = FindEdge( superface->pts[i], superface->pts[j], &t1, &t2 );
+                w = FindEdge( superface->pts[i], superface->pts[j], &t1, &t2, false );
+                if ( !w )
+                {
+                        // a new edge can't have any points on it yet
+                        continue;
+                }
 
                 for ( v = w->head.next; v->t < t1 + T_EPSILON; v = v->next )
                 {
@@ -462,7 +482,7 @@ restart:
 
                 if ( v->t < t2 - T_EPSILON )
                 {
-                        tjuncs++;
+                        ( *numedges )++;
                         // insert a new vertex here
                         for ( k = superface->numpoints; k > j; k-- )
                         {
@@ -478,14 +498,14 @@ restart:
         if ( superface->numpoints <= MAXPOINTS )
         {
                 *f = *superface;
-                f->next = newlist;
-                newlist = f;
+                f->next = *newlist;
+                *newlist = f;
                 return;
         }
 
         // the face needs to be split into multiple faces because of too many edges
 
-        SplitFaceForTjunc( superface, f );
+        SplitFaceForTjunc( superface, f, newlist, numfaces );
 
 }
 
@@ -509,28 +529,51 @@ static void     tjunc_find_r( node_t* node )
         tjunc_find_r( node->children[1] );
 }
 
-static void     tjunc_fix_r( node_t* node )
-{
-        face_t*         f;
-        face_t*         next;
+// Nodes with faces, handed out to the threads by the fix pass.
+static std::vector< node_t * > fixnodes;
 
+static void     tjunc_collect_r( node_t* node )
+{
         if ( node->planenum == PLANENUM_LEAF )
         {
                 return;
         }
 
-        newlist = NULL;
+        if ( node->faces )
+        {
+                fixnodes.push_back( node );
+        }
+
+        tjunc_collect_r( node->children[0] );
+        tjunc_collect_r( node->children[1] );
+}
+
+// =====================================================================================
+//  tjunc_fix_node
+//      The wedges are only read once all of the edges have been found, so every
+//      node can be fixed independently.
+// =====================================================================================
+static void     tjunc_fix_node( int work )
+{
+        node_t*         node = fixnodes[work];
+        face_t*         f;
+        face_t*         next;
+        face_t*         newlist = NULL;
+        int             numedges = 0;
+        int             numfaces = 0;
 
         for ( f = node->faces; f; f = next )
         {
                 next = f->next;
-                FixFaceEdges( f );
+                FixFaceEdges( f, &newlist, &numedges, &numfaces );
         }
 
         node->faces = newlist;
 
-        tjunc_fix_r( node->children[0] );
-        tjunc_fix_r( node->children[1] );
+        ThreadLock();
+        tjuncs += numedges;
+        tjuncfaces += numfaces;
+        ThreadUnlock();
 }
 
 /*
@@ -539,7 +582,7 @@ static void     tjunc_fix_r( node_t* node )
 *
 * ===========
 */
-void            tjunc( node_t* headnode )
+void            tjunc( node_t* headnode, bool threaded )
 {
         vec3_t          maxs, mins;
         int             i;
@@ -582,7 +625,21 @@ void            tjunc( node_t* headnode )
         //
         tjuncs = tjuncfaces = 0;
 
-        tjunc_fix_r( headnode );
+        fixnodes.clear();
+        tjunc_collect_r( headnode );
+        if ( threaded && g_numthreads > 1 )
+        {
+                Log( "FixTJunctions:" );
+                RunThreadsOn( (int)fixnodes.size(), false, tjunc_fix_node );
+        }
+        else
+        {
+                for ( i = 0; i < (int)fixnodes.size(); i++ )
+                {
+                        tjunc_fix_node( i );
+                }
+        }
+        fixnodes.clear();
 
         Verbose( "%i edges added by tjunctions\n", tjuncs );
         Verbose( "%i faces added by tjunctions\n", tjuncfaces );
@@ -19,6 +19,7 @@
 #include "scriplib.h"
 #include "winding.h"
 #include "threads.h"
+#include "profile.h"
 #include "bspfile.h"
 #include "blockmem.h"
 #include "filelib.h"
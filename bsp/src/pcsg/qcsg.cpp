@@ -1265,6 +1265,7 @@ static void     Usage()
         Log( "    -texdata #       : Alter maximum texture memory limit (in kb)\n" );
         Log( "    -lightdata #     : Alter maximum lighting memory limit (in kb)\n" );
         Log( "    -chart           : display bsp statitics\n" );
+        Log( "    -profile file    : Write a JSON report of the compile times to file\n" );
         Log( "    -low | -high     : run program an altered priority level\n" );
         Log( "    -nolog           : don't generate the compile logfiles\n" );
         Log( "    -noresetlog      : Do not delete log file\n" );
@@ -1514,6 +1515,17 @@ int             main( const int argc, char** argv )
                                 {
                                         g_chart = true;
                                 }
+                                else if ( !strcasecmp( argv[i], "-profile" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                safe_strncpy( g_profilefile, argv[++i], _MAX_PATH );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 else if ( !strcasecmp( argv[i], "-low" ) )
                                 {
                                         g_threadpriority = TP_low;
@@ -1811,6 +1823,7 @@ int             main( const int argc, char** argv )
                         // AJM: re-arranged some stuff up here so that the mapfile is loaded
                         //  before settings are finalised and printed out, so that the info_compile_parameters
                         //  entity can be dealt with effectively
+                        ProfileStart();
                         start = I_FloatTime();
                         if ( g_hullfile )
                         {
@@ -1902,7 +1915,10 @@ int             main( const int argc, char** argv )
 
                         g_bspdata = new bspdata_t;
 
+                        ProfileBeginPhase( "LoadMapFile" );
                         LoadMapFile( name );
+                        ProfileEndPhase();
+                        ProfileSetValue( "brushes", g_nummapbrushes );
                         ThreadSetDefault();
                         ThreadSetPriority( g_threadpriority );
                         Settings();
@@ -2025,12 +2041,15 @@ int             main( const int argc, char** argv )
 
                                 end = I_FloatTime();
                                 LogTimeElapsed( end - start );
+                                ProfileWrite( end - start );
                                 return 0;
                         }
 
                         // createbrush
+                        ProfileBeginPhase( "CreateBrush" );
                         NamedRunThreadsOnIndividual( g_nummapbrushes, g_estimate, CreateBrush );
                         CheckFatal();
+                        ProfileEndPhase();
 
 
                         // boundworld
@@ -2092,7 +2111,11 @@ int             main( const int argc, char** argv )
                                 fclose( f );
                         }
 
+                        ProfileBeginPhase( "ProcessModels" );
                         ProcessModels();
+                        ProfileEndPhase();
+                        ProfileSetValue( "csg_faces", c_csgfaces );
+                        ProfileSetValue( "used_faces", c_outfaces );
 
                         Verbose( "%5i csg faces\n", c_csgfaces );
                         Verbose( "%5i used faces\n", c_outfaces );
@@ -2110,11 +2133,13 @@ int             main( const int argc, char** argv )
                                 }
                         }
 
+                        ProfileBeginPhase( "Write" );
                         EmitPlanes();
                         EmitBrushes();
 
 
                         WriteBSP( g_Mapname );
+                        ProfileEndPhase();
 
                         // AJM: debug
 #if 0
@@ -2142,6 +2167,7 @@ int             main( const int argc, char** argv )
                         // elapsed time
                         end = I_FloatTime();
                         LogTimeElapsed( end - start );
+                        ProfileWrite( end - start );
 
                 }
         }
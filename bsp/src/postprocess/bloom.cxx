@@ -15,6 +15,7 @@
 #include "blurPasses.h"
 
 #include <configVariableDouble.h>
+#include <configVariableInt.h>
 #include <texture.h>
 
 static ConfigVariableDouble r_bloomscale( "r_bloomscale", 1.0 );
@@ -24,6 +25,10 @@ static ConfigVariableDouble r_bloomtintg( "r_bloomtintg", 0.59 );
 static ConfigVariableDouble r_bloomtintb( "r_bloomtintb", 0.11 );
 static ConfigVariableDouble r_bloomtintexponent( "r_bloomtintexponent", 2.2 );
 
+// The downsample shader averages a 4x4 block of the framebuffer, so anything
+// past 4 skips pixels.
+static ConfigVariableInt r_bloom_res_div( "r_bloom_res_div", 4 );
+
 class DownsampleLuminance : public PostProcessPass
 {
 public:
@@ -31,8 +36,7 @@ public:
 		PostProcessPass( pp, "bloom-downsample_luminance" ),
 		_tap_offsets( PTA_LVecBase2f::empty_array( 4 ) )
 	{
-		// Downsample by 4
-		set_div_size( true, 4 );
+		set_div_size( true, r_bloom_res_div );
 	}
 
 	virtual void setup()
@@ -88,6 +92,7 @@ BloomEffect::BloomEffect( PostProcess *pp ) :
 
 	// Downsample the framebuffer by 4, multiply image by luminance of image
 	PT( DownsampleLuminance ) dsl = new DownsampleLuminance( pp );
+	dsl->set_transient( true );
 	dsl->setup();
 	dsl->add_color_output();
 
@@ -95,14 +100,22 @@ BloomEffect::BloomEffect( PostProcess *pp ) :
 	// Separable gaussian blur
 	//
 
-	PT( BlurX ) blur_x = new BlurX( pp, dsl->get_color_texture() );
+	PT( BlurX ) blur_x = new BlurX( pp, dsl->get_color_texture(), r_bloom_res_div );
+	blur_x->set_transient( true );
 	blur_x->setup();
 	blur_x->add_color_output();
 
-	PT( BlurY ) blur_y = new BlurY( pp, blur_x, LVector3f( r_bloomscale ) );
+	// Only the horizontal blur reads the downsampled image, so the vertical
+	// blur can render into the same texture.
+	dsl->release_color_output();
+
+	PT( BlurY ) blur_y = new BlurY( pp, blur_x, LVector3f( r_bloomscale ), r_bloom_res_div );
+	blur_y->set_transient( true );
 	blur_y->setup();
 	blur_y->add_color_output();
 
+	blur_x->release_color_output();
+
 	add_pass( dsl );
 	add_pass( blur_x );
 	add_pass( blur_y );
@@ -5,13 +5,13 @@
 class BlurX : public PostProcessPass
 {
 public:
-	BlurX( PostProcess *pp, Texture *blur_input ) :
+	BlurX( PostProcess *pp, Texture *blur_input, int div = 4 ) :
 		PostProcessPass( pp, "blurX" ),
 		_vs_tap_offsets( PTA_LVecBase2f::empty_array( 3 ) ),
 		_ps_tap_offsets( PTA_LVecBase2f::empty_array( 3 ) ),
 		_blur_input( blur_input )
 	{
-		set_div_size( true, 4 );
+		set_div_size( true, div );
 	}
 
 	virtual void setup()
@@ -65,14 +65,14 @@ private:
 class BlurY : public PostProcessPass
 {
 public:
-	BlurY( PostProcess *pp, BlurX *blur_x, const LVector3f &scale_factor ) :
+	BlurY( PostProcess *pp, BlurX *blur_x, const LVector3f &scale_factor, int div = 4 ) :
 		PostProcessPass( pp, "blurY" ),
 		_vs_tap_offsets( PTA_LVecBase2f::empty_array( 3 ) ),
 		_ps_tap_offsets( PTA_LVecBase2f::empty_array( 3 ) ),
 		_blur_x( blur_x ),
 		_scale_factor( scale_factor )
 	{
-		set_div_size( true, 4 );
+		set_div_size( true, div );
 	}
 
 	virtual void setup()
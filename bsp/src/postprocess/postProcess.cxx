@@ -18,6 +18,17 @@
 #include <displayRegion.h>
 #include <asyncTaskManager.h>
 #include <auxBitplaneAttrib.h>
+#include <configVariableBool.h>
+#include <pset.h>
+#include <string_utils.h>
+
+#include <algorithm>
+#include <iomanip>
+
+static ConfigVariableBool postprocess_alias_targets(
+	"postprocess-alias-targets", true,
+	PRC_DESC( "If true, transient postprocess passes whose outputs are not needed "
+		  "at the same time render into the same texture, to save video memory." ) );
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // PostProcess
@@ -152,6 +163,168 @@ void PostProcess::set_stacked_clears( int n, DrawableRegion *region )
 	set_stacked_clears( region, _window_clears, _camera_info[n]->region_clears );
 }
 
+/**
+ * Returns a color texture for the indicated transient pass to render into.
+ * A texture that has been released by every pass using it is handed out again
+ * if it is the same size and format.  That is safe because passes render in
+ * the order they are set up, so the passes that wrote and read the texture
+ * are done with it by the time this one renders.
+ */
+Texture *PostProcess::acquire_render_target( PostProcessPass *pass, Texture::Format format )
+{
+	if ( postprocess_alias_targets )
+	{
+		for ( size_t i = 0; i < _render_targets.size(); i++ )
+		{
+			rendertarget_t &rt = _render_targets[i];
+			if ( rt.users == 0 &&
+			     rt.format == format &&
+			     rt.force_size == pass->get_force_size() &&
+			     ( !rt.force_size || rt.forced_size == pass->get_forced_size() ) &&
+			     rt.div_size == pass->get_div_size() &&
+			     ( !rt.div_size || rt.div == pass->get_div() ) )
+			{
+				rt.users++;
+				return rt.texture;
+			}
+		}
+	}
+
+	rendertarget_t rt;
+	rt.texture = pass->make_texture( format, "color" );
+	rt.format = format;
+	rt.force_size = pass->get_force_size();
+	rt.forced_size = pass->get_forced_size();
+	rt.div_size = pass->get_div_size();
+	rt.div = pass->get_div();
+	rt.users = 1;
+	_render_targets.push_back( rt );
+
+	return rt.texture;
+}
+
+/**
+ * Returns a texture given out by acquire_render_target() to the pool.
+ */
+void PostProcess::release_render_target( Texture *tex )
+{
+	for ( size_t i = 0; i < _render_targets.size(); i++ )
+	{
+		rendertarget_t &rt = _render_targets[i];
+		if ( rt.texture == tex )
+		{
+			nassertv( rt.users > 0 );
+			rt.users--;
+			return;
+		}
+	}
+
+	// Not one of ours: released twice, or never acquired.
+	nassertv( false );
+}
+
+static bool compare_pass_sort( const PostProcessPass *a, const PostProcessPass *b )
+{
+	return a->get_sort() < b->get_sort();
+}
+
+/**
+ * Fills in the scene pass and the passes of all effects, in the order they
+ * render.
+ */
+void PostProcess::get_passes( pvector<PostProcessPass *> &passes ) const
+{
+	passes.push_back( _scene_pass );
+	for ( size_t i = 0; i < _effects.size(); i++ )
+	{
+		PostProcessEffect *effect = _effects.get_data( i );
+		for ( int j = 0; j < effect->get_num_passes(); j++ )
+		{
+			passes.push_back( effect->get_pass( j ) );
+		}
+	}
+	std::sort( passes.begin(), passes.end(), compare_pass_sort );
+}
+
+/**
+ * Returns an estimate of the video memory taken up by the textures that the
+ * postprocessing passes render into.  A texture shared by several passes is
+ * only counted once.
+ */
+size_t PostProcess::get_memory_usage() const
+{
+	pset<Texture *> counted;
+	size_t bytes = 0;
+
+	pvector<PostProcessPass *> passes;
+	get_passes( passes );
+
+	for ( size_t i = 0; i < passes.size(); i++ )
+	{
+		PostProcessPass *pass = passes[i];
+		Texture *textures[2 + AUXTEXTURE_COUNT] = { pass->get_color_texture(), pass->get_depth_texture() };
+		for ( int j = 0; j < AUXTEXTURE_COUNT; j++ )
+		{
+			textures[2 + j] = pass->get_aux_texture( j );
+		}
+		for ( int j = 0; j < 2 + AUXTEXTURE_COUNT; j++ )
+		{
+			if ( textures[j] && counted.insert( textures[j] ).second )
+			{
+				bytes += textures[j]->estimate_texture_memory();
+			}
+		}
+	}
+
+	return bytes;
+}
+
+/**
+ * Writes the size of each pass and the video memory taken up by the textures
+ * it renders into, in the order the passes render.  A pass that renders into
+ * a texture that an earlier pass already took is listed with the name of the
+ * texture it shares.
+ */
+void PostProcess::write_memory_report( std::ostream &out ) const
+{
+	pvector<PostProcessPass *> passes;
+	get_passes( passes );
+
+	pset<Texture *> seen;
+	size_t total = 0;
+	for ( size_t i = 0; i < passes.size(); i++ )
+	{
+		PostProcessPass *pass = passes[i];
+		LVector2i size = pass->get_size();
+		size_t bytes = pass->get_memory_usage();
+
+		out << std::setw( 32 ) << std::left << pass->get_name()
+		    << std::setw( 12 ) << ( format_string( size[0] ) + "x" + format_string( size[1] ) );
+		if ( pass->get_div_size() && pass->get_div() > 1 )
+		{
+			out << std::setw( 8 ) << ( "1/" + format_string( pass->get_div() ) );
+		}
+		else
+		{
+			out << std::setw( 8 ) << "";
+		}
+		out << std::right << std::setw( 8 ) << ( bytes + 1023 ) / 1024 << " KB";
+
+		Texture *color = pass->get_color_texture();
+		if ( color && !seen.insert( color ).second )
+		{
+			out << " (shares " << color->get_name() << ")";
+		}
+		out << "\n";
+
+		total += bytes;
+	}
+
+	size_t usage = get_memory_usage();
+	out << "Total " << ( usage + 1023 ) / 1024 << " KB, "
+	    << ( total - usage ) / 1024 << " KB saved by sharing textures\n";
+}
+
 void PostProcess::set_scene_aux_bits( int bits )
 {
 	_scene_pass->set_camera_state( RenderState::make( AuxBitplaneAttrib::make( bits ) ) );
@@ -168,6 +341,8 @@ void PostProcess::shutdown()
 	_scene_pass->shutdown();
 	_scene_pass = nullptr;
 
+	_render_targets.clear();
+
 	_output = nullptr;
 
 	for ( size_t i = 0; i < _camera_info.size(); i++ )
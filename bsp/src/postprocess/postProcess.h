@@ -73,6 +73,9 @@ public:
 		return _camera_info[n];
 	}
 
+	Texture *acquire_render_target( PostProcessPass *pass, Texture::Format format );
+	void release_render_target( Texture *tex );
+
 PUBLISHED:
 	PostProcess();
 
@@ -148,6 +151,9 @@ PUBLISHED:
 	void update();
 	void window_event();
 
+	size_t get_memory_usage() const;
+	void write_memory_report( std::ostream &out ) const;
+
 private:
 	ClearInfoArray _window_clears;
 	CameraInfoArray _camera_info;
@@ -155,6 +161,7 @@ private:
 	void get_clears( DrawableRegion *region, ClearInfoArray &info );
 	void set_clears( DrawableRegion *region, const ClearInfoArray &info );
 	void set_stacked_clears( DrawableRegion *region, const ClearInfoArray &a, const ClearInfoArray &b );
+	void get_passes( pvector<PostProcessPass *> &passes ) const;
 
 	SimpleHashMap<std::string, PT( PostProcessEffect ), string_hash> _effects;
 	GraphicsOutput *_output;
@@ -167,6 +174,21 @@ private:
 	PT( PostProcessScenePass ) _scene_pass;
 
 	int _buffer_sort;
+
+	// The color textures of transient passes.  A texture with no users left
+	// is handed to the next transient pass of the same size and format.
+	struct rendertarget_t
+	{
+		PT( Texture ) texture;
+		Texture::Format format;
+		bool force_size;
+		LVector2i forced_size;
+		bool div_size;
+		int div;
+		int users;
+	};
+	typedef pvector<rendertarget_t> RenderTargetArray;
+	RenderTargetArray _render_targets;
 };
 
 #endif // POSTPROCESS_H
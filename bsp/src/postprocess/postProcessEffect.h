@@ -42,6 +42,15 @@ PUBLISHED:
 	void remove_pass( PostProcessPass *pass );
 	PostProcessPass *get_pass( const std::string &name );
 
+	INLINE int get_num_passes() const
+	{
+		return (int)_passes.size();
+	}
+	INLINE PostProcessPass *get_pass( int n ) const
+	{
+		return _passes.get_data( n );
+	}
+
 	virtual void setup();
 	virtual void update();
 	void window_event( GraphicsOutput *win );
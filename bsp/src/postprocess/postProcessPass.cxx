@@ -58,6 +58,8 @@ PostProcessPass::PostProcessPass( PostProcess *pp, const std::string &name,
 	_region( nullptr ),
 	_div_size( div_size ),
 	_div( div ),
+	_transient( false ),
+	_holds_target( false ),
 
 	_color_texture( nullptr ),
 	_depth_texture( nullptr )
@@ -96,11 +98,37 @@ void PostProcessPass::add_color_output()
 	nassertv( _buffer != nullptr );
 	if ( !_color_texture )
 	{
-		_color_texture = make_texture( Texture::F_srgb, "color" );
+		if ( _transient )
+		{
+			_color_texture = _pp->acquire_render_target( this, Texture::F_srgb );
+			_holds_target = true;
+		}
+		else
+		{
+			_color_texture = make_texture( Texture::F_srgb, "color" );
+		}
 		_buffer->add_render_texture( _color_texture, GraphicsOutput::RTM_bind_or_copy, GraphicsOutput::RTP_color );
 	}
 }
 
+/**
+ * Gives the color texture of a transient pass back to the render target pool,
+ * so that a pass that is set up later can render into it.  Call this once
+ * every pass that reads our color output has been set up; those render before
+ * any pass that is set up from here on.
+ *
+ * We keep rendering into the texture, so our output is only good until the
+ * next pass that takes the texture renders.
+ */
+void PostProcessPass::release_color_output()
+{
+	if ( _holds_target )
+	{
+		_pp->release_render_target( _color_texture );
+		_holds_target = false;
+	}
+}
+
 void PostProcessPass::add_depth_output()
 {
 	nassertv( _buffer != nullptr );
@@ -134,6 +162,31 @@ PT( Texture ) PostProcessPass::make_texture( Texture::Format format, const std::
 	return tex;
 }
 
+/**
+ * Returns an estimate of the video memory taken up by the textures that this
+ * pass renders into.
+ */
+size_t PostProcessPass::get_memory_usage() const
+{
+	size_t bytes = 0;
+	if ( _color_texture )
+	{
+		bytes += _color_texture->estimate_texture_memory();
+	}
+	if ( _depth_texture )
+	{
+		bytes += _depth_texture->estimate_texture_memory();
+	}
+	for ( size_t i = 0; i < _aux_textures.size(); i++ )
+	{
+		if ( _aux_textures[i] )
+		{
+			bytes += _aux_textures[i]->estimate_texture_memory();
+		}
+	}
+	return bytes;
+}
+
 bool PostProcessPass::setup_buffer()
 {
 	GraphicsOutput *window = _pp->get_output();
@@ -220,8 +273,7 @@ void PostProcessPass::window_event( GraphicsOutput *output )
 {
 	if ( !_force_size && _buffer )
 	{
-		LVector2i size = output->get_size();
-		get_corrected_size( size );
+		LVector2i size = get_corrected_size( output->get_size() );
 		if ( size != _buffer->get_size() )
 			_buffer->set_size( size[0], size[1] );
 	}
@@ -229,6 +281,8 @@ void PostProcessPass::window_event( GraphicsOutput *output )
 
 void PostProcessPass::shutdown()
 {
+	release_color_output();
+
 	_buffer->remove_display_region( _region );
 	_region = nullptr;
 	_buffer->clear_render_textures();
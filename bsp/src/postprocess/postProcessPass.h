@@ -36,6 +36,7 @@ PUBLISHED:
 			 bool force_size = false, const LVector2i &forced_size = LVector2i::zero(), bool div_size = false, int div = 1 );
 
 	void add_color_output();
+	void release_color_output();
 	void add_depth_output();
 	virtual void add_aux_output( int n );
 
@@ -57,12 +58,55 @@ PUBLISHED:
 		_div = div;
 	}
 
+	INLINE bool get_div_size() const
+	{
+		return _div_size;
+	}
+
+	INLINE int get_div() const
+	{
+		return _div;
+	}
+
 	INLINE void set_forced_size( bool force_size, const LVector2i &forced_size )
 	{
 		_force_size = force_size;
 		_forced_size = forced_size;
 	}
 
+	INLINE bool get_force_size() const
+	{
+		return _force_size;
+	}
+
+	INLINE const LVector2i &get_forced_size() const
+	{
+		return _forced_size;
+	}
+
+	// A transient pass renders into a color texture from the render target
+	// pool of the PostProcess, which may be shared with other passes.
+	// See PostProcess::acquire_render_target().
+	INLINE void set_transient( bool transient )
+	{
+		_transient = transient;
+	}
+
+	INLINE bool is_transient() const
+	{
+		return _transient;
+	}
+
+	INLINE int get_sort() const
+	{
+		return _buffer ? _buffer->get_sort() : 0;
+	}
+
+	INLINE LVector2i get_size() const
+	{
+		return _buffer ? _buffer->get_size() : LVector2i::zero();
+	}
+
 	INLINE void set_framebuffer_properties( const FrameBufferProperties &fbprops )
 	{
 		_fbprops = fbprops;
@@ -86,6 +130,8 @@ PUBLISHED:
 
 	PT( Texture ) make_texture( Texture::Format format, const std::string &suffix );
 
+	size_t get_memory_usage() const;
+
 	virtual bool setup_buffer();
 	virtual void setup_quad();
 	virtual void setup_camera();
@@ -114,6 +160,10 @@ protected:
 	bool _div_size;
 	int _div;
 
+	bool _transient;
+	// True while our color texture is checked out of the render target pool.
+	bool _holds_target;
+
 	// Output textures from this pass
 	PT( Texture ) _color_texture;
 	PT( Texture ) _depth_texture;
@@ -12,6 +12,7 @@ static ConfigVariableDouble r_hbao_radius( "r_hbao_radius", 0.3 );
 static ConfigVariableDouble r_hbao_strength( "r_hbao_strength", 2.5 );
 static ConfigVariableDouble r_hbao_max_radius_pixels( "r_hbao_max_radius_pixels", 50.0 );
 //static ConfigVariableInt r_hbao_res_ratio( "r_hbao_res_ratio", 2 );
+static ConfigVariableInt r_ssao_res_div( "r_ssao_res_div", 2 );
 static ConfigVariableInt r_hbao_dirs( "r_hbao_dirs", 6 );
 static ConfigVariableInt r_hbao_samples( "r_hbao_samples", 3 );
 static ConfigVariableInt r_hbao_noise_res( "r_hbao_noise_res", 4 );
@@ -25,6 +26,7 @@ public:
 		PostProcessPass( pp, "ssao-pass" ),
 		_dimensions( PTA_LVecBase2f::empty_array( 1 ) )
 	{
+		set_div_size( true, r_ssao_res_div );
 	}
 
 	virtual void setup()
@@ -48,7 +50,8 @@ public:
 	{
 		PostProcessPass::update();
 
-		LVector2i dim = get_back_buffer_dimensions();
+		// Size of our render target, which may be smaller than the backbuffer
+		LVector2i dim = _buffer->get_size();
 		_dimensions[0][0] = dim[0];
 		_dimensions[0][1] = dim[1];
 	}
@@ -132,6 +135,7 @@ SSAO_Effect::SSAO_Effect( PostProcess *pp, Mode mode ) :
 	if ( mode == M_SSAO )
 	{
 		PT( SSAO_Pass ) ssao = new SSAO_Pass( pp );
+		ssao->set_transient( true );
 		ssao->setup();
 		ssao->add_color_output();
 		ao_output = ssao->get_color_texture();
@@ -148,14 +152,23 @@ SSAO_Effect::SSAO_Effect( PostProcess *pp, Mode mode ) :
 	// Separable gaussian blur
 	//
 
-	PT( BlurX ) blur_x = new BlurX( pp, ao_output );
+	PT( BlurX ) blur_x = new BlurX( pp, ao_output, r_ssao_res_div );
+	blur_x->set_transient( true );
 	blur_x->setup();
 	blur_x->add_color_output();
 
-	PT( BlurY ) blur_y = new BlurY( pp, blur_x, 1 );
+	if ( mode == M_SSAO )
+	{
+		get_pass( "ssao-pass" )->release_color_output();
+	}
+
+	PT( BlurY ) blur_y = new BlurY( pp, blur_x, LVector3f( 1 ), r_ssao_res_div );
+	blur_y->set_transient( true );
 	blur_y->setup();
 	blur_y->add_color_output();
 
+	blur_x->release_color_output();
+
 
 	add_pass( blur_x );
 	add_pass( blur_y );
@@ -163,5 +176,6 @@ SSAO_Effect::SSAO_Effect( PostProcess *pp, Mode mode ) :
 
 Texture *SSAO_Effect::get_final_texture()
 {
-	return get_pass( "ssao-pass" )->get_color_texture();
+	// The raw AO texture is handed to later passes once the blur has read it.
+	return get_pass( "blurY" )->get_color_texture();
 }
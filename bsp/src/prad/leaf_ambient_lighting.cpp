@@ -27,6 +27,8 @@ struct AmbientSample
 {
         LVector3 pos;
         LVector3 cube[6];
+        // L1 spherical harmonics: dc, then the x, y and z linear terms
+        LVector3 sh[4];
 };
 
 typedef pvector<AmbientSample> vector_ambientsample;
@@ -220,7 +222,7 @@ float worldlight_distance_falloff( const directlight_t *dl, const vec3_t &delta
         return inv_r_squared( vec );
 }
 
-void add_emit_surface_lights( const LVector3 &start, LVector3 *cube )
+void add_emit_surface_lights( const LVector3 &start, LVector3 *cube, LVector3 *sh )
 {
         float fraction_visible[4];
         memset( fraction_visible, 0, sizeof( fraction_visible ) );
@@ -273,22 +275,30 @@ void add_emit_surface_lights( const LVector3 &start, LVector3 *cube )
                         continue;
                 }
 
+                LVector3 intensity;
+                VectorCopy( dl->intensity, intensity );
+                intensity *= ratio;
+
                 for ( int i = 0; i < 6; i++ )
                 {
                         float t = DotProduct( box_directions[i], deltanorm );
                         if ( t > 0 )
                         {
-                                LVector3 intensity;
-                                VectorCopy( dl->intensity, intensity );
-                                intensity *= ( t * ratio );
-                                VectorAdd( cube[i], intensity, cube[i] );
+                                cube[i] += intensity * t;
                         }
                 }
+
+                // The projection of a clamped cosine lobe facing the light.
+                sh[0] += intensity * 0.25f;
+                for ( int axis = 0; axis < 3; axis++ )
+                {
+                        sh[axis + 1] += intensity * ( deltanorm[axis] * 0.5f );
+                }
         }
 }
 
 void compute_ambient_from_spherical_samples( int thread, const LVector3 &sample_pos,
-                                             LVector3 *cube )
+                                             LVector3 *cube, LVector3 *sh )
 {
         LVector3 radcolor[NUMVERTEXNORMALS];
         fltx4 tan_theta = ReplicateX4( std::tan( VERTEXNORMAL_CONE_INNER_ANGLE ) );
@@ -346,12 +356,35 @@ void compute_ambient_from_spherical_samples( int thread, const LVector3 &sample_
                 cube[j] *= ( 1 / t );
         }
 
+        // Project the samples onto L1 spherical harmonics, convolved with the
+        // cosine lobe so that evaluating them gives the same irradiance the
+        // cube sides hold: dc is the mean radiance, and each linear term is
+        // 2/N times the radiance weighted by that axis of the direction.
+        for ( int k = 0; k < 4; k++ )
+        {
+                sh[k].set( 0, 0, 0 );
+        }
+        for ( int i = 0; i < NUMVERTEXNORMALS; i++ )
+        {
+                sh[0] += radcolor[i];
+                for ( int axis = 0; axis < 3; axis++ )
+                {
+                        sh[axis + 1] += radcolor[i] * g_anorms[i][axis];
+                }
+        }
+        sh[0] *= 1.0f / NUMVERTEXNORMALS;
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+                sh[axis + 1] *= 2.0f / NUMVERTEXNORMALS;
+        }
+
         // Now add direct light from the emit_surface lights. These go in the ambient cube because
         // there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
-        add_emit_surface_lights( sample_pos, cube );
+        add_emit_surface_lights( sample_pos, cube, sh );
 }
 
-void add_sample_to_list( vector_ambientsample &list, const LVector3 &sample_pos, LVector3 *cube )
+void add_sample_to_list( vector_ambientsample &list, const LVector3 &sample_pos, LVector3 *cube,
+                         LVector3 *sh )
 {
         const size_t max_samples = 16;
 
@@ -361,6 +394,10 @@ void add_sample_to_list( vector_ambientsample &list, const LVector3 &sample_pos,
         {
                 sample.cube[i] = cube[i];
         }
+        for ( int i = 0; i < 4; i++ )
+        {
+                sample.sh[i] = sh[i];
+        }
 
         list.push_back( sample );
 
@@ -457,12 +494,13 @@ void compute_ambient_for_leaf( int thread, int leaf_id,
         // Don't do any more than 128 samples
         int sample_count = clamp( volume_count, 1, 128 );
         LVector3 cube[6];
+        LVector3 sh[4];
         for ( int i = 0; i < sample_count; i++ )
         {
                 LVector3 sample_pos;
                 sampler.generate_leaf_sample_position( leaf_id, leaf_planes, sample_pos );
-                compute_ambient_from_spherical_samples( thread, sample_pos, cube );
-                add_sample_to_list( list, sample_pos, cube );
+                compute_ambient_from_spherical_samples( thread, sample_pos, cube, sh );
+                add_sample_to_list( list, sample_pos, cube, sh );
         }
 }
 
@@ -533,8 +571,9 @@ compute_per_leaf_ambient_lighting()
         // now write out the data :)
         g_bspdata->leafambientindex.clear();
         g_bspdata->leafambientlighting.clear();
+        g_bspdata->leafambientsh.clear();
         g_bspdata->leafambientindex.resize( numleafs );
-        g_bspdata->leafambientlighting.reserve( numleafs * 4 );
+        g_bspdata->leafambientsh.reserve( numleafs * 4 );
         for ( int leaf_id = 0; leaf_id < numleafs; leaf_id++ )
         {
                 const vector_ambientsample &list = leaf_ambient_samples[leaf_id];
@@ -546,23 +585,35 @@ compute_per_leaf_ambient_lighting()
                 }
                 else
                 {
-                        g_bspdata->leafambientindex[leaf_id].first_ambient_sample = g_bspdata->leafambientlighting.size();
+                        g_bspdata->leafambientindex[leaf_id].first_ambient_sample = g_bspdata->leafambientsh.size();
 
                         for ( int i = 0; i < list.size(); i++ )
                         {
-                                dleafambientlighting_t light;
+                                dleafambientsh_t light;
                                 light.x = fixed_8_fraction( list[i].pos[0], g_bspdata->dleafs[leaf_id].mins[0], g_bspdata->dleafs[leaf_id].maxs[0] );
                                 light.y = fixed_8_fraction( list[i].pos[1], g_bspdata->dleafs[leaf_id].mins[1], g_bspdata->dleafs[leaf_id].maxs[1] );
                                 light.z = fixed_8_fraction( list[i].pos[2], g_bspdata->dleafs[leaf_id].mins[2], g_bspdata->dleafs[leaf_id].maxs[2] );
-                                light.pad = 0;
-                                for ( int side = 0; side < 6; side++ )
+                                VectorToColorRGBExp32( list[i].sh[0], light.dc );
+
+                                // Store the linear terms relative to the dc term that was
+                                // actually written, so they stay in proportion to it.
+                                LVector3 dc;
+                                ColorRGBExp32ToVector( light.dc, dc );
+                                for ( int axis = 0; axis < 3; axis++ )
                                 {
-                                        LRGBColor temp;
-                                        VectorCopy( list[i].cube[side], temp );
-                                        VectorToColorRGBExp32( list[i].cube[side], light.cube.color[side] );
+                                        for ( int ch = 0; ch < 3; ch++ )
+                                        {
+                                                float frac = 0.0f;
+                                                if ( dc[ch] > 0.0f )
+                                                {
+                                                        frac = list[i].sh[axis + 1][ch] / ( 2.0f * dc[ch] );
+                                                }
+                                                frac = clamp( frac, -1.0f, 1.0f );
+                                                light.dir[axis][ch] = (signed char)floor( frac * 127.0f + 0.5f );
+                                        }
                                 }
 
-                                g_bspdata->leafambientlighting.push_back( light );
+                                g_bspdata->leafambientsh.push_back( light );
                         }
                 }
         }
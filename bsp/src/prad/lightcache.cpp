@@ -0,0 +1,527 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file lightcache.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ */
+
+#include "lightcache.h"
+#include "qrad.h"
+#include "transfers.h"
+
+#define LIGHTCACHE_IDENT        (('C' << 24) + ('M' << 16) + ('L' << 8) + 'P')
+#define TRANSFERCACHE_IDENT     (('C' << 24) + ('N' << 16) + ('I' << 8) + 'P')
+// Bump whenever the lighting code changes in a way that invalidates old caches.
+#define LIGHTCACHE_VERSION      2
+
+#define FNV_OFFSET_BASIS        14695981039346656037ULL
+#define FNV_PRIME               1099511628211ULL
+
+uint64_t LightCache::_world_key = 0;
+uint64_t LightCache::_patch_key = 0;
+pvector<uint64_t> LightCache::_face_keys;
+pvector<LightCache::cachedface_t> LightCache::_cached_faces;
+pvector<lightvalue_t> LightCache::_facedata;
+AtomicAdjust::Integer LightCache::_num_restored = 0;
+
+//
+// FNV-1a, the lump checksums in bspfile are too weak to key a cache on.
+//
+
+static INLINE uint64_t HashBytes( uint64_t hash, const void *data, size_t len )
+{
+        const byte *p = (const byte *)data;
+        for ( size_t i = 0; i < len; i++ )
+        {
+                hash ^= p[i];
+                hash *= FNV_PRIME;
+        }
+        return hash;
+}
+
+template <class T>
+static INLINE uint64_t HashValue( uint64_t hash, const T &value )
+{
+        return HashBytes( hash, &value, sizeof( T ) );
+}
+
+static INLINE uint64_t HashString( uint64_t hash, const char *str )
+{
+        return HashBytes( hash, str, strlen( str ) );
+}
+
+static uint64_t HashLight( uint64_t hash, const directlight_t *dl )
+{
+        hash = HashValue( hash, (int)dl->type );
+        hash = HashValue( hash, dl->style );
+        hash = HashValue( hash, dl->origin );
+        hash = HashValue( hash, dl->intensity );
+        hash = HashValue( hash, dl->normal );
+        hash = HashValue( hash, dl->stopdot );
+        hash = HashValue( hash, dl->stopdot2 );
+        hash = HashValue( hash, dl->leaf );
+        hash = HashValue( hash, dl->facenum );
+        hash = HashValue( hash, dl->exponent );
+        hash = HashValue( hash, dl->start_fade_distance );
+        hash = HashValue( hash, dl->end_fade_distance );
+        hash = HashValue( hash, dl->cap_distance );
+        hash = HashValue( hash, dl->quadratic_atten );
+        hash = HashValue( hash, dl->linear_atten );
+        hash = HashValue( hash, dl->constant_atten );
+        hash = HashValue( hash, dl->radius );
+        hash = HashValue( hash, dl->flags );
+        return hash;
+}
+
+/**
+ * Hashes everything besides the lights that can change the direct lighting of
+ * a face: the geometry that casts shadows, the visibility used to cull lights,
+ * the static props, and the compile settings.
+ */
+static uint64_t HashWorld()
+{
+        uint64_t hash = FNV_OFFSET_BASIS;
+        int i;
+
+        hash = HashValue( hash, LIGHTCACHE_VERSION );
+
+        hash = HashBytes( hash, g_bspdata->dvertexes, g_bspdata->numvertexes * sizeof( dvertex_t ) );
+        hash = HashBytes( hash, g_bspdata->dedges, g_bspdata->numedges * sizeof( dedge_t ) );
+        hash = HashBytes( hash, g_bspdata->dsurfedges, g_bspdata->numsurfedges * sizeof( int ) );
+        hash = HashBytes( hash, g_bspdata->texinfo, g_bspdata->numtexinfo * sizeof( texinfo_t ) );
+        hash = HashBytes( hash, g_bspdata->dmodels, g_bspdata->nummodels * sizeof( dmodel_t ) );
+        hash = HashBytes( hash, g_bspdata->dvisdata, g_bspdata->visdatasize );
+        hash = HashBytes( hash, g_bspdata->dmarksurfaces, g_bspdata->nummarksurfaces * sizeof( unsigned short ) );
+
+        for ( i = 0; i < g_bspdata->numplanes; i++ )
+        {
+                hash = HashValue( hash, g_bspdata->dplanes[i].normal );
+                hash = HashValue( hash, g_bspdata->dplanes[i].dist );
+        }
+
+        // Only the geometric part of a face, the lighting fields are our output.
+        for ( i = 0; i < g_bspdata->numfaces; i++ )
+        {
+                const dface_t *f = &g_bspdata->dfaces[i];
+                hash = HashValue( hash, f->planenum );
+                hash = HashValue( hash, f->side );
+                hash = HashValue( hash, f->firstedge );
+                hash = HashValue( hash, f->numedges );
+                hash = HashValue( hash, f->texinfo );
+                hash = HashValue( hash, f->lightmap_mins );
+                hash = HashValue( hash, f->lightmap_size );
+        }
+
+        for ( i = 0; i < g_bspdata->numleafs; i++ )
+        {
+                hash = HashValue( hash, g_bspdata->dleafs[i].contents );
+                hash = HashValue( hash, g_bspdata->dleafs[i].visofs );
+                hash = HashValue( hash, g_bspdata->dleafs[i].firstmarksurface );
+                hash = HashValue( hash, g_bspdata->dleafs[i].nummarksurfaces );
+        }
+
+        for ( i = 0; i < g_bspdata->numtexrefs; i++ )
+        {
+                hash = HashString( hash, g_bspdata->dtexrefs[i].name );
+                hash = HashValue( hash, g_smoothvalues[i] );
+                hash = HashValue( hash, g_translucenttextures[i] );
+                // only power and scale are filled in
+                hash = HashValue( hash, g_lightingconeinfo[i][0] );
+                hash = HashValue( hash, g_lightingconeinfo[i][1] );
+        }
+
+        for ( size_t j = 0; j < g_bspdata->dstaticprops.size(); j++ )
+        {
+                const dstaticprop_t *prop = &g_bspdata->dstaticprops[j];
+                hash = HashValue( hash, prop->pos );
+                hash = HashValue( hash, prop->hpr );
+                hash = HashValue( hash, prop->scale );
+                hash = HashValue( hash, prop->flags );
+                hash = HashString( hash, prop->name );
+        }
+
+        // Brush entities only block light when they have lightflags.
+        for ( i = 1; i < g_bspdata->nummodels; i++ )
+        {
+                entity_t *ent = EntityForModel( g_bspdata, i );
+                hash = HashValue( hash, IntForKey( ent, "zhlt_lightflags" ) );
+        }
+
+        hash = HashValue( hash, g_extra );
+        hash = HashValue( hash, g_softsky );
+        hash = HashValue( hash, g_sky_lighting_fix );
+        hash = HashValue( hash, g_fade );
+        hash = HashValue( hash, g_skysamplescale );
+        hash = HashValue( hash, g_smoothing_threshold );
+        hash = HashValue( hash, g_smoothing_threshold_2 );
+        hash = HashValue( hash, g_blur );
+        hash = HashValue( hash, g_translucentdepth );
+        hash = HashValue( hash, g_texlightgap );
+        hash = HashValue( hash, g_chop );
+        hash = HashValue( hash, g_texchop );
+
+        return hash;
+}
+
+/**
+ * Hashes the patches, which is all the transfer lists depend on besides the
+ * world itself.
+ */
+static uint64_t HashPatches( uint64_t hash )
+{
+        hash = HashValue( hash, g_patches.size() );
+        for ( size_t i = 0; i < g_patches.size(); i++ )
+        {
+                const patch_t *patch = &g_patches[i];
+                hash = HashValue( hash, patch->origin );
+                hash = HashValue( hash, patch->normal );
+                hash = HashValue( hash, patch->area );
+                hash = HashValue( hash, patch->reflectivity );
+                hash = HashValue( hash, patch->facenum );
+                hash = HashValue( hash, patch->parent );
+                hash = HashValue( hash, patch->child1 );
+                hash = HashValue( hash, patch->child2 );
+        }
+        return hash;
+}
+
+/**
+ * Reads the facelight cache from the previous compile, if it was made from the
+ * same world.  Must be called once the lights have been created.
+ */
+void LightCache::init()
+{
+        char filename[_MAX_PATH];
+        FILE *f;
+        int ident, version, numfaces;
+        uint64_t key;
+        bool valid = false;
+
+        _world_key = HashWorld();
+        _face_keys.assign( g_bspdata->numfaces, 0 );
+        _cached_faces.clear();
+        _facedata.clear();
+        AtomicAdjust::set( _num_restored, 0 );
+
+        safe_snprintf( filename, _MAX_PATH, "%s.lmc", g_Mapname );
+        f = fopen( filename, "rb" );
+        if ( f )
+        {
+                valid = fread( &ident, sizeof( int ), 1, f ) == 1 && ident == LIGHTCACHE_IDENT &&
+                        fread( &version, sizeof( int ), 1, f ) == 1 && version == LIGHTCACHE_VERSION &&
+                        fread( &key, sizeof( uint64_t ), 1, f ) == 1 && key == _world_key &&
+                        fread( &numfaces, sizeof( int ), 1, f ) == 1 && numfaces == g_bspdata->numfaces;
+
+                if ( valid )
+                {
+                        _cached_faces.resize( numfaces );
+                        for ( int i = 0; i < numfaces && valid; i++ )
+                        {
+                                cachedface_t &cf = _cached_faces[i];
+                                valid = fread( &cf.key, sizeof( uint64_t ), 1, f ) == 1 &&
+                                        fread( cf.styles, sizeof( cf.styles ), 1, f ) == 1 &&
+                                        fread( &cf.numsamples, sizeof( int ), 1, f ) == 1 &&
+                                        fread( &cf.normal_count, sizeof( int ), 1, f ) == 1;
+                                if ( !valid )
+                                {
+                                        break;
+                                }
+
+                                int numstyles;
+                                for ( numstyles = 0; numstyles < MAXLIGHTMAPS; numstyles++ )
+                                {
+                                        if ( cf.styles[numstyles] == 255 )
+                                                break;
+                                }
+
+                                // light and sunlight for each style
+                                size_t count = (size_t)numstyles * 2 * cf.numsamples * cf.normal_count;
+                                cf.offset = _facedata.size();
+                                _facedata.resize( cf.offset + count );
+                                if ( count )
+                                {
+                                        valid = fread( &_facedata[cf.offset], sizeof( lightvalue_t ), count, f ) == count;
+                                }
+                        }
+                }
+
+                fclose( f );
+        }
+
+        if ( !valid )
+        {
+                _cached_faces.clear();
+                _facedata.clear();
+                Log( "No usable facelight cache (%s), relighting all faces\n", filename );
+        }
+}
+
+/**
+ * Returns the key of the face's direct lighting inputs: its sample layout and
+ * every light that can reach one of its samples through the PVS.
+ */
+uint64_t LightCache::hash_face( int facenum, const facelight_t *fl )
+{
+        uint64_t hash = HashValue( FNV_OFFSET_BASIS, facenum );
+        pvector<int> leafs;
+        int i;
+
+        hash = HashValue( hash, fl->numsamples );
+        hash = HashValue( hash, fl->normal_count );
+        for ( i = 0; i < fl->numsamples; i++ )
+        {
+                const sample_t *sample = &fl->sample[i];
+                hash = HashValue( hash, sample->pos );
+                hash = HashValue( hash, sample->normal );
+
+                int leaf = PointInLeafD( sample->pos ) - g_bspdata->dleafs;
+                if ( std::find( leafs.begin(), leafs.end(), leaf ) == leafs.end() )
+                {
+                        leafs.push_back( leaf );
+                }
+        }
+
+        for ( directlight_t *dl = Lights::activelights; dl != nullptr; dl = dl->next )
+        {
+                for ( i = 0; i < (int)leafs.size(); i++ )
+                {
+                        if ( PVSCheck( dl->pvs, leafs[i] ) )
+                        {
+                                hash = HashLight( hash, dl );
+                                break;
+                        }
+                }
+        }
+
+        return hash;
+}
+
+/**
+ * Called by BuildFacelights once the sample points of the face are known.
+ * Returns true if the face's light was restored from the cache, in which case
+ * the lights don't need to be gathered again.
+ */
+bool LightCache::restore_facelight( int facenum, const SSE_SampleInfo_t &info )
+{
+        facelight_t *fl = info.facelight;
+        dface_t *f = info.face;
+
+        uint64_t key = hash_face( facenum, fl );
+        _face_keys[facenum] = key;
+
+        if ( facenum >= (int)_cached_faces.size() )
+        {
+                return false;
+        }
+
+        const cachedface_t &cf = _cached_faces[facenum];
+        if ( cf.key != key || cf.numsamples != fl->numsamples || cf.normal_count != info.normal_count )
+        {
+                return false;
+        }
+
+        const lightvalue_t *src = &_facedata[0] + cf.offset;
+        for ( int k = 0; k < MAXLIGHTMAPS; k++ )
+        {
+                f->styles[k] = cf.styles[k];
+                if ( cf.styles[k] == 255 )
+                {
+                        break;
+                }
+
+                // style 0 is always allocated by BuildFacelights
+                if ( k > 0 )
+                {
+                        AllocateLightstyleSamples( fl, k, cf.normal_count );
+                }
+
+                for ( int i = 0; i < cf.numsamples; i++ )
+                {
+                        for ( int n = 0; n < cf.normal_count; n++ )
+                        {
+                                fl->light[k][i].light[n] = *src++;
+                                fl->sunlight[k][i].light[n] = *src++;
+                        }
+                }
+        }
+
+        AtomicAdjust::inc( _num_restored );
+        return true;
+}
+
+/**
+ * Writes the direct lighting of every face to the cache.  Must be called after
+ * BuildFacelights, before the light is bounced.
+ */
+void LightCache::write_facelights()
+{
+        char filename[_MAX_PATH];
+        FILE *f;
+        int ident = LIGHTCACHE_IDENT;
+        int version = LIGHTCACHE_VERSION;
+
+        Log( "Restored %d of %d facelights from cache\n", (int)AtomicAdjust::get( _num_restored ),
+             g_bspdata->numfaces );
+
+        safe_snprintf( filename, _MAX_PATH, "%s.lmc", g_Mapname );
+        f = SafeOpenWrite( filename );
+
+        SafeWrite( f, &ident, sizeof( int ) );
+        SafeWrite( f, &version, sizeof( int ) );
+        SafeWrite( f, &_world_key, sizeof( uint64_t ) );
+        SafeWrite( f, &g_bspdata->numfaces, sizeof( int ) );
+
+        for ( int facenum = 0; facenum < g_bspdata->numfaces; facenum++ )
+        {
+                const dface_t *face = &g_bspdata->dfaces[facenum];
+                const facelight_t *fl = &facelight[facenum];
+                byte styles[MAXLIGHTMAPS];
+                int numsamples = fl->numsamples;
+                int normal_count = fl->normal_count;
+
+                memcpy( styles, face->styles, sizeof( styles ) );
+                if ( g_bspdata->texinfo[face->texinfo].flags & TEX_SPECIAL )
+                {
+                        // non-lit texture, nothing was built
+                        memset( styles, 255, sizeof( styles ) );
+                        numsamples = normal_count = 0;
+                }
+
+                SafeWrite( f, &_face_keys[facenum], sizeof( uint64_t ) );
+                SafeWrite( f, styles, sizeof( styles ) );
+                SafeWrite( f, &numsamples, sizeof( int ) );
+                SafeWrite( f, &normal_count, sizeof( int ) );
+
+                for ( int k = 0; k < MAXLIGHTMAPS && styles[k] != 255; k++ )
+                {
+                        for ( int i = 0; i < numsamples; i++ )
+                        {
+                                for ( int n = 0; n < normal_count; n++ )
+                                {
+                                        SafeWrite( f, &fl->light[k][i].light[n], sizeof( lightvalue_t ) );
+                                        SafeWrite( f, &fl->sunlight[k][i].light[n], sizeof( lightvalue_t ) );
+                                }
+                        }
+                }
+        }
+
+        fclose( f );
+
+        _cached_faces.clear();
+        _facedata.clear();
+}
+
+/**
+ * Loads the transfer lists of the previous compile if they were made for the
+ * same world and patches.  Returns false if the transfers have to be rebuilt.
+ */
+bool LightCache::load_transfers()
+{
+        char filename[_MAX_PATH];
+        FILE *f;
+        int ident, version, compress_type;
+        uint64_t key;
+        size_t numpatches;
+        bool valid;
+
+        _patch_key = HashPatches( _world_key );
+
+        safe_snprintf( filename, _MAX_PATH, "%s.inc", g_Mapname );
+        f = fopen( filename, "rb" );
+        if ( !f )
+        {
+                return false;
+        }
+
+        valid = fread( &ident, sizeof( int ), 1, f ) == 1 && ident == TRANSFERCACHE_IDENT &&
+                fread( &version, sizeof( int ), 1, f ) == 1 && version == LIGHTCACHE_VERSION &&
+                fread( &key, sizeof( uint64_t ), 1, f ) == 1 && key == _patch_key &&
+                fread( &compress_type, sizeof( int ), 1, f ) == 1 && compress_type == g_transfer_compress_type &&
+                fread( &numpatches, sizeof( size_t ), 1, f ) == 1 && numpatches == g_patches.size();
+
+        TransferStore::init();
+
+        pvector<byte> packed;
+        g_total_transfer = 0;
+        for ( size_t i = 0; i < g_patches.size() && valid; i++ )
+        {
+                patch_t *patch = &g_patches[i];
+                int counts[2];
+                valid = fread( counts, sizeof( int ), 2, f ) == 2;
+                if ( !valid )
+                {
+                        break;
+                }
+
+                // size the packed data like TransferStore will
+                patch->numtransfers = counts[0];
+                patch->numtransferindices = counts[1];
+                packed.resize( TransferStore::get_packed_size( patch ) );
+                valid = fread( packed.data(), 1, packed.size(), f ) == packed.size();
+                if ( valid )
+                {
+                        TransferStore::store_packed( (int)i, packed.data(), counts[0], counts[1] );
+                        g_total_transfer += patch->numtransfers;
+                }
+        }
+
+        fclose( f );
+
+        if ( !valid )
+        {
+                // Undo whatever we've read so far.
+                TransferStore::free_all();
+                g_total_transfer = 0;
+                Log( "Transfer cache %s is out of date, rebuilding transfers\n", filename );
+                return false;
+        }
+
+        TransferStore::finish();
+
+        Log( "Loaded %d transfers from %s\n", (int)g_total_transfer, filename );
+        return true;
+}
+
+/**
+ * Writes the transfer lists built by MakeAllScales for the next compile.
+ */
+void LightCache::write_transfers()
+{
+        char filename[_MAX_PATH];
+        FILE *f;
+        int ident = TRANSFERCACHE_IDENT;
+        int version = LIGHTCACHE_VERSION;
+        int compress_type = g_transfer_compress_type;
+        size_t numpatches = g_patches.size();
+
+        safe_snprintf( filename, _MAX_PATH, "%s.inc", g_Mapname );
+        f = SafeOpenWrite( filename );
+
+        SafeWrite( f, &ident, sizeof( int ) );
+        SafeWrite( f, &version, sizeof( int ) );
+        SafeWrite( f, &_patch_key, sizeof( uint64_t ) );
+        SafeWrite( f, &compress_type, sizeof( int ) );
+        SafeWrite( f, &numpatches, sizeof( size_t ) );
+
+        for ( size_t i = 0; i < g_patches.size(); i++ )
+        {
+                const patch_t *patch = &g_patches[i];
+
+                // Transfers are written packed, as TransferStore keeps them.
+                int counts[2] = { patch->numtransfers, patch->numtransferindices };
+                if ( !patch->transfers )
+                {
+                        counts[0] = counts[1] = 0;
+                }
+                SafeWrite( f, counts, sizeof( counts ) );
+                if ( counts[0] )
+                {
+                        SafeWrite( f, patch->transfers, TransferStore::get_packed_size( patch ) );
+                }
+        }
+
+        fclose( f );
+}
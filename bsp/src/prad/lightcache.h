@@ -0,0 +1,62 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file lightcache.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ * @desc Persistent lighting caches used by -incremental.
+ *
+ *       The facelight cache (mapname.lmc) stores the direct lighting of every
+ *       face keyed by the face's sample layout and by the parameters of every
+ *       light that can see it through the PVS.  On a rerun, faces whose key
+ *       still matches take their light from the cache instead of being traced.
+ *
+ *       The transfer cache (mapname.inc) stores the radiosity transfer lists,
+ *       which only depend on the patches, so light-only edits skip the
+ *       visibility matrix entirely.
+ *
+ *       Both caches are thrown away when the world geometry, static props,
+ *       visibility or the relevant compile settings change.
+ */
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+
+#include "lightmap.h"
+
+#include <atomicAdjust.h>
+
+class LightCache
+{
+public:
+        static void init();
+
+        static bool restore_facelight( int facenum, const SSE_SampleInfo_t &info );
+        static void write_facelights();
+
+        static bool load_transfers();
+        static void write_transfers();
+
+private:
+        static uint64_t hash_face( int facenum, const facelight_t *fl );
+
+        struct cachedface_t
+        {
+                uint64_t key;
+                byte styles[MAXLIGHTMAPS];
+                int numsamples;
+                int normal_count;
+                size_t offset; // into _facedata
+        };
+
+        static uint64_t _world_key;
+        static uint64_t _patch_key;
+        static pvector<uint64_t> _face_keys;
+        static pvector<cachedface_t> _cached_faces;
+        static pvector<lightvalue_t> _facedata;
+        static AtomicAdjust::Integer _num_restored;
+};
+
+#endif // LIGHTCACHE_H
@@ -5,6 +5,7 @@
 #include "anorms.h"
 #include "bsptools.h"
 #include "trace.h"
+#include "lightcache.h"
 
 //#include <CL/cl.h>
 
@@ -981,10 +982,13 @@ void GatherSampleSkyLightSSE( SSE_sampleLightInput_t &input, SSE_sampleLightOutp
         }
 
         fltx4 total_frac_vis = Four_Zeros;
-        fltx4 frac_vis = Four_Zeros;
 
         DirectionalSampler_t sampler;
 
+        // Trace all of the jittered directions as one stream.
+        static thread_local RADTraceStream stream;
+        stream.clear();
+
         for ( int d = 0; d < nsamples; d++ )
         {
                 // determine visibility of skylight
@@ -1004,9 +1008,15 @@ void GatherSampleSkyLightSSE( SSE_sampleLightInput_t &input, SSE_sampleLightOutp
                 delta4.DuplicateVector( delta );
                 delta4 += input.pos;
 
-                fltx4 this_fraction;
-                RADTrace::test_four_lines( input.pos, delta4, &this_fraction, CONTENTS_SKY, true );
+                stream.add_four_lines( input.pos, delta4, true );
+        }
 
+        stream.trace();
+
+        for ( int d = 0; d < nsamples; d++ )
+        {
+                fltx4 this_fraction;
+                stream.get_four_fractions( d * 4, &this_fraction, CONTENTS_SKY );
                 total_frac_vis = AddSIMD( total_frac_vis, this_fraction );
         }
 
@@ -1052,6 +1062,13 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightInput_t &input, SSE_sampleLightOu
         else
                 sky_samples *= g_skysamplescale;
 
+        // The dots of every direction that can light something are kept until
+        // all of their rays have been traced in one stream.
+        static thread_local RADTraceStream stream;
+        static thread_local pvector<fltx4> stream_dots;
+        stream.clear();
+        stream_dots.clear();
+
         for ( int j = 0; j < sky_samples; j++ )
         {
                 FourVectors anorm;
@@ -1093,11 +1110,21 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightInput_t &input, SSE_sampleLightOu
                 offset *= -input.epsilon;
                 surface_pos -= offset;
 
+                stream.add_four_lines( surface_pos, delta, true );
+                stream_dots.insert( stream_dots.end(), dots, dots + input.normal_count );
+        }
+
+        stream.trace();
+
+        int num_dirs = stream.get_num_rays() / 4;
+        for ( int j = 0; j < num_dirs; j++ )
+        {
                 fltx4 fraction_visible4;
-                RADTrace::test_four_lines( surface_pos, delta, &fraction_visible4, CONTENTS_SKY, true );
+                stream.get_four_fractions( j * 4, &fraction_visible4, CONTENTS_SKY );
+                const fltx4 *dir_dots = &stream_dots[j * input.normal_count];
                 for ( int i = 0; i < input.normal_count; i++ )
                 {
-                        fltx4 added_amt = MulSIMD( fraction_visible4, dots[i] );
+                        fltx4 added_amt = MulSIMD( fraction_visible4, dir_dots[i] );
                         ambient_intensity[i] = AddSIMD( ambient_intensity[i], added_amt );
                 }
         }
@@ -1249,10 +1276,21 @@ void GatherSampleLightStandardSSE( SSE_sampleLightInput_t &input, SSE_sampleLigh
                 out.falloff = MulSIMD( mult, out.falloff );
         }
 
-        // ray trace for visibility
-        fltx4 fraction_visible4;
-        RADTrace::test_four_lines( input.pos, src, &fraction_visible4, CONTENTS_EMPTY, true );
-        dot = MulSIMD( fraction_visible4, dot );
+        // ray trace for visibility, unless nothing can be lit anyway
+        if ( IsAllZeros( MulSIMD( dot, out.falloff ) ) )
+        {
+                dot = Four_Zeros;
+        }
+        else if ( input.stream != nullptr )
+        {
+                out.trace_index = input.stream->add_four_lines( input.pos, src, true );
+        }
+        else
+        {
+                fltx4 fraction_visible4;
+                RADTrace::test_four_lines( input.pos, src, &fraction_visible4, CONTENTS_EMPTY, true );
+                dot = MulSIMD( fraction_visible4, dot );
+        }
         out.dot[0] = dot;
 
         for ( int i = 1; i < input.normal_count; i++ )
@@ -1269,7 +1307,7 @@ void GatherSampleLightStandardSSE( SSE_sampleLightInput_t &input, SSE_sampleLigh
 
 void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum,
                            const FourVectors &pos, FourVectors *normals, int normal_count,
-                           int thread, int lightflags, float epsilon )
+                           int thread, int lightflags, float epsilon, RADTraceStream *stream )
 {
         for ( int b = 0; b < normal_count; b++ )
         {
@@ -1278,6 +1316,7 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 
         out.falloff = Four_Zeros;
         out.sun_amount = Four_Zeros;
+        out.trace_index = -1;
         nassertv( normal_count <= ( NUM_BUMP_VECTS + 1 ) );
 
         SSE_sampleLightInput_t inp;
@@ -1289,6 +1328,7 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
         inp.thread = thread;
         inp.lightflags = lightflags;
         inp.epsilon = epsilon;
+        inp.stream = stream;
 
         // skylights work fundamentally different than normal lights
         switch ( dl->type )
@@ -1323,6 +1363,25 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 
 }
 
+/**
+ * Applies the visibility test that GatherSampleLightSSE() added to the stream,
+ * once the stream has been traced.
+ */
+void ApplyDeferredVisibility( SSE_sampleLightOutput_t &out, const RADTraceStream &stream,
+                              int normal_count )
+{
+        if ( out.trace_index < 0 )
+                return;
+
+        fltx4 fraction_visible4;
+        stream.get_four_fractions( out.trace_index, &fraction_visible4, CONTENTS_EMPTY );
+        for ( int n = 0; n < normal_count; n++ )
+        {
+                out.dot[n] = MulSIMD( out.dot[n], fraction_visible4 );
+        }
+        out.trace_index = -1;
+}
+
 static int FindOrAllocateLightstyleSamples( dface_t *f, facelight_t *fl, int style, int normals )
 {
         // Search the lightstyles associated with the face for a match
@@ -1348,10 +1407,21 @@ static int FindOrAllocateLightstyleSamples( dface_t *f, facelight_t *fl, int sty
         return k;
 }
 
-void GatherSampleLightAt4Points( SSE_SampleInfo_t &info, int sample_idx, int num_samples )
+struct pendinglight_t
 {
+        directlight_t *dl;
+        fltx4 dot_mask;
         SSE_sampleLightOutput_t out;
+};
 
+void GatherSampleLightAt4Points( SSE_SampleInfo_t &info, int sample_idx, int num_samples )
+{
+        // The visibility rays of every light are traced together once all of
+        // the lights have been gathered, instead of four at a time per light.
+        static thread_local RADTraceStream stream;
+        static thread_local pvector<pendinglight_t> pending;
+        stream.clear();
+        pending.clear();
 
         // iterate over all direct lights and add them to the particular sapmle
         for ( directlight_t *dl = Lights::activelights; dl != nullptr; dl = dl->next )
@@ -1373,16 +1443,32 @@ void GatherSampleLightAt4Points( SSE_SampleInfo_t &info, int sample_idx, int num
                         continue;
                 }
 
+                pending.push_back( pendinglight_t() );
+                pendinglight_t &pl = pending.back();
+                pl.dl = dl;
+                pl.dot_mask = dot_mask;
+
+                GatherSampleLightSSE( pl.out, dl, info.facenum, info.points,
+                                      info.point_normals, info.normal_count, info.thread,
+                                      0, 0, &stream );
+        }
+
+        stream.trace();
+
+        for ( size_t p = 0; p < pending.size(); p++ )
+        {
+                pendinglight_t &pl = pending[p];
+                directlight_t *dl = pl.dl;
+                SSE_sampleLightOutput_t &out = pl.out;
 
-                GatherSampleLightSSE( out, dl, info.facenum, info.points,
-                                      info.point_normals, info.normal_count, info.thread );
+                ApplyDeferredVisibility( out, stream, info.normal_count );
 
                 // Apply the pvs check filter and compute falloff X dot
                 fltx4 fxdot[NUM_BUMP_VECTS + 1];
-                skip = true;
+                bool skip = true;
                 for ( int b = 0; b < info.normal_count; b++ )
                 {
-                        fxdot[b] = MulSIMD( out.dot[b], dot_mask );
+                        fxdot[b] = MulSIMD( out.dot[b], pl.dot_mask );
                         fxdot[b] = MulSIMD( fxdot[b], out.falloff );
                         if ( !IsAllZeros( fxdot[b] ) )
                                 skip = false;
@@ -2087,6 +2173,10 @@ void BuildFacelights( const int facenum )
         f->styles[0] = 0;
         AllocateLightstyleSamples( fl, 0, sampleinfo.normal_count );
 
+        // with -incremental, faces whose inputs didn't change since the last
+        // compile get their light back from the cache
+        bool cached = g_incremental && LightCache::restore_facelight( facenum, sampleinfo );
+
         // sample the lights at each sample location
         for ( int grp = 0; grp < num_groups; grp++ )
         {
@@ -2119,10 +2209,13 @@ void BuildFacelights( const int facenum )
                 }
 
                 // iterate over all the lights and add their contribution to this group of spots
-                GatherSampleLightAt4Points( sampleinfo, nsample, num_samples );
+                if ( !cached )
+                {
+                        GatherSampleLightAt4Points( sampleinfo, nsample, num_samples );
+                }
         }
 
-        if ( g_extra )
+        if ( g_extra && !cached )
         {
                 // for each lightstyle, perform a supersampling pass
                 for ( i = 0; i < MAXLIGHTMAPS; i++ )
@@ -135,10 +135,15 @@ struct SSE_SampleInfo_t
 
 extern void GatherSampleLightSSE( SSE_sampleLightOutput_t &output, directlight_t *dl, int facenum,
                                   const FourVectors &pos, FourVectors *normals, int normal_count,
-                                  int thread, int lightflags = 0, float epsilon = 0 );
+                                  int thread, int lightflags = 0, float epsilon = 0,
+                                  RADTraceStream *stream = nullptr );
+extern void ApplyDeferredVisibility( SSE_sampleLightOutput_t &output, const RADTraceStream &stream,
+                                     int normal_count );
 
 extern void SaveVertexNormals();
 
+extern void AllocateLightstyleSamples( facelight_t *fl, int style, int normal_count );
+
 extern int EdgeVertex( dface_t *f, int edge );
 
 #endif // LIGHTMAP_H
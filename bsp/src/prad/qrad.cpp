@@ -53,9 +53,11 @@ A simple summary of RAD goes as follows:
 #include "radstaticprop.h"
 #include "radial.h"
 #include "leaf_ambient_lighting.h"
+#include "lightcache.h"
 #include "lights.h"
 #include "vismat.h"
 #include "trace.h"
+#include "transfers.h"
 #include "rayTraceTriangleMesh.h"
 //#include "clhelper.h"
 #include <virtualFileSystem.h>
@@ -1363,6 +1365,7 @@ void GatherLight( int threadnum )
         int num;
         patch_t *patch;
         LVector3 sum, v;
+        pvector<transfer_t> unpacked;
 
         while ( 1 )
         {
@@ -1372,11 +1375,12 @@ void GatherLight( int threadnum )
 
                 patch = &g_patches[j];
 
-                trans = patch->transfers;
-                if ( !trans )
+                if ( !patch->transfers )
                         continue;
 
-                num = patch->numtransfers;
+                unpacked.resize( patch->numtransfers );
+                num = TransferStore::unpack( patch, unpacked.data() );
+                trans = unpacked.data();
                 if ( patch->bumped )
                 {
                         LVector3 delta;
@@ -1482,7 +1486,7 @@ static void     BounceLight()
         {
                 // transfer light from to the leaf patches from other patches via transfers
                 // this moves shooter->emitlight to receiver->addlight
-                NamedRunThreadsOn( g_patches.size(), g_estimate, GatherLight );
+                NamedRunThreadsOnCost( g_patches.size(), g_estimate, GatherLight, THREADCOST_CHEAP );
 
                 // move newly received light (addlight) to light to be sent out (emitlight)
                 // start at children and pull light up to parents
@@ -1615,7 +1619,7 @@ void MakeScales( int patchidx, transfer_t *all_transfers )
 {
         int j;
         float total;
-        transfer_t *t, *t2;
+        transfer_t *t;
         total = 0;
 
         if ( patchidx == -1 )
@@ -1629,17 +1633,13 @@ void MakeScales( int patchidx, transfer_t *all_transfers )
                 if ( patch->numtransfers > max_transfer )
                         max_transfer = patch->numtransfers;
 
-                patch->transfers = (transfer_t *)calloc( 1, patch->numtransfers * sizeof( transfer_t ) );
-                if ( !patch->transfers )
-                        Error( "Memory allocation failure" );
-
                 // get total transfer energy
-                t2 = all_transfers;
+                t = all_transfers;
 
                 // overflow check!
-                for ( j = 0; j < patch->numtransfers; j++, t2++ )
+                for ( j = 0; j < patch->numtransfers; j++, t++ )
                 {
-                        total += t2->transfer;
+                        total += t->transfer;
                 }
 
                 // the total transfer should be PI, but we need to correct errors due to overlapping surfaces
@@ -1648,18 +1648,15 @@ void MakeScales( int patchidx, transfer_t *all_transfers )
                 else
                         total = 1.0 / Q_PI;
 
-                t = patch->transfers;
-                t2 = all_transfers;
-                for ( j = 0; j < patch->numtransfers; j++, t++, t2++ )
+                t = all_transfers;
+                for ( j = 0; j < patch->numtransfers; j++, t++ )
                 {
-                        t->transfer = t2->transfer * total;
-                        t->patch = t2->patch;
+                        t->transfer *= total;
                 }
-
-                if ( patch->numtransfers > max_transfer )
-                        max_transfer = patch->numtransfers;
         }
 
+        TransferStore::store( patchidx, all_transfers, patch->numtransfers );
+
         ThreadLock();
         g_total_transfer += patch->numtransfers;
         ThreadUnlock();
@@ -1667,14 +1664,19 @@ void MakeScales( int patchidx, transfer_t *all_transfers )
 
 void MakeAllScales()
 {
+        TransferStore::init();
+
         // determine visiblity between patches
         BuildVisMatrix();
 
         FreeVisMatrix();
 
+        TransferStore::finish();
+
         Log( "transfers %d, max %d\n", g_total_transfer, max_transfer );
 
-        printf( "transfer lists: %5.1f megs\n",
+        printf( "transfer lists: %5.1f megs (%5.1f unpacked)\n",
+                (float)TransferStore::get_total_size() / ( 1024 * 1024 ),
                 (float)g_total_transfer * sizeof( transfer_t ) / ( 1024 * 1024 ) );
 }
 
@@ -1748,6 +1750,8 @@ static void     RadWorld()
         unsigned        i;
         unsigned        j;
 
+        ProfileBeginPhase( "RadWorld" );
+
         // setup our OpenCL environment for the GPU
         //CLHelper::SetupCL();
 
@@ -1755,6 +1759,8 @@ static void     RadWorld()
         // will take up on disk
         DetermineLightmapMemory();
 
+        ProfileBeginPhase( "MakePatches" );
+
         MakeBackplanes();
         MakeParents( 0, -1 );
 
@@ -1779,6 +1785,9 @@ static void     RadWorld()
 
         ScaleDirectLights();
 
+        ProfileEndPhase();
+        ProfileSetValue( "patches", g_patches.size() );
+
         Log( "\n" );
 
         // go!
@@ -1787,10 +1796,20 @@ static void     RadWorld()
         //NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, FindFacePositions );
 
         bfl_collector.start();
+        ProfileBeginPhase( "BuildFacelights" );
         // build initial facelights
         lightinfo = new lightinfo_t[g_bspdata->numfaces];
         memset( lightinfo, 0, sizeof( lightinfo_t ) * g_bspdata->numfaces );
-        NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, BuildFacelights ); // done
+        if ( g_incremental )
+        {
+                LightCache::init();
+        }
+        NamedRunThreadsOnIndividualCost( g_bspdata->numfaces, g_estimate, BuildFacelights, THREADCOST_EXPENSIVE ); // done
+        if ( g_incremental )
+        {
+                LightCache::write_facelights();
+        }
+        ProfileEndPhase();
         bfl_collector.stop();
 
         if ( g_numbounce > 0 )
@@ -1805,13 +1824,26 @@ static void     RadWorld()
                 addlight.resize( g_patches.size() );
                 memset( addlight.data(), 0, g_patches.size() * sizeof( bumpsample_t ) );
 
-                MakeAllScales();
+                ProfileBeginPhase( "MakeScales" );
+                if ( !g_incremental || !LightCache::load_transfers() )
+                {
+                        MakeAllScales();
+                        if ( g_incremental )
+                        {
+                                LightCache::write_transfers();
+                        }
+                }
+                ProfileEndPhase();
+                ProfileSetValue( "transfer_bytes", TransferStore::get_total_size() );
 
                 // spread light around
+                ProfileBeginPhase( "BounceLight" );
                 BounceLight();
+                ProfileEndPhase();
+
+                TransferStore::free_all();
         }
 
-        //FreeTransfers();
         //FreeStyleArrays();
 
         //NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, CreateTriangulations );
@@ -1819,19 +1851,25 @@ static void     RadWorld()
         // blend bounced light into direct light and save
         PrecompLightmapOffsets();
 
+        ProfileBeginPhase( "FinalLightFace" );
         NamedRunThreadsOnIndividual( g_bspdata->numfaces, g_estimate, FinalLightFace );
+        ProfileEndPhase();
         if ( g_maxdiscardedlight > 0.01 )
         {
                 Verbose( "Maximum brightness loss (too many light styles on a face) = %f @(%f, %f, %f)\n", g_maxdiscardedlight, g_maxdiscardedpos[0], g_maxdiscardedpos[1], g_maxdiscardedpos[2] );
         }
 
         // misc light computations
+        ProfileBeginPhase( "AmbientLighting" );
         LeafAmbientLighting::compute_per_leaf_ambient_lighting();
         DoComputeStaticPropLighting();
+        ProfileEndPhase();
 
         // free up the direct lights now that we have facelights
         Lights::DeleteDirectLights();
 
+        ProfileEndPhase();
+
         ReportRadTimers();
 }
 
@@ -1868,11 +1906,14 @@ static void     Usage()
         Log( "    -sky #          : Set ambient sunlight contribution in the shade outside\n" );
         Log( "    -lights file    : Manually specify a lights.rad file to use\n" );
         Log( "    -noskyfix       : Disable light_environment being global\n" );
-        Log( "    -incremental    : Use or create an incremental transfer list file\n\n" );
+        Log( "    -incremental    : Reuse the facelights and transfers of the last compile where possible\n" );
+        Log( "    -compress #     : Transfer precision (0=32bit 1=16bit)\n" );
+        Log( "    -transfermem #  : Transfer memory budget in megs, the rest is mapped from disk (0=unlimited)\n\n" );
         Log( "    -dump           : Dumps light patches to a file for hlrad debugging info\n\n" );
         Log( "    -texdata #      : Alter maximum texture memory limit (in kb)\n" );
         Log( "    -lightdata #    : Alter maximum lighting memory limit (in kb)\n" ); //lightdata
         Log( "    -chart          : display bsp statitics\n" );
+        Log( "    -profile file   : Write a JSON report of the compile times to file\n" );
         Log( "    -low | -high    : run program an altered priority level\n" );
         Log( "    -nolog          : Do not generate the compile logfiles\n" );
         Log( "    -threads #      : manually specify the number of threads to run\n" );
@@ -2078,8 +2119,16 @@ static void     Settings()
         Log( "rgb transfers        [ %17s ] [ %17s ]\n", g_rgb_transfers ? "on" : "off", DEFAULT_RGB_TRANSFERS ? "on" : "off" );
 
         Log( "minimum final light  [ %17d ] [ %17d ]\n", (int)g_minlight, (int)DEFAULT_MINLIGHT );
+        safe_snprintf( buf1, sizeof( buf1 ), "%s", g_transfer_compress_type == FLOAT16 ? "16bit" : "32bit" );
+        safe_snprintf( buf2, sizeof( buf2 ), "%s", DEFAULT_TRANSFER_COMPRESS_TYPE == FLOAT16 ? "16bit" : "32bit" );
         Log( "size of transfer     [ %17s ] [ %17s ]\n", buf1, buf2 );
         Log( "size of rgbtransfer  [ %17s ] [ %17s ]\n", buf1, buf2 );
+        if ( g_transfer_memory_limit )
+                safe_snprintf( buf1, sizeof( buf1 ), "%d megs", (int)( g_transfer_memory_limit / ( 1024 * 1024 ) ) );
+        else
+                safe_snprintf( buf1, sizeof( buf1 ), "unlimited" );
+        safe_snprintf( buf2, sizeof( buf2 ), "unlimited" );
+        Log( "transfer memory      [ %17s ] [ %17s ]\n", buf1, buf2 );
         Log( "soft sky             [ %17s ] [ %17s ]\n", g_softsky ? "on" : "off", DEFAULT_SOFTSKY ? "on" : "off" );
         safe_snprintf( buf1, sizeof( buf1 ), "%3.3f", g_translucentdepth );
         safe_snprintf( buf2, sizeof( buf2 ), "%3.3f", DEFAULT_TRANSLUCENTDEPTH );
@@ -2512,10 +2561,53 @@ int             main( const int argc, char** argv )
                                 {
                                         g_incremental = true;
                                 }
+                                else if ( !strcasecmp( argv[i], "-compress" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                int type = atoi( argv[++i] );
+                                                if ( type < 0 || type >= float_type_count )
+                                                {
+                                                        Usage();
+                                                }
+                                                g_transfer_compress_type = (float_type)type;
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
+                                else if ( !strcasecmp( argv[i], "-transfermem" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                int megs = atoi( argv[++i] );
+                                                if ( megs < 0 )
+                                                {
+                                                        Usage();
+                                                }
+                                                g_transfer_memory_limit = (size_t)megs * 1024 * 1024;
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 else if ( !strcasecmp( argv[i], "-chart" ) )
                                 {
                                         g_chart = true;
                                 }
+                                else if ( !strcasecmp( argv[i], "-profile" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                safe_strncpy( g_profilefile, argv[++i], _MAX_PATH );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 else if ( !strcasecmp( argv[i], "-low" ) )
                                 {
                                         g_threadpriority = TP_low;
@@ -2658,6 +2750,7 @@ int             main( const int argc, char** argv )
                         // END INIT
 
                         // BEGIN RAD
+                        ProfileStart();
                         start = I_FloatTime();
 
                         // normalise maxlight
@@ -2752,10 +2845,13 @@ int             main( const int argc, char** argv )
                         if ( g_chart )
                                 PrintBSPFileSizes( g_bspdata );
 
+                        ProfileBeginPhase( "Write" );
                         WriteBSPFile( g_bspdata, g_source );
+                        ProfileEndPhase();
 
                         end = I_FloatTime();
                         LogTimeElapsed( end - start );
+                        ProfileWrite( end - start );
                         // END RAD
 
 
@@ -15,6 +15,7 @@
 #include "winding.h"
 #include "scriplib.h"
 #include "threads.h"
+#include "profile.h"
 #include "blockmem.h"
 #include "filelib.h"
 #include "winding.h"
@@ -126,6 +127,7 @@
 #define DEFAULT_TRANSTOTAL_HACK 0.2 //0.5 //vluzacn
 #define DEFAULT_MINLIGHT 0
 #define DEFAULT_TRANSFER_COMPRESS_TYPE FLOAT16
+#define DEFAULT_TRANSFER_MEMORY_LIMIT 0 // unlimited
 #define DEFAULT_RGBTRANSFER_COMPRESS_TYPE VECTOR32
 #define DEFAULT_SOFTSKY true
 #define DEFAULT_TRANSLUCENTDEPTH 2.0f
@@ -332,7 +334,8 @@ struct patch_t
         int nextclusterchild;
 
         int numtransfers;
-        transfer_t *transfers;
+        int numtransferindices;
+        byte *transfers; // packed by TransferStore, see transfers.h
 
         short indices[3];
 
@@ -346,11 +349,17 @@ extern pvector<int> g_face_parents;
 extern pvector<int> g_cluster_children;
 
 
+class RADTraceStream;
+
 struct SSE_sampleLightOutput_t
 {
         fltx4 dot[NUM_BUMP_VECTS + 1];
         fltx4 falloff;
         fltx4 sun_amount;
+
+        // First ray of the deferred visibility test in the input stream, or -1
+        // if dot already accounts for visibility.
+        int trace_index;
 };
 
 struct SSE_sampleLightInput_t
@@ -363,6 +372,10 @@ struct SSE_sampleLightInput_t
         int thread;
         int lightflags;
         int epsilon;
+
+        // If set, the visibility test of point, spot and surface lights is
+        // added here instead of being traced right away.
+        RADTraceStream *stream;
 };
 
 extern vector_string g_multifiles; // for loading textures and static props
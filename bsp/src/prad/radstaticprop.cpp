@@ -216,7 +216,7 @@ void ComputeStaticPropLighting( const int prop_idx )
 void DoComputeStaticPropLighting()
 {
         //Log( "Computing static prop lighting...\n" );
-        NamedRunThreadsOnIndividual( (int)g_static_props.size(), g_estimate, ComputeStaticPropLighting );
+        NamedRunThreadsOnIndividualCost( (int)g_static_props.size(), g_estimate, ComputeStaticPropLighting, THREADCOST_EXPENSIVE );
         //for ( size_t i = 0; i < g_static_props.size(); i++ )
         //{
         //        Log( "%i ", (int)i );
@@ -18,6 +18,8 @@
 static PStatCollector testline_collector( "RadWorld:TestLine" );
 static PStatCollector test4lines_collector( "RadWorld:TestFourLines" );
 
+static ProfileCounter rays_counter( "RadWorld:RaysTraced" );
+
 static const unsigned int ALL_CONTENTS = (
         CONTENTS_EMPTY |
         CONTENTS_SOLID |
@@ -70,6 +72,8 @@ unsigned int RADTrace::test_line( const vec3_t start, const vec3_t stop,
 {
         //PStatTimer timer( testline_collector );
 
+        rays_counter.add( 1 );
+
         BitMask32 mask = test_static_props ? ALL_CONTENTS | CONTENTS_PROP : ALL_CONTENTS;
 
         RayTraceHitResult result = scene->trace_line( LPoint3( start[0], start[1], start[2] ),
@@ -88,6 +92,8 @@ unsigned int RADTrace::test_line( const vec3_t start, const vec3_t stop, float &
 {
         //PStatTimer timer( testline_collector );
 
+        rays_counter.add( 1 );
+
         BitMask32 mask = test_static_props ? ALL_CONTENTS | CONTENTS_PROP : ALL_CONTENTS;
         RayTraceHitResult result = scene->trace_line( LPoint3( start[0], start[1], start[2] ),
                                                       LPoint3( stop[0], stop[1], stop[2] ),
@@ -112,6 +118,7 @@ void RADTrace::test_four_lines( const FourVectors &start, const FourVectors &end
         float frac_vis;
         int contents;
 
+        rays_counter.add( 4 );
         scene->trace_four_lines( start, end, test_static_props ? Four_ALL_CONTENTS_OR_PROPS : Four_ALL_CONTENTS, &result );
 
         for ( int i = 0; i < 4; i++ )
@@ -142,6 +149,59 @@ void RADTrace::test_four_lines( const FourVectors &start, const FourVectors &end
         }
 }
 
+int RADTraceStream::add_line( const vec3_t start, const vec3_t end, bool test_static_props )
+{
+        return _stream.add_line( LPoint3( start[0], start[1], start[2] ),
+                                 LPoint3( end[0], end[1], end[2] ),
+                                 test_static_props ? ALL_CONTENTS_OR_PROPS : ALL_CONTENTS );
+}
+
+int RADTraceStream::add_four_lines( const FourVectors &start, const FourVectors &end,
+                                    bool test_static_props )
+{
+        return _stream.add_four_lines( start, end, test_static_props ? Four_ALL_CONTENTS_OR_PROPS : Four_ALL_CONTENTS );
+}
+
+void RADTraceStream::trace()
+{
+        rays_counter.add( _stream.get_num_rays() );
+        // The rays of many sample points and lights are mixed together in the
+        // stream, so let the scene sort them.
+        RADTrace::scene->trace_stream( _stream, false );
+}
+
+/**
+ * Returns the contents of whatever the nth line hit, or CONTENTS_EMPTY if it
+ * made it all the way to the end.
+ */
+unsigned int RADTraceStream::get_contents( int n ) const
+{
+        if ( _stream.get_hit_fraction( n ) < 1.0 - EQUAL_EPSILON )
+        {
+                return RADTrace::scene->get_geometry( _stream.get_geom_id( n ) )->get_mask().get_word();
+        }
+
+        return CONTENTS_EMPTY;
+}
+
+/**
+ * Fills in fraction4 for four lines added with add_four_lines(), exactly like
+ * RADTrace::test_four_lines() would have.
+ */
+void RADTraceStream::get_four_fractions( int first, fltx4 *fraction4, unsigned int contents_mask ) const
+{
+        for ( int i = 0; i < 4; i++ )
+        {
+                float frac_vis = 0.0;
+                if ( ( get_contents( first + i ) & contents_mask ) != 0 )
+                {
+                        frac_vis = 1.0;
+                }
+
+                *fraction4 = SetComponentSIMD( *fraction4, i, frac_vis );
+        }
+}
+
 dface_t *RADTrace::get_dface( const RayTraceHitResult &result )
 {
         int geomidx = dface_lookup.find( result.geom_id );
@@ -6,6 +6,7 @@
 #include "rayTrace.h"
 #include "rayTraceScene.h"
 #include "rayTraceHitResult.h"
+#include "rayTraceRayStream.h"
 #include "mathtypes.h"
 #include "mathlib/ssemath.h"
 #include "bspfile.h"
@@ -34,4 +35,34 @@ public:
         static PrimID2dface dface_lookup;
 };
 
+/**
+ * Collects lines to be tested against the world and traces all of them in a
+ * single call, letting Embree use its widest packets.  Results follow the same
+ * contents rules as RADTrace::test_four_lines().
+ */
+class RADTraceStream
+{
+public:
+        INLINE void clear()
+        {
+                _stream.clear();
+        }
+        INLINE int get_num_rays() const
+        {
+                return _stream.get_num_rays();
+        }
+
+        int add_line( const vec3_t start, const vec3_t end, bool test_static_props = false );
+        int add_four_lines( const FourVectors &start, const FourVectors &end,
+                            bool test_static_props = false );
+
+        void trace();
+
+        unsigned int get_contents( int n ) const;
+        void get_four_fractions( int first, fltx4 *fraction4, unsigned int contents_mask ) const;
+
+private:
+        RayTraceRayStream _stream;
+};
+
 #endif // RAD_TRACE_H
@@ -0,0 +1,344 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file transfers.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ */
+
+#include "transfers.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Transfers are positive and at most a little over 1, but they get very small
+// on big maps, so instead of IEEE half floats this keeps 6 exponent bits
+// (2^-61 to 2^2) and 10 mantissa bits.
+#define TRANSFER16_EXP_BIAS     61
+
+#define NOT_SPILLED             ( (size_t)-1 )
+
+float_type g_transfer_compress_type = DEFAULT_TRANSFER_COMPRESS_TYPE;
+size_t g_transfer_memory_limit = DEFAULT_TRANSFER_MEMORY_LIMIT;
+
+AtomicAdjust::Integer TransferStore::_resident_size = 0;
+size_t TransferStore::_spill_size = 0;
+FILE *TransferStore::_spill_file = nullptr;
+pvector<size_t> TransferStore::_spill_offsets;
+byte *TransferStore::_spill_base = nullptr;
+
+static INLINE unsigned short PackTransfer16( float f )
+{
+        union { float f; unsigned int i; } u;
+        u.f = f;
+
+        unsigned int bits = u.i + 0x1000; // round to nearest
+        int exp = (int)( ( bits >> 23 ) & 0xff ) - 127 + TRANSFER16_EXP_BIAS;
+        if ( exp <= 0 )
+                return 0;
+        if ( exp > 63 )
+                return 0xffff;
+
+        return (unsigned short)( ( exp << 10 ) | ( ( bits >> 13 ) & 0x3ff ) );
+}
+
+static INLINE float UnpackTransfer16( unsigned short v )
+{
+        if ( v == 0 )
+                return 0.0f;
+
+        union { float f; unsigned int i; } u;
+        u.i = ( ( ( v >> 10 ) - TRANSFER16_EXP_BIAS + 127 ) << 23 ) | ( ( v & 0x3ff ) << 13 );
+        return u.f;
+}
+
+static INLINE size_t TransferValueSize()
+{
+        return g_transfer_compress_type == FLOAT16 ? sizeof( unsigned short ) : sizeof( float );
+}
+
+static void GetSpillFilename( char *filename )
+{
+        safe_snprintf( filename, _MAX_PATH, "%s.trs", g_Mapname );
+}
+
+/**
+ * Prepares for a new set of transfer lists.  Must be called before the
+ * patches are stored.
+ */
+void TransferStore::init()
+{
+        free_all();
+        _spill_offsets.assign( g_patches.size(), NOT_SPILLED );
+}
+
+/**
+ * Packs the transfers made for a patch and stores them.  Sorts the transfers
+ * in place.  Can be called from several threads at once, one per patch.
+ */
+void TransferStore::store( int patchidx, transfer_t *transfers, int count )
+{
+        patch_t *patch = &g_patches[patchidx];
+        patch->numtransfers = count;
+        patch->numtransferindices = 0;
+        patch->transfers = nullptr;
+        if ( count == 0 )
+                return;
+
+        std::sort( transfers, transfers + count, []( const transfer_t &a, const transfer_t &b )
+        {
+                return a.patch < b.patch;
+        } );
+
+        static thread_local pvector<transfer_index_t> indices;
+        static thread_local pvector<byte> packed;
+        indices.clear();
+
+        // collapse runs of consecutive patch indices
+        transfer_index_t run;
+        run.index = transfers[0].patch;
+        run.size = 0;
+        for ( int i = 1; i < count; i++ )
+        {
+                if ( transfers[i].patch == transfers[i - 1].patch + 1 &&
+                     run.size < MAX_COMPRESSED_TRANSFER_INDEX_SIZE )
+                {
+                        run.size++;
+                }
+                else
+                {
+                        indices.push_back( run );
+                        run.index = transfers[i].patch;
+                        run.size = 0;
+                }
+        }
+        indices.push_back( run );
+
+        size_t index_size = indices.size() * sizeof( transfer_index_t );
+        packed.resize( index_size + count * TransferValueSize() );
+        memcpy( packed.data(), indices.data(), index_size );
+
+        if ( g_transfer_compress_type == FLOAT16 )
+        {
+                unsigned short *values = (unsigned short *)( packed.data() + index_size );
+                for ( int i = 0; i < count; i++ )
+                        values[i] = PackTransfer16( transfers[i].transfer );
+        }
+        else
+        {
+                float *values = (float *)( packed.data() + index_size );
+                for ( int i = 0; i < count; i++ )
+                        values[i] = transfers[i].transfer;
+        }
+
+        patch->numtransferindices = (int)indices.size();
+        commit_patch( patchidx, packed.data(), packed.size() );
+}
+
+/**
+ * Stores transfers that were already packed, i.e. read back from the
+ * transfer cache.
+ */
+void TransferStore::store_packed( int patchidx, const byte *data, int numtransfers, int numindices )
+{
+        patch_t *patch = &g_patches[patchidx];
+        patch->numtransfers = numtransfers;
+        patch->numtransferindices = numindices;
+        patch->transfers = nullptr;
+        if ( numtransfers == 0 )
+                return;
+
+        commit_patch( patchidx, data, get_packed_size( patch ) );
+}
+
+/**
+ * Keeps the packed transfers of a patch in memory if they fit in the budget,
+ * otherwise appends them to the spill file.
+ */
+void TransferStore::commit_patch( int patchidx, const byte *data, size_t size )
+{
+        patch_t *patch = &g_patches[patchidx];
+
+        AtomicAdjust::Integer resident = AtomicAdjust::add( _resident_size, (AtomicAdjust::Integer)size );
+        if ( g_transfer_memory_limit == 0 || (size_t)resident <= g_transfer_memory_limit )
+        {
+                patch->transfers = (byte *)malloc( size );
+                if ( !patch->transfers )
+                        Error( "Memory allocation failure" );
+                memcpy( patch->transfers, data, size );
+                return;
+        }
+
+        AtomicAdjust::add( _resident_size, -(AtomicAdjust::Integer)size );
+
+        // keep every list 4 byte aligned in the file for the transfer_index_t's
+        static const byte pad[4] = { 0, 0, 0, 0 };
+        size_t padded = ( size + 3 ) & ~(size_t)3;
+
+        ThreadLock();
+        if ( !_spill_file )
+        {
+                char filename[_MAX_PATH];
+                GetSpillFilename( filename );
+                _spill_file = SafeOpenWrite( filename );
+        }
+        _spill_offsets[patchidx] = _spill_size;
+        SafeWrite( _spill_file, data, size );
+        if ( padded > size )
+                SafeWrite( _spill_file, pad, padded - size );
+        _spill_size += padded;
+        ThreadUnlock();
+}
+
+/**
+ * Called once all of the transfers have been stored.  Maps the spill file, if
+ * there is one, and points the spilled patches into it.
+ */
+void TransferStore::finish()
+{
+        if ( !_spill_file )
+                return;
+
+        fclose( _spill_file );
+        _spill_file = nullptr;
+
+        char filename[_MAX_PATH];
+        GetSpillFilename( filename );
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+        HANDLE mapping = nullptr;
+        if ( file != INVALID_HANDLE_VALUE )
+        {
+                mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+                CloseHandle( file );
+        }
+        if ( mapping )
+        {
+                _spill_base = (byte *)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+                CloseHandle( mapping );
+        }
+#else
+        int fd = open( filename, O_RDONLY );
+        if ( fd != -1 )
+        {
+                void *base = mmap( nullptr, _spill_size, PROT_READ, MAP_SHARED, fd, 0 );
+                if ( base != MAP_FAILED )
+                        _spill_base = (byte *)base;
+                close( fd );
+        }
+#endif
+
+        if ( !_spill_base )
+                Error( "Unable to map transfer spill file %s", filename );
+
+        for ( size_t i = 0; i < g_patches.size(); i++ )
+        {
+                if ( _spill_offsets[i] != NOT_SPILLED )
+                        g_patches[i].transfers = _spill_base + _spill_offsets[i];
+        }
+
+        Log( "transfers over budget: %5.1f megs, mapped from %s\n",
+             (float)_spill_size / ( 1024 * 1024 ), filename );
+}
+
+/**
+ * Frees all of the transfer lists and removes the spill file.
+ */
+void TransferStore::free_all()
+{
+        for ( size_t i = 0; i < g_patches.size(); i++ )
+        {
+                patch_t *patch = &g_patches[i];
+                bool spilled = i < _spill_offsets.size() && _spill_offsets[i] != NOT_SPILLED;
+                if ( patch->transfers && !spilled )
+                        free( patch->transfers );
+                patch->transfers = nullptr;
+                patch->numtransfers = 0;
+                patch->numtransferindices = 0;
+        }
+
+        if ( _spill_file )
+        {
+                fclose( _spill_file );
+                _spill_file = nullptr;
+        }
+
+        if ( _spill_base )
+        {
+#ifdef _WIN32
+                UnmapViewOfFile( _spill_base );
+#else
+                munmap( _spill_base, _spill_size );
+#endif
+                _spill_base = nullptr;
+        }
+
+        if ( _spill_size )
+        {
+                char filename[_MAX_PATH];
+                GetSpillFilename( filename );
+                _unlink( filename );
+        }
+
+        _spill_size = 0;
+        _spill_offsets.clear();
+        AtomicAdjust::set( _resident_size, 0 );
+}
+
+/**
+ * Unpacks the transfers of a patch into out, which must have room for
+ * patch->numtransfers entries.  Returns the number of transfers.
+ */
+int TransferStore::unpack( const patch_t *patch, transfer_t *out )
+{
+        const transfer_index_t *tindex = (const transfer_index_t *)patch->transfers;
+        const byte *values = patch->transfers + patch->numtransferindices * sizeof( transfer_index_t );
+
+        int n = 0;
+        for ( int i = 0; i < patch->numtransferindices; i++ )
+        {
+                for ( unsigned int j = 0; j <= tindex[i].size; j++ )
+                        out[n++].patch = tindex[i].index + j;
+        }
+
+        if ( g_transfer_compress_type == FLOAT16 )
+        {
+                const unsigned short *v = (const unsigned short *)values;
+                for ( int i = 0; i < n; i++ )
+                        out[i].transfer = UnpackTransfer16( v[i] );
+        }
+        else
+        {
+                const float *v = (const float *)values;
+                for ( int i = 0; i < n; i++ )
+                        out[i].transfer = v[i];
+        }
+
+        return n;
+}
+
+size_t TransferStore::get_packed_size( const patch_t *patch )
+{
+        return patch->numtransferindices * sizeof( transfer_index_t ) +
+                patch->numtransfers * TransferValueSize();
+}
+
+/**
+ * Returns the number of bytes taken by all of the transfer lists, in memory
+ * and spilled to disk.
+ */
+size_t TransferStore::get_total_size()
+{
+        return (size_t)AtomicAdjust::get( _resident_size ) + _spill_size;
+}
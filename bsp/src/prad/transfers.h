@@ -0,0 +1,68 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file transfers.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ * @desc Compact storage of the radiosity transfer lists.
+ *
+ *       The transfers of a patch are sorted by patch index and packed as runs
+ *       of consecutive indices (transfer_index_t) followed by the transfer
+ *       values, quantized according to -compress.
+ *
+ *       With -transfermem, lists that don't fit in the memory budget are
+ *       written to a spill file (mapname.trs) instead, which is memory mapped
+ *       once all of the transfers have been made.
+ */
+
+#ifndef TRANSFERS_H
+#define TRANSFERS_H
+
+#include "qrad.h"
+
+#include <atomicAdjust.h>
+
+typedef enum
+{
+        FLOAT32 = 0,
+        FLOAT16 = 1,
+        float_type_count
+} float_type;
+
+struct transfer_index_t
+{
+        unsigned int size : 12;  // number of patches in the run, minus one
+        unsigned int index : 20; // first patch of the run
+};
+
+extern float_type g_transfer_compress_type;
+extern size_t g_transfer_memory_limit; // in bytes, 0 is unlimited
+
+class TransferStore
+{
+public:
+        static void init();
+
+        static void store( int patchidx, transfer_t *transfers, int count );
+        static void store_packed( int patchidx, const byte *data, int numtransfers, int numindices );
+        static void finish();
+        static void free_all();
+
+        static int unpack( const patch_t *patch, transfer_t *out );
+        static size_t get_packed_size( const patch_t *patch );
+
+        static size_t get_total_size();
+
+private:
+        static void commit_patch( int patchidx, const byte *data, size_t size );
+
+        static AtomicAdjust::Integer _resident_size;
+        static size_t _spill_size;
+        static FILE *_spill_file;
+        static pvector<size_t> _spill_offsets;
+        static byte *_spill_base;
+};
+
+#endif // TRANSFERS_H
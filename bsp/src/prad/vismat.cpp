@@ -24,6 +24,38 @@ Use the PVS to accelerate if available
 
 #define STREAM_SIZE 512
 
+// Patch pairs waiting on a visibility test.  The lines are traced STREAM_SIZE
+// at a time and the transfers are made in the order they were queued.
+struct visstream_t
+{
+        RADTraceStream stream;
+        pvector<std::pair<int, int>> pairs;
+};
+
+static thread_local visstream_t t_visstream;
+
+static void FlushVisStream( transfer_t *transfers )
+{
+        visstream_t &vs = t_visstream;
+        if ( vs.pairs.empty() )
+                return;
+
+        vs.stream.trace();
+
+        for ( size_t i = 0; i < vs.pairs.size(); i++ )
+        {
+                if ( vs.stream.get_contents( (int)i ) == CONTENTS_EMPTY )
+                {
+                        // line traced from patch1 to patch2 without hitting anything
+                        // create a transfer
+                        MakeTransfer( vs.pairs[i].first, vs.pairs[i].second, transfers );
+                }
+        }
+
+        vs.stream.clear();
+        vs.pairs.clear();
+}
+
 dleaf_t* PointInLeaf( int iNode, LVector3 const& point )
 {
         if ( iNode < 0 )
@@ -101,7 +133,7 @@ void TestPatchToPatch( int patchidx1, int patchidx2, int head, transfer_t *trans
                 if ( tmp.dot( tmp ) * 0.0625 < patch2->area )
                 {
                         TestPatchToPatch( patchidx1, patch2->child1, head, transfers, thread );
-                        TestPatchToPatch( patchidx2, patch2->child2, head, transfers, thread );
+                        TestPatchToPatch( patchidx1, patch2->child2, head, transfers, thread );
                         return;
                 }
         }
@@ -116,14 +148,12 @@ void TestPatchToPatch( int patchidx1, int patchidx2, int head, transfer_t *trans
                 vec3_t p1, p2;
                 VectorAdd( patch->origin, patch->normal, p1 );
                 VectorAdd( patch2->origin, patch2->normal, p2 );
-                float frac_vis = 0.0;
-                int contents = RADTrace::test_line( p1, p2 );
-                if ( contents == CONTENTS_EMPTY )
-                {
-                        // line traced from patch1 to patch2 without hitting anything
-                        // create a transfer
-                        MakeTransfer( patchidx1, patchidx2, transfers );
-                }
+
+                visstream_t &vs = t_visstream;
+                vs.stream.add_line( p1, p2 );
+                vs.pairs.push_back( std::make_pair( patchidx1, patchidx2 ) );
+                if ( vs.pairs.size() >= STREAM_SIZE )
+                        FlushVisStream( transfers );
         }
 }
 
@@ -204,6 +234,8 @@ void BuildVisRow( int patchnum, byte *pvs, int head, transfer_t *transfers, int
                         TestPatchToFace( patchnum, l, head, transfers, thread );
                 }
         }
+
+        FlushVisStream( transfers );
 }
 
 transfer_t *BuildVisLeafs_Start()
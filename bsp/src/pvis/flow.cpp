@@ -1,5 +1,12 @@
 #include "vis.h"
 
+#include <pbitops.h>
+
+#include <emmintrin.h>
+
+static ProfileCounter portalflow_counter( "PortalFlow:Portals" );
+static ProfileCounter leafflow_counter( "PortalFlow:RecursiveLeafFlow" );
+
 // =====================================================================================
 //  CheckStack
 // =====================================================================================
@@ -54,58 +61,144 @@ inline static void     FreeStackWinding( const winding_t* const w, pstack_t* con
         stack->freewindings[i] = 1;
 }
 
+// =====================================================================================
+//  Side masks
+//      One bit per winding point, for the points more than ON_EPSILON in front of
+//      or behind a plane.
+// =====================================================================================
+#define SIDEMASK_WORDS ( MAX_POINTS_ON_WINDING / 64 )
+
+typedef struct
+{
+        uint64_t        front[SIDEMASK_WORDS];
+        uint64_t        back[SIDEMASK_WORDS];
+} sidemask_t;
+
+inline static bool SideMaskEmpty( const uint64_t* const mask )
+{
+        uint64_t        any = 0;
+        for ( int i = 0; i < SIDEMASK_WORDS; i++ )
+        {
+                any |= mask[i];
+        }
+        return !any;
+}
+
+inline static void ClearSideMaskPoint( sidemask_t* const sides, const int i )
+{
+        const uint64_t  bit = (uint64_t)1 << ( i & 63 );
+        sides->front[i >> 6] &= ~bit;
+        sides->back[i >> 6] &= ~bit;
+}
+
+inline static int SideMaskPointSide( const sidemask_t* const sides, const int i )
+{
+        const uint64_t  bit = (uint64_t)1 << ( i & 63 );
+        if ( sides->front[i >> 6] & bit )
+        {
+                return SIDE_FRONT;
+        }
+        if ( sides->back[i >> 6] & bit )
+        {
+                return SIDE_BACK;
+        }
+        return SIDE_ON;
+}
+
+// returns the first point that is off the plane, or -1 if the winding is on it
+inline static int FirstPointOffPlane( const sidemask_t* const sides, bool* const front )
+{
+        for ( int i = 0; i < SIDEMASK_WORDS; i++ )
+        {
+                const uint64_t  off = sides->front[i] | sides->back[i];
+                if ( off )
+                {
+                        const int bit = get_lowest_on_bit( off );
+                        *front = ( sides->front[i] >> bit ) & 1;
+                        return i * 64 + bit;
+                }
+        }
+        return -1;
+}
+
+// =====================================================================================
+//  ClassifyWinding
+//      Finds the distance of every point of the winding to the plane, a pair of points
+//      at a time.  dists must have room for the winding rounded up to an even number
+//      of points.
+// =====================================================================================
+inline static void ClassifyWinding( const winding_t* const w, const vec3_t normal, const vec_t dist,
+                                    vec_t* const dists, sidemask_t* const sides )
+{
+        const __m128d   nx = _mm_set1_pd( normal[0] );
+        const __m128d   ny = _mm_set1_pd( normal[1] );
+        const __m128d   nz = _mm_set1_pd( normal[2] );
+        const __m128d   d = _mm_set1_pd( dist );
+        const __m128d   eps = _mm_set1_pd( ON_EPSILON );
+        const __m128d   negeps = _mm_set1_pd( -ON_EPSILON );
+
+        memset( sides, 0, sizeof( *sides ) );
+
+        const int       numpairs = ( w->numpoints + 1 ) >> 1;
+        for ( int i = 0; i < numpairs; i++ )
+        {
+                const pointpair_t& pair = w->pairs[i];
+
+                __m128d dot = _mm_mul_pd( _mm_loadu_pd( pair.x ), nx );
+                dot = _mm_add_pd( dot, _mm_mul_pd( _mm_loadu_pd( pair.y ), ny ) );
+                dot = _mm_add_pd( dot, _mm_mul_pd( _mm_loadu_pd( pair.z ), nz ) );
+                dot = _mm_sub_pd( dot, d );
+                _mm_storeu_pd( dists + i * 2, dot );
+
+                const int shift = ( i & 31 ) << 1;
+                sides->front[i >> 5] |= (uint64_t)_mm_movemask_pd( _mm_cmpgt_pd( dot, eps ) ) << shift;
+                sides->back[i >> 5] |= (uint64_t)_mm_movemask_pd( _mm_cmplt_pd( dot, negeps ) ) << shift;
+        }
+
+        if ( w->numpoints & 1 )
+        {
+                // the second half of the last pair isn't a point
+                ClearSideMaskPoint( sides, w->numpoints );
+        }
+}
+
 // =====================================================================================
 //  ChopWinding
 // =====================================================================================
 inline winding_t*      ChopWinding( winding_t* const in, pstack_t* const stack, const plane_t* const split )
 {
-        vec_t           dists[128];
-        int             sides[128];
-        int             counts[3];
+        vec_t           dists[MAX_POINTS_ON_WINDING + 2];
+        int             sides[MAX_POINTS_ON_WINDING + 1];
+        sidemask_t      sidemask;
         vec_t           dot;
         int             i;
+        vec3_t          p1;
         vec3_t          mid;
         winding_t*      neww;
 
-        counts[0] = counts[1] = counts[2] = 0;
-
-        if ( in->numpoints > ( sizeof( sides ) / sizeof( *sides ) ) )
+        if ( in->numpoints > MAX_POINTS_ON_WINDING )
         {
                 Error( "Winding with too many sides!" );
         }
 
         // determine sides for each point
-        for ( i = 0; i < in->numpoints; i++ )
-        {
-                dot = DotProduct( in->points[i], split->normal );
-                dot -= split->dist;
-                dists[i] = dot;
-                if ( dot > ON_EPSILON )
-                {
-                        sides[i] = SIDE_FRONT;
-                }
-                else if ( dot < -ON_EPSILON )
-                {
-                        sides[i] = SIDE_BACK;
-                }
-                else
-                {
-                        sides[i] = SIDE_ON;
-                }
-                counts[sides[i]]++;
-        }
+        ClassifyWinding( in, split->normal, split->dist, dists, &sidemask );
 
-        if ( !counts[1] )
+        if ( SideMaskEmpty( sidemask.back ) )
         {
                 return in;                                         // completely on front side
         }
 
-        if ( !counts[0] )
+        if ( SideMaskEmpty( sidemask.front ) )
         {
                 FreeStackWinding( in, stack );
                 return NULL;
         }
 
+        for ( i = 0; i < in->numpoints; i++ )
+        {
+                sides[i] = SideMaskPointSide( &sidemask, i );
+        }
         sides[i] = sides[0];
         dists[i] = dists[0];
 
@@ -115,7 +208,7 @@ inline winding_t*      ChopWinding( winding_t* const in, pstack_t* const stack,
 
         for ( i = 0; i < in->numpoints; i++ )
         {
-                vec_t* p1 = in->points[i];
+                GetWindingPoint( in, i, p1 );
 
                 if ( neww->numpoints == MAX_POINTS_ON_FIXED_WINDING )
                 {
@@ -126,13 +219,13 @@ inline winding_t*      ChopWinding( winding_t* const in, pstack_t* const stack,
 
                 if ( sides[i] == SIDE_ON )
                 {
-                        VectorCopy( p1, neww->points[neww->numpoints] );
+                        SetWindingPoint( neww, neww->numpoints, p1 );
                         neww->numpoints++;
                         continue;
                 }
                 else if ( sides[i] == SIDE_FRONT )
                 {
-                        VectorCopy( p1, neww->points[neww->numpoints] );
+                        SetWindingPoint( neww, neww->numpoints, p1 );
                         neww->numpoints++;
                 }
 
@@ -155,7 +248,8 @@ inline winding_t*      ChopWinding( winding_t* const in, pstack_t* const stack,
                         {
                                 tmp = 0;
                         }
-                        const vec_t* p2 = in->points[tmp];
+                        vec3_t p2;
+                        GetWindingPoint( in, tmp, p2 );
 
                         dot = dists[i] / ( dists[i] - dists[i + 1] );
 
@@ -182,10 +276,16 @@ inline winding_t*      ChopWinding( winding_t* const in, pstack_t* const stack,
                         }
                 }
 
-                VectorCopy( mid, neww->points[neww->numpoints] );
+                SetWindingPoint( neww, neww->numpoints, mid );
                 neww->numpoints++;
         }
 
+        if ( neww->numpoints & 1 )
+        {
+                // keep the unused half of the last pair from holding garbage
+                SetWindingPoint( neww, neww->numpoints, vec3_origin );
+        }
+
         // free the original winding
         FreeStackWinding( in, stack );
 
@@ -238,8 +338,9 @@ inline static winding_t* ClipToSeperators(
         int             i, j, k, l;
         plane_t         plane;
         vec3_t          v1, v2;
-        float           d;
-        int             counts[3];
+        vec3_t          sourcepoint, nextpoint, passpoint;
+        vec_t           dists[MAX_POINTS_ON_WINDING + 2];
+        sidemask_t      sides;
         bool            fliptest;
         winding_t*      target = a_target;
 
@@ -253,45 +354,32 @@ inline static winding_t* ClipToSeperators(
                         l = 0;
                 }
 
-                VectorSubtract( source->points[l], source->points[i], v1 );
+                GetWindingPoint( source, i, sourcepoint );
+                GetWindingPoint( source, l, nextpoint );
+                VectorSubtract( nextpoint, sourcepoint, v1 );
 
                 // fing a vertex of pass that makes a plane that puts all of the
                 // vertexes of pass on the front side and all of the vertexes of
                 // source on the back side
                 for ( j = 0; j < pass->numpoints; j++ )
                 {
-                        VectorSubtract( pass->points[j], source->points[i], v2 );
+                        GetWindingPoint( pass, j, passpoint );
+                        VectorSubtract( passpoint, sourcepoint, v2 );
                         CrossProduct( v1, v2, plane.normal );
                         if ( VectorNormalize( plane.normal ) < ON_EPSILON )
                         {
                                 continue;
                         }
-                        plane.dist = DotProduct( pass->points[j], plane.normal );
+                        plane.dist = DotProduct( passpoint, plane.normal );
 
                         // find out which side of the generated seperating plane has the
-                        // source portal
-                        fliptest = false;
-                        for ( k = 0; k < numpoints; k++ )
-                        {
-                                if ( ( k == i ) | ( k == l ) ) // | instead of || for branch optimization
-                                {
-                                        continue;
-                                }
-                                d = DotProduct( source->points[k], plane.normal ) - plane.dist;
-                                if ( d < -ON_EPSILON )
-                                {                                          // source is on the negative side, so we want all
-                                                                           // pass and target on the positive side
-                                        fliptest = false;
-                                        break;
-                                }
-                                else if ( d > ON_EPSILON )
-                                {                                          // source is on the positive side, so we want all
-                                                                           // pass and target on the negative side
-                                        fliptest = true;
-                                        break;
-                                }
-                        }
-                        if ( k == numpoints )
+                        // source portal.  If the first point off the plane is on the
+                        // negative side we want all pass and target on the positive side,
+                        // otherwise on the negative side.
+                        ClassifyWinding( source, plane.normal, plane.dist, dists, &sides );
+                        ClearSideMaskPoint( &sides, i );
+                        ClearSideMaskPoint( &sides, l );
+                        if ( FirstPointOffPlane( &sides, &fliptest ) < 0 )
                         {
                                 continue;                                  // planar with source portal
                         }
@@ -305,33 +393,14 @@ inline static winding_t* ClipToSeperators(
 
                         // if all of the pass portal points are now on the positive side,
                         // this is the seperating plane
-                        counts[0] = counts[1] = counts[2] = 0;
-                        for ( k = 0; k < pass->numpoints; k++ )
-                        {
-                                if ( k == j )
-                                {
-                                        continue;
-                                }
-                                d = DotProduct( pass->points[k], plane.normal ) - plane.dist;
-                                if ( d < -ON_EPSILON )
-                                {
-                                        break;
-                                }
-                                else if ( d > ON_EPSILON )
-                                {
-                                        counts[0]++;
-                                }
-                                else
-                                {
-                                        counts[2]++;
-                                }
-                        }
-                        if ( k != pass->numpoints )
+                        ClassifyWinding( pass, plane.normal, plane.dist, dists, &sides );
+                        ClearSideMaskPoint( &sides, j );
+                        if ( !SideMaskEmpty( sides.back ) )
                         {
                                 continue;                                  // points on negative side, not a seperating plane
                         }
 
-                        if ( !counts[0] )
+                        if ( SideMaskEmpty( sides.front ) )
                         {
                                 continue;                                  // planar with seperating plane
                         }
@@ -381,6 +450,8 @@ inline static void     RecursiveLeafFlow( const int leafnum, const threaddata_t*
         CheckStack( leaf, thread );
 #endif
 
+        leafflow_counter.add( 1 );
+
         {
                 const unsigned offset = leafnum >> 3;
                 const unsigned bit = ( 1 << ( leafnum & 7 ) );
@@ -436,50 +507,10 @@ inline static void     RecursiveLeafFlow( const int leafnum, const threaddata_t*
                 }
 
                 // if the portal can't see anything we haven't allready seen, skip it
+                if ( !VisBitsAndNew( stack.mightsee, prevstack->mightsee,
+                                     p->status == stat_done ? p->visbits : p->mightsee, thread->leafvis ) )
                 {
-                        long* test;
-
-                        if ( p->status == stat_done )
-                        {
-                                test = (long*)p->visbits;
-                        }
-                        else
-                        {
-                                test = (long*)p->mightsee;
-                        }
-
-                        {
-                                const int bitlongs = g_bitlongs;
-
-                                {
-                                        long* prevmight = (long*)prevstack->mightsee;
-                                        long* might = (long*)stack.mightsee;
-
-                                        unsigned j;
-                                        for ( j = 0; j < bitlongs; j++, test++, might++, prevmight++ )
-                                        {
-                                                ( *might ) = ( *prevmight ) & ( *test );
-                                        }
-                                }
-
-                                {
-                                        long* might = (long*)stack.mightsee;
-                                        long* vis = (long*)thread->leafvis;
-                                        unsigned j;
-                                        for ( j = 0; j < bitlongs; j++, might++, vis++ )
-                                        {
-                                                if ( ( *might ) & ~( *vis ) )
-                                                {
-                                                        break;
-                                                }
-                                        }
-
-                                        if ( j == g_bitlongs )
-                                        {                                                  // can't see anything new
-                                                continue;
-                                        }
-                                }
-                        }
+                        continue;                                      // can't see anything new
                 }
 
                 // get plane of portal, point normal into the neighbor leaf
@@ -596,7 +627,6 @@ inline static void     RecursiveLeafFlow( const int leafnum, const threaddata_t*
 void            PortalFlow( portal_t* p )
 {
         threaddata_t    data;
-        unsigned        i;
 
         if ( p->status != stat_working )
                 Error( "PortalFlow: reflowed" );
@@ -611,19 +641,11 @@ void            PortalFlow( portal_t* p )
         data.pstack_head.portal = p;
         data.pstack_head.source = p->winding;
         data.pstack_head.portalplane = &p->plane;
-        for ( i = 0; i < g_bitlongs; i++ )
-        {
-                ( (long*)data.pstack_head.mightsee )[i] = ( (long*)p->mightsee )[i];
-        }
+        memcpy( data.pstack_head.mightsee, p->mightsee, g_bitbytes );
         RecursiveLeafFlow( p->leaf, &data, &data.pstack_head );
 
-#ifdef ZHLT_NETVIS
-        p->fromclient = g_clientid;
-#endif
+        portalflow_counter.add( 1 );
         p->status = stat_done;
-#ifdef ZHLT_NETVIS
-        Flag_VIS_DONE_PORTAL( g_visportalindex );
-#endif
 }
 
 // =====================================================================================
@@ -631,7 +653,7 @@ void            PortalFlow( portal_t* p )
 //      This is a rough first-order aproximation that is used to trivially reject some
 //      of the final calculations.
 // =====================================================================================
-static void     SimpleFlood( byte* const srcmightsee, const int leafnum, byte* const portalsee, unsigned int* const c_leafsee )
+static void     SimpleFlood( byte* const srcmightsee, const int leafnum, const uint64_t* const portalsee, unsigned int* const c_leafsee )
 {
         unsigned        i;
         leaf_t*         leaf;
@@ -657,7 +679,8 @@ static void     SimpleFlood( byte* const srcmightsee, const int leafnum, byte* c
         for ( i = 0; i < leaf->numportals; i++ )
         {
                 p = leaf->portals[i];
-                if ( !portalsee[p - g_portals] )
+                const int       index = p - g_portals;
+                if ( !( portalsee[index >> 6] & ( (uint64_t)1 << ( index & 63 ) ) ) )
                 {
                         continue;
                 }
@@ -677,12 +700,13 @@ static void     SimpleFlood( byte* const srcmightsee, const int leafnum, byte* c
 // =====================================================================================
 void            BasePortalVis( int unused )
 {
-        int             i, j, k;
+        int             i, j;
         portal_t*       tp;
         portal_t*       p;
-        float           d;
         winding_t*      w;
-        byte            portalsee[PORTALSEE_SIZE];
+        vec_t           dists[MAX_POINTS_ON_WINDING + 2];
+        sidemask_t      sides;
+        uint64_t        portalsee[PORTALSEE_SIZE / 64];        // bit per portal
         const int       portalsize = ( g_numportals * 2 );
 
 #ifdef ZHLT_NETVIS
@@ -699,7 +723,7 @@ void            BasePortalVis( int unused )
 
                 p->mightsee = (byte*)calloc( 1, g_bitbytes );
 
-                memset( portalsee, 0, portalsize );
+                memset( portalsee, 0, ( ( portalsize + 63 ) >> 6 ) * sizeof( uint64_t ) );
 
 #if ZHLT_ZONES
                 uint32_t zone = p->zone;
@@ -719,36 +743,22 @@ void            BasePortalVis( int unused )
 #endif
 
                         w = tp->winding;
-                        for ( k = 0; k < w->numpoints; k++ )
-                        {
-                                d = DotProduct( w->points[k], p->plane.normal ) - p->plane.dist;
-                                if ( d > ON_EPSILON )
-                                {
-                                        break;
-                                }
-                        }
-                        if ( k == w->numpoints )
+                        ClassifyWinding( w, p->plane.normal, p->plane.dist, dists, &sides );
+                        if ( SideMaskEmpty( sides.front ) )
                         {
                                 continue;                                  // no points on front
                         }
 
 
                         w = p->winding;
-                        for ( k = 0; k < w->numpoints; k++ )
-                        {
-                                d = DotProduct( w->points[k], tp->plane.normal ) - tp->plane.dist;
-                                if ( d < -ON_EPSILON )
-                                {
-                                        break;
-                                }
-                        }
-                        if ( k == w->numpoints )
+                        ClassifyWinding( w, tp->plane.normal, tp->plane.dist, dists, &sides );
+                        if ( SideMaskEmpty( sides.back ) )
                         {
                                 continue;                                  // no points on front
                         }
 
 
-                        portalsee[j] = 1;
+                        portalsee[j >> 6] |= (uint64_t)1 << ( j & 63 );
                 }
 
                 SimpleFlood( p->mightsee, p->leaf, portalsee, &p->nummightsee );
@@ -756,62 +766,63 @@ void            BasePortalVis( int unused )
         }
         }
 
-bool BestNormalFromWinding( const vec3_t *points, int numpoints, vec3_t &normal_out )
+bool BestNormalFromWinding( const winding_t *w, vec3_t &normal_out )
 {
-        const vec3_t *pt1, *pt2, *pt3;
-        int k;
+        vec3_t p1, p2, p3, point;
+        int k, i2, i3;
         vec3_t d, normal, edge;
         vec_t dist, maxdist;
+        const int numpoints = w->numpoints;
         if ( numpoints < 3 )
         {
                 return false;
         }
-        pt1 = &points[0];
+        GetWindingPoint( w, 0, p1 );
         maxdist = -1;
-        for ( k = 0; k < numpoints; k++ )
+        for ( k = 1; k < numpoints; k++ )
         {
-                if ( &points[k] == pt1 )
-                {
-                        continue;
-                }
-                VectorSubtract( points[k], *pt1, edge );
+                GetWindingPoint( w, k, point );
+                VectorSubtract( point, p1, edge );
                 dist = DotProduct( edge, edge );
                 if ( dist > maxdist )
                 {
                         maxdist = dist;
-                        pt2 = &points[k];
+                        i2 = k;
                 }
         }
         if ( maxdist <= ON_EPSILON * ON_EPSILON )
         {
                 return false;
         }
+        GetWindingPoint( w, i2, p2 );
         maxdist = -1;
-        VectorSubtract( *pt2, *pt1, edge );
+        VectorSubtract( p2, p1, edge );
         VectorNormalize( edge );
-        for ( k = 0; k < numpoints; k++ )
+        for ( k = 1; k < numpoints; k++ )
         {
-                if ( &points[k] == pt1 || &points[k] == pt2 )
+                if ( k == i2 )
                 {
                         continue;
                 }
-                VectorSubtract( points[k], *pt1, d );
+                GetWindingPoint( w, k, point );
+                VectorSubtract( point, p1, d );
                 CrossProduct( edge, d, normal );
                 dist = DotProduct( normal, normal );
                 if ( dist > maxdist )
                 {
                         maxdist = dist;
-                        pt3 = &points[k];
+                        i3 = k;
                 }
         }
         if ( maxdist <= ON_EPSILON * ON_EPSILON )
         {
                 return false;
         }
-        VectorSubtract( *pt3, *pt1, d );
+        GetWindingPoint( w, i3, p3 );
+        VectorSubtract( p3, p1, d );
         CrossProduct( edge, d, normal );
         VectorNormalize( normal );
-        if ( pt3 < pt2 )
+        if ( i3 < i2 )
         {
                 VectorScale( normal, -1, normal );
         }
@@ -829,8 +840,10 @@ vec_t WindingDist( const winding_t *w[2] )
         {
                 for ( b = 0; b < w[1]->numpoints; b++ )
                 {
-                        vec3_t v;
-                        VectorSubtract( w[0]->points[a], w[1]->points[b], v );
+                        vec3_t p1, p2, v;
+                        GetWindingPoint( w[0], a, p1 );
+                        GetWindingPoint( w[1], b, p2 );
+                        VectorSubtract( p1, p2, v );
                         sqrdist = DotProduct( v, v );
                         if ( sqrdist < minsqrdist )
                         {
@@ -845,9 +858,10 @@ vec_t WindingDist( const winding_t *w[2] )
                 {
                         for ( b = 0; b < w[!side]->numpoints; b++ )
                         {
-                                const vec3_t &p = w[side]->points[a];
-                                const vec3_t &p1 = w[!side]->points[b];
-                                const vec3_t &p2 = w[!side]->points[( b + 1 ) % w[!side]->numpoints];
+                                vec3_t p, p1, p2;
+                                GetWindingPoint( w[side], a, p );
+                                GetWindingPoint( w[!side], b, p1 );
+                                GetWindingPoint( w[!side], ( b + 1 ) % w[!side]->numpoints, p2 );
                                 vec3_t delta;
                                 vec_t frac;
                                 vec3_t v;
@@ -877,10 +891,11 @@ vec_t WindingDist( const winding_t *w[2] )
         {
                 for ( b = 0; b < w[1]->numpoints; b++ )
                 {
-                        const vec3_t &p1 = w[0]->points[a];
-                        const vec3_t &p2 = w[0]->points[( a + 1 ) % w[0]->numpoints];
-                        const vec3_t &p3 = w[1]->points[b];
-                        const vec3_t &p4 = w[1]->points[( b + 1 ) % w[1]->numpoints];
+                        vec3_t p1, p2, p3, p4;
+                        GetWindingPoint( w[0], a, p1 );
+                        GetWindingPoint( w[0], ( a + 1 ) % w[0]->numpoints, p2 );
+                        GetWindingPoint( w[1], b, p3 );
+                        GetWindingPoint( w[1], ( b + 1 ) % w[1]->numpoints, p4 );
                         vec3_t delta1;
                         vec3_t delta2;
                         vec3_t normal;
@@ -922,19 +937,21 @@ vec_t WindingDist( const winding_t *w[2] )
                 vec_t planedist;
                 vec3_t *boundnormals;
                 vec_t *bounddists;
-                if ( !BestNormalFromWinding( w[!side]->points, w[!side]->numpoints, planenormal ) )
+                vec3_t origin;
+                if ( !BestNormalFromWinding( w[!side], planenormal ) )
                 {
                         continue;
                 }
-                planedist = DotProduct( planenormal, w[!side]->points[0] );
+                GetWindingPoint( w[!side], 0, origin );
+                planedist = DotProduct( planenormal, origin );
                 hlassume( boundnormals = (vec3_t *)malloc( w[!side]->numpoints * sizeof( vec3_t ) ), assume_NoMemory );
                 hlassume( bounddists = (vec_t *)malloc( w[!side]->numpoints * sizeof( vec_t ) ), assume_NoMemory );
                 // build boundaries
                 for ( b = 0; b < w[!side]->numpoints; b++ )
                 {
-                        vec3_t v;
-                        const vec3_t &p1 = w[!side]->points[b];
-                        const vec3_t &p2 = w[!side]->points[( b + 1 ) % w[!side]->numpoints];
+                        vec3_t v, p1, p2;
+                        GetWindingPoint( w[!side], b, p1 );
+                        GetWindingPoint( w[!side], ( b + 1 ) % w[!side]->numpoints, p2 );
                         VectorSubtract( p2, p1, v );
                         CrossProduct( v, planenormal, boundnormals[b] );
                         if ( !VectorNormalize( boundnormals[b] ) )
@@ -948,7 +965,8 @@ vec_t WindingDist( const winding_t *w[2] )
                 }
                 for ( a = 0; a < w[side]->numpoints; a++ )
                 {
-                        const vec3_t &p = w[side]->points[a];
+                        vec3_t p;
+                        GetWindingPoint( w[side], a, p );
                         for ( b = 0; b < w[!side]->numpoints; b++ )
                         {
                                 if ( DotProduct( p, boundnormals[b] ) - bounddists[b] >= -ON_EPSILON )
@@ -969,8 +987,9 @@ vec_t WindingDist( const winding_t *w[2] )
                 }
                 for ( a = 0; a < w[side]->numpoints; a++ )
                 {
-                        const vec3_t &p1 = w[side]->points[a];
-                        const vec3_t &p2 = w[side]->points[( a + 1 ) % w[side]->numpoints];
+                        vec3_t p1, p2;
+                        GetWindingPoint( w[side], a, p1 );
+                        GetWindingPoint( w[side], ( a + 1 ) % w[side]->numpoints, p2 );
                         vec_t dist1 = DotProduct( p1, planenormal ) - planedist;
                         vec_t dist2 = DotProduct( p2, planenormal ) - planedist;
                         vec3_t delta;
@@ -1078,7 +1097,8 @@ void	MaxDistVis( int unused )
                                                 w = leaf[side]->portals[a]->winding;
                                                 for ( b = 0; b < w->numpoints; b++ )
                                                 {
-                                                        VectorAdd( w->points[b], center[side], center[side] );
+                                                        GetWindingPoint( w, b, v );
+                                                        VectorAdd( v, center[side], center[side] );
                                                         count[side]++;
                                                 }
                                         }
@@ -1096,7 +1116,8 @@ void	MaxDistVis( int unused )
                                                 w = leaf[side]->portals[a]->winding;
                                                 for ( b = 0; b < w->numpoints; b++ )
                                                 {
-                                                        VectorSubtract( w->points[b], center[side], v );
+                                                        GetWindingPoint( w, b, v );
+                                                        VectorSubtract( v, center[side], v );
                                                         dist = DotProduct( v, v );
                                                         radius[side] = qmax( radius[side], dist );
                                                 }
@@ -0,0 +1,696 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file netvis.cpp
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ */
+
+#include "netvis.h"
+
+#include <datagram.h>
+#include <datagramIterator.h>
+#include <socket_address.h>
+#include <socket_tcp.h>
+#include <socket_tcp_listen.h>
+#include <thread.h>
+#include <pmutex.h>
+#include <pdeque.h>
+#include <atomicAdjust.h>
+
+// Bump whenever the protocol changes.
+#define NETVIS_VERSION          1
+
+// Most portals handed to a worker at once.
+#define NETVIS_MAX_BATCH        64
+
+// Largest message either side accepts.  The biggest legitimate message is a
+// work reply carrying every portal of a huge map, well under this.
+#define NETVIS_MAX_MESSAGE      ( 256 * 1024 * 1024 )
+
+#define FNV_OFFSET_BASIS        14695981039346656037ULL
+#define FNV_PRIME               1099511628211ULL
+
+vis_modes       g_vismode = VIS_MODE_NULL;
+unsigned short  g_port = DEFAULT_NETVIS_PORT;
+const char*     g_server_addr = NULL;
+unsigned int    g_rate = DEFAULT_NETVIS_RATE;
+
+enum
+{
+        NV_HELLO,       // worker: version, portals, leafs, mightsee hash, threads
+        NV_WELCOME,     // coordinator: client id
+        NV_REJECT,      // coordinator: reason
+        NV_REQUEST,     // worker: finished portals, wants more work
+        NV_WORK,        // coordinator: portals finished elsewhere, portals to flow
+        NV_DONE         // coordinator: every portal is done
+};
+
+// =====================================================================================
+//  Messages
+//      A message is a little-endian length followed by a Datagram.
+// =====================================================================================
+static bool     SendAll( Socket_TCP& sock, const char* data, size_t size )
+{
+        while ( size > 0 )
+        {
+                int sent = sock.SendData( data, (int)size );
+                if ( sent <= 0 )
+                {
+                        return false;
+                }
+                data += sent;
+                size -= sent;
+        }
+        return true;
+}
+
+static bool     RecvAll( Socket_TCP& sock, char* data, size_t size )
+{
+        while ( size > 0 )
+        {
+                int got = sock.RecvData( data, (int)size );
+                if ( got <= 0 )
+                {
+                        return false;
+                }
+                data += got;
+                size -= got;
+        }
+        return true;
+}
+
+static bool     SendMessage( Socket_TCP& sock, const Datagram& dg )
+{
+        if ( dg.get_length() > NETVIS_MAX_MESSAGE )
+        {
+                return false;
+        }
+
+        Datagram header;
+        header.add_uint32( (uint32_t)dg.get_length() );
+        return SendAll( sock, (const char*)header.get_data(), header.get_length() ) &&
+               SendAll( sock, (const char*)dg.get_data(), dg.get_length() );
+}
+
+static bool     RecvMessage( Socket_TCP& sock, Datagram& dg )
+{
+        unsigned char header[4];
+        if ( !RecvAll( sock, (char*)header, sizeof( header ) ) )
+        {
+                return false;
+        }
+
+        uint32_t length = header[0] | ( header[1] << 8 ) | ( header[2] << 16 ) | ( (uint32_t)header[3] << 24 );
+        if ( length > NETVIS_MAX_MESSAGE )
+        {
+                Warning( "netvis: dropping connection, message of %u bytes is too large", length );
+                sock.Close();
+                return false;
+        }
+
+        pvector<char> body( length + 1 );
+        if ( !RecvAll( sock, body.data(), length ) )
+        {
+                return false;
+        }
+
+        dg = Datagram( body.data(), length );
+        return true;
+}
+
+// =====================================================================================
+//  HashMightsee
+//      Both sides must have flowed from the same BasePortalVis.
+// =====================================================================================
+static uint64_t HashMightsee()
+{
+        uint64_t        hash = FNV_OFFSET_BASIS;
+
+        for ( int i = 0; i < g_numportals * 2; i++ )
+        {
+                const byte* bits = g_portals[i].mightsee;
+                for ( unsigned j = 0; j < g_bitbytes; j++ )
+                {
+                        hash ^= bits[j];
+                        hash *= FNV_PRIME;
+                }
+        }
+
+        return hash;
+}
+
+static void     AddPortal( Datagram& dg, const portal_t* p )
+{
+        dg.add_uint32( (uint32_t)( p - g_portals ) );
+        dg.add_int32( p->numcansee );
+        dg.append_data( p->visbits, g_bitbytes );
+}
+
+// =====================================================================================
+//  MergePortal
+//      Takes the visibility of a portal that was flowed by another process.
+//      The coordinator only takes it from the worker it gave the portal to,
+//      workers take anything they haven't started on.
+// =====================================================================================
+static bool     MergePortal( DatagramIterator& dgi, int owner, pvector<int>* donelog )
+{
+        if ( dgi.get_remaining_size() < 8 + g_bitbytes )
+        {
+                return false;
+        }
+
+        uint32_t        index = dgi.get_uint32();
+        int             numcansee = dgi.get_int32();
+        if ( index >= (uint32_t)g_numportals * 2 )
+        {
+                return false;
+        }
+
+        byte*           bits = (byte*)calloc( 1, g_bitbytes );
+        dgi.extract_bytes( bits, g_bitbytes );
+
+        portal_t*       p = &g_portals[index];
+
+        g_global_lock.acquire();
+        bool            take = donelog ? ( p->status == stat_working && p->fromclient == owner )
+                                       : ( p->status == stat_none );
+        if ( take )
+        {
+                p->visbits = bits;
+                p->numcansee = numcansee;
+                p->fromclient = owner;
+                p->status = stat_done;
+                if ( donelog )
+                {
+                        donelog->push_back( index );
+                }
+        }
+        g_global_lock.release();
+
+        if ( !take )
+        {
+                free( bits );
+        }
+
+        return true;
+}
+
+/////////////////
+// COORDINATOR
+//
+// ThreadLock() does nothing outside of RunThreadsOn(), and the connection
+// threads outlive it, so the portal states are guarded by g_global_lock itself.
+
+static Socket_TCP_Listen s_listen;
+static pvector<int> s_donelog;                             // portals in the order they were finished
+static AtomicAdjust::Integer s_workerthreads = 0;
+static AtomicAdjust::Integer s_nextclient = 0;
+static volatile bool s_stop = false;
+
+static int      CountDonePortals()
+{
+        g_global_lock.acquire();
+        int             count = (int)s_donelog.size();
+        g_global_lock.release();
+        return count;
+}
+
+class NetVisConnection : public Thread
+{
+public:
+        NetVisConnection( Socket_TCP* sock, const std::string& address, int id ) :
+                Thread( "NetVisConnection", "NetVisConnection" ),
+                _sock( sock ),
+                _address( address ),
+                _id( id ),
+                _numthreads( 0 ),
+                _synced( 0 )
+        {
+        }
+
+protected:
+        virtual void thread_main();
+
+private:
+        bool    handshake();
+        bool    serve_request( DatagramIterator& dgi );
+
+        Socket_TCP* _sock;
+        std::string _address;
+        int     _id;
+        int     _numthreads;
+        size_t  _synced;
+};
+
+bool            NetVisConnection::handshake()
+{
+        Datagram        dg;
+        if ( !RecvMessage( *_sock, dg ) )
+        {
+                return false;
+        }
+
+        DatagramIterator dgi( dg );
+        if ( dg.get_length() < 23 || dgi.get_uint8() != NV_HELLO )
+        {
+                return false;
+        }
+
+        uint32_t        version = dgi.get_uint32();
+        uint32_t        numportals = dgi.get_uint32();
+        uint32_t        portalleafs = dgi.get_uint32();
+        uint64_t        hash = dgi.get_uint64();
+        _numthreads = dgi.get_uint16();
+
+        const char*     reason = NULL;
+        if ( version != NETVIS_VERSION )
+        {
+                reason = "netvis version mismatch";
+        }
+        else if ( numportals != (uint32_t)g_numportals || portalleafs != g_portalleafs || hash != HashMightsee() )
+        {
+                reason = "the map or portal file is different";
+        }
+
+        Datagram        reply;
+        if ( reason )
+        {
+                reply.add_uint8( NV_REJECT );
+                reply.add_string( reason );
+                SendMessage( *_sock, reply );
+                Warning( "netvis: refused worker at %s: %s", _address.c_str(), reason );
+                return false;
+        }
+
+        reply.add_uint8( NV_WELCOME );
+        reply.add_uint32( _id );
+        if ( !SendMessage( *_sock, reply ) )
+        {
+                return false;
+        }
+
+        AtomicAdjust::add( s_workerthreads, _numthreads );
+        Log( "netvis: worker #%d connected from %s with %d threads\n", _id, _address.c_str(), _numthreads );
+        return true;
+}
+
+bool            NetVisConnection::serve_request( DatagramIterator& dgi )
+{
+        uint32_t        numresults = dgi.get_uint32();
+        for ( uint32_t i = 0; i < numresults; i++ )
+        {
+                if ( !MergePortal( dgi, _id, &s_donelog ) )
+                {
+                        return false;
+                }
+        }
+
+        Datagram        reply;
+        if ( AllPortalsDone() )
+        {
+                reply.add_uint8( NV_DONE );
+                return SendMessage( *_sock, reply );
+        }
+
+        pvector<int>    sync;
+        pvector<int>    work;
+
+        g_global_lock.acquire();
+        // Pass on everything the other processes finished since the last request.
+        for ( ; _synced < s_donelog.size(); _synced++ )
+        {
+                if ( g_portals[s_donelog[_synced]].fromclient != _id )
+                {
+                        sync.push_back( s_donelog[_synced] );
+                }
+        }
+
+        // Batches shrink as the map runs out of portals so the slowest
+        // worker doesn't hold up the end of the compile.
+        int             totalthreads = g_numthreads + (int)AtomicAdjust::get( s_workerthreads );
+        int             remaining = g_numportals * 2 - (int)s_donelog.size();
+        int             batch = remaining / ( 4 * qmax( totalthreads, 1 ) );
+        batch = qmax( 1, qmin( batch, qmin( NETVIS_MAX_BATCH, 2 * _numthreads ) ) );
+        for ( int i = 0; i < batch; i++ )
+        {
+                portal_t*       p = ClaimNextPortal( _id );
+                if ( !p )
+                {
+                        break;
+                }
+                work.push_back( (int)( p - g_portals ) );
+        }
+        g_global_lock.release();
+
+        reply.add_uint8( NV_WORK );
+        reply.add_uint32( (uint32_t)sync.size() );
+        for ( size_t i = 0; i < sync.size(); i++ )
+        {
+                AddPortal( reply, &g_portals[sync[i]] );
+        }
+        reply.add_uint32( (uint32_t)work.size() );
+        for ( size_t i = 0; i < work.size(); i++ )
+        {
+                reply.add_uint32( work[i] );
+        }
+
+        return SendMessage( *_sock, reply );
+}
+
+void            NetVisConnection::thread_main()
+{
+        if ( handshake() )
+        {
+                Datagram        dg;
+                while ( RecvMessage( *_sock, dg ) )
+                {
+                        DatagramIterator dgi( dg );
+                        if ( dg.get_length() < 5 || dgi.get_uint8() != NV_REQUEST || !serve_request( dgi ) )
+                        {
+                                Warning( "netvis: bad request from worker #%d", _id );
+                                break;
+                        }
+                }
+
+                // Give back whatever the worker was still flowing.
+                int             returned = 0;
+                g_global_lock.acquire();
+                for ( int i = 0; i < g_numportals * 2; i++ )
+                {
+                        if ( g_portals[i].status == stat_working && g_portals[i].fromclient == _id )
+                        {
+                                g_portals[i].status = stat_none;
+                                returned++;
+                        }
+                }
+                g_global_lock.release();
+
+                AtomicAdjust::add( s_workerthreads, -_numthreads );
+                Log( "netvis: worker #%d disconnected, %d portals returned\n", _id, returned );
+        }
+
+        _sock->Close();
+        delete _sock;
+}
+
+class NetVisListener : public Thread
+{
+public:
+        NetVisListener() :
+                Thread( "NetVisListener", "NetVisListener" )
+        {
+        }
+
+protected:
+        virtual void thread_main();
+};
+
+void            NetVisListener::thread_main()
+{
+        while ( !s_stop )
+        {
+                Socket_TCP*     sock = new Socket_TCP;
+                Socket_Address  address;
+                if ( !s_listen.GetIncomingConnection( *sock, address ) )
+                {
+                        delete sock;
+                        Thread::sleep( 0.1 );
+                        continue;
+                }
+
+                sock->SetBlocking();
+                sock->SetNoDelay();
+
+                int             id = (int)AtomicAdjust::add( s_nextclient, 1 );
+                PT( NetVisConnection ) connection = new NetVisConnection( sock, address.get_ip_port(), id );
+                connection->start( TP_normal, false );
+        }
+}
+
+static PT( NetVisListener ) s_listener;
+
+// =====================================================================================
+//  NetVisStartServer
+// =====================================================================================
+void            NetVisStartServer()
+{
+        if ( !s_listen.OpenForListen( g_port ) )
+        {
+                Error( "netvis: unable to listen on port %d\n", g_port );
+        }
+        s_listen.SetNonBlocking();
+
+        s_stop = false;
+        s_listener = new NetVisListener;
+        s_listener->start( TP_normal, true );
+
+        Log( "netvis: waiting for workers on port %d\n", g_port );
+}
+
+// =====================================================================================
+//  NetVisWaitForPortals
+//      Called once the local threads run out of portals.  Waits for the
+//      workers to finish theirs, and picks up the portals of any worker that
+//      went away.
+// =====================================================================================
+void            NetVisWaitForPortals( q_threadfunction* leafthread )
+{
+        const int       numportals = g_numportals * 2;
+        double          lastreport = I_FloatTime();
+
+        while ( !AllPortalsDone() )
+        {
+                bool            unclaimed = false;
+                g_global_lock.acquire();
+                for ( int i = 0; i < numportals && !unclaimed; i++ )
+                {
+                        unclaimed = g_portals[i].status == stat_none;
+                }
+                g_global_lock.release();
+
+                if ( unclaimed )
+                {
+                        RunThreadsOn( numportals, false, leafthread, THREADCOST_EXPENSIVE );
+                        continue;
+                }
+
+                Thread::sleep( 0.25 );
+
+                double          now = I_FloatTime();
+                if ( now - lastreport >= g_rate )
+                {
+                        lastreport = now;
+                        Log( "netvis: %d of %d portals done, %d worker threads connected\n",
+                             CountDonePortals(), numportals, (int)AtomicAdjust::get( s_workerthreads ) );
+                }
+        }
+}
+
+// =====================================================================================
+//  NetVisStopServer
+//      Connected workers are told to finish by their connection threads.
+// =====================================================================================
+void            NetVisStopServer()
+{
+        s_stop = true;
+        if ( s_listener )
+        {
+                s_listener->join();
+                s_listener = nullptr;
+        }
+        s_listen.Close();
+}
+
+/////////////////
+// WORKER
+
+static Socket_TCP s_server;
+static Mutex    s_lock( "netvis" );
+static pdeque<int> s_queue;                                // portals handed to us
+static pvector<int> s_results;                             // portals finished since the last request
+static bool     s_alldone = false;
+static int      s_numflowed = 0;
+
+// =====================================================================================
+//  NetVisConnect
+// =====================================================================================
+void            NetVisConnect()
+{
+        std::string     host = g_server_addr;
+        unsigned short  port = g_port;
+        size_t          colon = host.rfind( ':' );
+        if ( colon != std::string::npos )
+        {
+                port = (unsigned short)atoi( host.c_str() + colon + 1 );
+                host = host.substr( 0, colon );
+        }
+
+        Socket_Address  address;
+        if ( !address.set_host( host, port ) )
+        {
+                Error( "netvis: unable to resolve %s\n", host.c_str() );
+        }
+        if ( !s_server.ActiveOpen( address, true ) )
+        {
+                Error( "netvis: unable to connect to %s\n", address.get_ip_port().c_str() );
+        }
+
+        Datagram        hello;
+        hello.add_uint8( NV_HELLO );
+        hello.add_uint32( NETVIS_VERSION );
+        hello.add_uint32( g_numportals );
+        hello.add_uint32( g_portalleafs );
+        hello.add_uint64( HashMightsee() );
+        hello.add_uint16( g_numthreads );
+
+        Datagram        reply;
+        if ( !SendMessage( s_server, hello ) || !RecvMessage( s_server, reply ) || reply.get_length() < 1 )
+        {
+                Error( "netvis: lost connection to %s\n", address.get_ip_port().c_str() );
+        }
+
+        DatagramIterator dgi( reply );
+        switch ( dgi.get_uint8() )
+        {
+        case NV_WELCOME:
+                g_clientid = dgi.get_uint32();
+                break;
+        case NV_REJECT:
+                Error( "netvis: coordinator refused this worker: %s\n", dgi.get_string().c_str() );
+                break;
+        default:
+                Error( "netvis: unexpected reply from the coordinator\n" );
+                break;
+        }
+
+        Log( "netvis: connected to %s as worker #%lu\n", address.get_ip_port().c_str(), g_clientid );
+}
+
+// =====================================================================================
+//  NetVisDisconnect
+// =====================================================================================
+void            NetVisDisconnect()
+{
+        s_server.Close();
+        Log( "netvis: flowed %d portals\n", s_numflowed );
+}
+
+// =====================================================================================
+//  Exchange
+//      Sends our finished portals and gets more work.  s_lock must be held.
+// =====================================================================================
+static void     Exchange()
+{
+        Datagram        request;
+        request.add_uint8( NV_REQUEST );
+        request.add_uint32( (uint32_t)s_results.size() );
+        for ( size_t i = 0; i < s_results.size(); i++ )
+        {
+                AddPortal( request, &g_portals[s_results[i]] );
+        }
+        s_results.clear();
+
+        Datagram        reply;
+        if ( !SendMessage( s_server, request ) || !RecvMessage( s_server, reply ) || reply.get_length() < 1 )
+        {
+                Error( "netvis: lost connection to the coordinator\n" );
+        }
+
+        DatagramIterator dgi( reply );
+        int             type = dgi.get_uint8();
+        if ( type == NV_DONE )
+        {
+                s_alldone = true;
+                return;
+        }
+        if ( type != NV_WORK )
+        {
+                Error( "netvis: unexpected reply from the coordinator\n" );
+        }
+
+        uint32_t        numsync = dgi.get_uint32();
+        for ( uint32_t i = 0; i < numsync; i++ )
+        {
+                if ( !MergePortal( dgi, 0, NULL ) )
+                {
+                        Error( "netvis: bad portal data from the coordinator\n" );
+                }
+        }
+
+        uint32_t        numwork = dgi.get_uint32();
+        for ( uint32_t i = 0; i < numwork; i++ )
+        {
+                uint32_t        index = dgi.get_uint32();
+                if ( index >= (uint32_t)g_numportals * 2 )
+                {
+                        Error( "netvis: bad portal index from the coordinator\n" );
+                }
+
+                g_global_lock.acquire();
+                g_portals[index].status = stat_working;
+                g_global_lock.release();
+                s_queue.push_back( index );
+        }
+}
+
+// =====================================================================================
+//  NetVisGetNextPortal
+//      GetNextPortal for workers.
+// =====================================================================================
+portal_t*       NetVisGetNextPortal()
+{
+        s_lock.acquire();
+        while ( 1 )
+        {
+                if ( !s_queue.empty() )
+                {
+                        int             index = s_queue.front();
+                        s_queue.pop_front();
+                        s_lock.release();
+                        return &g_portals[index];
+                }
+
+                if ( s_alldone )
+                {
+                        s_lock.release();
+                        return NULL;
+                }
+
+                Exchange();
+
+                if ( s_queue.empty() && !s_alldone )
+                {
+                        // The rest are being flowed elsewhere, but a worker
+                        // may drop out and give some back.
+                        s_lock.release();
+                        Thread::sleep( 0.5 );
+                        s_lock.acquire();
+                }
+        }
+}
+
+// =====================================================================================
+//  NetVisPortalDone
+//      Called after every PortalFlow.
+// =====================================================================================
+void            NetVisPortalDone( portal_t* p )
+{
+        int             index = (int)( p - g_portals );
+
+        if ( g_vismode == VIS_MODE_CLIENT )
+        {
+                s_lock.acquire();
+                s_results.push_back( index );
+                s_numflowed++;
+                s_lock.release();
+        }
+        else if ( g_vismode == VIS_MODE_SERVER )
+        {
+                g_global_lock.acquire();
+                s_donelog.push_back( index );
+                g_global_lock.release();
+        }
+}
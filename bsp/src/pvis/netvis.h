@@ -0,0 +1,51 @@
+/**
+ * PANDA3D BSP TOOLS
+ * Copyright (c) CIO Team. All rights reserved.
+ *
+ * @file netvis.h
+ * @author Brian Lach
+ * @date October 17, 2026
+ *
+ * @desc Distributed vis.
+ *
+ *       The coordinator (-server) works on the map like a normal vis, but
+ *       also hands out batches of portals to worker processes (-connect)
+ *       over TCP and merges the portal visibility they send back.  Finished
+ *       portals are passed on to the other workers so they can use them to
+ *       cut their own flows short, just like the threads of a single vis do.
+ *
+ *       Every process loads the same .bsp and .prt and runs BasePortalVis
+ *       itself.  The mightsee bits are hashed when a worker connects, so a
+ *       worker with different inputs is turned away.
+ */
+
+#ifndef NETVIS_H
+#define NETVIS_H
+
+#include "vis.h"
+
+enum vis_modes
+{
+        VIS_MODE_NULL,                                     // plain vis
+        VIS_MODE_SERVER,                                   // coordinator
+        VIS_MODE_CLIENT                                    // worker
+};
+
+extern vis_modes g_vismode;
+extern unsigned short g_port;
+extern const char* g_server_addr;
+extern unsigned int g_rate;
+
+// coordinator
+extern void     NetVisStartServer();
+extern void     NetVisWaitForPortals( q_threadfunction* leafthread );
+extern void     NetVisStopServer();
+
+// worker
+extern void     NetVisConnect();
+extern void     NetVisDisconnect();
+extern portal_t* NetVisGetNextPortal();
+
+extern void     NetVisPortalDone( portal_t* p );
+
+#endif // NETVIS_H
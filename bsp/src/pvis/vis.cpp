@@ -17,9 +17,7 @@ Contains code by Skyler "Zipster" York (zipster89134@hotmail.com) - Included wit
 #endif
 #endif
 
-#ifdef ZHLT_NETVIS
-#include "zlib.h"
-#endif
+#include "netvis.h"
 
 /*
 
@@ -47,8 +45,8 @@ static int      originalvismapsize;
 
 byte*           g_uncompressed;                            // [bitbytes*portalleafs]
 
-unsigned        g_bitbytes;                                // (portalleafs+63)>>3
-unsigned        g_bitlongs;
+unsigned        g_bitbytes;                                // VIS_BITBYTES(portalleafs)
+unsigned        g_bitwords;
 
 bool            g_fastvis = DEFAULT_FASTVIS;
 bool            g_fullvis = DEFAULT_FULLVIS;
@@ -67,40 +65,10 @@ leafinfo_t*		g_leafinfos = NULL;
 
 
 static int      totalvis = 0;
+static int      benchruns = 0;                             // -bench
 
 #if ZHLT_ZONES
 Zones*          g_Zones;
-#endif
-
-#ifdef ZHLT_NETVIS
-// -- these are definitions and initializations of C/CPP common variables
-volatile int    g_visportalindex = UNINITIALIZED_PORTAL_INDEX;  // a client's portal index : current portalindex being worked on
-
-
-volatile int    g_visportals = 0;                          // the total portals in the map
-volatile int    g_visleafs = 0;                            // the total portal leafs in the map
-volatile int    g_vislocalportal = 0;                      // number of portals solved locally
-volatile enum vis_states g_visstate = VIS_STARTUP;         // current step of execution
-volatile enum vis_modes g_vismode = VIS_MODE_NULL;         // style of execution (client or server)
-volatile int    g_visleafthread = 0;                       // control flag (are we ready to leafthread)
-unsigned int    g_rate = DEFAULT_NETVIS_RATE;
-volatile double g_starttime = 0;                           // Start time (from I_FloatTime())
-volatile unsigned long g_idletime = 0;                     // Accumulated idle time in milliseconds (rolls over after 46.7 days, hopefully a vis client wont run that long)
-volatile unsigned long g_serverindex = 0;                  // client only variable, server index for calculating percentage indicators on the client
-short           g_port = DEFAULT_NETVIS_PORT;
-const char*     g_server_addr = NULL;
-
-
-volatile bool   g_bsp_downloaded = false;       // Client variable
-volatile bool   g_prt_downloaded = false;       // Client variable
-volatile bool   g_mightsee_downloaded = false;  // Client variable
-
-char*           g_bsp_image = NULL;         // Client/Server variable : Server uses it for cache for connecting clients, clients download it to memory to not require filesystem usage
-char*           g_prt_image = NULL;         // Client/Server variable : Server uses it for cache for connecting clients, clients download it to memory to not require filesystem usage
-unsigned long   g_bsp_compressed_size = 0;  // Server variable
-unsigned long   g_prt_compressed_size = 0;  // Server variable
-unsigned long   g_bsp_size = 0;             // Server variable
-unsigned long   g_prt_size = 0;             // Server variable
 #endif
 
                                             // AJM: addded in
@@ -195,15 +163,20 @@ void            GetParamsFromEnt( entity_t* mapent )
 // =====================================================================================
 static void     PlaneFromWinding( winding_t* w, plane_t* plane )
 {
+        vec3_t          p0, p1, p2;
         vec3_t          v1;
         vec3_t          v2;
 
+        GetWindingPoint( w, 0, p0 );
+        GetWindingPoint( w, 1, p1 );
+        GetWindingPoint( w, 2, p2 );
+
         // calc plane
-        VectorSubtract( w->points[2], w->points[1], v1 );
-        VectorSubtract( w->points[0], w->points[1], v2 );
+        VectorSubtract( p2, p1, v1 );
+        VectorSubtract( p0, p1, v2 );
         CrossProduct( v2, v1, plane->normal );
         VectorNormalize( plane->normal );
-        plane->dist = DotProduct( w->points[0], plane->normal );
+        plane->dist = DotProduct( p0, plane->normal );
 }
 
 // =====================================================================================
@@ -219,7 +192,7 @@ static winding_t* NewWinding( const int points )
                 Error( "NewWinding: %i points > MAX_POINTS_ON_WINDING", points );
         }
 
-        size = (int)(intptr_t)( (winding_t*)0 )->points[points];
+        size = (int)(intptr_t)&( (winding_t*)0 )->pairs[( points + 1 ) >> 1];
         w = (winding_t*)calloc( 1, size );
 
         return w;
@@ -227,41 +200,19 @@ static winding_t* NewWinding( const int points )
 
 //=============================================================================
 
-/////////
-// NETVIS
-#ifdef ZHLT_NETVIS
-
 // =====================================================================================
-//  GetPortalPtr
-//      converts a portal index to a pointer
+//  ClaimNextPortal
+//      Marks the least complex portal nobody is working on as in progress, so the
+//      later ones can reuse the earlier information.  The caller must hold the
+//      global lock.
 // =====================================================================================
-portal_t*       GetPortalPtr( const long index )
-{
-        if ( index < ( g_numportals * 2 ) )
-        {
-                return g_portals + index;
-        }
-        else
-        {
-                return ( NULL );
-        }
-}
-
-
-// =====================================================================================
-//  GetNextPortalIndex
-//      This is called by ClientSockets
-// =====================================================================================
-int             GetNextPortalIndex()
+portal_t*       ClaimNextPortal( int owner )
 {
         int             j;
-        int             best = NO_PORTAL_INDEX;
         portal_t*       p;
         portal_t*       tp;
         int             min;
 
-        ThreadLock();
-
         min = 99999;
         p = NULL;
 
@@ -271,29 +222,23 @@ int             GetNextPortalIndex()
                 {
                         min = tp->nummightsee;
                         p = tp;
-                        best = j;
                 }
         }
 
         if ( p )
         {
                 p->status = stat_working;
-        }
-        else
-        {
-                best = NO_PORTAL_INDEX;                            // hack to return NO_PORTAL_INDEX to the queue'ing code
+                p->fromclient = owner;
         }
 
-        ThreadUnlock();
-
-        return best;
+        return p;
 }
 
 // =====================================================================================
 //  AllPortalsDone
 //      returns true if all portals are done...
 // =====================================================================================
-static int      AllPortalsDone()
+bool            AllPortalsDone()
 {
         const unsigned  numportals = g_numportals * 2;
         portal_t*       tp;
@@ -303,101 +248,37 @@ static int      AllPortalsDone()
         {
                 if ( tp->status != stat_done )
                 {
-                        return 0;
+                        return false;
                 }
         }
 
-        return 1;
+        return true;
 }
 
-#endif
-// NETVIS
-///////////
-
 // =====================================================================================
 //  GetNextPortal
 //      Returns the next portal for a thread to work on
-//      Returns the portals from the least complex, so the later ones can reuse the earlier information.
 // =====================================================================================
 static portal_t* GetNextPortal()
 {
-        int             j;
         portal_t*       p;
-        portal_t*       tp;
-        int             min;
 
-#ifdef ZHLT_NETVIS
-        if ( g_vismode == VIS_MODE_SERVER )
+        if ( g_vismode == VIS_MODE_CLIENT )
         {
-#else
-                {
-                        if ( GetThreadWork() == -1 )
-                        {
-                                return NULL;
-                        }
-#endif
-                        ThreadLock();
-
-                        min = 99999;
-                        p = NULL;
-
-                        for ( j = 0, tp = g_portals; j < g_numportals * 2; j++, tp++ )
-                        {
-                                if ( tp->nummightsee < min && tp->status == stat_none )
-                                {
-                                        min = tp->nummightsee;
-                                        p = tp;
-#ifdef ZHLT_NETVIS
-                                        g_visportalindex = j;
-#endif
-                                }
-                        }
-
-                        if ( p )
-                        {
-                                p->status = stat_working;
-                        }
-
-                        ThreadUnlock();
-
-                        return p;
-                }
-#ifdef ZHLT_NETVIS
-    else                                                   // AS CLIENT
-    {
-            while ( getWorkFromClientQueue() == WAITING_FOR_PORTAL_INDEX )
-            {
-                    unsigned        delay = 100;
-
-                    g_idletime += delay;                           // This is the only point where the portal work goes idle, so its easy to add up just how idle it is.
-                    if ( !isConnectedToServer() )
-                    {
-                            Error( "Unexepected disconnect from server(1)\n" );
-                    }
-                    NetvisSleep( delay );
-            }
-
-            if ( g_visportalindex == NO_PORTAL_INDEX )
-            {
-                    g_visstate = VIS_CLIENT_DONE;
-                    Send_VIS_GOING_DOWN( g_ClientSession );
-                    return NULL;
-            }
-
-            // convert index to pointer
-            tp = GetPortalPtr( g_visportalindex );
-
-            if ( tp )
-            {
-                    tp->status = stat_working;
-            }
-            return ( tp );
-    }
-#endif
+                return NetVisGetNextPortal();
         }
 
+        if ( GetThreadWork() == -1 )
+        {
+                return NULL;
+        }
 
+        ThreadLock();
+        p = ClaimNextPortal( 0 );
+        ThreadUnlock();
 
+        return p;
+}
 
 // =====================================================================================
 //  LeafThread
@@ -407,7 +288,6 @@ static portal_t* GetNextPortal()
 #pragma warning(disable: 4100)                             // unreferenced formal parameter
 #endif
 
-#ifndef ZHLT_NETVIS
 static void     LeafThread( int threadnum )
 {
         portal_t*       p;
@@ -421,85 +301,14 @@ static void     LeafThread( int threadnum )
 
                 PortalFlow( p );
 
-                Verbose( "portal:%4i  mightsee:%4i  cansee:%4i\n", (int)( p - g_portals ), p->nummightsee, p->numcansee );
-        }
-}
-#endif //!ZHLT_NETVIS
-
-#ifdef ZHLT_NETVIS
-
-static void     LeafThread( int unused )
-{
-        if ( g_vismode == VIS_MODE_CLIENT )
-        {
-                portal_t*       p;
-
-                g_visstate = VIS_BASE_PORTAL_VIS_SERVER_WAIT;
-                Send_VIS_LEAFTHREAD( g_visleafs, g_visportals, g_bitbytes );
-                while ( !g_visleafthread )
-                {
-                        if ( !isConnectedToServer() )
-                        {
-                                Error( "Unexepected disconnect from server(2)\n" );
-                        }
-                        NetvisSleep( 100 );
-                }
-                g_visstate = VIS_PORTAL_FLOW;
-                Send_VIS_WANT_FULL_SYNC();
-
-                while ( !g_NetvisAbort )
+                if ( g_vismode != VIS_MODE_NULL )
                 {
-                        if ( !( p = GetNextPortal() ) )
-                        {
-                                return;
-                        }
-
-                        PortalFlow( p );
-                        Send_VIS_DONE_PORTAL( g_visportalindex, p );
-                        g_vislocalportal++;
-                }
-        }
-        else if ( g_vismode == VIS_MODE_SERVER )
-        {
-#if 0
-                // Server does zero work in ZHLT netvis
-                g_visstate = VIS_WAIT_CLIENTS;
-                while ( !g_NetvisAbort )
-                {
-                        NetvisSleep( 1000 );
-                        if ( AllPortalsDone() )
-                        {
-                                g_visstate = VIS_POST;
-                                return;
-                        }
+                        NetVisPortalDone( p );
                 }
-#else
-                portal_t*       p;
 
-                g_visstate = VIS_WAIT_CLIENTS;
-                while ( !g_NetvisAbort )
-                {
-                        if ( !( p = GetNextPortal() ) )
-                        {
-                                if ( AllPortalsDone() )
-                                {
-                                        g_visstate = VIS_POST;
-                                        return;
-                                }
-                                NetvisSleep( 1000 );                         // No need to churn while waiting on slow clients
-                                continue;
-                        }
-                        PortalFlow( p );
-                        g_vislocalportal++;
-                }
-#endif
-        }
-        else
-        {
-                hlassume( false, assume_VALID_NETVIS_STATE );
+                Verbose( "portal:%4i  mightsee:%4i  cansee:%4i\n", (int)( p - g_portals ), p->nummightsee, p->numcansee );
         }
 }
-#endif
 
 #ifdef _WIN32
 #pragma warning(pop)
@@ -541,14 +350,7 @@ static void     LeafFlow( const int leafnum )
                         Error( "portal not done (leaf %d)", leafnum );
                 }
 
-                {
-                        byte* dst = outbuffer;
-                        byte* src = p->visbits;
-                        for ( j = 0; j<g_bitbytes; j++, dst++, src++ )
-                        {
-                                *dst |= *src;
-                        }
-                }
+                VisBitsOr( outbuffer, p->visbits );
 
                 if ( ( tmp == 0 ) && ( outbuffer[offset] & bit ) )
                 {
@@ -557,7 +359,9 @@ static void     LeafFlow( const int leafnum )
                         Log( "    Problem at portal between leaves %i and %i:\n   ", leafnum, p->leaf );
                         for ( k = 0; k < p->winding->numpoints; k++ )
                         {
-                                Log( "    (%4.3f %4.3f %4.3f)\n", p->winding->points[k][0], p->winding->points[k][1], p->winding->points[k][2] );
+                                vec3_t          point;
+                                GetWindingPoint( p->winding, k, point );
+                                Log( "    (%4.3f %4.3f %4.3f)\n", point[0], point[1], point[2] );
                         }
                         Log( "\n" );
                 }
@@ -579,14 +383,7 @@ static void     LeafFlow( const int leafnum )
                         outbuffer[i >> 3] |= ( 1 << ( i & 7 ) );
                 }
         }
-        numvis = 0;
-        for ( i = 0; i < g_portalleafs; i++ )
-        {
-                if ( outbuffer[i >> 3] & ( 1 << ( i & 7 ) ) )
-                {
-                        numvis++;
-                }
-        }
+        numvis = VisBitsCount( outbuffer );
 
         //
         // compress the bit string
@@ -634,7 +431,6 @@ static void     LeafFlow( const int leafnum )
 // =====================================================================================
 static void     CalcPortalVis()
 {
-#ifndef ZHLT_NETVIS
         // g_fastvis just uses mightsee for a very loose bound
         if ( g_fastvis )
         {
@@ -647,83 +443,58 @@ static void     CalcPortalVis()
                 }
                 return;
         }
-#endif
 
-#ifdef ZHLT_NETVIS
-        LeafThread( 0 );
-#else
-        NamedRunThreadsOn( g_numportals * 2, g_estimate, LeafThread );
-#endif
+        NamedRunThreadsOnCost( g_numportals * 2, g_estimate, LeafThread, THREADCOST_EXPENSIVE );
 }
 
-//////////////
-// ZHLT_NETVIS
-
-#ifdef ZHLT_NETVIS
 // =====================================================================================
-//  CalcVis
+//  BenchmarkVis
+//      Flows every portal of the map several times over without writing anything,
+//      to time changes to the flow code against a recorded .prt.
 // =====================================================================================
-static void     CalcVis()
+static void     BenchmarkVis( const int runs )
 {
-        unsigned        lastpercent = 0;
-        int             x, size;
+        int             i, run;
+        double          start, time;
+        double          best = 0;
+        double          total = 0;
+        unsigned        cansee = 0;
 
-        if ( g_vismode == VIS_MODE_SERVER )
-        {
-                g_visstate = VIS_BASE_PORTAL_VIS;
-                Log( "BasePortalVis: \n" );
-
-                for ( x = 0, size = g_numportals * 2; x < size; x++ )
-                {
-                        unsigned        percent = ( x * 100 / size );
+        NamedRunThreadsOn( g_numportals * 2, g_estimate, BasePortalVis );
 
-                        if ( percent && ( percent != lastpercent ) && ( ( percent % 10 ) == 0 ) )
-                        {
-                                lastpercent = percent;
-                                printf
-                                ( "%d%%....", percent );
-                        }
-                        BasePortalVis( x );
-                }
-                printf
-                ( "\n" );
-        }
-        else
+        for ( run = 0; run < runs; run++ )
         {
-                Send_VIS_WANT_MIGHTSEE_DATA();
-                while ( !g_mightsee_downloaded )
+                for ( i = 0; i < g_numportals * 2; i++ )
                 {
-                        if ( !isConnectedToServer() )
-                        {
-                                Error( "Unexepected disconnect from server(3)\n" );
-                        }
-                        NetvisSleep( 100 );
-                }
-        }
-
-        g_visportals = g_numportals;
-        g_visleafs = g_portalleafs;
+                        portal_t*       p = &g_portals[i];
 
-        g_starttime = I_FloatTime();
-        StartStatusDisplayThread( g_rate );
-        CalcPortalVis();
+                        free( p->visbits );
+                        p->visbits = NULL;
+                        p->numcansee = 0;
+                        p->status = stat_none;
+                }
 
-        if ( g_vismode == VIS_MODE_SERVER )
-        {
-                unsigned int    i;
+                printf( "PortalFlow run %d:  ", run + 1 );
+                start = I_FloatTime();
+                RunThreadsOn( g_numportals * 2, false, LeafThread, THREADCOST_EXPENSIVE );
+                time = I_FloatTime() - start;
 
-                for ( i = 0; i < g_portalleafs; i++ )
+                total += time;
+                if ( !run || time < best )
                 {
-                        LeafFlow( i );
+                        best = time;
                 }
-
-                Log( "average leafs visible: %i\n", totalvis / g_portalleafs );
         }
-}
-#endif
 
-#ifndef ZHLT_NETVIS
+        // the sum only changes if the flow does
+        for ( i = 0; i < g_numportals * 2; i++ )
+        {
+                cansee += g_portals[i].numcansee;
+        }
 
+        Log( "PortalFlow: best %.3f seconds, average %.3f seconds over %d runs\n", best, total / runs, runs );
+        Log( "total portal cansee: %u\n", cansee );
+}
 
 // AJM: MVD
 // =====================================================================================
@@ -795,17 +566,42 @@ static void     CalcVis()
 
         // First do a normal VIS, save to file, then redo MaxDistVis
 
-        CalcPortalVis();
+        ProfileBeginPhase( "PortalFlow" );
+        if ( g_vismode == VIS_MODE_CLIENT )
+        {
+                // Workers only flow portals, the coordinator writes the map.
+                NetVisConnect();
+                CalcPortalVis();
+                NetVisDisconnect();
+                ProfileEndPhase();
+                return;
+        }
+
+        if ( g_vismode == VIS_MODE_SERVER )
+        {
+                NetVisStartServer();
+                CalcPortalVis();
+                NetVisWaitForPortals( LeafThread );
+                NetVisStopServer();
+        }
+        else
+        {
+                CalcPortalVis();
+        }
+        ProfileEndPhase();
 
         //
         // assemble the leaf vis lists by oring and compressing the portal lists
         //
+        ProfileBeginPhase( "LeafFlow" );
         for ( i = 0; i < g_portalleafs; i++ )
         {
                 LeafFlow( i );
         }
+        ProfileEndPhase();
 
         Log( "average leafs visible: %i\n", totalvis / g_portalleafs );
+        ProfileSetValue( "average_leafs_visible", (double)totalvis / g_portalleafs );
 
         if ( g_maxdistance )
         {
@@ -821,6 +617,7 @@ static void     CalcVis()
                 vismap_p = g_bspdata->dvisdata;
 
                 // We don't need to run BasePortalVis again
+                ProfileBeginPhase( "MaxDistVis" );
                 NamedRunThreadsOn( g_portalleafs, g_estimate, MaxDistVis );
 
                 // No need to run this - MaxDistVis now writes directly to visbits after the initial VIS
@@ -830,16 +627,13 @@ static void     CalcVis()
                 {
                         LeafFlow( i );
                 }
+                ProfileEndPhase();
 
 
                 Log( "average maxdistance leafs visible: %i\n", totalvis / g_portalleafs );
         }
         //	}
 }
-#endif //!ZHLT_NETVIS
-
-// ZHLT_NETVIS
-//////////////
 
 // =====================================================================================
 //  CheckNullToken
@@ -884,8 +678,8 @@ static void     LoadPortals( char* portal_image )
         Log( "%4i portalleafs\n", g_portalleafs );
         Log( "%4i numportals\n", g_numportals );
 
-        g_bitbytes = ( ( g_portalleafs + 63 ) & ~63 ) >> 3;
-        g_bitlongs = g_bitbytes / sizeof( long );
+        g_bitbytes = VIS_BITBYTES( g_portalleafs );
+        g_bitwords = g_bitbytes / ( VIS_WORD_BITS / 8 );
 
         // each file portal is split into two memory portals
         g_portals = (portal_t*)calloc( 2 * g_numportals, sizeof( portal_t ) );
@@ -972,7 +766,6 @@ static void     LoadPortals( char* portal_image )
 
                 for ( j = 0; j < numpoints; j++ )
                 {
-                        int             k;
                         double          v[3];
                         unsigned        rval = 0;
 
@@ -991,10 +784,7 @@ static void     LoadPortals( char* portal_image )
                         {
                                 Error( "LoadPortals: reading portal %i", i );
                         }
-                        for ( k = 0; k < 3; k++ )
-                        {
-                                w->points[j][k] = v[k];
-                        }
+                        SetWindingPoint( w, j, v );
                 }
 
                 // calc plane
@@ -1022,7 +812,9 @@ static void     LoadPortals( char* portal_image )
                 p->winding->numpoints = w->numpoints;
                 for ( j = 0; j < w->numpoints; j++ )
                 {
-                        VectorCopy( w->points[w->numpoints - 1 - j], p->winding->points[j] );
+                        vec3_t          point;
+                        GetWindingPoint( w, w->numpoints - 1 - j, point );
+                        SetWindingPoint( p->winding, j, point );
                 }
 
                 p->plane = plane;
@@ -1076,7 +868,9 @@ static void     AssignPortalsToZones()
 
                 for ( y = 0; y<numpoints; y++ )
                 {
-                        bounds.add( w->points[y] );
+                        vec3_t point;
+                        GetWindingPoint( w, y, point );
+                        bounds.add( point );
                 }
 
                 p->zone = g_Zones->getZoneFromBounds( bounds );
@@ -1106,12 +900,10 @@ static void     Usage()
         Log( "    -lang file      : localization file\n" );
         Log( "    -full           : Full vis\n" );
         Log( "    -fast           : Fast vis\n\n" );
-#ifdef ZHLT_NETVIS
-        Log( "    -connect address : Connect to netvis server at address as a client\n" );
-        Log( "    -server          : Run as the netvis server\n" );
-        Log( "    -port #          : Use a non-standard port for netvis\n" );
-        Log( "    -rate #          : Alter the display update rate\n\n" );
-#endif
+        Log( "    -server         : Hand out portals to netvis workers\n" );
+        Log( "    -connect host[:port] : Work on the portals of a netvis server\n" );
+        Log( "    -port #         : Alter the netvis port\n" );
+        Log( "    -rate #         : Alter the netvis progress report rate (in seconds)\n\n" );
         Log( "    -texdata #      : Alter maximum texture memory limit (in kb)\n" );
         Log( "    -lightdata #      : Alter maximum lighting memory limit (in kb)\n" ); //lightdata //--vluzacn
         Log( "    -chart          : display bsp statitics\n" );
@@ -1125,21 +917,17 @@ static void     Usage()
         Log( "    -noestimate     : do not display continuous compile time estimates\n" );
 #endif
         Log( "    -maxdistance #  : Alter the maximum distance for visibility\n" );
+        Log( "    -bench #        : Time # portal flows of the map, without writing it\n" );
+        Log( "    -profile file   : Write a JSON report of the compile times to file\n" );
         Log( "    -verbose        : compile with verbose messages\n" );
         Log( "    -noinfo         : Do not show tool configuration information\n" );
         Log( "    -dev #          : compile with developer message\n\n" );
         Log( "    mapfile         : The mapfile to compile\n\n" );
 
-#ifdef ZHLT_NETVIS
-        Log( "\n"
-             "In netvis one computer must be the server and all the rest are the clients.\n"
-             "The server should be started with      : netvis -server mapname\n"
-             "And the clients should be started with : netvis -connect servername\n"
-             "\n"
-             "The default socket it uses is 21212 and can be changed with -port\n"
-             "The default update rate is 60 seconds and can be changed with -rate\n" );
-
-#endif
+        Log( "In netvis one process is the server and the rest are workers.\n"
+             "The server should be started with : pvis -server mapname\n"
+             "And the workers with              : pvis -connect servername mapname\n"
+             "Every worker needs the same .bsp and .prt as the server.\n\n" );
 
         exit( 1 );
 }
@@ -1177,6 +965,7 @@ static void     Settings()
         Log( "max texture memory  [ %7d ] [ %7d ]\n", g_max_map_texref, DEFAULT_MAX_MAP_TEXREF );
 
         Log( "max vis distance    [ %7d ] [ %7d ]\n", g_maxdistance, DEFAULT_MAXDISTANCE_RANGE );
+        Log( "benchmark runs      [ %7d ] [ %7d ]\n", benchruns, 0 );
         //Log("max dist only       [ %7s ] [ %7s ]\n", g_postcompile ? "on" : "off", DEFAULT_POST_COMPILE ? "on" : "off");
 
         switch ( g_threadpriority )
@@ -1199,18 +988,19 @@ static void     Settings()
         Log( "fast vis            [ %7s ] [ %7s ]\n", g_fastvis ? "on" : "off", DEFAULT_FASTVIS ? "on" : "off" );
         Log( "full vis            [ %7s ] [ %7s ]\n", g_fullvis ? "on" : "off", DEFAULT_FULLVIS ? "on" : "off" );
 
-#ifdef ZHLT_NETVIS
         if ( g_vismode == VIS_MODE_SERVER )
         {
                 Log( "netvis mode         [  Server ]\n" );
         }
         else if ( g_vismode == VIS_MODE_CLIENT )
         {
-                Log( "netvis mode         [  Client, connected to %s ]\n", g_server_addr );
+                Log( "netvis mode         [  Worker, connected to %s ]\n", g_server_addr );
+        }
+        if ( g_vismode != VIS_MODE_NULL )
+        {
+                Log( "netvis port         [ %7d ] [ %7d ]\n", g_port, DEFAULT_NETVIS_PORT );
+                Log( "netvis report rate  [ %7d ] [ %7d ]\n", g_rate, DEFAULT_NETVIS_RATE );
         }
-        Log( "netvis port         [ %7d ] [ %7d ]\n", g_port, DEFAULT_NETVIS_PORT );
-        Log( "netvis display rate [ %7d ] [ %7d ]\n", g_rate, DEFAULT_NETVIS_RATE );
-#endif
 
         Log( "\n\n" );
 }
@@ -1251,11 +1041,7 @@ int             main( const int argc, char** argv )
         double          start, end;
         const char*     mapname_from_arg = NULL;
 
-#ifdef ZHLT_NETVIS
-        g_Program = "netvis";
-#else
         g_Program = "p3vis";
-#endif
 
         int argcold = argc;
         char ** argvold = argv;
@@ -1300,14 +1086,13 @@ int             main( const int argc, char** argv )
                                         g_estimate = false;
                                 }
 #endif
-#ifdef ZHLT_NETVIS
                                 else if ( !strcasecmp( argv[i], "-server" ) )
                                 {
                                         g_vismode = VIS_MODE_SERVER;
                                 }
                                 else if ( !strcasecmp( argv[i], "-connect" ) )
                                 {
-                                        if ( i + 1 < argc )	//added "1" .--vluzacn
+                                        if ( i + 1 < argc )
                                         {
                                                 g_vismode = VIS_MODE_CLIENT;
                                                 g_server_addr = argv[++i];
@@ -1319,9 +1104,9 @@ int             main( const int argc, char** argv )
                                 }
                                 else if ( !strcasecmp( argv[i], "-port" ) )
                                 {
-                                        if ( i + 1 < argc )	//added "1" .--vluzacn
+                                        if ( i + 1 < argc )
                                         {
-                                                g_port = atoi( argv[++i] );
+                                                g_port = (unsigned short)atoi( argv[++i] );
                                         }
                                         else
                                         {
@@ -1330,7 +1115,7 @@ int             main( const int argc, char** argv )
                                 }
                                 else if ( !strcasecmp( argv[i], "-rate" ) )
                                 {
-                                        if ( i + 1 < argc )	//added "1" .--vluzacn
+                                        if ( i + 1 < argc )
                                         {
                                                 g_rate = atoi( argv[++i] );
                                         }
@@ -1349,14 +1134,11 @@ int             main( const int argc, char** argv )
                                                 g_rate = 900;
                                         }
                                 }
-#endif
-#ifndef ZHLT_NETVIS
                                 else if ( !strcasecmp( argv[i], "-fast" ) )
                                 {
                                         Log( "g_fastvis = true\n" );
                                         g_fastvis = true;
                                 }
-#endif
                                 else if ( !strcasecmp( argv[i], "-full" ) )
                                 {
                                         g_fullvis = true;
@@ -1443,6 +1225,33 @@ int             main( const int argc, char** argv )
                                                 Usage();
                                         }
                                 }
+                                else if ( !strcasecmp( argv[i], "-bench" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                benchruns = atoi( argv[++i] );
+                                                if ( benchruns < 1 )
+                                                {
+                                                        Log( "Expected value of at least 1 for '-bench'\n" );
+                                                        Usage();
+                                                }
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
+                                else if ( !strcasecmp( argv[i], "-profile" ) )
+                                {
+                                        if ( i + 1 < argc )
+                                        {
+                                                safe_strncpy( g_profilefile, argv[++i], _MAX_PATH );
+                                        }
+                                        else
+                                        {
+                                                Usage();
+                                        }
+                                }
                                 /*		else if(!strcasecmp(argv[i], "-postcompile"))
                                 {
                                 g_postcompile = true;
@@ -1481,60 +1290,27 @@ int             main( const int argc, char** argv )
                                 }
                         }
 
-#ifdef ZHLT_NETVIS
-                        threads_InitCrit();
-
-                        if ( g_vismode == VIS_MODE_CLIENT )
-                        {
-                                ConnectToServer( g_server_addr, g_port );
-
-                                while ( !isConnectedToServer() )
-                                {
-                                        NetvisSleep( 100 );
-                                }
-                                Send_VIS_LOGIN();
-                                while ( !g_clientid )
-                                {
-                                        if ( !isConnectedToServer() )
-                                        {
-                                                Error( "Unexepected disconnect from server(4)\n" );
-                                        }
-                                        NetvisSleep( 100 );
-                                }
-
-                                mapname_from_arg = "proxy";
-                        }
-                        else if ( g_vismode == VIS_MODE_SERVER )
-                        {
-                                StartNetvisSocketServer( g_port );
-
-                                if ( !mapname_from_arg )
-                                {
-                                        Log( "No mapfile specified\n" );
-                                        Usage();
-                                }
-                        }
-                        else
+                        if ( !mapname_from_arg )
                         {
-                                Log( "Netvis must be run either as a server (-server)\n" "or as a client (-connect servername)\n\n" );
+                                Log( "No mapfile specified\n" );
                                 Usage();
                         }
 
-#else
-
-                        if ( !mapname_from_arg )
+                        if ( benchruns && g_vismode != VIS_MODE_NULL )
                         {
-                                Log( "No mapfile specified\n" );
+                                Log( "-bench can't be used with -server or -connect\n" );
                                 Usage();
                         }
-#endif
 
-#ifdef ZHLT_NETVIS
                         if ( g_vismode == VIS_MODE_CLIENT )
                         {
+                                if ( g_fastvis )
+                                {
+                                        Log( "-fast doesn't flow any portals, so it can't be used with -connect\n" );
+                                        Usage();
+                                }
                                 g_log = false;
                         }
-#endif
 
                         safe_strncpy( g_Mapname, mapname_from_arg, _MAX_PATH );
                         FlipSlashes( g_Mapname );
@@ -1561,18 +1337,6 @@ int             main( const int argc, char** argv )
                                 Log( "\n" );
                         }
 
-#ifdef ZHLT_NETVIS
-                        if ( g_vismode == VIS_MODE_CLIENT )
-                        {
-                                Log( "ZHLT NETVIS Client #%d\n", g_clientid );
-                                g_log = false;
-                        }
-                        else
-                        {
-                                Log( "ZHLT NETVIS Server\n" );
-                        }
-#endif
-
                         CheckForErrorLog();
 
 #ifdef PLATFORM_CAN_CALC_EXTENT
@@ -1583,78 +1347,16 @@ int             main( const int argc, char** argv )
                         // END INIT
 
                         // BEGIN VIS
+                        ProfileStart();
                         start = I_FloatTime();
 
+                        ProfileBeginPhase( "Load" );
+
                         safe_strncpy( source, g_Mapname, _MAX_PATH );
                         safe_strncat( source, ".bsp", _MAX_PATH );
                         safe_strncpy( portalfile, g_Mapname, _MAX_PATH );
                         safe_strncat( portalfile, ".prt", _MAX_PATH );
 
-#ifdef ZHLT_NETVIS
-
-                        if ( g_vismode == VIS_MODE_SERVER )
-                        {
-                                LoadBSPFile( source );
-                                LoadPortalsByFilename( portalfile );
-
-                                char* bsp_image;
-                                char* prt_image;
-
-                                g_bsp_size = LoadFile( source, &bsp_image );
-                                g_prt_size = LoadFile( portalfile, &prt_image );
-
-                                g_bsp_compressed_size = ( g_bsp_size * 1.01 ) + 12; // Magic numbers come from zlib documentation
-                                g_prt_compressed_size = ( g_prt_size * 1.01 ) + 12; // Magic numbers come from zlib documentation
-
-                                char* bsp_compressed_image = (char*)malloc( g_bsp_compressed_size );
-                                char* prt_compressed_image = (char*)malloc( g_prt_compressed_size );
-
-                                int rval;
-
-                                rval = compress2( (byte*)bsp_compressed_image, &g_bsp_compressed_size, (byte*)bsp_image, g_bsp_size, 5 );
-                                if ( rval != Z_OK )
-                                {
-                                        Error( "zlib Compression error with bsp image\n" );
-                                }
-
-                                rval = compress2( (byte*)prt_compressed_image, &g_prt_compressed_size, (byte*)prt_image, g_prt_size, 7 );
-                                if ( rval != Z_OK )
-                                {
-                                        Error( "zlib Compression error with prt image\n" );
-                                }
-
-                                free( bsp_image );
-                                free( prt_image );
-
-                                g_bsp_image = bsp_compressed_image;
-                                g_prt_image = prt_compressed_image;
-                        }
-                        else if ( g_vismode == VIS_MODE_CLIENT )
-                        {
-                                Send_VIS_WANT_BSP_DATA();
-                                while ( !g_bsp_downloaded )
-                                {
-                                        if ( !isConnectedToServer() )
-                                        {
-                                                Error( "Unexepected disconnect from server(5)\n" );
-                                        }
-                                        NetvisSleep( 100 );
-                                }
-                                Send_VIS_WANT_PRT_DATA();
-                                while ( !g_prt_downloaded )
-                                {
-                                        if ( !isConnectedToServer() )
-                                        {
-                                                Error( "Unexepected disconnect from server(6)\n" );
-                                        }
-                                        NetvisSleep( 100 );
-                                }
-                                LoadPortals( g_prt_image );
-                                free( g_prt_image );
-                        }
-
-#else // NOT ZHLT_NETVIS
-
                         g_bspdata = LoadBSPFile( source );
                         ParseEntities(g_bspdata);
                         {
@@ -1682,56 +1384,37 @@ int             main( const int argc, char** argv )
                         AssignPortalsToZones();
 #   endif
 
-#endif
+                        ProfileEndPhase();
+                        ProfileSetValue( "portals", g_numportals );
+                        ProfileSetValue( "leafs", g_portalleafs );
 
                         Settings();
                         g_uncompressed = (byte*)calloc( g_portalleafs, g_bitbytes );
 
-                        CalcVis();
-
-#ifdef ZHLT_NETVIS
-
-                        if ( g_vismode == VIS_MODE_SERVER )
+                        if ( benchruns )
                         {
-                                g_visdatasize = vismap_p - g_dvisdata;
-                                Log( "g_visdatasize:%i  compressed from %i\n", g_visdatasize, originalvismapsize );
-
-                                if ( g_chart )
-                                {
-                                        PrintBSPFileSizes();
-                                }
-
-                                WriteBSPFile( source );
-
-                                end = I_FloatTime();
-                                LogTimeElapsed( end - start );
+                                ProfileBeginPhase( "Benchmark" );
+                                BenchmarkVis( benchruns );
+                                ProfileEndPhase();
+                                ProfileWrite( I_FloatTime() - start );
 
                                 free( g_uncompressed );
-                                // END VIS
-
-#ifndef _WIN32
-                                // Talk about cheese . . .
-                                StopNetvisSocketServer();
-#endif
-
+                                return 0;
                         }
-                        else if ( g_vismode == VIS_MODE_CLIENT )
-                        {
 
-#ifndef _WIN32
-                                // Dont ask  . .
-                                DisconnectFromServer();
-#endif
+                        ProfileBeginPhase( "CalcVis" );
+                        CalcVis();
+                        ProfileEndPhase();
 
+                        if ( g_vismode == VIS_MODE_CLIENT )
+                        {
                                 end = I_FloatTime();
                                 LogTimeElapsed( end - start );
+                                ProfileWrite( end - start );
 
                                 free( g_uncompressed );
-                                // END VIS
+                                return 0;
                         }
-                        threads_UninitCrit();
-
-#else // NOT ZHLT_NETVIS
 
                         g_bspdata->visdatasize = vismap_p - g_bspdata->dvisdata;
                         Log( "g_visdatasize:%i  compressed from %i\n", g_bspdata->visdatasize, originalvismapsize );
@@ -1741,15 +1424,18 @@ int             main( const int argc, char** argv )
                                 PrintBSPFileSizes( g_bspdata );
                         }
 
+                        ProfileSetValue( "visdatasize", g_bspdata->visdatasize );
+
+                        ProfileBeginPhase( "Write" );
                         WriteBSPFile( g_bspdata, source );
+                        ProfileEndPhase();
 
                         end = I_FloatTime();
                         LogTimeElapsed( end - start );
+                        ProfileWrite( end - start );
 
                         free( g_uncompressed );
                         // END VIS
-
-#endif // ZHLT_NETVIS
                 }
         }
 
@@ -13,11 +13,16 @@
 #include "mathlib.h"
 #include "bspfile.h"
 #include "threads.h"
+#include "profile.h"
 #include "filelib.h"
 
 #include "zones.h"
 #include "cmdlinecfg.h"
 
+#include <pbitops.h>
+
+#include <emmintrin.h>
+
 #define DEFAULT_MAXDISTANCE_RANGE   0
 
 
@@ -44,13 +49,43 @@
 
 #define	MAX_POINTS_ON_FIXED_WINDING	32
 
+// Leaf bit strings are padded to a whole number of 128-bit words so they can
+// be combined a word at a time.
+#define VIS_WORD_BITS           128
+#define VIS_BITBYTES( leafs )   ( ( ( ( leafs ) + VIS_WORD_BITS - 1 ) & ~( VIS_WORD_BITS - 1 ) ) >> 3 )
+
+// Winding points are stored two at a time as separate x, y and z pairs, so
+// the flow can test them against a plane with one SSE2 operation per pair.
+typedef struct
+{
+        vec_t           x[2];
+        vec_t           y[2];
+        vec_t           z[2];
+} pointpair_t;
+
 typedef struct
 {
         bool            original;                              // don't free, it's part of the portal
         int             numpoints;
-        vec3_t          points[MAX_POINTS_ON_FIXED_WINDING];
+        pointpair_t     pairs[MAX_POINTS_ON_FIXED_WINDING / 2];    // portal windings may be allocated larger
 } winding_t;
 
+inline void     GetWindingPoint( const winding_t* const w, const int i, vec3_t point )
+{
+        const pointpair_t& pair = w->pairs[i >> 1];
+        point[0] = pair.x[i & 1];
+        point[1] = pair.y[i & 1];
+        point[2] = pair.z[i & 1];
+}
+
+inline void     SetWindingPoint( winding_t* const w, const int i, const vec3_t point )
+{
+        pointpair_t&    pair = w->pairs[i >> 1];
+        pair.x[i & 1] = point[0];
+        pair.y[i & 1] = point[1];
+        pair.z[i & 1] = point[2];
+}
+
 typedef struct
 {
         vec3_t          normal;
@@ -74,9 +109,7 @@ typedef struct
         byte*           mightsee;
         unsigned        nummightsee;
         int             numcansee;
-#ifdef ZHLT_NETVIS
-        int             fromclient;                            // which client did this come from
-#endif
+        int             fromclient;                            // which netvis worker flowed this, 0 is local
         uint32_t          zone;                                  // Which zone is this portal a member of
 } portal_t;
 
@@ -103,7 +136,7 @@ typedef struct leaf_s
 
 typedef struct pstack_s
 {
-        byte            mightsee[MAX_MAP_LEAFS / 8];           // bit string
+        byte            mightsee[VIS_BITBYTES( MAX_MAP_LEAFS )]; // bit string
 #ifdef USE_CHECK_STACK
         struct pstack_s* next;
 #endif
@@ -167,7 +200,56 @@ extern leaf_t*  g_leafs;
 
 extern byte*    g_uncompressed;
 extern unsigned g_bitbytes;
-extern unsigned g_bitlongs;
+extern unsigned g_bitwords;                                // g_bitbytes in 128-bit words
+
+// =====================================================================================
+//  VisBitsAndNew
+//      out = a & b.  Returns true if out has any bits that aren't in seen.
+// =====================================================================================
+inline bool     VisBitsAndNew( byte* const out, const byte* const a, const byte* const b, const byte* const seen )
+{
+        __m128i         fresh = _mm_setzero_si128();
+
+        for ( unsigned i = 0; i < g_bitwords; i++ )
+        {
+                const __m128i   bits = _mm_and_si128( _mm_loadu_si128( (const __m128i*)a + i ),
+                                                      _mm_loadu_si128( (const __m128i*)b + i ) );
+                _mm_storeu_si128( (__m128i*)out + i, bits );
+                fresh = _mm_or_si128( fresh, _mm_andnot_si128( _mm_loadu_si128( (const __m128i*)seen + i ), bits ) );
+        }
+
+        return _mm_movemask_epi8( _mm_cmpeq_epi8( fresh, _mm_setzero_si128() ) ) != 0xFFFF;
+}
+
+// =====================================================================================
+//  VisBitsOr
+//      out |= in
+// =====================================================================================
+inline void     VisBitsOr( byte* const out, const byte* const in )
+{
+        for ( unsigned i = 0; i < g_bitwords; i++ )
+        {
+                __m128i*        dst = (__m128i*)out + i;
+                _mm_storeu_si128( dst, _mm_or_si128( _mm_loadu_si128( dst ), _mm_loadu_si128( (const __m128i*)in + i ) ) );
+        }
+}
+
+// =====================================================================================
+//  VisBitsCount
+// =====================================================================================
+inline unsigned VisBitsCount( const byte* const bits )
+{
+        unsigned        count = 0;
+        uint64_t        word;
+
+        for ( unsigned i = 0; i < g_bitbytes; i += sizeof( word ) )
+        {
+                memcpy( &word, bits + i, sizeof( word ) );
+                count += count_bits_in_word( word );
+        }
+
+        return count;
+}
 
 extern volatile int g_vislocalpercent;
 
@@ -180,12 +262,8 @@ extern void		MaxDistVis( int threadnum );
 //extern void		PostMaxDistVis(int threadnum);
 
 extern void     PortalFlow( portal_t* p );
+extern portal_t* ClaimNextPortal( int owner );
+extern bool     AllPortalsDone();
 extern void     CalcAmbientSounds();
 
-#ifdef ZHLT_NETVIS
-#include "packet.h"
-#include "c2cpp.h"
-#include "NetvisSession.h"
-#endif
-
 #endif //      byte            fullportal[MAX_PORTALS/8];              // bit string  HLVIS_H__
@@ -0,0 +1,210 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file rayTraceRayStream.cxx
+ * @author Brian Lach
+ * @date 2026-10-17
+ */
+
+#include "rayTraceRayStream.h"
+
+#include <algorithm>
+
+/**
+ * Makes room for at least count rays without reallocating.
+ */
+void RayTraceRayStream::
+reserve(int count) {
+  if ((int)_org_x.size() >= count) {
+    return;
+  }
+
+  _org_x.resize(count); _org_y.resize(count); _org_z.resize(count);
+  _dir_x.resize(count); _dir_y.resize(count); _dir_z.resize(count);
+  _tnear.resize(count); _tfar.resize(count); _time.resize(count);
+  _mask.resize(count); _id.resize(count); _flags.resize(count);
+
+  _ng_x.resize(count); _ng_y.resize(count); _ng_z.resize(count);
+  _u.resize(count); _v.resize(count);
+  _prim_id.resize(count); _geom_id.resize(count); _inst_id.resize(count);
+
+  _distance.resize(count);
+}
+
+/**
+ * Adds a ray starting at origin and travelling distance units along the
+ * normalized direction.  Returns the index of the ray.
+ */
+int RayTraceRayStream::
+add_ray(const LPoint3 &origin, const LVector3 &direction, float distance,
+        unsigned int mask) {
+  int n = _num_rays;
+  if (n >= (int)_org_x.size()) {
+    reserve(std::max(n * 2, 64));
+  }
+
+  _org_x[n] = origin[0]; _org_y[n] = origin[1]; _org_z[n] = origin[2];
+  _dir_x[n] = direction[0]; _dir_y[n] = direction[1]; _dir_z[n] = direction[2];
+  _tnear[n] = 0.0f;
+  _tfar[n] = distance;
+  _time[n] = 0.0f;
+  _mask[n] = mask;
+  _id[n] = n;
+  _flags[n] = 0;
+  _distance[n] = distance;
+
+  _num_rays++;
+  return n;
+}
+
+/**
+ * Adds the four lines from start to end.  Returns the index of the first ray;
+ * the other three follow it.
+ */
+int RayTraceRayStream::
+add_four_lines(const FourVectors &start, const FourVectors &end, const u32x4 &mask) {
+  FourVectors direction = end;
+  direction -= start;
+  fltx4 length4 = direction.length();
+  direction.VectorNormalize();
+
+  int first = _num_rays;
+  for (int i = 0; i < 4; i++) {
+    add_ray(start.Vec(i), direction.Vec(i), SubFloat(length4, i),
+            SubInt(mask, i));
+  }
+
+  return first;
+}
+
+/**
+ * Resets the hit fields before the stream is traced.  Embree doesn't touch
+ * the hit of a ray that misses.
+ */
+void RayTraceRayStream::
+prepare_hits() {
+  for (int i = 0; i < _num_rays; i++) {
+    _geom_id[i] = (unsigned int)-1;
+    _prim_id[i] = (unsigned int)-1;
+    _inst_id[i] = (unsigned int)-1;
+    _tfar[i] = _distance[i];
+  }
+}
+
+/**
+ * Puts v[order[i]] in slot i of v.
+ */
+template<class T>
+static void
+gather(pvector<T> &v, const pvector<int> &order, pvector<T> &scratch) {
+  size_t count = order.size();
+  scratch.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    scratch[i] = v[order[i]];
+  }
+  std::copy(scratch.begin(), scratch.end(), v.begin());
+}
+
+/**
+ * Puts v[i] back in slot id[i] of v.
+ */
+template<class T>
+static void
+scatter(pvector<T> &v, const pvector<unsigned int> &id, size_t count, pvector<T> &scratch) {
+  scratch.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    scratch[id[i]] = v[i];
+  }
+  std::copy(scratch.begin(), scratch.end(), v.begin());
+}
+
+/**
+ * Spreads the low 10 bits of x out to every third bit.
+ */
+static uint32_t
+spread_bits(uint32_t x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+/**
+ * Reorders the rays so that rays pointing the same way from nearby origins
+ * are next to each other, which keeps the packets Embree builds from the
+ * stream coherent.  The rays are sorted by direction octant, then by a coarse
+ * direction, then along a Morton curve through the origins.
+ *
+ * Only the rays themselves are moved, so this must be done before
+ * prepare_hits().  The original order is kept in _id.
+ */
+void RayTraceRayStream::
+sort_rays() {
+  LPoint3f mins(_org_x[0], _org_y[0], _org_z[0]);
+  LPoint3f maxs = mins;
+  for (int i = 1; i < _num_rays; i++) {
+    mins.set(std::min(mins[0], _org_x[i]), std::min(mins[1], _org_y[i]), std::min(mins[2], _org_z[i]));
+    maxs.set(std::max(maxs[0], _org_x[i]), std::max(maxs[1], _org_y[i]), std::max(maxs[2], _org_z[i]));
+  }
+  LVector3f scale = maxs - mins;
+  for (int j = 0; j < 3; j++) {
+    scale[j] = scale[j] > 0.0f ? 1023.0f / scale[j] : 0.0f;
+  }
+
+  pvector<std::pair<uint64_t, int> > keys(_num_rays);
+  for (int i = 0; i < _num_rays; i++) {
+    uint64_t octant = (_dir_x[i] < 0.0f) | ((_dir_y[i] < 0.0f) << 1) | ((_dir_z[i] < 0.0f) << 2);
+    uint64_t dir = (uint64_t)((_dir_x[i] + 1.0f) * 15.5f) << 10 |
+                   (uint64_t)((_dir_y[i] + 1.0f) * 15.5f) << 5 |
+                   (uint64_t)((_dir_z[i] + 1.0f) * 15.5f);
+    uint64_t org = spread_bits((uint32_t)((_org_x[i] - mins[0]) * scale[0])) |
+                   spread_bits((uint32_t)((_org_y[i] - mins[1]) * scale[1])) << 1 |
+                   spread_bits((uint32_t)((_org_z[i] - mins[2]) * scale[2])) << 2;
+    keys[i].first = octant << 45 | dir << 30 | org;
+    keys[i].second = i;
+  }
+  std::sort(keys.begin(), keys.end());
+
+  pvector<int> order(_num_rays);
+  for (int i = 0; i < _num_rays; i++) {
+    order[i] = keys[i].second;
+  }
+
+  pvector<float> fscratch;
+  pvector<unsigned int> uscratch;
+  gather(_org_x, order, fscratch); gather(_org_y, order, fscratch); gather(_org_z, order, fscratch);
+  gather(_dir_x, order, fscratch); gather(_dir_y, order, fscratch); gather(_dir_z, order, fscratch);
+  gather(_tnear, order, fscratch); gather(_time, order, fscratch); gather(_distance, order, fscratch);
+  gather(_mask, order, uscratch); gather(_id, order, uscratch); gather(_flags, order, uscratch);
+}
+
+/**
+ * Puts the rays and their hits back in the order they were added in, after a
+ * sorted stream has been traced.
+ */
+void RayTraceRayStream::
+unsort_rays() {
+  pvector<float> fscratch;
+  pvector<unsigned int> uscratch;
+  size_t count = _num_rays;
+  scatter(_org_x, _id, count, fscratch); scatter(_org_y, _id, count, fscratch); scatter(_org_z, _id, count, fscratch);
+  scatter(_dir_x, _id, count, fscratch); scatter(_dir_y, _id, count, fscratch); scatter(_dir_z, _id, count, fscratch);
+  scatter(_tnear, _id, count, fscratch); scatter(_tfar, _id, count, fscratch); scatter(_time, _id, count, fscratch);
+  scatter(_distance, _id, count, fscratch);
+  scatter(_mask, _id, count, uscratch); scatter(_flags, _id, count, uscratch);
+
+  scatter(_ng_x, _id, count, fscratch); scatter(_ng_y, _id, count, fscratch); scatter(_ng_z, _id, count, fscratch);
+  scatter(_u, _id, count, fscratch); scatter(_v, _id, count, fscratch);
+  scatter(_prim_id, _id, count, uscratch); scatter(_geom_id, _id, count, uscratch);
+  scatter(_inst_id, _id, count, uscratch);
+
+  // Last, since the others are put back by it.
+  for (size_t i = 0; i < count; i++) {
+    _id[i] = (unsigned int)i;
+  }
+}
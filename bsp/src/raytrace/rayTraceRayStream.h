@@ -0,0 +1,86 @@
+/**
+ * PANDA3D BSP LIBRARY
+ *
+ * Copyright (c) Brian Lach <brianlach72@gmail.com>
+ * All rights reserved.
+ *
+ * @file rayTraceRayStream.h
+ * @author Brian Lach
+ * @date 2026-10-17
+ */
+
+#ifndef RAYTRACERAYSTREAM_H
+#define RAYTRACERAYSTREAM_H
+
+#include "config_raytrace.h"
+#include "luse.h"
+#include "pvector.h"
+
+#ifndef CPPPARSER
+#include "mathlib/ssemath.h"
+#endif
+
+/**
+ * An arbitrarily long batch of rays stored as structure-of-arrays, traced in
+ * one call with RayTraceScene::trace_stream() or occluded_stream().  Embree
+ * splits the stream into the widest packets the host CPU supports, so this is
+ * much faster than tracing rays one or four at a time when there are many
+ * rays to trace.
+ *
+ * Rays are traced in the order they were added, unless the stream is traced
+ * as incoherent, in which case large streams are sorted by direction and
+ * origin first (see sort_rays()).  Either way, the results are indexed by the
+ * order the rays were added in.
+ */
+class EXPCL_BSP_RAYTRACE RayTraceRayStream {
+PUBLISHED:
+  INLINE RayTraceRayStream();
+
+  INLINE void clear();
+  void reserve(int count);
+  INLINE int get_num_rays() const;
+
+  int add_ray(const LPoint3 &origin, const LVector3 &direction, float distance,
+              unsigned int mask);
+  INLINE int add_line(const LPoint3 &start, const LPoint3 &end, unsigned int mask);
+
+  INLINE bool has_hit(int n) const;
+  INLINE float get_hit_fraction(int n) const;
+  INLINE unsigned int get_geom_id(int n) const;
+  INLINE unsigned int get_prim_id(int n) const;
+  INLINE LVector3 get_hit_normal(int n) const;
+
+public:
+#ifndef CPPPARSER
+  int add_four_lines(const FourVectors &start, const FourVectors &end, const u32x4 &mask);
+  INLINE fltx4 get_four_hit_fractions(int first) const;
+  INLINE u32x4 get_four_geom_ids(int first) const;
+#endif
+
+private:
+  void prepare_hits();
+  void sort_rays();
+  void unsort_rays();
+
+  int _num_rays;
+
+  // RTCRayNp
+  pvector<float> _org_x, _org_y, _org_z;
+  pvector<float> _dir_x, _dir_y, _dir_z;
+  pvector<float> _tnear, _tfar, _time;
+  pvector<unsigned int> _mask, _id, _flags;
+
+  // RTCHitNp
+  pvector<float> _ng_x, _ng_y, _ng_z;
+  pvector<float> _u, _v;
+  pvector<unsigned int> _prim_id, _geom_id, _inst_id;
+
+  // The distance each ray was added with, to turn tfar back into a fraction.
+  pvector<float> _distance;
+
+  friend class RayTraceScene;
+};
+
+#include "rayTraceRayStream.I"
+
+#endif // RAYTRACERAYSTREAM_H
@@ -4,6 +4,10 @@
 #include "embree3/rtcore.h"
 #include "nodePath.h"
 
+// Incoherent streams shorter than this are traced as they are; sorting them
+// costs more than it saves.
+static const int min_sorted_stream_rays = 256;
+
 static const ALIGN_16BYTE int32_t Four_NegativeOnes_NonSIMD[4] = { -1, -1, -1, -1 };
 
 RayTraceScene::RayTraceScene()
@@ -174,3 +178,105 @@ void RayTraceScene::trace_four_rays( const FourVectors &start, const FourVectors
         res->hit_fraction = MulSIMD( LoadAlignedSIMD( rhit4.ray.tfar ), factor );
         //res->hit = CmpLtSIMD( res->hit_fraction, Four_Ones );
 }
+
+/**
+ * Finds the closest hit of every ray in the stream.  Embree splits the stream
+ * into packets as wide as the host CPU allows (8 or 16 lanes with AVX2 and
+ * AVX-512), so this is the fastest way to trace a large batch of rays.
+ *
+ * Pass coherent = true when neighbouring rays in the stream start near each
+ * other and point the same way.  Otherwise, large streams are sorted into a
+ * coherent order before they are traced.
+ */
+void RayTraceScene::trace_stream( RayTraceRayStream &stream, bool coherent )
+{
+        int count = stream.get_num_rays();
+        if ( count == 0 )
+                return;
+
+        bool sort = !coherent && count >= min_sorted_stream_rays;
+        if ( sort )
+        {
+                stream.sort_rays();
+                coherent = true;
+        }
+
+        stream.prepare_hits();
+
+        RTCIntersectContext ctx;
+        rtcInitIntersectContext( &ctx );
+        ctx.flags = coherent ? RTC_INTERSECT_CONTEXT_FLAG_COHERENT : RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+
+        RTCRayHitNp rhit;
+        rhit.ray.org_x = stream._org_x.data();
+        rhit.ray.org_y = stream._org_y.data();
+        rhit.ray.org_z = stream._org_z.data();
+        rhit.ray.tnear = stream._tnear.data();
+        rhit.ray.dir_x = stream._dir_x.data();
+        rhit.ray.dir_y = stream._dir_y.data();
+        rhit.ray.dir_z = stream._dir_z.data();
+        rhit.ray.time = stream._time.data();
+        rhit.ray.tfar = stream._tfar.data();
+        rhit.ray.mask = stream._mask.data();
+        rhit.ray.id = stream._id.data();
+        rhit.ray.flags = stream._flags.data();
+        rhit.hit.Ng_x = stream._ng_x.data();
+        rhit.hit.Ng_y = stream._ng_y.data();
+        rhit.hit.Ng_z = stream._ng_z.data();
+        rhit.hit.u = stream._u.data();
+        rhit.hit.v = stream._v.data();
+        rhit.hit.primID = stream._prim_id.data();
+        rhit.hit.geomID = stream._geom_id.data();
+        for ( int i = 0; i < RTC_MAX_INSTANCE_LEVEL_COUNT; i++ )
+                rhit.hit.instID[i] = stream._inst_id.data();
+
+        rtcIntersectNp( _scene, &ctx, &rhit, count );
+
+        if ( sort )
+                stream.unsort_rays();
+}
+
+/**
+ * Only tests whether each ray in the stream hits anything, which is cheaper
+ * than trace_stream() because Embree can stop at the first hit.  Afterwards,
+ * only RayTraceRayStream::has_hit() is valid.
+ */
+void RayTraceScene::occluded_stream( RayTraceRayStream &stream, bool coherent )
+{
+        int count = stream.get_num_rays();
+        if ( count == 0 )
+                return;
+
+        bool sort = !coherent && count >= min_sorted_stream_rays;
+        if ( sort )
+        {
+                stream.sort_rays();
+                coherent = true;
+        }
+
+        stream.prepare_hits();
+
+        RTCIntersectContext ctx;
+        rtcInitIntersectContext( &ctx );
+        ctx.flags = coherent ? RTC_INTERSECT_CONTEXT_FLAG_COHERENT : RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+
+        RTCRayNp ray;
+        ray.org_x = stream._org_x.data();
+        ray.org_y = stream._org_y.data();
+        ray.org_z = stream._org_z.data();
+        ray.tnear = stream._tnear.data();
+        ray.dir_x = stream._dir_x.data();
+        ray.dir_y = stream._dir_y.data();
+        ray.dir_z = stream._dir_z.data();
+        ray.time = stream._time.data();
+        ray.tfar = stream._tfar.data();
+        ray.mask = stream._mask.data();
+        ray.id = stream._id.data();
+        ray.flags = stream._flags.data();
+
+        // Embree sets tfar to -inf for every ray that hit something.
+        rtcOccludedNp( _scene, &ctx, &ray, count );
+
+        if ( sort )
+                stream.unsort_rays();
+}
@@ -8,6 +8,7 @@
 #include "simpleHashMap.h"
 #include "rayTraceHitResult.h"
 #include "rayTraceHitResult4.h"
+#include "rayTraceRayStream.h"
 
 class RayTraceGeometry;
 
@@ -36,6 +37,9 @@ PUBLISHED:
         RayTraceHitResult trace_ray( const LPoint3 &origin, const LVector3 &direction,
                 float distance, const BitMask32 &mask );
 
+        void trace_stream( RayTraceRayStream &stream, bool coherent = true );
+        void occluded_stream( RayTraceRayStream &stream, bool coherent = true );
+
         void set_build_quality( int quality );
 
         void update();
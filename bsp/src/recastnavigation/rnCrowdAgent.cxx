@@ -13,6 +13,7 @@
 
 #include "rnNavMesh.h"
 #include "throw_event.h"
+#include "look_at.h"
 #ifdef PYTHON_BUILD
 #include <py_panda.h>
 #ifndef CPPPARSER
@@ -104,6 +105,13 @@ LVector3f RNCrowdAgent::get_actual_velocity() const
 	// continue if crowdAgent belongs to a mesh
 	CONTINUE_IF_ELSE_R(mNavMesh, LVector3f::zero())
 
+	// the crowd may be being stepped asynchronously
+	const RNNavMesh::CrowdAgentState* state =
+			mNavMesh->do_get_crowd_agent_state(mAgentIdx);
+	if (state)
+	{
+		return state->mVel;
+	}
 	return rnsup::RecastToLVecBase3f(
 			mNavMesh->get_recast_crowd()->getAgent(mAgentIdx)->vel);
 }
@@ -118,6 +126,13 @@ RNCrowdAgent::RNCrowdAgentState RNCrowdAgent::get_traversing_state() const
 	// continue if crowdAgent belongs to a mesh
 	CONTINUE_IF_ELSE_R(mNavMesh, STATE_INVALID)
 
+	// the crowd may be being stepped asynchronously
+	const RNNavMesh::CrowdAgentState* state =
+			mNavMesh->do_get_crowd_agent_state(mAgentIdx);
+	if (state)
+	{
+		return static_cast<RNCrowdAgentState>(state->mState);
+	}
 	return static_cast<RNCrowdAgentState>(mNavMesh->get_recast_crowd()->getAgent(
 			mAgentIdx)->state);
 }
@@ -362,14 +377,22 @@ void RNCrowdAgent::do_update_pos_dir(float dt, const LPoint3f& pos, const LVecto
 			updatedPos.set_z(gotCollisionZ.get_second());
 		}
 	}
-	mThisNP.set_pos(updatedPos);
-
-	//update node path direction & throw events
+	//update node path position & direction with a single transform change
 	if (velSquared > 0.0)
 	{
-		//update node path direction
-		mThisNP.heads_up(updatedPos - vel);
+		//as heads_up(updatedPos - vel)
+		LQuaternion quat;
+		::heads_up(quat, -vel);
+		mThisNP.set_pos_quat(updatedPos, quat);
+	}
+	else
+	{
+		mThisNP.set_pos(updatedPos);
+	}
 
+	//throw events
+	if (velSquared > 0.0)
+	{
 		//throw Move event (if enabled)
 		if (mMove.mEnable)
 		{
@@ -14,6 +14,10 @@
 #include "rnCrowdAgent.h"
 #include "rnNavMeshManager.h"
 #include "camera.h"
+#include "bamCache.h"
+#include "asyncTaskManager.h"
+#include "configVariableInt.h"
+#include "thread.h"
 
 #ifndef CPPPARSER
 #include "library/DetourCommon.h"
@@ -30,6 +34,11 @@ class Dtool_RNNavMesh;
 #endif
 #endif //PYTHON_BUILD
 
+static ConfigVariableInt recast_crowd_update_threads(
+		"recast-crowd-update-threads", 1,
+		PRC_DESC("Number of threads that step the crowds of the RNNavMeshes "
+				"updated asynchronously (see RNNavMesh::set_async_update())."));
+
 /**
  *
  */
@@ -43,6 +52,8 @@ RNNavMesh::RNNavMesh(const string& name):PandaNode(name)
  */
 RNNavMesh::~RNNavMesh()
 {
+	// The asynchronous crowd update runs on this object.
+	do_wait_crowd_update();
 }
 
 /**
@@ -79,6 +90,8 @@ void RNNavMesh::set_crowd_area_cost(int area, float cost)
 
 	if(mNavMeshType)
 	{
+		//the crowd may be being stepped
+		do_wait_crowd_update();
 		//there is a crowd tool because the recast nav mesh
 		//has been completely setup
 		rnsup::CrowdTool* crowdTool =
@@ -105,6 +118,8 @@ void RNNavMesh::set_crowd_include_flags(int oredFlags)
 
 	if(mNavMeshType)
 	{
+		//the crowd may be being stepped
+		do_wait_crowd_update();
 		//there is a crowd tool because the recast nav mesh
 		//has been completely setup
 		rnsup::CrowdTool* crowdTool =
@@ -125,6 +140,8 @@ void RNNavMesh::set_crowd_exclude_flags(int oredFlags)
 
 	if(mNavMeshType)
 	{
+		//the crowd may be being stepped
+		do_wait_crowd_update();
 		//there is a crowd tool because the recast nav mesh
 		//has been completely setup
 		rnsup::CrowdTool* crowdTool =
@@ -158,6 +175,21 @@ void RNNavMesh::set_nav_mesh_tile_settings(
 	}
 }
 
+/**
+ * Keeps the built tiles (only TILE and OBSTACLE) in the model cache, as
+ * <name>.navtiles, so that the next setup() only has to build the tiles whose
+ * input geometry or settings changed.  map_hash identifies the input the tiles
+ * are built from (for example BSPLevel::get_file_hash()): when it is unchanged
+ * the cached tiles are used without checking their input again.  It may be 0
+ * if there is no such hash.  An empty name disables the cache.
+ * \note Must be called before setup().
+ */
+void RNNavMesh::set_tile_build_cache(const string& name, uint64_t map_hash)
+{
+	mTileBuildCacheName = name;
+	mTileBuildCacheMapHash = map_hash;
+}
+
 /**
  * Initializes the RNNavMesh with starting settings.
  * \note Internal use only.
@@ -280,6 +312,9 @@ void RNNavMesh::do_initialize()
 			mTmpl->get_parameter_value(RNNavMeshManager::NAVMESH,
 					string("tile_size")).c_str(), NULL);
 	mNavMeshTileSettings.set_tileSize(value >= 0.0 ? value : -value);
+	//async update
+	mAsyncUpdate = (mTmpl->get_parameter_value(RNNavMeshManager::NAVMESH,
+			string("async_update")) == string("true") ? true : false);
 	///
 	//0: get navmesh type
 	valueStr = mTmpl->get_parameter_value(RNNavMeshManager::NAVMESH,
@@ -636,6 +671,20 @@ int RNNavMesh::setup()
 	//set recast areas' flags table
 	mNavMeshType->setFlagsAreaTable(mPolyAreaFlags);
 
+	//set the tile build cache
+	if ((mNavMeshTypeEnum == TILE || mNavMeshTypeEnum == OBSTACLE)
+			&& !mTileBuildCacheName.empty())
+	{
+		BamCache* cache = BamCache::get_global_ptr();
+		if (cache->get_active())
+		{
+			Filename path(cache->get_root(),
+					Filename(mTileBuildCacheName + ".navtiles"));
+			mNavMeshType->setTileBuildCache(path.to_os_specific(),
+					mTileBuildCacheMapHash);
+		}
+	}
+
 	{
 		//set recast convex volumes
 		//mConvexVolumes could be modified during iteration so use this pattern:
@@ -1117,6 +1166,9 @@ int RNNavMesh::set_convex_volume_settings(const LPoint3f& insidePoint,
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	int convexVolumeID = do_get_convex_volume_from_point(insidePoint);
 
 	// check if a convex volume was it
@@ -1493,6 +1545,9 @@ int RNNavMesh::set_off_mesh_connection_settings(const LPoint3f& beginOrEndPoint,
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	int offMeshConnectionID = do_get_off_mesh_connection_from_point(
 			beginOrEndPoint);
 
@@ -1690,6 +1745,9 @@ int RNNavMesh::cleanup()
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, result)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	// remove all obstacles from recast
 	if (mNavMeshTypeEnum == OBSTACLE)
 	{
@@ -1791,6 +1849,9 @@ int RNNavMesh::build_tile(const LPoint3f& pos)
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	if (mNavMeshTypeEnum == TILE)
 	{
 		float recastPos[3];
@@ -1819,6 +1880,9 @@ int RNNavMesh::remove_tile(const LPoint3f& pos)
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	if (mNavMeshTypeEnum == TILE)
 	{
 		float recastPos[3];
@@ -1847,6 +1911,9 @@ int RNNavMesh::build_all_tiles()
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	if (mNavMeshTypeEnum == TILE)
 	{
 		static_cast<rnsup::NavMeshType_Tile*>(mNavMeshType)->buildAllTiles();
@@ -1871,6 +1938,9 @@ int RNNavMesh::remove_all_tiles()
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	if (mNavMeshTypeEnum == TILE)
 	{
 		static_cast<rnsup::NavMeshType_Tile*>(mNavMeshType)->removeAllTiles();
@@ -1930,6 +2000,9 @@ int RNNavMesh::add_obstacle(NodePath objectNP)
 int RNNavMesh::do_add_obstacle_to_recast(NodePath& objectNP, int index,
 		bool buildFromBam)
 {
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	//get obstacle dimensions
 	LVecBase3f modelDims;
 	LVector3f modelDeltaCenter;
@@ -2031,6 +2104,9 @@ int RNNavMesh::remove_obstacle(NodePath objectNP)
 int RNNavMesh::do_remove_obstacle_from_recast(NodePath& objectNP,
 		int obstacleRef)
 {
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	//remove recast obstacle
 	dtTileCache* tileCache =
 			static_cast<rnsup::NavMeshType_Obstacle*>(mNavMeshType)->getTileCache();
@@ -2162,6 +2238,9 @@ void RNNavMesh::do_add_crowd_agent_to_update_list(PT(RNCrowdAgent)crowdAgent)
 bool RNNavMesh::do_add_crowd_agent_to_recast_update(PT(RNCrowdAgent)crowdAgent,
 		bool buildFromBam)
 {
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	//there is a crowd tool because the recast nav mesh
 	//has been completely setup
 	//check if crowdAgent has not been already added to recast
@@ -2222,6 +2301,12 @@ bool RNNavMesh::do_add_crowd_agent_to_recast_update(PT(RNCrowdAgent)crowdAgent,
 			return false;
 		}
 		//agent has been added to recast
+		//the agent index may have belonged to an agent removed since the
+		//last asynchronous step
+		if (crowdAgent->mAgentIdx < (int)mCrowdAgentStates[mCrowdAgentStatesFront].size())
+		{
+			mCrowdAgentStates[mCrowdAgentStatesFront][crowdAgent->mAgentIdx].mActive = false;
+		}
 		//update the (possibly) modified params
 		crowdAgent->mAgentParams = ap;
 		//set crowd agent other settings
@@ -2288,6 +2373,9 @@ void RNNavMesh::do_remove_crowd_agent_from_update_list(PT(RNCrowdAgent)crowdAgen
  */
 void RNNavMesh::do_remove_crowd_agent_from_recast_update(PT(RNCrowdAgent)crowdAgent)
 {
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	//there is a crowd tool because the recast nav mesh
 	//has been completely setup
 	//and check if crowdAgent has been already added to recast
@@ -2296,6 +2384,8 @@ void RNNavMesh::do_remove_crowd_agent_from_recast_update(PT(RNCrowdAgent)crowdAg
 	{
 		//remove recast agent
 		crowdTool->getState()->removeAgent(crowdAgent->mAgentIdx);
+		//and its queued move request (if any)
+		mCrowdAgentRequests.erase(crowdAgent->mAgentIdx);
 		//set the index of the crowd agent to -1
 		crowdAgent->mAgentIdx = -1;
 	}
@@ -2313,6 +2403,9 @@ const RNCrowdAgentParams& params)
 	// continue if nav mesh has been already setup
 	CONTINUE_IF_ELSE_R(mNavMeshType, RN_ERROR)
 
+	//the crowd may be being stepped
+	do_wait_crowd_update();
+
 	//there is a crowd tool because the recast nav mesh
 	//has been completely setup
 	//check if crowdAgent has been already added to recast
@@ -2358,10 +2451,20 @@ const LPoint3f& moveTarget)
 	//check if crowdAgent has been already added to recast
 	if (crowdAgent->mAgentIdx != -1)
 	{
-		float p[3];
-		rnsup::LVecBase3fToRecast(moveTarget, p);
-		static_cast<rnsup::CrowdTool*>(mNavMeshType->getTool())->
-		getState()->setMoveTarget(crowdAgent->mAgentIdx, p);
+		if (mAsyncUpdate)
+		{
+			//queue the request until the next update
+			CrowdAgentRequest& request = mCrowdAgentRequests[crowdAgent->mAgentIdx];
+			request.mVelocity = false;
+			request.mValue = moveTarget;
+		}
+		else
+		{
+			float p[3];
+			rnsup::LVecBase3fToRecast(moveTarget, p);
+			static_cast<rnsup::CrowdTool*>(mNavMeshType->getTool())->
+			getState()->setMoveTarget(crowdAgent->mAgentIdx, p);
+		}
 	}
 	crowdAgent->mMoveTarget = moveTarget;
 	//
@@ -2385,10 +2488,20 @@ const LVector3f& moveVelocity)
 	//check if crowdAgent has been already added to recast
 	if (crowdAgent->mAgentIdx != -1)
 	{
-		float v[3];
-		rnsup::LVecBase3fToRecast(moveVelocity, v);
-		static_cast<rnsup::CrowdTool*>(mNavMeshType->getTool())->
-		getState()->setMoveVelocity(crowdAgent->mAgentIdx, v);
+		if (mAsyncUpdate)
+		{
+			//queue the request until the next update
+			CrowdAgentRequest& request = mCrowdAgentRequests[crowdAgent->mAgentIdx];
+			request.mVelocity = true;
+			request.mValue = moveVelocity;
+		}
+		else
+		{
+			float v[3];
+			rnsup::LVecBase3fToRecast(moveVelocity, v);
+			static_cast<rnsup::CrowdTool*>(mNavMeshType->getTool())->
+			getState()->setMoveVelocity(crowdAgent->mAgentIdx, v);
+		}
 	}
 	crowdAgent->mMoveVelocity = moveVelocity;
 	//
@@ -2540,6 +2653,9 @@ void RNNavMesh::do_create_nav_mesh_type(rnsup::NavMeshType* navMeshType)
 /**
  * Updates position/orientation of all added RNCrowdAgents along their
  * navigation paths.
+ * \note With asynchronous update (see set_async_update()) the crowd is stepped
+ * by dt on a thread of its own after this returns, and the positions set here
+ * are those of the step started by the previous update.
  */
 void RNNavMesh::update(float dt)
 {
@@ -2555,20 +2671,54 @@ void RNNavMesh::update(float dt)
 	rnsup::CrowdTool* crowdTool =
 			static_cast<rnsup::CrowdTool*>(mNavMeshType->getTool());
 	dtCrowd* crowd = crowdTool->getState()->getCrowd();
+	bool crowdRunning = crowdTool->getState()->isRunning();
 
-	//update crowd agents' pos/vel
-	mNavMeshType->handleUpdate(dt);
+	if (mAsyncUpdate)
+	{
+		//wait for the previous step: this makes its results the front buffer
+		do_wait_crowd_update();
+		//send the move requests queued meanwhile
+		do_flush_crowd_agent_requests();
+		//update everything but the crowd (ie the OBSTACLE tile cache), which
+		//is stepped below
+		crowdTool->getState()->setRunning(false);
+		mNavMeshType->handleUpdate(dt);
+		crowdTool->getState()->setRunning(crowdRunning);
+	}
+	else
+	{
+		//update crowd agents' pos/vel
+		mNavMeshType->handleUpdate(dt);
+	}
 
 	//post-update all agent positions
+	const pvector<CrowdAgentState>& states =
+			mCrowdAgentStates[mCrowdAgentStatesFront];
 	pvector<PT(RNCrowdAgent)>::iterator iter;
 	for (iter = mCrowdAgents.begin(); iter != mCrowdAgents.end(); ++iter)
 	{
 		int agentIdx = (*iter)->mAgentIdx;
+		LPoint3f agentPos;
+		LVector3f agentDir;
+		if (mAsyncUpdate)
+		{
+			//skip agents added since the last step
+			if ((agentIdx < 0) || (agentIdx >= (int) states.size())
+					|| (!states[agentIdx].mActive))
+			{
+				continue;
+			}
+			agentPos = states[agentIdx].mPos;
+			agentDir = states[agentIdx].mVel;
+		}
+		else
+		{
+			agentPos = rnsup::RecastToLVecBase3f(
+					crowd->getAgent(agentIdx)->npos);
+			agentDir = rnsup::RecastToLVecBase3f(
+					crowd->getAgent(agentIdx)->vel);
+		}
 		//give RNCrowdAgent a chance to update its pos/vel
-		LPoint3f agentPos = rnsup::RecastToLVecBase3f(
-				crowd->getAgent(agentIdx)->npos);
-		LVector3f agentDir = rnsup::RecastToLVecBase3f(
-				crowd->getAgent(agentIdx)->vel);
 		(*iter)->do_update_pos_dir(dt, agentPos, agentDir);
 	}
 	//
@@ -2583,6 +2733,32 @@ void RNNavMesh::update(float dt)
 		}
 	}
 #endif //RN_DEBUG
+	//start the next asynchronous step, which runs until the next update (or
+	//until something else needs the crowd)
+	if (mAsyncUpdate && crowdRunning)
+	{
+		AsyncTaskManager* taskMgr = AsyncTaskManager::get_global_ptr();
+		AsyncTaskChain* chain = taskMgr->find_task_chain("recast_crowd_update");
+		if (!chain)
+		{
+			chain = taskMgr->make_task_chain("recast_crowd_update");
+			chain->set_num_threads(max(recast_crowd_update_threads.get_value(), 1));
+		}
+		mCrowdUpdateDt = dt;
+		if (Thread::is_threading_supported())
+		{
+			mCrowdUpdateTask = new GenericAsyncTask("recast-crowd-update",
+					&do_crowd_update_task, this);
+			mCrowdUpdateTask->set_task_chain("recast_crowd_update");
+			taskMgr->add(mCrowdUpdateTask);
+		}
+		else
+		{
+			//no threads: step right away
+			do_crowd_update_task(NULL, this);
+			mCrowdAgentStatesFront = 1 - mCrowdAgentStatesFront;
+		}
+	}
 #ifdef PYTHON_BUILD
 	// execute python callback (if any)
 	if (mUpdateCallback && (mUpdateCallback != Py_None))
@@ -2607,6 +2783,147 @@ void RNNavMesh::update(float dt)
 #endif //PYTHON_BUILD
 }
 
+/**
+ * Enables/disables asynchronous update.  With asynchronous update, update()
+ * steps the crowd on the "recast_crowd_update" task chain (see the
+ * recast-crowd-update-threads config variable) rather than right away, so the
+ * step runs alongside whatever the application does until the next update(),
+ * which waits for it and moves the RNCrowdAgents to the positions it computed.
+ * The move targets and velocities set on the RNCrowdAgents in the meantime are
+ * queued and sent to the crowd together at the next update(), the targets
+ * shared by several agents being looked up only once.
+ * Anything else that changes the crowd or the navigation mesh (adding and
+ * removing crowd agents or obstacles, building tiles, ...) waits for the step
+ * to finish first.
+ */
+void RNNavMesh::set_async_update(bool enable)
+{
+	do_wait_crowd_update();
+	mAsyncUpdate = enable;
+	if (!mAsyncUpdate)
+	{
+		do_flush_crowd_agent_requests();
+		mCrowdAgentStates[0].clear();
+		mCrowdAgentStates[1].clear();
+	}
+}
+
+/**
+ * Waits for the crowd step started by the last update() to finish, if the
+ * update is asynchronous.  The crowd can then be accessed directly (see
+ * get_recast_crowd()) until the next update().
+ */
+void RNNavMesh::wait_update()
+{
+	do_wait_crowd_update();
+}
+
+/**
+ * Waits for the asynchronous crowd step (if any) and swaps the agent state
+ * buffers.
+ * \note Internal use only.
+ */
+void RNNavMesh::do_wait_crowd_update()
+{
+	if (mCrowdUpdateTask != NULL)
+	{
+		mCrowdUpdateTask->wait();
+		mCrowdUpdateTask.clear();
+		//the step wrote the back buffer
+		mCrowdAgentStatesFront = 1 - mCrowdAgentStatesFront;
+	}
+}
+
+/**
+ * Sends the queued move requests to the crowd.  The targets are sorted, so
+ * that agents heading to the same target share the nearest poly query.
+ * \note Internal use only.
+ */
+void RNNavMesh::do_flush_crowd_agent_requests()
+{
+	CONTINUE_IF_ELSE_V(mNavMeshType && (!mCrowdAgentRequests.empty()))
+
+	rnsup::CrowdToolState* crowdState =
+			static_cast<rnsup::CrowdTool*>(mNavMeshType->getTool())->getState();
+	pvector<pair<LVecBase3f, int> > targets;
+	pmap<int, CrowdAgentRequest>::const_iterator iter;
+	for (iter = mCrowdAgentRequests.begin(); iter != mCrowdAgentRequests.end();
+			++iter)
+	{
+		if (iter->second.mVelocity)
+		{
+			float v[3];
+			rnsup::LVecBase3fToRecast(iter->second.mValue, v);
+			crowdState->setMoveVelocity(iter->first, v);
+		}
+		else
+		{
+			targets.push_back(pair<LVecBase3f, int>(iter->second.mValue,
+					iter->first));
+		}
+	}
+	mCrowdAgentRequests.clear();
+
+	sort(targets.begin(), targets.end());
+	pvector<int> idxs(targets.size());
+	pvector<float> ps(targets.size() * 3);
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		idxs[i] = targets[i].second;
+		rnsup::LVecBase3fToRecast(targets[i].first, &ps[i * 3]);
+	}
+	if (!targets.empty())
+	{
+		crowdState->setMoveTargets(&idxs[0], &ps[0], (int) targets.size());
+	}
+}
+
+/**
+ * Returns the state of the agent as of the last asynchronous crowd step, or
+ * NULL if the update is not asynchronous, or there is none.
+ * \note Internal use only.
+ */
+const RNNavMesh::CrowdAgentState* RNNavMesh::do_get_crowd_agent_state(
+		int agentIdx) const
+{
+	const pvector<CrowdAgentState>& states =
+			mCrowdAgentStates[mCrowdAgentStatesFront];
+	if ((!mAsyncUpdate) || (agentIdx < 0) || (agentIdx >= (int) states.size()))
+	{
+		return NULL;
+	}
+	return &states[agentIdx];
+}
+
+/**
+ * Steps the crowd, then copies the agents' state into the back buffer.
+ * This runs on the crowd update task chain, while the main thread only reads
+ * the front buffer.
+ * \note Internal use only.
+ */
+AsyncTask::DoneStatus RNNavMesh::do_crowd_update_task(GenericAsyncTask* task,
+		void* data)
+{
+	RNNavMesh* navMesh = (RNNavMesh*) data;
+	rnsup::CrowdToolState* crowdState =
+			static_cast<rnsup::CrowdTool*>(navMesh->mNavMeshType->getTool())->getState();
+	crowdState->updateTick(navMesh->mCrowdUpdateDt);
+
+	dtCrowd* crowd = crowdState->getCrowd();
+	pvector<CrowdAgentState>& states =
+			navMesh->mCrowdAgentStates[1 - navMesh->mCrowdAgentStatesFront];
+	states.resize(crowd->getAgentCount());
+	for (int i = 0; i < crowd->getAgentCount(); ++i)
+	{
+		const dtCrowdAgent* ag = crowd->getAgent(i);
+		states[i].mPos = rnsup::RecastToLVecBase3f(ag->npos);
+		states[i].mVel = rnsup::RecastToLVecBase3f(ag->vel);
+		states[i].mState = ag->state;
+		states[i].mActive = ag->active;
+	}
+	return AsyncTask::DS_done;
+}
+
 /**
  * Finds a path from the start point to the end point.
  * Should be called after RNNavMesh setup.
@@ -63,6 +63,7 @@ class RNCrowdAgent;
  * | *max_tiles*					|single| 128 | -
  * | *max_polys_per_tile*			|single| 32768 | -
  * | *tile_size*					|single| 32 | -
+ * | *async_update*				|single| *false* | see set_async_update()
  * | *area_flags_cost*				|multiple| - | each one specified as "area_type@flag1[:flag2...:flagN]@cost" note: flags are or-ed
  * | *crowd_include_flags*			|single| - | specified as "flag1[:flag2...:flagN]" note: flags are or-ed
  * | *crowd_exclude_flags*			|single| - | specified as "flag1[:flag2...:flagN]" note: flags are or-ed
@@ -165,6 +166,9 @@ PUBLISHED:
 	int cleanup();
 	INLINE bool is_setup();
 	void update(float dt);
+	void set_async_update(bool enable);
+	INLINE bool get_async_update() const;
+	void wait_update();
 	///@}
 
 	/**
@@ -261,6 +265,7 @@ PUBLISHED:
 	void set_nav_mesh_tile_settings(const RNNavMeshTileSettings& settings);
 	INLINE RNNavMeshTileSettings get_nav_mesh_tile_settings() const;
 	LVecBase2i get_tile_indexes(const LPoint3f& pos);
+	void set_tile_build_cache(const string& name, uint64_t map_hash = 0);
 	///@}
 
 	/**
@@ -421,6 +426,9 @@ private:
 	RNNavMeshSettings mNavMeshSettings;
 	///RNNavMesh's NavMeshTileSettings equivalent.
 	RNNavMeshTileSettings mNavMeshTileSettings;
+	///Tile build cache name and the hash of the map it is built from.
+	string mTileBuildCacheName;
+	uint64_t mTileBuildCacheMapHash;
 	///Area types with ability flags settings (see support/NavMeshType.h).
 	rnsup::NavMeshPolyAreaFlags mPolyAreaFlags;
 	///Area types with cost settings (see support/NavMeshType.h).
@@ -436,6 +444,35 @@ private:
 	///Crowd related data.
 	//The RNCrowdAgents added to and handled by this RNNavMesh.
 	pvector<PT(RNCrowdAgent)> mCrowdAgents;
+	///Asynchronous crowd update (see set_async_update()).
+	bool mAsyncUpdate;
+	PT(AsyncTask) mCrowdUpdateTask;
+	float mCrowdUpdateDt;
+	///Agent state copied out of the crowd at the end of each asynchronous
+	///step, indexed by agent index: the step writes the back buffer while the
+	///front one is read.
+	struct CrowdAgentState
+	{
+		LPoint3f mPos;
+		LVector3f mVel;
+		int mState;
+		bool mActive;
+	};
+	pvector<CrowdAgentState> mCrowdAgentStates[2];
+	int mCrowdAgentStatesFront;
+	///Last move request of each agent, queued until the next update
+	///(asynchronous update only).
+	struct CrowdAgentRequest
+	{
+		bool mVelocity;
+		LVecBase3f mValue;
+	};
+	pmap<int, CrowdAgentRequest> mCrowdAgentRequests;
+	void do_wait_crowd_update();
+	void do_flush_crowd_agent_requests();
+	const CrowdAgentState* do_get_crowd_agent_state(int agentIdx) const;
+	static AsyncTask::DoneStatus do_crowd_update_task(GenericAsyncTask* task,
+			void* data);
 	int do_set_crowd_agent_params(PT(RNCrowdAgent)crowdAgent,
 			const RNCrowdAgentParams& params);
 	int do_set_crowd_agent_target(PT(RNCrowdAgent)crowdAgent,
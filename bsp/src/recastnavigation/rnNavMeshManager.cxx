@@ -393,6 +393,9 @@ void RNNavMeshManager::set_parameters_defaults(RNType type)
 		mNavMeshesParameterTable.insert(
 				ParameterNameValue("max_polys_per_tile", "32768"));
 		mNavMeshesParameterTable.insert(ParameterNameValue("tile_size", "32"));
+		//crowd update
+		mNavMeshesParameterTable.insert(
+				ParameterNameValue("async_update", "false"));
 		//area flags cost
 		//NAVMESH_POLYAREA_GROUND@NAVMESH_POLYFLAGS_WALK@1.0
 		mNavMeshesParameterTable.insert(ParameterNameValue("area_flags_cost", "0@0x01@1.0"));
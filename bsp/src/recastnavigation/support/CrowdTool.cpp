@@ -809,6 +809,33 @@ void CrowdToolState::setMoveTarget(int idx, const float* p)
 		crowd->requestMoveTarget(idx, m_targetRef, m_targetPos);
 }
 
+/// Sets the move targets of n agents at once.  Consecutive agents with the
+/// same target share the nearest poly query, so sort the requests by target.
+void CrowdToolState::setMoveTargets(const int* idxs, const float* ps, const int n)
+{
+	if (!m_sample) return;
+	
+	dtNavMeshQuery* navquery = m_sample->getNavMeshQuery();
+	dtCrowd* crowd = m_sample->getCrowd();
+	const dtQueryFilter* filter = crowd->getFilter(0);
+	const float* ext = crowd->getQueryExtents();
+
+	const float* last = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		const float* p = &ps[i*3];
+		if (!last || p[0] != last[0] || p[1] != last[1] || p[2] != last[2])
+		{
+			navquery->findNearestPoly(p, ext, filter, &m_targetRef, m_targetPos);
+			last = p;
+		}
+
+		const dtCrowdAgent* ag = crowd->getAgent(idxs[i]);
+		if (ag && ag->active)
+			crowd->requestMoveTarget(idxs[i], m_targetRef, m_targetPos);
+	}
+}
+
 void CrowdToolState::setMoveVelocity(int idx, const float* v)
 {
 	if (!m_sample)
@@ -110,6 +110,7 @@ public:
 	int hitTestAgents(const float* s, const float* p);
 	void setMoveTarget(const float* p, bool adjust);
 	void setMoveTarget(int idx, const float* p);
+	void setMoveTargets(const int* idxs, const float* ps, const int n);
 	void setMoveVelocity(int idx, const float* v);
 	void updateTick(const float dt);
 
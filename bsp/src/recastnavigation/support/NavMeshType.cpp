@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include "NavMeshType.h"
 #include "InputGeom.h"
+#include "TileBuildCache.h"
 #include <DetourDebugDraw.h>
 #include <RecastDebugDraw.h>
 
@@ -68,7 +69,8 @@ NavMeshType::NavMeshType() :
 	m_filterLedgeSpans(true),
 	m_filterWalkableLowHeightSpans(true),
 	m_tool(0),
-	m_ctx(0)
+	m_ctx(0),
+	m_tileBuildCacheMapHash(0)
 {
 	resetNavMeshSettings();
 	m_navQuery = dtAllocNavMeshQuery();
@@ -378,4 +380,60 @@ const float* NavMeshType::getBoundsMax()
 	return m_geom->getMeshBoundsMax();
 }
 
+/// Hashes everything besides the input geometry that goes into building the
+/// tiles: the settings, the area flags, the convex volumes and the off-mesh
+/// connections.  The tile size is hashed by the per tile build configuration.
+uint64_t NavMeshType::hashBuildSettings() const
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	const float settings[] = {
+		m_cellSize, m_cellHeight, m_agentHeight, m_agentRadius, m_agentMaxClimb,
+		m_agentMaxSlope, m_regionMinSize, m_regionMergeSize, m_edgeMaxLen,
+		m_edgeMaxError, m_vertsPerPoly, m_detailSampleDist, m_detailSampleMaxError
+	};
+	hash = hashTileBytes(settings, sizeof(settings), hash);
+	const int flags[] = {
+		m_partitionType, m_filterLowHangingObstacles, m_filterLedgeSpans,
+		m_filterWalkableLowHeightSpans
+	};
+	hash = hashTileBytes(flags, sizeof(flags), hash);
+
+	for (NavMeshPolyAreaFlags::const_iterator it = m_flagsAreaTable.begin();
+			it != m_flagsAreaTable.end(); ++it)
+	{
+		const int areaFlags[] = { it->first, it->second };
+		hash = hashTileBytes(areaFlags, sizeof(areaFlags), hash);
+	}
+
+	if (m_geom)
+	{
+		hash = hashTileBytes(m_geom->getNavMeshBoundsMin(), sizeof(float)*3, hash);
+		hash = hashTileBytes(m_geom->getNavMeshBoundsMax(), sizeof(float)*3, hash);
+
+		const ConvexVolume* vols = m_geom->getConvexVolumes();
+		for (int i = 0; i < m_geom->getConvexVolumeCount(); ++i)
+		{
+			hash = hashTileBytes(vols[i].verts, sizeof(float)*3*vols[i].nverts, hash);
+			hash = hashTileBytes(&vols[i].hmin, sizeof(float), hash);
+			hash = hashTileBytes(&vols[i].hmax, sizeof(float), hash);
+			hash = hashTileBytes(&vols[i].area, sizeof(int), hash);
+		}
+
+		const int ncons = m_geom->getOffMeshConnectionCount();
+		hash = hashTileBytes(&ncons, sizeof(ncons), hash);
+		if (ncons > 0)
+		{
+			hash = hashTileBytes(m_geom->getOffMeshConnectionVerts(), sizeof(float)*6*ncons, hash);
+			hash = hashTileBytes(m_geom->getOffMeshConnectionRads(), sizeof(float)*ncons, hash);
+			hash = hashTileBytes(m_geom->getOffMeshConnectionDirs(), ncons, hash);
+			hash = hashTileBytes(m_geom->getOffMeshConnectionAreas(), ncons, hash);
+			hash = hashTileBytes(m_geom->getOffMeshConnectionFlags(), sizeof(unsigned short)*ncons, hash);
+			hash = hashTileBytes(m_geom->getOffMeshConnectionId(), sizeof(unsigned int)*ncons, hash);
+		}
+	}
+
+	return hash;
+}
+
 } // namespace rnsup
@@ -30,6 +30,7 @@
 #include "DebugInterfaces.h"
 #include <DetourNavMeshQuery.h>
 #include <DetourCrowd.h>
+#include <string>
 
 namespace rnsup
 {
@@ -180,6 +181,12 @@ protected:
 	
 	BuildContext* m_ctx;
 
+	///Tile build cache file (see TileBuildCache), empty if none.
+	std::string m_tileBuildCachePath;
+	uint64_t m_tileBuildCacheMapHash;
+
+	uint64_t hashBuildSettings() const;
+
 //	SampleDebugDraw m_dd;
 	
 public:
@@ -235,6 +242,11 @@ public:
 //	void handleCommonSettings();
 
 	void setFlagsAreaTable(const NavMeshPolyAreaFlags& flagsAreaTable) { m_flagsAreaTable = flagsAreaTable; }
+	void setTileBuildCache(const std::string& path, uint64_t mapHash)
+	{
+		m_tileBuildCachePath = path;
+		m_tileBuildCacheMapHash = mapHash;
+	}
 private:
 	// Explicitly disabled copy constructor and copy assignment operator.
 	NavMeshType(const NavMeshType&);
@@ -34,6 +34,7 @@
 #include "ChunkyTriMesh.h"
 #include "ConvexVolumeTool.h"
 #include "fastlz.h"
+#include "TileBuildCache.h"
 #include <Recast.h>
 #include <DetourNavMeshBuilder.h>
 #include <DetourDebugDraw.h>
@@ -279,15 +280,40 @@ struct RasterizationContext
 	int ntiles;
 };
 
+/// Returns the build configuration of the tile at (tx, ty), with the bounds
+/// expanded by the border.
+static void calcTileConfig(const rcConfig& cfg, const int tx, const int ty, rcConfig& tcfg)
+{
+	// Tile bounds.
+	const float tcs = cfg.tileSize * cfg.cs;
+	
+	memcpy(&tcfg, &cfg, sizeof(tcfg));
+
+	tcfg.bmin[0] = cfg.bmin[0] + tx*tcs;
+	tcfg.bmin[1] = cfg.bmin[1];
+	tcfg.bmin[2] = cfg.bmin[2] + ty*tcs;
+	tcfg.bmax[0] = cfg.bmin[0] + (tx+1)*tcs;
+	tcfg.bmax[1] = cfg.bmax[1];
+	tcfg.bmax[2] = cfg.bmin[2] + (ty+1)*tcs;
+	tcfg.bmin[0] -= tcfg.borderSize*tcfg.cs;
+	tcfg.bmin[2] -= tcfg.borderSize*tcfg.cs;
+	tcfg.bmax[0] += tcfg.borderSize*tcfg.cs;
+	tcfg.bmax[2] += tcfg.borderSize*tcfg.cs;
+}
+
+/// Rasterizes the tile at (tx, ty) into compressed tile cache layers.  This
+/// only reads the type and its input geometry, so several tiles can be
+/// rasterized at once from different threads, each with their own context.
 int NavMeshType_Obstacle::rasterizeTileLayers(
+							   rcContext* ctx,
 							   const int tx, const int ty,
 							   const rcConfig& cfg,
 							   rnsup::TileCacheData* tiles,
-							   const int maxTiles)
+							   const int maxTiles) const
 {
 	if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildTile: Input mesh is not specified.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildTile: Input mesh is not specified.");
 		return 0;
 	}
 	
@@ -298,33 +324,19 @@ int NavMeshType_Obstacle::rasterizeTileLayers(
 	const int nverts = m_geom->getMesh()->getVertCount();
 	const rnsup::rcChunkyTriMesh* chunkyMesh = m_geom->getChunkyMesh();
 	
-	// Tile bounds.
-	const float tcs = cfg.tileSize * cfg.cs;
-	
 	rcConfig tcfg;
-	memcpy(&tcfg, &cfg, sizeof(tcfg));
-
-	tcfg.bmin[0] = cfg.bmin[0] + tx*tcs;
-	tcfg.bmin[1] = cfg.bmin[1];
-	tcfg.bmin[2] = cfg.bmin[2] + ty*tcs;
-	tcfg.bmax[0] = cfg.bmin[0] + (tx+1)*tcs;
-	tcfg.bmax[1] = cfg.bmax[1];
-	tcfg.bmax[2] = cfg.bmin[2] + (ty+1)*tcs;
-	tcfg.bmin[0] -= tcfg.borderSize*tcfg.cs;
-	tcfg.bmin[2] -= tcfg.borderSize*tcfg.cs;
-	tcfg.bmax[0] += tcfg.borderSize*tcfg.cs;
-	tcfg.bmax[2] += tcfg.borderSize*tcfg.cs;
+	calcTileConfig(cfg, tx, ty, tcfg);
 	
 	// Allocate voxel heightfield where we rasterize our input data to.
 	rc.solid = rcAllocHeightfield();
 	if (!rc.solid)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
 		return 0;
 	}
-	if (!rcCreateHeightfield(m_ctx, *rc.solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
+	if (!rcCreateHeightfield(ctx, *rc.solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
 		return 0;
 	}
 	
@@ -334,7 +346,7 @@ int NavMeshType_Obstacle::rasterizeTileLayers(
 	rc.triareas = new unsigned char[chunkyMesh->maxTrisPerChunk];
 	if (!rc.triareas)
 	{
-		CTXLOG1(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'm_triareas' (%d).", chunkyMesh->maxTrisPerChunk);
+		CTXLOG1(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'm_triareas' (%d).", chunkyMesh->maxTrisPerChunk);
 		return 0;
 	}
 	
@@ -357,10 +369,10 @@ int NavMeshType_Obstacle::rasterizeTileLayers(
 		const int ntris = node.n;
 		
 		memset(rc.triareas, 0, ntris*sizeof(unsigned char));
-		rcMarkWalkableTriangles(m_ctx, tcfg.walkableSlopeAngle,
+		rcMarkWalkableTriangles(ctx, tcfg.walkableSlopeAngle,
 								verts, nverts, tris, ntris, rc.triareas);
 		
-		if (!rcRasterizeTriangles(m_ctx, verts, nverts, tris, rc.triareas, ntris, *rc.solid, tcfg.walkableClimb))
+		if (!rcRasterizeTriangles(ctx, verts, nverts, tris, rc.triareas, ntris, *rc.solid, tcfg.walkableClimb))
 			return 0;
 	}
 	
@@ -368,29 +380,29 @@ int NavMeshType_Obstacle::rasterizeTileLayers(
 	// remove unwanted overhangs caused by the conservative rasterization
 	// as well as filter spans where the character cannot possibly stand.
 	if (m_filterLowHangingObstacles)
-		rcFilterLowHangingWalkableObstacles(m_ctx, tcfg.walkableClimb, *rc.solid);
+		rcFilterLowHangingWalkableObstacles(ctx, tcfg.walkableClimb, *rc.solid);
 	if (m_filterLedgeSpans)
-		rcFilterLedgeSpans(m_ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid);
+		rcFilterLedgeSpans(ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid);
 	if (m_filterWalkableLowHeightSpans)
-		rcFilterWalkableLowHeightSpans(m_ctx, tcfg.walkableHeight, *rc.solid);
+		rcFilterWalkableLowHeightSpans(ctx, tcfg.walkableHeight, *rc.solid);
 	
 	
 	rc.chf = rcAllocCompactHeightfield();
 	if (!rc.chf)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
 		return 0;
 	}
-	if (!rcBuildCompactHeightfield(m_ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid, *rc.chf))
+	if (!rcBuildCompactHeightfield(ctx, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid, *rc.chf))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
 		return 0;
 	}
 	
 	// Erode the walkable area by agent radius.
-	if (!rcErodeWalkableArea(m_ctx, tcfg.walkableRadius, *rc.chf))
+	if (!rcErodeWalkableArea(ctx, tcfg.walkableRadius, *rc.chf))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not erode.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not erode.");
 		return 0;
 	}
 	
@@ -398,7 +410,7 @@ int NavMeshType_Obstacle::rasterizeTileLayers(
 	const rnsup::ConvexVolume* vols = m_geom->getConvexVolumes();
 	for (int i  = 0; i < m_geom->getConvexVolumeCount(); ++i)
 	{
-		rcMarkConvexPolyArea(m_ctx, vols[i].verts, vols[i].nverts,
+		rcMarkConvexPolyArea(ctx, vols[i].verts, vols[i].nverts,
 							 vols[i].hmin, vols[i].hmax,
 							 (unsigned char)vols[i].area, *rc.chf);
 	}
@@ -406,12 +418,12 @@ int NavMeshType_Obstacle::rasterizeTileLayers(
 	rc.lset = rcAllocHeightfieldLayerSet();
 	if (!rc.lset)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'lset'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'lset'.");
 		return 0;
 	}
-	if (!rcBuildHeightfieldLayers(m_ctx, *rc.chf, tcfg.borderSize, tcfg.walkableHeight, *rc.lset))
+	if (!rcBuildHeightfieldLayers(ctx, *rc.chf, tcfg.borderSize, tcfg.walkableHeight, *rc.lset))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build heighfield layers.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build heighfield layers.");
 		return 0;
 	}
 	
@@ -1203,6 +1215,47 @@ void NavMeshType_Obstacle::clearAllTempObstacles()
 	}
 }
 
+namespace
+{
+struct TileRasterizeJob
+{
+	int tx, ty;
+	uint64_t inputHash;
+	const TileBuildCache::Tile* cached;
+	TileCacheData tiles[MAX_LAYERS];
+	int ntiles;
+};
+
+struct TileRasterizeJobs
+{
+	const NavMeshType_Obstacle* type;
+	const TileBuildCache* cache;
+	const rcConfig* cfg;
+	std::vector<TileRasterizeJob>* jobs;
+};
+}
+
+void NavMeshType_Obstacle::rasterizeTileJob(int i, void* data)
+{
+	TileRasterizeJobs* jobs = (TileRasterizeJobs*)data;
+	TileRasterizeJob& job = (*jobs->jobs)[i];
+	const NavMeshType_Obstacle* type = jobs->type;
+
+	if (jobs->cache)
+	{
+		rcConfig tcfg;
+		calcTileConfig(*jobs->cfg, job.tx, job.ty, tcfg);
+		job.cached = jobs->cache->lookup(job.tx, job.ty, type->m_geom, tcfg, job.inputHash);
+		if (job.cached)
+			return;
+	}
+
+	// The build context of the type is not thread safe, so each job gets its
+	// own, which doesn't log.
+	rcContext ctx(false);
+	job.ntiles = type->rasterizeTileLayers(&ctx, job.tx, job.ty, *jobs->cfg, job.tiles, MAX_LAYERS);
+}
+
 bool NavMeshType_Obstacle::handleBuild()
 {
 	dtStatus status;
@@ -1318,34 +1371,78 @@ bool NavMeshType_Obstacle::handleBuild()
 	m_cacheRawSize = 0;
 #endif
 	
+	// Tiles whose input didn't change since the last build are taken from the
+	// tile build cache, the rest are rasterized in parallel.
+	TileBuildCache cache;
+	const bool useCache = !m_tileBuildCachePath.empty();
+	if (useCache)
+		cache.load(m_tileBuildCachePath, m_tileBuildCacheMapHash, hashBuildSettings());
+
+	std::vector<TileRasterizeJob> jobs(tw*th);
 	for (int y = 0; y < th; ++y)
 	{
 		for (int x = 0; x < tw; ++x)
 		{
-			TileCacheData tiles[MAX_LAYERS];
-			memset(tiles, 0, sizeof(tiles));
-			int ntiles = rasterizeTileLayers(x, y, cfg, tiles, MAX_LAYERS);
+			TileRasterizeJob& job = jobs[y*tw + x];
+			memset(&job, 0, sizeof(job));
+			job.tx = x;
+			job.ty = y;
+		}
+	}
 
-			for (int i = 0; i < ntiles; ++i)
+	TileRasterizeJobs jobData;
+	jobData.type = this;
+	jobData.cache = useCache ? &cache : 0;
+	jobData.cfg = &cfg;
+	jobData.jobs = &jobs;
+	runTileBuildJobs((int)jobs.size(), &rasterizeTileJob, &jobData);
+
+	for (size_t j = 0; j < jobs.size(); ++j)
+	{
+		TileRasterizeJob& job = jobs[j];
+		if (job.cached)
+		{
+			job.ntiles = rcMin((int)job.cached->layers.size(), MAX_LAYERS);
+			for (int i = 0; i < job.ntiles; ++i)
 			{
-				TileCacheData* tile = &tiles[i];
-				status = m_tileCache->addTile(tile->data, tile->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
-				if (dtStatusFailed(status))
-				{
-					dtFree(tile->data);
-					tile->data = 0;
-					continue;
-				}
-				
+				job.tiles[i].data = TileBuildCache::copyLayer(job.cached->layers[i]);
+				job.tiles[i].dataSize = (int)job.cached->layers[i].size();
+			}
+		}
+		else if (useCache)
+		{
+			unsigned char* layers[MAX_LAYERS];
+			int layerSizes[MAX_LAYERS];
+			for (int i = 0; i < job.ntiles; ++i)
+			{
+				layers[i] = job.tiles[i].data;
+				layerSizes[i] = job.tiles[i].dataSize;
+			}
+			cache.addTile(job.tx, job.ty, job.inputHash, layers, layerSizes, job.ntiles);
+		}
+
+		for (int i = 0; i < job.ntiles; ++i)
+		{
+			TileCacheData* tile = &job.tiles[i];
+			status = m_tileCache->addTile(tile->data, tile->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+			if (dtStatusFailed(status))
+			{
+				dtFree(tile->data);
+				tile->data = 0;
+				continue;
+			}
+			
 #ifdef RN_DEBUG
-				m_cacheLayerCount++;
-				m_cacheCompressedSize += tile->dataSize;
-				m_cacheRawSize += calcLayerBufferSize(tcparams.width, tcparams.height);
+			m_cacheLayerCount++;
+			m_cacheCompressedSize += tile->dataSize;
+			m_cacheRawSize += calcLayerBufferSize(tcparams.width, tcparams.height);
 #endif
-			}
 		}
 	}
 
+	if (useCache && cache.isDirty())
+		cache.save(m_tileBuildCachePath);
+
 	// Build initial meshes
 #ifdef RN_DEBUG
 	m_ctx->startTimer(RC_TIMER_TOTAL);
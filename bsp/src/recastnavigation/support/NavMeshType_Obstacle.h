@@ -104,7 +104,8 @@ private:
 	NavMeshType_Obstacle(const NavMeshType_Obstacle&);
 	NavMeshType_Obstacle& operator=(const NavMeshType_Obstacle&);
 
-	int rasterizeTileLayers(const int tx, const int ty, const rcConfig& cfg, struct TileCacheData* tiles, const int maxTiles);
+	int rasterizeTileLayers(rcContext* ctx, const int tx, const int ty, const rcConfig& cfg, struct TileCacheData* tiles, const int maxTiles) const;
+	static void rasterizeTileJob(int i, void* data);
 };
 
 } // namespace rnsup
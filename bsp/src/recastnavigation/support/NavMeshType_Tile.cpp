@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "NavMeshType_Tile.h"
+#include "TileBuildCache.h"
 #include <RecastDump.h>
 #include <DetourNavMeshBuilder.h>
 #include <DetourDebugDraw.h>
@@ -216,6 +217,30 @@ void NavMeshType_Tile::cleanup()
 	m_dmesh = 0;
 }
 
+NavMeshType_Tile::TileBuildState::TileBuildState() :
+	triareas(0),
+	solid(0),
+	chf(0),
+	cset(0),
+	pmesh(0),
+	dmesh(0),
+	tileTriCount(0),
+	tileMemUsage(0),
+	tileBuildTime(0)
+{
+	memset(&cfg, 0, sizeof(cfg));
+}
+
+NavMeshType_Tile::TileBuildState::~TileBuildState()
+{
+	delete [] triareas;
+	rcFreeHeightField(solid);
+	rcFreeCompactHeightfield(chf);
+	rcFreeContourSet(cset);
+	rcFreePolyMesh(pmesh);
+	rcFreePolyMeshDetail(dmesh);
+}
+
 } // rnsup
 
 static const int NAVMESHSET_MAGIC = 'M'<<24 | 'S'<<16 | 'E'<<8 | 'T'; //'MSET';
@@ -849,6 +874,48 @@ void NavMeshType_Tile::removeTile(const float* pos)
 	m_navMesh->removeTile(m_navMesh->getTileRefAt(tx,ty,0),0,0);
 }
 
+namespace
+{
+struct TileBuildJob
+{
+	int tx, ty;
+	float bmin[3], bmax[3];
+	uint64_t inputHash;
+	const TileBuildCache::Tile* cached;
+	unsigned char* data;
+	int dataSize;
+};
+
+struct TileBuildJobs
+{
+	const NavMeshType_Tile* type;
+	const TileBuildCache* cache;
+	std::vector<TileBuildJob>* jobs;
+};
+}
+
+void NavMeshType_Tile::buildTileJob(int i, void* data)
+{
+	TileBuildJobs* jobs = (TileBuildJobs*)data;
+	TileBuildJob& job = (*jobs->jobs)[i];
+	const NavMeshType_Tile* type = jobs->type;
+
+	if (jobs->cache)
+	{
+		rcConfig tcfg;
+		type->initTileConfig(tcfg, job.bmin, job.bmax);
+		job.cached = jobs->cache->lookup(job.tx, job.ty, type->m_geom, tcfg, job.inputHash);
+		if (job.cached)
+			return;
+	}
+
+	// The build context of the type is not thread safe, so each job gets its
+	// own, which doesn't log.
+	rcContext ctx(false);
+	TileBuildState state;
+	job.data = type->buildTileData(&ctx, job.tx, job.ty, job.bmin, job.bmax, job.dataSize, state, false);
+}
+
 void NavMeshType_Tile::buildAllTiles()
 {
 	if (!m_geom) return;
@@ -869,31 +936,75 @@ void NavMeshType_Tile::buildAllTiles()
 	m_ctx->startTimer(RC_TIMER_TEMP);
 #endif
 
+	// Tiles whose input didn't change since the last build are taken from the
+	// tile build cache, the rest are built in parallel.
+	TileBuildCache cache;
+	const bool useCache = !m_tileBuildCachePath.empty();
+	if (useCache)
+		cache.load(m_tileBuildCachePath, m_tileBuildCacheMapHash, hashBuildSettings());
+
+	std::vector<TileBuildJob> jobs(tw*th);
 	for (int y = 0; y < th; ++y)
 	{
 		for (int x = 0; x < tw; ++x)
 		{
-			m_lastBuiltTileBmin[0] = bmin[0] + x*tcs;
-			m_lastBuiltTileBmin[1] = bmin[1];
-			m_lastBuiltTileBmin[2] = bmin[2] + y*tcs;
+			TileBuildJob& job = jobs[y*tw + x];
+			memset(&job, 0, sizeof(job));
+			job.tx = x;
+			job.ty = y;
 			
-			m_lastBuiltTileBmax[0] = bmin[0] + (x+1)*tcs;
-			m_lastBuiltTileBmax[1] = bmax[1];
-			m_lastBuiltTileBmax[2] = bmin[2] + (y+1)*tcs;
+			job.bmin[0] = bmin[0] + x*tcs;
+			job.bmin[1] = bmin[1];
+			job.bmin[2] = bmin[2] + y*tcs;
 			
-			int dataSize = 0;
-			unsigned char* data = buildTileMesh(x, y, m_lastBuiltTileBmin, m_lastBuiltTileBmax, dataSize);
-			if (data)
-			{
-				// Remove any previous data (navmesh owns and deletes the data).
-				m_navMesh->removeTile(m_navMesh->getTileRefAt(x,y,0),0,0);
-				// Let the navmesh own the data.
-				dtStatus status = m_navMesh->addTile(data,dataSize,DT_TILE_FREE_DATA,0,0);
-				if (dtStatusFailed(status))
-					dtFree(data);
-			}
+			job.bmax[0] = bmin[0] + (x+1)*tcs;
+			job.bmax[1] = bmax[1];
+			job.bmax[2] = bmin[2] + (y+1)*tcs;
+		}
+	}
+
+	TileBuildJobs jobData;
+	jobData.type = this;
+	jobData.cache = useCache ? &cache : 0;
+	jobData.jobs = &jobs;
+	runTileBuildJobs((int)jobs.size(), &buildTileJob, &jobData);
+
+	// Adding the tiles links them up with their neighbours, which has to be
+	// done one tile at a time.
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		TileBuildJob& job = jobs[i];
+		if (job.cached)
+		{
+			if (job.cached->layers.empty())
+				continue;
+			job.data = TileBuildCache::copyLayer(job.cached->layers[0]);
+			job.dataSize = (int)job.cached->layers[0].size();
+		}
+		else if (useCache)
+		{
+			cache.addTile(job.tx, job.ty, job.inputHash, &job.data, &job.dataSize, job.data ? 1 : 0);
+		}
+
+		if (job.data)
+		{
+			// Remove any previous data (navmesh owns and deletes the data).
+			m_navMesh->removeTile(m_navMesh->getTileRefAt(job.tx,job.ty,0),0,0);
+			// Let the navmesh own the data.
+			dtStatus status = m_navMesh->addTile(job.data,job.dataSize,DT_TILE_FREE_DATA,0,0);
+			if (dtStatusFailed(status))
+				dtFree(job.data);
 		}
 	}
+
+	if (!jobs.empty())
+	{
+		rcVcopy(m_lastBuiltTileBmin, jobs.back().bmin);
+		rcVcopy(m_lastBuiltTileBmax, jobs.back().bmax);
+	}
+
+	if (useCache && cache.isDirty())
+		cache.save(m_tileBuildCachePath);
 	
 #ifdef RN_DEBUG
 	// Start the build process.	
@@ -925,41 +1036,54 @@ void NavMeshType_Tile::removeAllTiles()
 
 unsigned char* NavMeshType_Tile::buildTileMesh(const int tx, const int ty, const float* bmin, const float* bmax, int& dataSize)
 {
-	if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
-	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Input mesh is not specified.");
-		return 0;
-	}
-	
-	m_tileMemUsage = 0;
-	m_tileBuildTime = 0;
-	
 	cleanup();
-	
-	const float* verts = m_geom->getMesh()->getVerts();
-	const int nverts = m_geom->getMesh()->getVertCount();
-	const int ntris = m_geom->getMesh()->getTriCount();
-	const rcChunkyTriMesh* chunkyMesh = m_geom->getChunkyMesh();
-		
+
+	TileBuildState state;
+	unsigned char* data = buildTileData(m_ctx, tx, ty, bmin, bmax, dataSize, state, m_keepInterResults);
+
+	// Keep the intermediate results around for debug drawing.
+	m_cfg = state.cfg;
+	m_triareas = state.triareas;
+	m_solid = state.solid;
+	m_chf = state.chf;
+	m_cset = state.cset;
+	m_pmesh = state.pmesh;
+	m_dmesh = state.dmesh;
+	state.triareas = 0;
+	state.solid = 0;
+	state.chf = 0;
+	state.cset = 0;
+	state.pmesh = 0;
+	state.dmesh = 0;
+
+	m_tileTriCount = state.tileTriCount;
+	m_tileMemUsage = state.tileMemUsage;
+	m_tileBuildTime = state.tileBuildTime;
+
+	return data;
+}
+
+void NavMeshType_Tile::initTileConfig(rcConfig& cfg, const float* bmin, const float* bmax) const
+{
 	// Init build configuration from GUI
-	memset(&m_cfg, 0, sizeof(m_cfg));
-	m_cfg.cs = m_cellSize;
-	m_cfg.ch = m_cellHeight;
-	m_cfg.walkableSlopeAngle = m_agentMaxSlope;
-	m_cfg.walkableHeight = (int)ceilf(m_agentHeight / m_cfg.ch);
-	m_cfg.walkableClimb = (int)floorf(m_agentMaxClimb / m_cfg.ch);
-	m_cfg.walkableRadius = (int)ceilf(m_agentRadius / m_cfg.cs);
-	m_cfg.maxEdgeLen = (int)(m_edgeMaxLen / m_cellSize);
-	m_cfg.maxSimplificationError = m_edgeMaxError;
-	m_cfg.minRegionArea = (int)rcSqr(m_regionMinSize);		// Note: area = size*size
-	m_cfg.mergeRegionArea = (int)rcSqr(m_regionMergeSize);	// Note: area = size*size
-	m_cfg.maxVertsPerPoly = (int)m_vertsPerPoly;
-	m_cfg.tileSize = (int)m_tileSize;
-	m_cfg.borderSize = m_cfg.walkableRadius + 3; // Reserve enough padding.
-	m_cfg.width = m_cfg.tileSize + m_cfg.borderSize*2;
-	m_cfg.height = m_cfg.tileSize + m_cfg.borderSize*2;
-	m_cfg.detailSampleDist = m_detailSampleDist < 0.9f ? 0 : m_cellSize * m_detailSampleDist;
-	m_cfg.detailSampleMaxError = m_cellHeight * m_detailSampleMaxError;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cs = m_cellSize;
+	cfg.ch = m_cellHeight;
+	cfg.walkableSlopeAngle = m_agentMaxSlope;
+	cfg.walkableHeight = (int)ceilf(m_agentHeight / cfg.ch);
+	cfg.walkableClimb = (int)floorf(m_agentMaxClimb / cfg.ch);
+	cfg.walkableRadius = (int)ceilf(m_agentRadius / cfg.cs);
+	cfg.maxEdgeLen = (int)(m_edgeMaxLen / m_cellSize);
+	cfg.maxSimplificationError = m_edgeMaxError;
+	cfg.minRegionArea = (int)rcSqr(m_regionMinSize);		// Note: area = size*size
+	cfg.mergeRegionArea = (int)rcSqr(m_regionMergeSize);	// Note: area = size*size
+	cfg.maxVertsPerPoly = (int)m_vertsPerPoly;
+	cfg.tileSize = (int)m_tileSize;
+	cfg.borderSize = cfg.walkableRadius + 3; // Reserve enough padding.
+	cfg.width = cfg.tileSize + cfg.borderSize*2;
+	cfg.height = cfg.tileSize + cfg.borderSize*2;
+	cfg.detailSampleDist = m_detailSampleDist < 0.9f ? 0 : m_cellSize * m_detailSampleDist;
+	cfg.detailSampleMaxError = m_cellHeight * m_detailSampleMaxError;
 	
 	// Expand the heighfield bounding box by border size to find the extents of geometry we need to build this tile.
 	//
@@ -982,59 +1106,85 @@ unsigned char* NavMeshType_Tile::buildTileMesh(const int tx, const int ty, const
 	// For example if you build a navmesh for terrain, and want the navmesh tiles to match the terrain tile size
 	// you will need to pass in data from neighbour terrain tiles too! In a simple case, just pass in all the 8 neighbours,
 	// or use the bounding box below to only pass in a sliver of each of the 8 neighbours.
-	rcVcopy(m_cfg.bmin, bmin);
-	rcVcopy(m_cfg.bmax, bmax);
-	m_cfg.bmin[0] -= m_cfg.borderSize*m_cfg.cs;
-	m_cfg.bmin[2] -= m_cfg.borderSize*m_cfg.cs;
-	m_cfg.bmax[0] += m_cfg.borderSize*m_cfg.cs;
-	m_cfg.bmax[2] += m_cfg.borderSize*m_cfg.cs;
+	rcVcopy(cfg.bmin, bmin);
+	rcVcopy(cfg.bmax, bmax);
+	cfg.bmin[0] -= cfg.borderSize*cfg.cs;
+	cfg.bmin[2] -= cfg.borderSize*cfg.cs;
+	cfg.bmax[0] += cfg.borderSize*cfg.cs;
+	cfg.bmax[2] += cfg.borderSize*cfg.cs;
+}
+
+/// Builds the navmesh data of a single tile.  This only reads the type and
+/// its input geometry, and everything it builds goes into state, so several
+/// tiles can be built at once from different threads, each with their own
+/// context.
+unsigned char* NavMeshType_Tile::buildTileData(rcContext* ctx, const int tx, const int ty,
+		const float* bmin, const float* bmax, int& dataSize, TileBuildState& state,
+		bool keepInterResults) const
+{
+	if (!m_geom || !m_geom->getMesh() || !m_geom->getChunkyMesh())
+	{
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Input mesh is not specified.");
+		return 0;
+	}
+	
+	state.tileMemUsage = 0;
+	state.tileBuildTime = 0;
+	
+	const float* verts = m_geom->getMesh()->getVerts();
+	const int nverts = m_geom->getMesh()->getVertCount();
+	const int ntris = m_geom->getMesh()->getTriCount();
+	const rcChunkyTriMesh* chunkyMesh = m_geom->getChunkyMesh();
+	
+	rcConfig& cfg = state.cfg;
+	initTileConfig(cfg, bmin, bmax);
 	
 #ifdef RN_DEBUG
 	// Reset build times gathering.
-	m_ctx->resetTimers();
+	ctx->resetTimers();
 	
 	// Start the build process.
-	m_ctx->startTimer(RC_TIMER_TOTAL);
+	ctx->startTimer(RC_TIMER_TOTAL);
 	
-	CTXLOG(m_ctx,RC_LOG_PROGRESS, "Building navigation:");
-	CTXLOG2(m_ctx,RC_LOG_PROGRESS, " - %d x %d cells", m_cfg.width, m_cfg.height);
-	CTXLOG2(m_ctx,RC_LOG_PROGRESS, " - %.1fK verts, %.1fK tris", nverts/1000.0f, ntris/1000.0f);
+	CTXLOG(ctx,RC_LOG_PROGRESS, "Building navigation:");
+	CTXLOG2(ctx,RC_LOG_PROGRESS, " - %d x %d cells", cfg.width, cfg.height);
+	CTXLOG2(ctx,RC_LOG_PROGRESS, " - %.1fK verts, %.1fK tris", nverts/1000.0f, ntris/1000.0f);
 	
 #endif
 	// Allocate voxel heightfield where we rasterize our input data to.
-	m_solid = rcAllocHeightfield();
-	if (!m_solid)
+	state.solid = rcAllocHeightfield();
+	if (!state.solid)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'solid'.");
 		return 0;
 	}
-	if (!rcCreateHeightfield(m_ctx, *m_solid, m_cfg.width, m_cfg.height, m_cfg.bmin, m_cfg.bmax, m_cfg.cs, m_cfg.ch))
+	if (!rcCreateHeightfield(ctx, *state.solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
 		return 0;
 	}
 	
 	// Allocate array that can hold triangle flags.
 	// If you have multiple meshes you need to process, allocate
 	// and array which can hold the max number of triangles you need to process.
-	m_triareas = new unsigned char[chunkyMesh->maxTrisPerChunk];
-	if (!m_triareas)
+	state.triareas = new unsigned char[chunkyMesh->maxTrisPerChunk];
+	if (!state.triareas)
 	{
-		CTXLOG1(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'm_triareas' (%d).", chunkyMesh->maxTrisPerChunk);
+		CTXLOG1(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'm_triareas' (%d).", chunkyMesh->maxTrisPerChunk);
 		return 0;
 	}
 	
 	float tbmin[2], tbmax[2];
-	tbmin[0] = m_cfg.bmin[0];
-	tbmin[1] = m_cfg.bmin[2];
-	tbmax[0] = m_cfg.bmax[0];
-	tbmax[1] = m_cfg.bmax[2];
+	tbmin[0] = cfg.bmin[0];
+	tbmin[1] = cfg.bmin[2];
+	tbmax[0] = cfg.bmax[0];
+	tbmax[1] = cfg.bmax[2];
 	int cid[512];// TODO: Make grow when returning too many items.
 	const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
 	if (!ncid)
 		return 0;
 	
-	m_tileTriCount = 0;
+	state.tileTriCount = 0;
 	
 	for (int i = 0; i < ncid; ++i)
 	{
@@ -1042,64 +1192,64 @@ unsigned char* NavMeshType_Tile::buildTileMesh(const int tx, const int ty, const
 		const int* ctris = &chunkyMesh->tris[node.i*3];
 		const int nctris = node.n;
 		
-		m_tileTriCount += nctris;
+		state.tileTriCount += nctris;
 		
-		memset(m_triareas, 0, nctris*sizeof(unsigned char));
-		rcMarkWalkableTriangles(m_ctx, m_cfg.walkableSlopeAngle,
-								verts, nverts, ctris, nctris, m_triareas);
+		memset(state.triareas, 0, nctris*sizeof(unsigned char));
+		rcMarkWalkableTriangles(ctx, cfg.walkableSlopeAngle,
+								verts, nverts, ctris, nctris, state.triareas);
 		
-		if (!rcRasterizeTriangles(m_ctx, verts, nverts, ctris, m_triareas, nctris, *m_solid, m_cfg.walkableClimb))
+		if (!rcRasterizeTriangles(ctx, verts, nverts, ctris, state.triareas, nctris, *state.solid, cfg.walkableClimb))
 			return 0;
 	}
 	
-	if (!m_keepInterResults)
+	if (!keepInterResults)
 	{
-		delete [] m_triareas;
-		m_triareas = 0;
+		delete [] state.triareas;
+		state.triareas = 0;
 	}
 	
 	// Once all geometry is rasterized, we do initial pass of filtering to
 	// remove unwanted overhangs caused by the conservative rasterization
 	// as well as filter spans where the character cannot possibly stand.
 	if (m_filterLowHangingObstacles)
-		rcFilterLowHangingWalkableObstacles(m_ctx, m_cfg.walkableClimb, *m_solid);
+		rcFilterLowHangingWalkableObstacles(ctx, cfg.walkableClimb, *state.solid);
 	if (m_filterLedgeSpans)
-		rcFilterLedgeSpans(m_ctx, m_cfg.walkableHeight, m_cfg.walkableClimb, *m_solid);
+		rcFilterLedgeSpans(ctx, cfg.walkableHeight, cfg.walkableClimb, *state.solid);
 	if (m_filterWalkableLowHeightSpans)
-		rcFilterWalkableLowHeightSpans(m_ctx, m_cfg.walkableHeight, *m_solid);
+		rcFilterWalkableLowHeightSpans(ctx, cfg.walkableHeight, *state.solid);
 	
 	// Compact the heightfield so that it is faster to handle from now on.
 	// This will result more cache coherent data as well as the neighbours
 	// between walkable cells will be calculated.
-	m_chf = rcAllocCompactHeightfield();
-	if (!m_chf)
+	state.chf = rcAllocCompactHeightfield();
+	if (!state.chf)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'chf'.");
 		return 0;
 	}
-	if (!rcBuildCompactHeightfield(m_ctx, m_cfg.walkableHeight, m_cfg.walkableClimb, *m_solid, *m_chf))
+	if (!rcBuildCompactHeightfield(ctx, cfg.walkableHeight, cfg.walkableClimb, *state.solid, *state.chf))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
 		return 0;
 	}
 	
-	if (!m_keepInterResults)
+	if (!keepInterResults)
 	{
-		rcFreeHeightField(m_solid);
-		m_solid = 0;
+		rcFreeHeightField(state.solid);
+		state.solid = 0;
 	}
 
 	// Erode the walkable area by agent radius.
-	if (!rcErodeWalkableArea(m_ctx, m_cfg.walkableRadius, *m_chf))
+	if (!rcErodeWalkableArea(ctx, cfg.walkableRadius, *state.chf))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not erode.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not erode.");
 		return 0;
 	}
 
 	// (Optional) Mark areas.
 	const ConvexVolume* vols = m_geom->getConvexVolumes();
 	for (int i  = 0; i < m_geom->getConvexVolumeCount(); ++i)
-		rcMarkConvexPolyArea(m_ctx, vols[i].verts, vols[i].nverts, vols[i].hmin, vols[i].hmax, (unsigned char)vols[i].area, *m_chf);
+		rcMarkConvexPolyArea(ctx, vols[i].verts, vols[i].nverts, vols[i].hmin, vols[i].hmax, (unsigned char)vols[i].area, *state.chf);
 	
 	
 	// Partition the heightfield so that we can use simple algorithm later to triangulate the walkable areas.
@@ -1131,16 +1281,16 @@ unsigned char* NavMeshType_Tile::buildTileMesh(const int tx, const int ty, const
 	if (m_partitionType == NAVMESH_PARTITION_WATERSHED)
 	{
 		// Prepare for region partitioning, by calculating distance field along the walkable surface.
-		if (!rcBuildDistanceField(m_ctx, *m_chf))
+		if (!rcBuildDistanceField(ctx, *state.chf))
 		{
-			CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build distance field.");
+			CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build distance field.");
 			return 0;
 		}
 		
 		// Partition the walkable surface into simple regions without holes.
-		if (!rcBuildRegions(m_ctx, *m_chf, m_cfg.borderSize, m_cfg.minRegionArea, m_cfg.mergeRegionArea))
+		if (!rcBuildRegions(ctx, *state.chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
 		{
-			CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build watershed regions.");
+			CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build watershed regions.");
 			return 0;
 		}
 	}
@@ -1148,133 +1298,134 @@ unsigned char* NavMeshType_Tile::buildTileMesh(const int tx, const int ty, const
 	{
 		// Partition the walkable surface into simple regions without holes.
 		// Monotone partitioning does not need distancefield.
-		if (!rcBuildRegionsMonotone(m_ctx, *m_chf, m_cfg.borderSize, m_cfg.minRegionArea, m_cfg.mergeRegionArea))
+		if (!rcBuildRegionsMonotone(ctx, *state.chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
 		{
-			CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build monotone regions.");
+			CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build monotone regions.");
 			return 0;
 		}
 	}
 	else // SAMPLE_PARTITION_LAYERS
 	{
 		// Partition the walkable surface into simple regions without holes.
-		if (!rcBuildLayerRegions(m_ctx, *m_chf, m_cfg.borderSize, m_cfg.minRegionArea))
+		if (!rcBuildLayerRegions(ctx, *state.chf, cfg.borderSize, cfg.minRegionArea))
 		{
-			CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not build layer regions.");
+			CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not build layer regions.");
 			return 0;
 		}
 	}
 	 	
 	// Create contours.
-	m_cset = rcAllocContourSet();
-	if (!m_cset)
+	state.cset = rcAllocContourSet();
+	if (!state.cset)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'cset'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'cset'.");
 		return 0;
 	}
-	if (!rcBuildContours(m_ctx, *m_chf, m_cfg.maxSimplificationError, m_cfg.maxEdgeLen, *m_cset))
+	if (!rcBuildContours(ctx, *state.chf, cfg.maxSimplificationError, cfg.maxEdgeLen, *state.cset))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could not create contours.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could not create contours.");
 		return 0;
 	}
 	
-	if (m_cset->nconts == 0)
+	if (state.cset->nconts == 0)
 	{
 		return 0;
 	}
 	
 	// Build polygon navmesh from the contours.
-	m_pmesh = rcAllocPolyMesh();
-	if (!m_pmesh)
+	state.pmesh = rcAllocPolyMesh();
+	if (!state.pmesh)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'pmesh'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'pmesh'.");
 		return 0;
 	}
-	if (!rcBuildPolyMesh(m_ctx, *m_cset, m_cfg.maxVertsPerPoly, *m_pmesh))
+	if (!rcBuildPolyMesh(ctx, *state.cset, cfg.maxVertsPerPoly, *state.pmesh))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, 				"buildNavigation: Could not triangulate contours.");
+		CTXLOG(ctx, RC_LOG_ERROR, 				"buildNavigation: Could not triangulate contours.");
 		return 0;
 	}
 	
 	// Build detail mesh.
-	m_dmesh = rcAllocPolyMeshDetail();
-	if (!m_dmesh)
+	state.dmesh = rcAllocPolyMeshDetail();
+	if (!state.dmesh)
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'dmesh'.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Out of memory 'dmesh'.");
 		return 0;
 	}
 	
-	if (!rcBuildPolyMeshDetail(m_ctx, *m_pmesh, *m_chf,
-							   m_cfg.detailSampleDist, m_cfg.detailSampleMaxError,
-							   *m_dmesh))
+	if (!rcBuildPolyMeshDetail(ctx, *state.pmesh, *state.chf,
+							   cfg.detailSampleDist, cfg.detailSampleMaxError,
+							   *state.dmesh))
 	{
-		CTXLOG(m_ctx, RC_LOG_ERROR, "buildNavigation: Could build polymesh detail.");
+		CTXLOG(ctx, RC_LOG_ERROR, "buildNavigation: Could build polymesh detail.");
 		return 0;
 	}
 	
-	if (!m_keepInterResults)
+	if (!keepInterResults)
 	{
-		rcFreeCompactHeightfield(m_chf);
-		m_chf = 0;
-		rcFreeContourSet(m_cset);
-		m_cset = 0;
+		rcFreeCompactHeightfield(state.chf);
+		state.chf = 0;
+		rcFreeContourSet(state.cset);
+		state.cset = 0;
 	}
 	
 	unsigned char* navData = 0;
 	int navDataSize = 0;
-	if (m_cfg.maxVertsPerPoly <= DT_VERTS_PER_POLYGON)
+	if (cfg.maxVertsPerPoly <= DT_VERTS_PER_POLYGON)
 	{
-		if (m_pmesh->nverts >= 0xffff)
+		if (state.pmesh->nverts >= 0xffff)
 		{
 			// The vertex indices are ushorts, and cannot point to more than 0xffff vertices.
-			CTXLOG2(m_ctx, RC_LOG_ERROR, "Too many vertices per tile %d (max: %d).", m_pmesh->nverts, 0xffff);
+			CTXLOG2(ctx, RC_LOG_ERROR, "Too many vertices per tile %d (max: %d).", state.pmesh->nverts, 0xffff);
 			return 0;
 		}
 		
 		// Update poly flags from areas.
-		for (int i = 0; i < m_pmesh->npolys; ++i)
+		for (int i = 0; i < state.pmesh->npolys; ++i)
 		{
-			if (m_pmesh->areas[i] == RC_WALKABLE_AREA)
-				m_pmesh->areas[i] = NAVMESH_POLYAREA_GROUND;
+			if (state.pmesh->areas[i] == RC_WALKABLE_AREA)
+				state.pmesh->areas[i] = NAVMESH_POLYAREA_GROUND;
 			
 			//set polyFlags for polyAreas only if m_flagsAreaTable not empty
 			if (! m_flagsAreaTable.empty())
 			{ 
 				// get flags from a table indexed by areas
-				m_pmesh->flags[i] = m_flagsAreaTable[m_pmesh->areas[i]];
+				NavMeshPolyAreaFlags::const_iterator flags = m_flagsAreaTable.find(state.pmesh->areas[i]);
+				state.pmesh->flags[i] = flags != m_flagsAreaTable.end() ? flags->second : 0;
 			} 
 			else
 			{ 
-				if (m_pmesh->areas[i] == NAVMESH_POLYAREA_GROUND ||
-					m_pmesh->areas[i] == NAVMESH_POLYAREA_GRASS ||
-					m_pmesh->areas[i] == NAVMESH_POLYAREA_ROAD)
+				if (state.pmesh->areas[i] == NAVMESH_POLYAREA_GROUND ||
+					state.pmesh->areas[i] == NAVMESH_POLYAREA_GRASS ||
+					state.pmesh->areas[i] == NAVMESH_POLYAREA_ROAD)
 				{
-					m_pmesh->flags[i] = NAVMESH_POLYFLAGS_WALK;
+					state.pmesh->flags[i] = NAVMESH_POLYFLAGS_WALK;
 				}
-				else if (m_pmesh->areas[i] == NAVMESH_POLYAREA_WATER)
+				else if (state.pmesh->areas[i] == NAVMESH_POLYAREA_WATER)
 				{
-					m_pmesh->flags[i] = NAVMESH_POLYFLAGS_SWIM;
+					state.pmesh->flags[i] = NAVMESH_POLYFLAGS_SWIM;
 				}
-				else if (m_pmesh->areas[i] == NAVMESH_POLYAREA_DOOR)
+				else if (state.pmesh->areas[i] == NAVMESH_POLYAREA_DOOR)
 				{
-					m_pmesh->flags[i] = NAVMESH_POLYFLAGS_WALK | NAVMESH_POLYFLAGS_DOOR;
+					state.pmesh->flags[i] = NAVMESH_POLYFLAGS_WALK | NAVMESH_POLYFLAGS_DOOR;
 				}
 			} 
 		}
 		
 		dtNavMeshCreateParams params;
 		memset(&params, 0, sizeof(params));
-		params.verts = m_pmesh->verts;
-		params.vertCount = m_pmesh->nverts;
-		params.polys = m_pmesh->polys;
-		params.polyAreas = m_pmesh->areas;
-		params.polyFlags = m_pmesh->flags;
-		params.polyCount = m_pmesh->npolys;
-		params.nvp = m_pmesh->nvp;
-		params.detailMeshes = m_dmesh->meshes;
-		params.detailVerts = m_dmesh->verts;
-		params.detailVertsCount = m_dmesh->nverts;
-		params.detailTris = m_dmesh->tris;
-		params.detailTriCount = m_dmesh->ntris;
+		params.verts = state.pmesh->verts;
+		params.vertCount = state.pmesh->nverts;
+		params.polys = state.pmesh->polys;
+		params.polyAreas = state.pmesh->areas;
+		params.polyFlags = state.pmesh->flags;
+		params.polyCount = state.pmesh->npolys;
+		params.nvp = state.pmesh->nvp;
+		params.detailMeshes = state.dmesh->meshes;
+		params.detailVerts = state.dmesh->verts;
+		params.detailVertsCount = state.dmesh->nverts;
+		params.detailTris = state.dmesh->tris;
+		params.detailTriCount = state.dmesh->ntris;
 		params.offMeshConVerts = m_geom->getOffMeshConnectionVerts();
 		params.offMeshConRad = m_geom->getOffMeshConnectionRads();
 		params.offMeshConDir = m_geom->getOffMeshConnectionDirs();
@@ -1288,28 +1439,28 @@ unsigned char* NavMeshType_Tile::buildTileMesh(const int tx, const int ty, const
 		params.tileX = tx;
 		params.tileY = ty;
 		params.tileLayer = 0;
-		rcVcopy(params.bmin, m_pmesh->bmin);
-		rcVcopy(params.bmax, m_pmesh->bmax);
-		params.cs = m_cfg.cs;
-		params.ch = m_cfg.ch;
+		rcVcopy(params.bmin, state.pmesh->bmin);
+		rcVcopy(params.bmax, state.pmesh->bmax);
+		params.cs = cfg.cs;
+		params.ch = cfg.ch;
 		params.buildBvTree = true;
 		
 		if (!dtCreateNavMeshData(&params, &navData, &navDataSize))
 		{
-			CTXLOG(m_ctx, RC_LOG_ERROR, "Could not build Detour navmesh.");
+			CTXLOG(ctx, RC_LOG_ERROR, "Could not build Detour navmesh.");
 			return 0;
 		}		
 	}
-	m_tileMemUsage = navDataSize/1024.0f;
+	state.tileMemUsage = navDataSize/1024.0f;
 	
 #ifdef RN_DEBUG
-	m_ctx->stopTimer(RC_TIMER_TOTAL);
+	ctx->stopTimer(RC_TIMER_TOTAL);
 	
 	// Show performance stats.
-	duLogBuildTimes(*m_ctx, m_ctx->getAccumulatedTime(RC_TIMER_TOTAL));
-	CTXLOG2(m_ctx, RC_LOG_PROGRESS, ">> Polymesh: %d vertices  %d polygons", m_pmesh->nverts, m_pmesh->npolys);
+	duLogBuildTimes(*ctx, ctx->getAccumulatedTime(RC_TIMER_TOTAL));
+	CTXLOG2(ctx, RC_LOG_PROGRESS, ">> Polymesh: %d vertices  %d polygons", state.pmesh->nverts, state.pmesh->npolys);
 	
-	m_tileBuildTime = m_ctx->getAccumulatedTime(RC_TIMER_TOTAL)/1000.0f;
+	state.tileBuildTime = ctx->getAccumulatedTime(RC_TIMER_TOTAL)/1000.0f;
 #endif
 
 	dataSize = navDataSize;
@@ -84,7 +84,30 @@ protected:
 	float m_tileMemUsage;
 	int m_tileTriCount;
 
+	///Everything built for a single tile.
+	struct TileBuildState
+	{
+		rcConfig cfg;
+		unsigned char* triareas;
+		rcHeightfield* solid;
+		rcCompactHeightfield* chf;
+		rcContourSet* cset;
+		rcPolyMesh* pmesh;
+		rcPolyMeshDetail* dmesh;
+		int tileTriCount;
+		float tileMemUsage;
+		float tileBuildTime;
+
+		TileBuildState();
+		~TileBuildState();
+	};
+
 	unsigned char* buildTileMesh(const int tx, const int ty, const float* bmin, const float* bmax, int& dataSize);
+	void initTileConfig(rcConfig& cfg, const float* bmin, const float* bmax) const;
+	unsigned char* buildTileData(rcContext* ctx, const int tx, const int ty,
+			const float* bmin, const float* bmax, int& dataSize, TileBuildState& state,
+			bool keepInterResults) const;
+	static void buildTileJob(int i, void* data);
 	
 	void cleanup();
 	
@@ -0,0 +1,339 @@
+/**
+ * \file TileBuildCache.cpp
+ *
+ * \date 2026-10-17
+ * \author Brian Lach
+ */
+
+#include "TileBuildCache.h"
+#include "InputGeom.h"
+#include "ChunkyTriMesh.h"
+#include <DetourAlloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "asyncTaskManager.h"
+#include "genericAsyncTask.h"
+#include "configVariableInt.h"
+#include "thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+static ConfigVariableInt recast_tile_build_threads(
+	"recast-tile-build-threads", -1,
+	PRC_DESC("Number of threads that build the tiles of a tiled navigation "
+			"mesh.  -1 picks one based on the number of CPUs."));
+
+static const int TILEBUILDCACHE_MAGIC = 'N'<<24 | 'T'<<16 | 'B'<<8 | 'C'; //'NTBC';
+static const int TILEBUILDCACHE_VERSION = 1;
+// Sanity limits for reading the cache, well above what a navigation mesh can
+// have (the tile coordinates fit in 2^22 tiles, the tile cache in 255 layers).
+static const int TILEBUILDCACHE_MAX_TILES = 1 << 22;
+static const int TILEBUILDCACHE_MAX_LAYERS = 255;
+
+namespace rnsup
+{
+
+struct TileBuildCacheHeader
+{
+	int magic;
+	int version;
+	uint64_t mapHash;
+	uint64_t settingsHash;
+	int numTiles;
+};
+
+struct TileBuildCacheTileHeader
+{
+	int tx, ty;
+	uint64_t inputHash;
+	int numLayers;
+};
+
+TileBuildCache::TileBuildCache() :
+	m_mapHash(0),
+	m_settingsHash(0),
+	m_sameMap(false),
+	m_dirty(false)
+{
+}
+
+/// Reads the cache from the indicated file.  Returns false, and leaves the
+/// cache empty, if there is none or it was built with different settings.
+/// The map hash may be 0 if it is unknown, in which case every tile is
+/// checked against its input.
+bool TileBuildCache::load(const std::string& path, uint64_t mapHash, uint64_t settingsHash)
+{
+	m_tiles.clear();
+	m_mapHash = mapHash;
+	m_settingsHash = settingsHash;
+	m_sameMap = false;
+	m_dirty = false;
+
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	// Nothing in the file can be larger than the file itself.
+	long fileSize = -1;
+	if (fseek(fp, 0, SEEK_END) == 0)
+		fileSize = ftell(fp);
+	if (fileSize < 0 || fseek(fp, 0, SEEK_SET) != 0)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	TileBuildCacheHeader header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+		header.magic != TILEBUILDCACHE_MAGIC ||
+		header.version != TILEBUILDCACHE_VERSION ||
+		header.settingsHash != settingsHash ||
+		header.numTiles < 0 || header.numTiles > TILEBUILDCACHE_MAX_TILES)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	for (int i = 0; i < header.numTiles; ++i)
+	{
+		TileBuildCacheTileHeader tileHeader;
+		if (fread(&tileHeader, sizeof(tileHeader), 1, fp) != 1 ||
+			tileHeader.numLayers < 0 || tileHeader.numLayers > TILEBUILDCACHE_MAX_LAYERS)
+		{
+			m_tiles.clear();
+			fclose(fp);
+			return false;
+		}
+
+		Tile& tile = m_tiles[std::make_pair(tileHeader.tx, tileHeader.ty)];
+		tile.tx = tileHeader.tx;
+		tile.ty = tileHeader.ty;
+		tile.inputHash = tileHeader.inputHash;
+		tile.layers.resize(tileHeader.numLayers);
+		for (int j = 0; j < tileHeader.numLayers; ++j)
+		{
+			int dataSize = 0;
+			bool ok = fread(&dataSize, sizeof(dataSize), 1, fp) == 1 &&
+				dataSize > 0 && dataSize <= fileSize - ftell(fp);
+			if (ok)
+			{
+				tile.layers[j].resize(dataSize);
+				ok = fread(&tile.layers[j][0], dataSize, 1, fp) == 1;
+			}
+			if (!ok)
+			{
+				m_tiles.clear();
+				fclose(fp);
+				return false;
+			}
+		}
+	}
+
+	fclose(fp);
+
+	m_sameMap = mapHash != 0 && header.mapHash == mapHash;
+	// Store the new map hash once the tiles have been checked.
+	m_dirty = !m_sameMap;
+	return true;
+}
+
+bool TileBuildCache::save(const std::string& path) const
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	TileBuildCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = TILEBUILDCACHE_MAGIC;
+	header.version = TILEBUILDCACHE_VERSION;
+	header.mapHash = m_mapHash;
+	header.settingsHash = m_settingsHash;
+	header.numTiles = (int)m_tiles.size();
+	fwrite(&header, sizeof(header), 1, fp);
+
+	for (Tiles::const_iterator it = m_tiles.begin(); it != m_tiles.end(); ++it)
+	{
+		const Tile& tile = it->second;
+
+		TileBuildCacheTileHeader tileHeader;
+		memset(&tileHeader, 0, sizeof(tileHeader));
+		tileHeader.tx = tile.tx;
+		tileHeader.ty = tile.ty;
+		tileHeader.inputHash = tile.inputHash;
+		tileHeader.numLayers = (int)tile.layers.size();
+		fwrite(&tileHeader, sizeof(tileHeader), 1, fp);
+
+		for (size_t j = 0; j < tile.layers.size(); ++j)
+		{
+			int dataSize = (int)tile.layers[j].size();
+			fwrite(&dataSize, sizeof(dataSize), 1, fp);
+			fwrite(&tile.layers[j][0], dataSize, 1, fp);
+		}
+	}
+
+	bool ok = ferror(fp) == 0;
+	fclose(fp);
+	return ok;
+}
+
+/// Returns the cached tile at (tx, ty) if it is still good, or 0 if it has to
+/// be built.  inputHash receives the hash of the tile input either way, to be
+/// passed to addTile() when the tile is built.  tcfg is the build
+/// configuration of the tile, with the bounds expanded by the border.
+///
+/// This is safe to call from several threads at once, as long as nothing is
+/// being added.
+const TileBuildCache::Tile* TileBuildCache::lookup(int tx, int ty,
+		const InputGeom* geom, const rcConfig& tcfg, uint64_t& inputHash) const
+{
+	Tiles::const_iterator it = m_tiles.find(std::make_pair(tx, ty));
+	if (it != m_tiles.end() && m_sameMap)
+	{
+		inputHash = it->second.inputHash;
+		return &it->second;
+	}
+
+	inputHash = hashTileInput(geom, tcfg);
+	if (it != m_tiles.end() && it->second.inputHash == inputHash)
+		return &it->second;
+	return 0;
+}
+
+/// Stores a tile that was just built, replacing the one at (tx, ty), if any.
+/// The layer data is copied.
+void TileBuildCache::addTile(int tx, int ty, uint64_t inputHash,
+		unsigned char* const* layers, const int* layerSizes, int nlayers)
+{
+	Tile& tile = m_tiles[std::make_pair(tx, ty)];
+	tile.tx = tx;
+	tile.ty = ty;
+	tile.inputHash = inputHash;
+	tile.layers.resize(nlayers);
+	for (int i = 0; i < nlayers; ++i)
+		tile.layers[i].assign(layers[i], layers[i] + layerSizes[i]);
+	m_dirty = true;
+}
+
+/// Returns a copy of a cached layer, allocated with dtAlloc() so that the
+/// navmesh or tile cache can take ownership of it.
+unsigned char* TileBuildCache::copyLayer(const std::vector<unsigned char>& layer)
+{
+	unsigned char* data = (unsigned char*)dtAlloc((int)layer.size(), DT_ALLOC_PERM);
+	if (data)
+		memcpy(data, &layer[0], layer.size());
+	return data;
+}
+
+/// FNV-1a.
+uint64_t hashTileBytes(const void* data, size_t size, uint64_t hash)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/// Hashes the input of a single tile: its build configuration, which holds
+/// its bounds, and the vertices of the triangles that overlap it.
+uint64_t hashTileInput(const InputGeom* geom, const rcConfig& tcfg)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	hash = hashTileBytes(&tcfg, sizeof(tcfg), hash);
+
+	const float* verts = geom->getMesh()->getVerts();
+	const rcChunkyTriMesh* chunkyMesh = geom->getChunkyMesh();
+
+	float tbmin[2], tbmax[2];
+	tbmin[0] = tcfg.bmin[0];
+	tbmin[1] = tcfg.bmin[2];
+	tbmax[0] = tcfg.bmax[0];
+	tbmax[1] = tcfg.bmax[2];
+	int cid[512];
+	const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
+
+	for (int i = 0; i < ncid; ++i)
+	{
+		const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
+		const int* tris = &chunkyMesh->tris[node.i*3];
+		for (int j = 0; j < node.n*3; ++j)
+			hash = hashTileBytes(&verts[tris[j]*3], sizeof(float)*3, hash);
+	}
+
+	return hash;
+}
+
+struct TileBuildJobs
+{
+	std::atomic<int> next;
+	int count;
+	void (*job)(int, void*);
+	void* data;
+
+	void run()
+	{
+		int i;
+		while ((i = next.fetch_add(1)) < count)
+			job(i, data);
+	}
+};
+
+static AsyncTask::DoneStatus tileBuildTask(GenericAsyncTask* task, void* data)
+{
+	((TileBuildJobs*)data)->run();
+	return AsyncTask::DS_done;
+}
+
+void runTileBuildJobs(int count, void (*job)(int, void*), void* data)
+{
+	TileBuildJobs jobs;
+	jobs.next = 0;
+	jobs.count = count;
+	jobs.job = job;
+	jobs.data = data;
+
+	if (!Thread::is_threading_supported() || count <= 1)
+	{
+		jobs.run();
+		return;
+	}
+
+	static const char* chainName = "recast_tile_build";
+
+	AsyncTaskManager* taskMgr = AsyncTaskManager::get_global_ptr();
+	AsyncTaskChain* chain = taskMgr->find_task_chain(chainName);
+	if (!chain)
+	{
+		int numThreads = recast_tile_build_threads.get_value();
+		if (numThreads < 0)
+			numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+		chain = taskMgr->make_task_chain(chainName);
+		chain->set_num_threads(std::max(numThreads, 1));
+		chain->set_thread_priority(TP_low);
+	}
+
+	// Each task takes jobs until there are none left, so there is no point in
+	// having more of them than threads.  The calling thread takes jobs too.
+	int numTasks = std::min(chain->get_num_threads(), count - 1);
+	std::vector<PT(AsyncTask)> tasks;
+	for (int i = 0; i < numTasks; ++i)
+	{
+		PT(AsyncTask) task = new GenericAsyncTask("recast-tile-build", &tileBuildTask, &jobs);
+		task->set_task_chain(chainName);
+		taskMgr->add(task);
+		tasks.push_back(task);
+	}
+
+	jobs.run();
+
+	for (size_t i = 0; i < tasks.size(); ++i)
+		tasks[i]->wait();
+}
+
+} // namespace rnsup
@@ -0,0 +1,77 @@
+/**
+ * \file TileBuildCache.h
+ *
+ * \date 2026-10-17
+ * \author Brian Lach
+ */
+
+#ifndef TILEBUILDCACHE_H
+#define TILEBUILDCACHE_H
+
+#include "pstdint.h"
+#include <Recast.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace rnsup
+{
+
+class InputGeom;
+
+/// The built tiles of a tiled navigation mesh, kept on disk between runs so
+/// that tiles whose input did not change don't have to be built again.
+///
+/// A tile is keyed by a hash of everything that goes into building it: the
+/// triangles that overlap it, its bounds and the build settings. The whole
+/// cache also records the hash of the map it was built from; when that
+/// matches, the map is unchanged and the tiles are taken as they are without
+/// hashing their input again.
+class TileBuildCache
+{
+public:
+	struct Tile
+	{
+		int tx, ty;
+		uint64_t inputHash;
+		/// One blob per layer (navmesh tile data for TILE, compressed tile
+		/// cache layers for OBSTACLE). An empty tile has no layers.
+		std::vector<std::vector<unsigned char> > layers;
+	};
+
+	TileBuildCache();
+
+	bool load(const std::string& path, uint64_t mapHash, uint64_t settingsHash);
+	bool save(const std::string& path) const;
+
+	const Tile* lookup(int tx, int ty, const InputGeom* geom, const rcConfig& tcfg,
+			uint64_t& inputHash) const;
+	void addTile(int tx, int ty, uint64_t inputHash,
+			unsigned char* const* layers, const int* layerSizes, int nlayers);
+
+	/// Whether the cache has to be saved again.
+	bool isDirty() const { return m_dirty; }
+
+	static unsigned char* copyLayer(const std::vector<unsigned char>& layer);
+
+private:
+	typedef std::map<std::pair<int, int>, Tile> Tiles;
+
+	uint64_t m_mapHash;
+	uint64_t m_settingsHash;
+	bool m_sameMap;
+	bool m_dirty;
+	Tiles m_tiles;
+};
+
+uint64_t hashTileBytes(const void* data, size_t size, uint64_t hash);
+uint64_t hashTileInput(const InputGeom* geom, const rcConfig& tcfg);
+
+/// Calls job(i, data) for every i in [0, count) on the recast tile build
+/// task chain, and returns when they are all done. The calling thread helps
+/// out with the jobs as well.
+void runTileBuildJobs(int count, void (*job)(int, void*), void* data);
+
+} // namespace rnsup
+
+#endif // TILEBUILDCACHE_H
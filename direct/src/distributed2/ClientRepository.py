@@ -146,7 +146,7 @@ class ClientRepository(BaseObjectManager, CClientRepository):
         self.serverTickCount = dgi.getUint32()
 
         # Let the C++ repository unpack and apply the snapshot onto our objects
-        self.unpackServerSnapshot(dgi)
+        self.unpackServerSnapshot(dgi, self.serverTickCount)
 
         self.notify.debug("Got tick %i and snapshot from server" % self.serverTickCount)
 
@@ -216,6 +216,7 @@ class ClientRepository(BaseObjectManager, CClientRepository):
 
     def deleteObject(self, do):
         del self.doId2do[do.doId]
+        self.removeObjectState(do.doId)
         if do.doState > DOState.Disabled:
             do.disable()
         do.delete()
@@ -227,6 +228,7 @@ class ClientRepository(BaseObjectManager, CClientRepository):
             do.delete()
 
         self.doId2do = {}
+        self.clearObjectStates()
 
     def disconnect(self):
         if not self.connected:
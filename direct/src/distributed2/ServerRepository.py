@@ -240,9 +240,9 @@ class ServerRepository(BaseObjectManager):
             dg.addUint16(NetMessages.SV_Tick)
             if oldFrame:
                 # We have an old frame to delta against
-                self.snapshotMgr.clientFormatDeltaSnapshot(dg, oldFrame.getSnapshot(), snap, list(client.currentInterestZoneIds))
+                self.snapshotMgr.clientFormatDeltaSnapshot(dg, oldFrame, client.currentFrame, list(client.currentInterestZoneIds))
             else:
-                self.snapshotMgr.clientFormatSnapshot(dg, snap, list(client.currentInterestZoneIds))
+                self.snapshotMgr.clientFormatSnapshot(dg, client.currentFrame, list(client.currentInterestZoneIds))
             self.sendDatagram(dg, client.connection)
 
     def isFull(self):
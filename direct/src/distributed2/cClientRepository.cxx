@@ -12,27 +12,196 @@
  */
 
 #include "cClientRepository.h"
+#include "frameSnapshotManager.h"
+#include "snapshotCodec.h"
+#include "dcFile.h"
 #include "dcClass.h"
 #include "dcField.h"
 #include "dcParameter.h"
 #include "dcPacker.h"
 #include "extension.h"
 
+// The server keeps this many frames for each client (see ServerRepository),
+// so it never encodes a snapshot against an older one.
+static const size_t max_frames = 128;
+
 /**
  * Unpacks a server snapshot from the datagram and applies the state onto the
- * distributed objects.
+ * distributed objects.  tick_count is the tick of the snapshot, which
+ * precedes it in the datagram.
+ *
+ * See FrameSnapshotManager::format_client_snapshot() for the format.
  */
 void CClientRepository::
-unpack_server_snapshot(DatagramIterator &dgi) {
-  bool is_delta = (bool)dgi.get_uint8();
-  int num_objects = dgi.get_uint16();
+unpack_server_snapshot(DatagramIterator &dgi, int tick_count) {
+  PyMutexHolder holder;
+
+  uint8_t flags = dgi.get_uint8();
+  bool is_delta = (flags & FrameSnapshotManager::SF_delta) != 0;
+  int base_tick_count = is_delta ? (int)dgi.get_uint32() : 0;
+
+  vector_uchar bytes = dgi.extract_bytes(dgi.get_uint32());
+  std::string payload((const char *)bytes.data(), bytes.size());
+  if ((flags & FrameSnapshotManager::SF_compressed) != 0) {
+    std::string compressed;
+    compressed.swap(payload);
+    if (!SnapshotCodec::decompress_payload(compressed, payload)) {
+      PyErr_SetString(PyExc_BufferError, "Unable to decompress server snapshot");
+      return;
+    }
+  }
+
+  // Start out with the object states of the snapshot this one is a delta
+  // against.  Objects that are not in this snapshot did not change.
+  ObjectStates states;
+  if (is_delta) {
+    Frames::const_iterator fi = _frames.find(base_tick_count);
+    if (fi == _frames.end()) {
+      std::ostringstream ss;
+      ss << "Received snapshot " << tick_count << " as a delta against snapshot "
+         << base_tick_count << ", which we don't have";
+      std::string message = ss.str();
+      PyErr_SetString(PyExc_KeyError, message.c_str());
+      return;
+    }
+    states = fi->second;
+  }
+
+  DCFile *dc_file = nullptr;
+
+  SnapshotBitReader bits((const unsigned char *)payload.data(), payload.size());
+  // Every object takes at least three bits, which bounds the count by the
+  // size of the payload.
+  uint64_t num_objects = bits.read_uint();
+  if (num_objects > (uint64_t)payload.size() * 8 / 3) {
+    PyErr_SetString(PyExc_BufferError, "Server snapshot has a bad object count");
+    return;
+  }
 
   if (distributed2_cat.is_debug()) {
     distributed2_cat.debug()
       << "Unpacking " << num_objects << " objects in snapshot\n";
   }
 
-  PyMutexHolder holder;
+  // The objects in this snapshot and the fields that were sent for them.
+  pvector<std::pair<PT(ObjectState), vector_int> > updates;
+  pvector<DOID_TYPE> update_do_ids;
+
+  DOID_TYPE do_id = 0;
+  for (uint64_t i = 0; i < num_objects && !bits.is_overflow(); i++) {
+    do_id += (DOID_TYPE)bits.read_uint();
+
+    PT(ObjectState) state = new ObjectState;
+    const ObjectState *prev = nullptr;
+
+    if (bits.read_bit()) {
+      // The whole object was sent.
+      uint64_t class_number = bits.read_uint();
+      if (dc_file == nullptr) {
+        PyObject *py_dc_file = PyObject_GetAttrString(_py_repo, (char *)"dcFile");
+        if (!py_dc_file) {
+          return;
+        }
+        PyObject *py_dc_file_this = PyObject_GetAttrString(py_dc_file, (char *)"this");
+        Py_DECREF(py_dc_file);
+        if (!py_dc_file_this) {
+          return;
+        }
+        dc_file = (DCFile *)PyLong_AsVoidPtr(py_dc_file_this);
+        Py_DECREF(py_dc_file_this);
+        if (dc_file == nullptr) {
+          return;
+        }
+      }
+
+      if (class_number >= (uint64_t)dc_file->get_num_classes()) {
+        std::ostringstream ss;
+        ss << "Received snapshot of object " << do_id << " with unknown class " << class_number;
+        std::string message = ss.str();
+        PyErr_SetString(PyExc_BufferError, message.c_str());
+        return;
+      }
+      state->_dclass = dc_file->get_class((int)class_number);
+      nassertv(state->_dclass != nullptr);
+      state->_fields.resize(state->_dclass->get_num_inherited_fields());
+
+    } else {
+      // Only the fields that changed were sent, against the state we had.
+      ObjectStates::const_iterator si = states.find(do_id);
+      if (si == states.end()) {
+        std::ostringstream ss;
+        ss << "Received delta snapshot of object " << do_id << ", which we have no state for";
+        std::string message = ss.str();
+        PyErr_SetString(PyExc_KeyError, message.c_str());
+        return;
+      }
+      prev = si->second;
+      state->_dclass = prev->_dclass;
+      state->_fields = prev->_fields;
+    }
+
+    // Each field is sent at most once.
+    uint64_t num_fields = bits.read_uint();
+    if (num_fields > (uint64_t)state->_fields.size()) {
+      std::ostringstream ss;
+      ss << "Received snapshot of object " << do_id << " with " << num_fields
+         << " fields, but it only has " << state->_fields.size();
+      std::string message = ss.str();
+      PyErr_SetString(PyExc_BufferError, message.c_str());
+      return;
+    }
+
+    vector_int fields;
+    fields.reserve((size_t)num_fields);
+    uint64_t next_field = 0;
+    for (uint64_t j = 0; j < num_fields; j++) {
+      uint64_t gap = bits.read_uint();
+      if (gap >= (uint64_t)state->_fields.size() - next_field) {
+        break;
+      }
+      int field_number = (int)(next_field + gap);
+      next_field = field_number + 1;
+
+      DCField *field = state->_dclass->get_inherited_field(field_number);
+      int num_quantized = SnapshotCodec::get_num_quantized_values(field);
+      const std::string *base = prev != nullptr ? &prev->_fields[field_number] : nullptr;
+      if (!SnapshotCodec::read_field(bits, num_quantized, base, state->_fields[field_number])) {
+        break;
+      }
+
+      fields.push_back(field_number);
+    }
+
+    if ((uint64_t)fields.size() != num_fields) {
+      std::ostringstream ss;
+      ss << "Unable to unpack snapshot of object " << do_id;
+      std::string message = ss.str();
+      PyErr_SetString(PyExc_BufferError, message.c_str());
+      return;
+    }
+
+    states[do_id] = state;
+    updates.push_back(std::make_pair(state, std::move(fields)));
+    update_do_ids.push_back(do_id);
+  }
+
+  if (bits.is_overflow()) {
+    PyErr_SetString(PyExc_BufferError, "Server snapshot is truncated");
+    return;
+  }
+
+  _frames[tick_count] = std::move(states);
+
+  // The server encodes every snapshot from here on against this one or a
+  // later one.
+  if (is_delta) {
+    _frames.erase(_frames.begin(), _frames.lower_bound(base_tick_count));
+  }
+  while (_frames.size() > max_frames) {
+    _frames.erase(_frames.begin());
+  }
+
+  // Now apply the new state onto the objects.
 
   PyObject *doid2do = PyObject_GetAttrString(_py_repo, (char *)"doId2do");
   if (!doid2do) {
@@ -40,8 +209,10 @@ unpack_server_snapshot(DatagramIterator &dgi) {
     return;
   }
 
-  for (int i = 0; i < num_objects; i++) {
-    DOID_TYPE do_id = dgi.get_uint32();
+  for (size_t i = 0; i < updates.size(); i++) {
+    do_id = update_do_ids[i];
+    const ObjectState *state = updates[i].first;
+    const vector_int &fields = updates[i].second;
 
     PyObject *py_do_id = PyLong_FromUnsignedLong(do_id);
     PyObject *dist_obj = PyDict_GetItem(doid2do, py_do_id);
@@ -49,35 +220,38 @@ unpack_server_snapshot(DatagramIterator &dgi) {
     Py_DECREF(py_do_id);
 
     if (!dist_obj) {
-      std::ostringstream ss;
-      ss << "Received state snapshot for object id " << do_id << ", but not found in doId2do";
-      std::string message = ss.str();
-      PyErr_SetString(PyExc_KeyError, message.c_str());
-      Py_DECREF(doid2do);
-      return;
+      // We keep the state anyway, since later snapshots are encoded against
+      // it.
+      distributed2_cat.warning()
+        << "Received state snapshot for object id " << do_id << ", but not found in doId2do\n";
+      continue;
     }
 
-    PyObject *py_dclass = PyObject_GetAttrString(dist_obj, (char *)"dclass");
-    if (!py_dclass) {
-      PyErr_Print();
-      Py_DECREF(doid2do);
-      return;
+    PyObject *pre_data_update = PyObject_GetAttrString(dist_obj, (char *)"preDataUpdate");
+    if (pre_data_update) {
+      PyObject_CallObject(pre_data_update, NULL);
+      Py_DECREF(pre_data_update);
     }
 
-    PyObject *py_dclass_this = PyObject_GetAttrString(py_dclass, (char *)"this");
-    Py_DECREF(py_dclass);
-    if (!py_dclass_this) {
-      PyErr_Print();
-      Py_DECREF(doid2do);
-      return;
+    if (distributed2_cat.is_debug()) {
+      distributed2_cat.debug()
+        << "Unpacking " << fields.size() << " fields on object " << do_id << "\n";
     }
 
-    DCClass *dclass = (DCClass *)PyLong_AsVoidPtr(py_dclass_this);
-    Py_DECREF(py_dclass_this);
+    for (int field_number : fields) {
+      const std::string &data = state->_fields[field_number];
+      size_t num_unpacked_bytes;
+      if (!unpack_field(dist_obj, state->_dclass, field_number,
+                        data.data(), data.size(), do_id, num_unpacked_bytes)) {
+        Py_DECREF(doid2do);
+        return;
+      }
+    }
 
-    if (!unpack_object_state(dgi, dist_obj, dclass, do_id)) {
-      Py_DECREF(doid2do);
-      return;
+    PyObject *post_data_update = PyObject_GetAttrString(dist_obj, (char *)"postDataUpdate");
+    if (post_data_update) {
+      PyObject_CallObject(post_data_update, NULL);
+      Py_DECREF(post_data_update);
     }
   }
 
@@ -107,114 +281,154 @@ unpack_object_state(DatagramIterator &dgi, PyObject *dist_obj, DCClass *dclass,
       << "Unpacking " << num_fields << " fields on object " << do_id << "\n";
   }
 
-  char proxy_name[256];
-  DCPacker packer;
-
   const char *data = (const char *)dgi.get_datagram().get_data();
 
   for (int j = 0; j < num_fields; j++) {
     int field_number = dgi.get_uint16();
 
-    DCField *field = dclass->get_inherited_field(field_number);
-    if (!field) {
-      std::ostringstream ss;
-      ss << "Inherited field " << field_number << " not found on " << do_id;
-      std::string message = ss.str();
-      PyErr_SetString(PyExc_AttributeError, message.c_str());
+    size_t num_unpacked_bytes;
+    if (!unpack_field(dist_obj, dclass, field_number,
+                      data + dgi.get_current_index(), dgi.get_remaining_size(),
+                      do_id, num_unpacked_bytes)) {
       return false;
     }
 
-    DCParameter *param = field->as_parameter();
-    if (!param) {
-      std::ostringstream ss;
-      ss << "Inherited field " << field_number << " on " << do_id << " is not a parameter";
-      std::string message = ss.str();
-      PyErr_SetString(PyExc_AttributeError, message.c_str());
-      return false;
-    }
+    // Skip over the bytes in the DGI that the DCPacker just unpacked
+    dgi.skip_bytes(num_unpacked_bytes);
+  }
 
-    const char *c_name = field->get_name().c_str();
+  // Finally call the postDataUpdate method so they can do stuff after we've
+  // unpacked the state.
+  PyObject *post_data_update = PyObject_GetAttrString(dist_obj, (char *)"postDataUpdate");
+  if (post_data_update) {
+    PyObject_CallObject(post_data_update, NULL);
+    Py_DECREF(post_data_update);
+  }
 
-    if (distributed2_cat.is_debug()) {
-      distributed2_cat.debug()
-        << "Unpacking field " << field_number << " (" << field->get_name() << ") on "
-        << do_id << "\n";
-    }
+  return true;
+}
 
-    // Put the buffer in the DCPacker to unpack the data into python objects
-    packer.set_unpack_data(data + dgi.get_current_index(), dgi.get_remaining_size(), false);
-    packer.begin_unpack(field);
-    PyObject *args = invoke_extension(field).unpack_args(packer);
-    packer.end_unpack();
+/**
+ * Forgets the state of the indicated object.  Call this when the object is
+ * deleted.
+ */
+void CClientRepository::
+remove_object_state(DOID_TYPE do_id) {
+  for (Frames::iterator fi = _frames.begin(); fi != _frames.end(); ++fi) {
+    fi->second.erase(do_id);
+  }
+}
 
-    // Skip over the bytes in the DGI that the DCPacker just unpacked
-    dgi.skip_bytes(packer.get_num_unpacked_bytes());
+/**
+ * Forgets the states of all objects, and all snapshots received so far.
+ */
+void CClientRepository::
+clear_object_states() {
+  _frames.clear();
+}
 
-    if (!args) {
-      std::ostringstream ss;
-      ss << "Unable to unpack inherited field " << field_number << " on object " << do_id;
-      std::string message = ss.str();
-      PyErr_SetString(PyExc_BufferError, message.c_str());
-      return false;
-    }
+/**
+ * Unpacks the value of a single field from the indicated buffer and applies
+ * it to the specified distributed object.  num_unpacked_bytes receives the
+ * number of bytes that were unpacked.
+ */
+bool CClientRepository::
+unpack_field(PyObject *dist_obj, DCClass *dclass, int field_number,
+             const char *data, size_t length, DOID_TYPE do_id,
+             size_t &num_unpacked_bytes) {
+  char proxy_name[256];
+  DCPacker packer;
 
-    // Now set the args on the field
-    sprintf(proxy_name, "RecvProxy_%s", c_name);
-    if (PyObject_HasAttrString(dist_obj, proxy_name)) {
-      // If we have a proxy for this field, allow the proxy method to
-      // do whatever it needs to do with the args
-      PyObject *proxy = PyObject_GetAttrString(dist_obj, proxy_name);
+  DCField *field = dclass->get_inherited_field(field_number);
+  if (!field) {
+    std::ostringstream ss;
+    ss << "Inherited field " << field_number << " not found on " << do_id;
+    std::string message = ss.str();
+    PyErr_SetString(PyExc_AttributeError, message.c_str());
+    return false;
+  }
 
-      if (distributed2_cat.is_debug()) {
-        distributed2_cat.debug()
-          << "Calling recv proxy\n";
-      }
+  DCParameter *param = field->as_parameter();
+  if (!param) {
+    std::ostringstream ss;
+    ss << "Inherited field " << field_number << " on " << do_id << " is not a parameter";
+    std::string message = ss.str();
+    PyErr_SetString(PyExc_AttributeError, message.c_str());
+    return false;
+  }
 
-      if (PyTuple_Check(args)) {
-        // Args are already a tuple
-        PyObject_CallObject(proxy, args);
+  const char *c_name = field->get_name().c_str();
 
-      } else {
-        // The arguments are not already a tuple. Since we are calling a
-        // method, the arguments need to be in a tuple.
-        PyObject *tuple_args = PyTuple_Pack(1, args);
-        PyObject_CallObject(proxy, tuple_args);
-        Py_DECREF(tuple_args);
-      }
+  if (distributed2_cat.is_debug()) {
+    distributed2_cat.debug()
+      << "Unpacking field " << field_number << " (" << field->get_name() << ") on "
+      << do_id << "\n";
+  }
 
-      Py_DECREF(proxy);
+  // Put the buffer in the DCPacker to unpack the data into python objects
+  packer.set_unpack_data(data, length, false);
+  packer.begin_unpack(field);
+  PyObject *args = invoke_extension(field).unpack_args(packer);
+  packer.end_unpack();
 
-    } else {
-      // Set the args directly on the attribute on the object with the
-      // name of the field.
-      if (distributed2_cat.is_debug()) {
-        distributed2_cat.debug()
-          << "Setting unpacked value directly on object\n";
-      }
-      PyObject_SetAttrString(dist_obj, c_name, args);
+  num_unpacked_bytes = packer.get_num_unpacked_bytes();
+
+  if (!args) {
+    std::ostringstream ss;
+    ss << "Unable to unpack inherited field " << field_number << " on object " << do_id;
+    std::string message = ss.str();
+    PyErr_SetString(PyExc_BufferError, message.c_str());
+    return false;
+  }
+
+  // Now set the args on the field
+  sprintf(proxy_name, "RecvProxy_%s", c_name);
+  if (PyObject_HasAttrString(dist_obj, proxy_name)) {
+    // If we have a proxy for this field, allow the proxy method to
+    // do whatever it needs to do with the args
+    PyObject *proxy = PyObject_GetAttrString(dist_obj, proxy_name);
+
+    if (distributed2_cat.is_debug()) {
+      distributed2_cat.debug()
+        << "Calling recv proxy\n";
     }
 
-    // Check to see if the object defines a method to handle when this
-    // particuler field is unpacked.
-    // Re-use the proxy_name buffer
-    sprintf(proxy_name, "OnRecv_%s", c_name);
-    if (PyObject_HasAttrString(dist_obj, proxy_name)) {
-      // Call it
-      PyObject *recv_handler = PyObject_GetAttrString(dist_obj, proxy_name);
-      PyObject_CallObject(recv_handler, NULL);
-      Py_DECREF(recv_handler);
+    if (PyTuple_Check(args)) {
+      // Args are already a tuple
+      PyObject_CallObject(proxy, args);
+
+    } else {
+      // The arguments are not already a tuple. Since we are calling a
+      // method, the arguments need to be in a tuple.
+      PyObject *tuple_args = PyTuple_Pack(1, args);
+      PyObject_CallObject(proxy, tuple_args);
+      Py_DECREF(tuple_args);
     }
 
-    Py_DECREF(args);
+    Py_DECREF(proxy);
+
+  } else {
+    // Set the args directly on the attribute on the object with the
+    // name of the field.
+    if (distributed2_cat.is_debug()) {
+      distributed2_cat.debug()
+        << "Setting unpacked value directly on object\n";
+    }
+    PyObject_SetAttrString(dist_obj, c_name, args);
   }
 
-  // Finally call the postDataUpdate method so they can do stuff after we've
-  // unpacked the state.
-  PyObject *post_data_update = PyObject_GetAttrString(dist_obj, (char *)"postDataUpdate");
-  if (post_data_update) {
-    PyObject_CallObject(post_data_update, NULL);
-    Py_DECREF(post_data_update);
+  // Check to see if the object defines a method to handle when this
+  // particuler field is unpacked.
+  // Re-use the proxy_name buffer
+  sprintf(proxy_name, "OnRecv_%s", c_name);
+  if (PyObject_HasAttrString(dist_obj, proxy_name)) {
+    // Call it
+    PyObject *recv_handler = PyObject_GetAttrString(dist_obj, proxy_name);
+    PyObject_CallObject(recv_handler, NULL);
+    Py_DECREF(recv_handler);
   }
 
+  Py_DECREF(args);
+
   return true;
 }
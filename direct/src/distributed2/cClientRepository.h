@@ -18,6 +18,9 @@
 #include "datagramIterator.h"
 #include "dcbase.h"
 #include "py_panda.h"
+#include "referenceCount.h"
+#include "pointerTo.h"
+#include "pmap.h"
 
 class DCClass;
 
@@ -25,6 +28,10 @@ class DCClass;
  * This is the C++ implementation of the ClientRepository, which currently
  * only handles unpacking of server snapshots and object state datagrams
  * for performance efficiency.
+ *
+ * It keeps the state of each object as of the last few snapshots received,
+ * since the server encodes each snapshot against the one the client most
+ * recently acknowledged.
  */
 class EXPCL_DIRECT_DISTRIBUTED2 CClientRepository {
 PUBLISHED:
@@ -32,11 +39,31 @@ PUBLISHED:
 
   INLINE void set_python_repository(PyObject *repo);
 
-  void unpack_server_snapshot(DatagramIterator &dgi);
+  void unpack_server_snapshot(DatagramIterator &dgi, int tick_count);
   bool unpack_object_state(DatagramIterator &dgi, PyObject *dist_obj,
                            DCClass *dclass, DOID_TYPE do_id);
 
+  void remove_object_state(DOID_TYPE do_id);
+  void clear_object_states();
+
 private:
+  bool unpack_field(PyObject *dist_obj, DCClass *dclass, int field_number,
+                    const char *data, size_t length, DOID_TYPE do_id,
+                    size_t &num_unpacked_bytes);
+
+  // The packed fields of an object as of a particular snapshot, indexed by
+  // inherited field number.  Shared between snapshots until it changes.
+  class ObjectState : public ReferenceCount {
+  public:
+    DCClass *_dclass;
+    pvector<std::string> _fields;
+  };
+  typedef phash_map<DOID_TYPE, PT(ObjectState), integer_hash<DOID_TYPE>> ObjectStates;
+
+  // The object states after each snapshot, by tick count.
+  typedef pmap<int, ObjectStates> Frames;
+  Frames _frames;
+
   PyObject *_py_repo;
 };
 
@@ -13,4 +13,22 @@
 
 #include "clientFrame.h"
 
+#include <algorithm>
+
 TypeHandle ClientFrame::_type_handle;
+
+/**
+ * Returns the state of the indicated object in this frame, or nullptr if it
+ * was not in view of the client.
+ */
+const PackedObject *ClientFrame::
+find_visible_object(DOID_TYPE do_id) const {
+  VisibleObjects::const_iterator it =
+    std::lower_bound(_visible_objects.begin(), _visible_objects.end(), do_id,
+                     [](const VisibleObject &a, DOID_TYPE b) { return a.do_id < b; });
+  if (it != _visible_objects.end() && it->do_id == do_id) {
+    return it->packet;
+  }
+
+  return nullptr;
+}
@@ -16,6 +16,7 @@
 
 #include "config_distributed2.h"
 #include "frameSnapshot.h"
+#include "packedObject.h"
 #include "deletedChain.h"
 #include "pointerTo.h"
 
@@ -46,8 +47,23 @@ PUBLISHED:
   INLINE void set_next(ClientFrame *next);
   INLINE ClientFrame *get_next() const;
 
+public:
+  // An object that was in view of the client in this frame, and its state at
+  // the time.  Once the client acknowledges the frame, these are the states
+  // the next snapshot is encoded against.
+  struct VisibleObject {
+    DOID_TYPE do_id;
+    PT(PackedObject) packet;
+  };
+  typedef pvector<VisibleObject> VisibleObjects;
+
+  INLINE void set_visible_objects(VisibleObjects &&objects);
+  INLINE const VisibleObjects &get_visible_objects() const;
+  const PackedObject *find_visible_object(DOID_TYPE do_id) const;
+
 private:
   PT(FrameSnapshot) _snapshot;
+  VisibleObjects _visible_objects;
   int _tick_count;
 
   PT(ClientFrame) _next;
@@ -26,6 +26,13 @@
 Configure(config_distributed2);
 NotifyCategoryDef(distributed2, "");
 
+ConfigVariableInt snapshot_compression_level
+("snapshot-compression-level", 0,
+ PRC_DESC("Set this to a zlib compression level between 1 and 9 to compress "
+          "the snapshots the server sends to clients, on top of the bit "
+          "packing.  It is only used for a snapshot if it makes it smaller.  "
+          "0 turns it off."));
+
 ConfigureFn(config_distributed2) {
   init_libdistributed2();
 }
@@ -17,9 +17,12 @@
 #include "directbase.h"
 #include "notifyCategoryProxy.h"
 #include "dconfig.h"
+#include "configVariableInt.h"
 
 NotifyCategoryDecl(distributed2, EXPCL_DIRECT_DISTRIBUTED2, EXPTP_DIRECT_DISTRIBUTED2);
 
+extern EXPCL_DIRECT_DISTRIBUTED2 ConfigVariableInt snapshot_compression_level;
+
 extern EXPCL_DIRECT_DISTRIBUTED void init_libdistributed2();
 
 #endif
@@ -13,14 +13,24 @@
 
 #include "frameSnapshotManager.h"
 #include "frameSnapshot.h"
+#include "frameSnapshotEntry.h"
+#include "clientFrame.h"
+#include "snapshotCodec.h"
+#include "dcClass.h"
+#include "dcField.h"
+
+#include <algorithm>
 
 /**
  * Creates and returns a new PackedObject for the specified object ID.
  */
 PT(PackedObject) FrameSnapshotManager::
 create_packed_object(DOID_TYPE do_id) {
+  PackedObject *prev_pack = get_prev_sent_packet(do_id);
+
   PT(PackedObject) obj = new PackedObject;
   obj->set_do_id(do_id);
+  obj->set_serial(prev_pack != nullptr ? prev_pack->get_serial() : ++_next_serial);
   _prev_sent_packets[do_id] = obj;
   return obj;
 }
@@ -51,3 +61,171 @@ remove_prev_sent_packet(DOID_TYPE do_id) {
     _prev_sent_packets.erase(itr);
   }
 }
+
+/**
+ * Builds a datagram out of the snapshot of the `to` frame suitable for sending
+ * to a client.  Only objects that are in the specified interest zones are
+ * packed into the datagram.
+ *
+ * If `from` is given, it is the frame the client most recently acknowledged,
+ * and the snapshot is encoded as a delta against it: objects that were in
+ * view of the client then only send the fields that changed since, each one
+ * encoded against the value the client has (see SnapshotCodec), and
+ * unchanged objects are left out.  Objects that just came into view are sent
+ * in full.
+ *
+ * The objects are bit-packed, and sorted by ID so that the IDs can be sent as
+ * small differences.  See CClientRepository::unpack_server_snapshot() for the
+ * other end.
+ */
+void FrameSnapshotManager::
+format_client_snapshot(Datagram &dg, ClientFrame *from, ClientFrame *to,
+                       const pvector<ZONEID_TYPE> &interest_zone_ids) {
+  FrameSnapshot *snapshot = to->get_snapshot();
+
+  ClientFrame::VisibleObjects visible;
+  for (int i = 0; i < snapshot->get_num_valid_entries(); i++) {
+    FrameSnapshotEntry &entry = snapshot->get_entry(snapshot->get_valid_entry(i));
+    if (std::find(interest_zone_ids.begin(), interest_zone_ids.end(),
+                  entry.get_zone_id()) == interest_zone_ids.end()) {
+
+      // Object not seen by this client, don't include in client snapshot
+      continue;
+    }
+
+    visible.push_back({ entry.get_do_id(), entry.get_packed_object() });
+  }
+  std::sort(visible.begin(), visible.end(),
+            [](const ClientFrame::VisibleObject &a, const ClientFrame::VisibleObject &b) {
+              return a.do_id < b.do_id;
+            });
+
+  int num_objects = 0;
+  SnapshotBitWriter objects;
+  DOID_TYPE prev_do_id = 0;
+  vector_int changed_fields;
+
+  for (const ClientFrame::VisibleObject &object : visible) {
+    PackedObject *packet = object.packet;
+
+    // The state the client has for the object, if it was in view in the
+    // frame the client acknowledged.
+    const PackedObject *base = nullptr;
+    int num_changes = -1;
+    if (from != nullptr) {
+      base = from->find_visible_object(object.do_id);
+      if (base != nullptr &&
+          (base->get_serial() != packet->get_serial() ||
+           base->get_class() != packet->get_class() ||
+           base->get_num_fields() != packet->get_num_fields())) {
+        // A different object with the same ID.
+        base = nullptr;
+      }
+
+      if (base != nullptr) {
+        changed_fields.clear();
+        num_changes = packet->get_fields_changed_after_tick(from->get_tick_count(), changed_fields);
+
+        if (distributed2_cat.is_debug()) {
+          distributed2_cat.debug()
+            << num_changes << " fields changed for client after tick " << from->get_tick_count()
+            << " doId " << object.do_id << "\n";
+        }
+
+        if (num_changes == 0) {
+          // Nothing changed from previous client snapshot, don't include
+          // this object.
+          continue;
+        }
+
+        if (num_changes == -1) {
+          // -1 means all fields changed, so just send the whole object.
+          base = nullptr;
+        }
+      }
+    }
+
+    objects.write_uint(object.do_id - prev_do_id);
+    prev_do_id = object.do_id;
+
+    DCClass *dclass = packet->get_class();
+    int num_fields = base != nullptr ? num_changes : packet->get_num_fields();
+
+    objects.write_bit(base == nullptr);
+    if (base == nullptr) {
+      objects.write_uint(dclass->get_number());
+    }
+    objects.write_uint(num_fields);
+
+    int prev_field_index = -1;
+    for (int j = 0; j < num_fields; j++) {
+      int n = base != nullptr ? changed_fields[j] : j;
+      const PackedObject::PackedField &field = packet->get_field(n);
+
+      objects.write_uint(field.field_index - prev_field_index - 1);
+      prev_field_index = field.field_index;
+
+      int num_quantized =
+        SnapshotCodec::get_num_quantized_values(dclass->get_inherited_field(field.field_index));
+
+      if (base != nullptr) {
+        const PackedObject::PackedField &base_field = base->get_field(n);
+        SnapshotCodec::write_field(objects, num_quantized,
+                                   packet->get_data() + field.offset, field.length,
+                                   base->get_data() + base_field.offset, base_field.length);
+      } else {
+        SnapshotCodec::write_field(objects, num_quantized,
+                                   packet->get_data() + field.offset, field.length,
+                                   nullptr, 0);
+      }
+    }
+
+    num_objects++;
+  }
+
+  // The objects the client sees in this frame, for the next delta.
+  to->set_visible_objects(std::move(visible));
+
+  SnapshotBitWriter payload;
+  payload.write_uint(num_objects);
+  payload.append(objects);
+
+  std::string compressed = SnapshotCodec::compress_payload(payload.get_data());
+
+  // Record tick count of the snapshot
+  dg.add_uint32(to->get_tick_count());
+
+  uint8_t flags = 0;
+  if (from != nullptr) {
+    flags |= SF_delta;
+  }
+  if (!compressed.empty()) {
+    flags |= SF_compressed;
+  }
+  dg.add_uint8(flags);
+
+  if (from != nullptr) {
+    // The frame the snapshot is a delta against.
+    dg.add_uint32(from->get_tick_count());
+  }
+
+  if (!compressed.empty()) {
+    dg.add_uint32((uint32_t)compressed.size());
+    dg.append_data(compressed.data(), compressed.size());
+  } else {
+    dg.add_uint32((uint32_t)payload.get_data().size());
+    dg.append_data(payload.get_data());
+  }
+
+  if (distributed2_cat.is_debug()) {
+    distributed2_cat.debug()
+      << num_objects << " objects in snapshot " << to->get_tick_count() << " for client, "
+      << payload.get_data().size() << " bytes";
+    if (!compressed.empty()) {
+      distributed2_cat.debug(false)
+        << ", " << compressed.size() << " compressed";
+    }
+    distributed2_cat.debug(false)
+      << "\n";
+  }
+}
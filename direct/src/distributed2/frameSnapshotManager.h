@@ -21,8 +21,16 @@
 #include "datagram.h"
 
 class FrameSnapshot;
+class ClientFrame;
 
 class EXPCL_DIRECT_DISTRIBUTED2 FrameSnapshotManager {
+public:
+  // Flags in the header of a client snapshot.
+  enum SnapshotFlags {
+    SF_delta = 0x01,
+    SF_compressed = 0x02,
+  };
+
 PUBLISHED:
   INLINE FrameSnapshotManager();
 
@@ -30,18 +38,24 @@ PUBLISHED:
   PackedObject *get_prev_sent_packet(DOID_TYPE do_id) const;
   void remove_prev_sent_packet(DOID_TYPE do_id);
 
+public:
+  void format_client_snapshot(Datagram &dg, ClientFrame *from, ClientFrame *to,
+                              const pvector<ZONEID_TYPE> &interest_zone_ids);
+
 private:
   // The most recently sent packets for each object ID.
   typedef phash_map<DOID_TYPE, PT(PackedObject), integer_hash<DOID_TYPE>> PrevSentPackets;
   PrevSentPackets _prev_sent_packets;
 
+  unsigned int _next_serial;
+
 PUBLISHED:
   EXTENSION(PackedObject *find_or_create_object_packet_for_baseline(PyObject *dist_obj, DCClass *dclass,
                                                                     DOID_TYPE do_id));
-  EXTENSION(void client_format_snapshot(Datagram &dg, FrameSnapshot *snapshot,
+  EXTENSION(void client_format_snapshot(Datagram &dg, ClientFrame *frame,
                                         PyObject *interest_zone_ids));
-  EXTENSION(void client_format_delta_snapshot(Datagram &dg, FrameSnapshot *from,
-                                              FrameSnapshot *to, PyObject *interest_zone_ids));
+  EXTENSION(void client_format_delta_snapshot(Datagram &dg, ClientFrame *from,
+                                              ClientFrame *to, PyObject *interest_zone_ids));
 
   EXTENSION(bool pack_object_in_snapshot(FrameSnapshot *snapshot, int entry, PyObject *dist_obj,
                                          DOID_TYPE do_id, ZONEID_TYPE zone_id, DCClass *dclass));
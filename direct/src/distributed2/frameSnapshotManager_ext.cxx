@@ -14,6 +14,8 @@
 #include "frameSnapshotManager_ext.h"
 #include "frameSnapshot.h"
 #include "frameSnapshotEntry.h"
+#include "clientFrame.h"
+#include "snapshotCodec.h"
 #include "changeFrameList.h"
 #include "packedObject.h"
 #include "dcClass.h"
@@ -100,6 +102,23 @@ encode_object_state(PyObject *dist_obj, DCClass *dclass, DCPacker &packer,
   return true;
 }
 
+/**
+ * Rounds the fields of a packed object state that are marked "quantized" to
+ * the precision they are sent at, so that the server compares and stores the
+ * same values the client ends up with.  See SnapshotCodec.
+ */
+void Extension<FrameSnapshotManager>::
+quantize_object_state(char *data, DCClass *dclass,
+                      const PackedObject::PackedFields &fields) {
+  for (const PackedObject::PackedField &field : fields) {
+    int num_quantized =
+      SnapshotCodec::get_num_quantized_values(dclass->get_inherited_field(field.field_index));
+    if (num_quantized != 0) {
+      SnapshotCodec::quantize_field(data + field.offset, field.length, num_quantized);
+    }
+  }
+}
+
 /**
  * Returns a PackedObject suitable for use as a baseline/initial state of an
  * object upon generate. If a packet was previously sent for this object,
@@ -127,6 +146,7 @@ find_or_create_object_packet_for_baseline(PyObject *dist_obj, DCClass *dclass, D
 
   size_t length = packer.get_length();
   char *data = packer.take_data();
+  quantize_object_state(data, dclass, fields);
 
   // Use a bogus -1 tick count so any fields that don't change between now and when
   // the snapshot is built don't get sent again.
@@ -172,7 +192,8 @@ pack_object_in_snapshot(FrameSnapshot *snapshot, int entry_idx, PyObject *dist_o
 
   // Take the bytes out of the packer
   size_t length = packer.get_length();
-  const char *data = packer.get_data();
+  char *data = packer.take_data();
+  quantize_object_state(data, dclass, packed_fields);
 
   PT(ChangeFrameList) change_frame = nullptr;
 
@@ -199,6 +220,7 @@ pack_object_in_snapshot(FrameSnapshot *snapshot, int entry_idx, PyObject *dist_o
     if (changes == 0) {
       // If there are no changes between the previous state and the current
       // state, just use the previous state.
+      delete[] data;
       entry.set_packed_object(prev_pack);
       return true;
     }
@@ -233,7 +255,7 @@ pack_object_in_snapshot(FrameSnapshot *snapshot, int entry_idx, PyObject *dist_o
   packed_object->set_change_frame_list(change_frame);
   packed_object->set_class(dclass);
   packed_object->set_snapshot_creation_tick(snapshot->get_tick_count());
-  packed_object->set_data(packer.take_data(), length);
+  packed_object->set_data(data, length);
   packed_object->set_fields(std::move(packed_fields));
 
   entry.set_packed_object(packed_object);
@@ -242,127 +264,42 @@ pack_object_in_snapshot(FrameSnapshot *snapshot, int entry_idx, PyObject *dist_o
 }
 
 /**
- * Builds a datagram out of the specified snapshot suitable for sending to a
- * client. Only objects that are in the specified interest zones are packed
- * into the datagram.
+ * Converts the Python list of interest zone IDs.
  */
 void Extension<FrameSnapshotManager>::
-client_format_snapshot(Datagram &dg, FrameSnapshot *snapshot,
-                       PyObject *py_interest_zone_ids) {
-  pvector<ZONEID_TYPE> interest_zone_ids;
+get_interest_zone_ids(PyObject *py_interest_zone_ids,
+                      pvector<ZONEID_TYPE> &interest_zone_ids) {
   interest_zone_ids.resize(PyList_Size(py_interest_zone_ids));
   for (size_t i = 0; i < interest_zone_ids.size(); i++) {
     interest_zone_ids[i] = PyLong_AsLong(PyList_GetItem(py_interest_zone_ids, i));
   }
+}
 
-  // Record tick count of the snapshot
-  dg.add_uint32(snapshot->get_tick_count());
-
-  // Indicate this is *not* a delta snapshot.
-  dg.add_uint8(0);
-
-  int num_objects = 0;
-  Datagram object_dg;
-  for (int i = 0; i < snapshot->get_num_valid_entries(); i++) {
-    FrameSnapshotEntry &entry = snapshot->get_entry(snapshot->get_valid_entry(i));
-    if (std::find(interest_zone_ids.begin(), interest_zone_ids.end(),
-                  entry.get_zone_id()) == interest_zone_ids.end()) {
-
-      // Object not seen by this client, don't include in client snapshot
-      continue;
-    }
-
-    // Object ID
-    object_dg.add_uint32(entry.get_do_id());
-
-    // This is not a delta snapshot, just copy the absolute state
-    // onto the datagram.
-    PackedObject *packet = entry.get_packed_object();
-    packet->pack_datagram(object_dg);
-
-    num_objects++;
-  }
-
-  // # of objects in this client snapshot
-  dg.add_uint16(num_objects);
+/**
+ * Builds a datagram out of the snapshot of the specified client frame
+ * suitable for sending to a client. Only objects that are in the specified
+ * interest zones are packed into the datagram.
+ */
+void Extension<FrameSnapshotManager>::
+client_format_snapshot(Datagram &dg, ClientFrame *frame,
+                       PyObject *py_interest_zone_ids) {
+  pvector<ZONEID_TYPE> interest_zone_ids;
+  get_interest_zone_ids(py_interest_zone_ids, interest_zone_ids);
 
-  // Copy object data onto main datagram
-  dg.append_data(object_dg.get_data(), object_dg.get_length());
+  _this->format_client_snapshot(dg, nullptr, frame, interest_zone_ids);
 }
 
 /**
- * Builds a datagram out of the specified snapshot suitable for sending to a
- * client. Only objects that are in the specified interest zones are packed
- * into the datagram, and only fields that have changed between `from` and `to`
- * are packed.
+ * Builds a datagram out of the snapshot of the `to` client frame suitable for
+ * sending to a client. Only objects that are in the specified interest zones
+ * are packed into the datagram, and only fields that have changed since the
+ * `from` frame, which the client acknowledged, are packed.
  */
 void Extension<FrameSnapshotManager>::
-client_format_delta_snapshot(Datagram &dg, FrameSnapshot *from, FrameSnapshot *to,
+client_format_delta_snapshot(Datagram &dg, ClientFrame *from, ClientFrame *to,
                              PyObject *py_interest_zone_ids) {
   pvector<ZONEID_TYPE> interest_zone_ids;
-  interest_zone_ids.resize(PyList_Size(py_interest_zone_ids));
-  for (size_t i = 0; i < interest_zone_ids.size(); i++) {
-    interest_zone_ids[i] = PyLong_AsLong(PyList_GetItem(py_interest_zone_ids, i));
-  }
-
-  // Record tick count of the snapshot
-  dg.add_uint32(to->get_tick_count());
-
-  // Indicate this is a delta snapshot.
-  dg.add_uint8(1);
-
-  int num_objects = 0;
-  Datagram object_dg;
-  for (int i = 0; i < to->get_num_valid_entries(); i++) {
-    FrameSnapshotEntry &entry = to->get_entry(to->get_valid_entry(i));
-    if (std::find(interest_zone_ids.begin(), interest_zone_ids.end(),
-                  entry.get_zone_id()) == interest_zone_ids.end()) {
-
-      // Object not seen by this client, don't include in client snapshot
-      continue;
-    }
-
-    PackedObject *packet = entry.get_packed_object();
-
-    vector_int changed_fields;
-    int num_changes = packet->get_fields_changed_after_tick(from->get_tick_count(), changed_fields);
-
-    if (distributed2_cat.is_debug()) {
-      distributed2_cat.debug()
-        << from->get_tick_count() << " to " << to->get_tick_count() << " for client\n";
-      distributed2_cat.debug()
-        << num_changes << " fields changed for client after tick " << from->get_tick_count() << " doId " << packet->get_do_id() << "\n";
-    }
-
-    if (num_changes == 0) {
-      // Nothing changed from previous client snapshot, don't include this
-      // object.
-      continue;
-    }
-
-    // Object ID
-    object_dg.add_uint32(entry.get_do_id());
-
-    if (num_changes != -1) {
-      // How many fields are there?
-      object_dg.add_uint16(num_changes);
-
-      // Now copy each changed field into the datagram
-      for (int j = 0; j < num_changes; j++) {
-        packet->pack_field(object_dg, changed_fields[j]);
-      }
-
-    } else {
-      // -1 means all fields changed, so just pack the whole object
-      packet->pack_datagram(object_dg);
-    }
-
-    num_objects++;
-  }
-
-  // # of objects in this client snapshot
-  dg.add_uint16(num_objects);
+  get_interest_zone_ids(py_interest_zone_ids, interest_zone_ids);
 
-  // Copy object data onto main datagram
-  dg.append_data(object_dg.get_data(), object_dg.get_length());
+  _this->format_client_snapshot(dg, from, to, interest_zone_ids);
 }
@@ -21,6 +21,7 @@
 #include "py_panda.h"
 
 class FrameSnapshot;
+class ClientFrame;
 class DCClass;
 
 template<>
@@ -28,6 +29,10 @@ class Extension<FrameSnapshotManager> : public ExtensionBase<FrameSnapshotManage
 private:
   bool encode_object_state(PyObject *dist_obj, DCClass *dclass, DCPacker &packer,
                            PackedObject::PackedFields &fields);
+  void quantize_object_state(char *data, DCClass *dclass,
+                             const PackedObject::PackedFields &fields);
+  void get_interest_zone_ids(PyObject *py_interest_zone_ids,
+                             pvector<ZONEID_TYPE> &interest_zone_ids);
 
 public:
   PackedObject *find_or_create_object_packet_for_baseline(PyObject *dist_obj, DCClass *dclass,
@@ -38,10 +43,10 @@ public:
 
 
 
-  void client_format_snapshot(Datagram &dg, FrameSnapshot *snapshot,
+  void client_format_snapshot(Datagram &dg, ClientFrame *frame,
                               PyObject *interest_zone_ids);
-  void client_format_delta_snapshot(Datagram &dg, FrameSnapshot *from,
-                                    FrameSnapshot *to, PyObject *interest_zone_ids);
+  void client_format_delta_snapshot(Datagram &dg, ClientFrame *from,
+                                    ClientFrame *to, PyObject *interest_zone_ids);
 };
 
 #endif // FRAMESNAPSHOTMANAGER_EXT_H
@@ -64,6 +64,9 @@ PUBLISHED:
   INLINE void set_do_id(DOID_TYPE do_id);
   INLINE DOID_TYPE get_do_id() const;
 
+  INLINE void set_serial(unsigned int serial);
+  INLINE unsigned int get_serial() const;
+
   INLINE void set_change_frame_list(ChangeFrameList *list);
   INLINE ChangeFrameList *get_change_frame_list() const;
   INLINE PT(ChangeFrameList) take_change_frame_list();
@@ -88,6 +91,10 @@ private:
   DCClass *_dclass;
   DOID_TYPE _do_id;
 
+  // Identifies the object the state belongs to.  An object that reuses the
+  // ID of a deleted object gets a new serial.
+  unsigned int _serial;
+
   PT(ChangeFrameList) _change_frame_list;
 
   // This is the tick the PackedObject was created on.
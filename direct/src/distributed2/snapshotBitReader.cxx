@@ -0,0 +1,71 @@
+/**
+ * PANDA 3D SOFTWARE
+ * Copyright (c) Carnegie Mellon University.  All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license.  You should have received a copy of this license along
+ * with this source code in a file named "LICENSE."
+ *
+ * @file snapshotBitReader.cxx
+ * @author lachbr
+ * @date 2026-10-17
+ */
+
+#include "snapshotBitReader.h"
+
+/**
+ * Reads num_bits bits, up to 64.
+ */
+uint64_t SnapshotBitReader::
+read_bits(int num_bits) {
+  nassertr(num_bits >= 0 && num_bits <= 64, 0);
+
+  if (_bit + num_bits > _length * 8) {
+    _overflow = true;
+    _bit = _length * 8;
+    return 0;
+  }
+
+  uint64_t value = 0;
+  int shift = 0;
+  while (num_bits > 0) {
+    size_t byte = _bit >> 3;
+    int bit = (int)(_bit & 7);
+
+    int n = std::min(8 - bit, num_bits);
+    uint64_t bits = (_data[byte] >> bit) & ((1u << n) - 1);
+    value |= bits << shift;
+
+    shift += n;
+    num_bits -= n;
+    _bit += n;
+  }
+
+  return value;
+}
+
+/**
+ * Reads an unsigned integer written by SnapshotBitWriter::write_uint().
+ */
+uint64_t SnapshotBitReader::
+read_uint() {
+  int num_bits = 0;
+  while (!read_bit()) {
+    if (_overflow || ++num_bits > 63) {
+      _overflow = true;
+      return 0;
+    }
+  }
+
+  return (((uint64_t)1 << num_bits) | read_bits(num_bits)) - 1;
+}
+
+/**
+ * Reads the indicated number of bytes, eight bits each.
+ */
+void SnapshotBitReader::
+read_bytes(unsigned char *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    data[i] = (unsigned char)read_bits(8);
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ * PANDA 3D SOFTWARE
+ * Copyright (c) Carnegie Mellon University.  All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license.  You should have received a copy of this license along
+ * with this source code in a file named "LICENSE."
+ *
+ * @file snapshotBitReader.h
+ * @author lachbr
+ * @date 2026-10-17
+ */
+
+#ifndef SNAPSHOTBITREADER_H
+#define SNAPSHOTBITREADER_H
+
+#include "config_distributed2.h"
+#include "numeric_types.h"
+
+/**
+ * Reads back the values written by a SnapshotBitWriter.
+ *
+ * Reading past the end of the buffer returns zeros and sets the overflow
+ * flag, which should be checked once everything has been read.
+ */
+class EXPCL_DIRECT_DISTRIBUTED2 SnapshotBitReader {
+public:
+  INLINE SnapshotBitReader(const unsigned char *data, size_t length);
+
+  uint64_t read_bits(int num_bits);
+  INLINE bool read_bit();
+  uint64_t read_uint();
+  INLINE int64_t read_int();
+  void read_bytes(unsigned char *data, size_t length);
+
+  INLINE bool is_overflow() const;
+
+private:
+  const unsigned char *_data;
+  size_t _length;
+  size_t _bit;
+  bool _overflow;
+};
+
+#include "snapshotBitReader.I"
+
+#endif // SNAPSHOTBITREADER_H
@@ -0,0 +1,82 @@
+/**
+ * PANDA 3D SOFTWARE
+ * Copyright (c) Carnegie Mellon University.  All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license.  You should have received a copy of this license along
+ * with this source code in a file named "LICENSE."
+ *
+ * @file snapshotBitWriter.cxx
+ * @author lachbr
+ * @date 2026-10-17
+ */
+
+#include "snapshotBitWriter.h"
+
+/**
+ * Writes the low num_bits bits of the value, up to 64.
+ */
+void SnapshotBitWriter::
+write_bits(uint64_t value, int num_bits) {
+  nassertv(num_bits >= 0 && num_bits <= 64);
+
+  while (num_bits > 0) {
+    size_t byte = _num_bits >> 3;
+    int bit = (int)(_num_bits & 7);
+    if (byte == _data.size()) {
+      _data.push_back(0);
+    }
+
+    int n = std::min(8 - bit, num_bits);
+    _data[byte] |= (unsigned char)((value & ((1u << n) - 1)) << bit);
+
+    value >>= n;
+    num_bits -= n;
+    _num_bits += n;
+  }
+}
+
+/**
+ * Writes an unsigned integer as an exponential-Golomb code: the number of
+ * significant bits of value + 1, in unary, followed by those bits.  0 takes
+ * up a single bit, and numbers below 2^n take up 2n + 1 bits.  The value must
+ * be less than 2^63.
+ */
+void SnapshotBitWriter::
+write_uint(uint64_t value) {
+  nassertv(value < ((uint64_t)1 << 63));
+
+  uint64_t code = value + 1;
+  int num_bits = 0;
+  while ((code >> (num_bits + 1)) != 0) {
+    num_bits++;
+  }
+
+  write_bits(0, num_bits);
+  write_bits(1, 1);
+  write_bits(code, num_bits);
+}
+
+/**
+ * Writes the indicated bytes, eight bits each.
+ */
+void SnapshotBitWriter::
+write_bytes(const unsigned char *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    write_bits(data[i], 8);
+  }
+}
+
+/**
+ * Writes all of the bits written to the other writer.
+ */
+void SnapshotBitWriter::
+append(const SnapshotBitWriter &other) {
+  size_t num_bytes = other._num_bits >> 3;
+  write_bytes(other._data.data(), num_bytes);
+
+  int num_bits = (int)(other._num_bits & 7);
+  if (num_bits != 0) {
+    write_bits(other._data[num_bytes], num_bits);
+  }
+}
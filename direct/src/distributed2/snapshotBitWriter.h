@@ -0,0 +1,50 @@
+/**
+ * PANDA 3D SOFTWARE
+ * Copyright (c) Carnegie Mellon University.  All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license.  You should have received a copy of this license along
+ * with this source code in a file named "LICENSE."
+ *
+ * @file snapshotBitWriter.h
+ * @author lachbr
+ * @date 2026-10-17
+ */
+
+#ifndef SNAPSHOTBITWRITER_H
+#define SNAPSHOTBITWRITER_H
+
+#include "config_distributed2.h"
+#include "vector_uchar.h"
+#include "numeric_types.h"
+
+/**
+ * Writes values into a buffer one bit at a time, so that a value takes up
+ * only as many bits as it needs.  Used to encode the object states in a
+ * client snapshot.
+ *
+ * Bits are filled in starting with the least significant bit of each byte.
+ * See SnapshotBitReader.
+ */
+class EXPCL_DIRECT_DISTRIBUTED2 SnapshotBitWriter {
+public:
+  INLINE SnapshotBitWriter();
+
+  void write_bits(uint64_t value, int num_bits);
+  INLINE void write_bit(bool value);
+  void write_uint(uint64_t value);
+  INLINE void write_int(int64_t value);
+  void write_bytes(const unsigned char *data, size_t length);
+  void append(const SnapshotBitWriter &other);
+
+  INLINE const vector_uchar &get_data() const;
+  INLINE size_t get_num_bits() const;
+
+private:
+  vector_uchar _data;
+  size_t _num_bits;
+};
+
+#include "snapshotBitWriter.I"
+
+#endif // SNAPSHOTBITWRITER_H
@@ -0,0 +1,231 @@
+/**
+ * PANDA 3D SOFTWARE
+ * Copyright (c) Carnegie Mellon University.  All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license.  You should have received a copy of this license along
+ * with this source code in a file named "LICENSE."
+ *
+ * @file snapshotCodec.cxx
+ * @author lachbr
+ * @date 2026-10-17
+ */
+
+#include "snapshotCodec.h"
+#include "dcField.h"
+#include "dcParameter.h"
+#include "dcSimpleParameter.h"
+#include "dcArrayParameter.h"
+#include "littleEndian.h"
+#include "compress_string.h"
+#include "cmath.h"
+
+#include <algorithm>
+
+// Quantized values are sent as 64-bit integers, and must survive the trip
+// through a double.
+static const double max_quantized_value = 9007199254740992.0; // 2^53
+static const int64_t max_quantized_int = (int64_t)1 << 53;
+
+/**
+ * Returns the number of float64 values in the field if it is marked
+ * "quantized", or 0 if it isn't, or isn't a float64 or a fixed-size array of
+ * them.
+ */
+int SnapshotCodec::
+get_num_quantized_values(const DCField *field) {
+  if (!field->has_keyword("quantized")) {
+    return 0;
+  }
+
+  const DCParameter *param = field->as_parameter();
+  if (param == nullptr) {
+    return 0;
+  }
+
+  const DCSimpleParameter *simple = param->as_simple_parameter();
+  if (simple != nullptr) {
+    return simple->get_type() == ST_float64 ? 1 : 0;
+  }
+
+  const DCArrayParameter *array = param->as_array_parameter();
+  if (array != nullptr && array->get_array_size() > 0) {
+    const DCSimpleParameter *element = array->get_element_type()->as_simple_parameter();
+    if (element != nullptr && element->get_type() == ST_float64) {
+      return array->get_array_size();
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Rounds the packed values of a quantized field, as returned by
+ * get_num_quantized_values(), to whole numbers in place.  The values have
+ * already been scaled by the divisor of the field when they were packed.
+ */
+void SnapshotCodec::
+quantize_field(char *data, size_t length, int num_values) {
+  nassertv(length == (size_t)num_values * 8);
+
+  for (int i = 0; i < num_values; i++) {
+    double value = get_float64(data + i * 8);
+    if (cnan(value)) {
+      value = 0.0;
+    } else {
+      value = std::max(-max_quantized_value, std::min(max_quantized_value, floor(value + 0.5)));
+    }
+    set_float64(data + i * 8, value);
+  }
+}
+
+/**
+ * Writes the packed bytes of a field, against the bytes the client has for
+ * the field, or nullptr if it has none.  num_quantized is the value returned
+ * by get_num_quantized_values() for the field.
+ */
+void SnapshotCodec::
+write_field(SnapshotBitWriter &bits, int num_quantized,
+            const char *data, size_t length,
+            const char *base, size_t base_length) {
+  if (num_quantized != 0) {
+    nassertv(length == (size_t)num_quantized * 8);
+    nassertv(base == nullptr || base_length == length);
+
+    for (int i = 0; i < num_quantized; i++) {
+      int64_t value = (int64_t)get_float64(data + i * 8);
+      int64_t base_value = base != nullptr ? (int64_t)get_float64(base + i * 8) : 0;
+      bits.write_int(value - base_value);
+    }
+    return;
+  }
+
+  if (base != nullptr) {
+    bool xor_base = (base_length == length);
+    bits.write_bit(xor_base);
+    if (xor_base) {
+      for (size_t i = 0; i < length; i++) {
+        unsigned char x = (unsigned char)(data[i] ^ base[i]);
+        bits.write_bit(x != 0);
+        if (x != 0) {
+          bits.write_bits(x, 8);
+        }
+      }
+      return;
+    }
+  }
+
+  bits.write_uint(length);
+  bits.write_bytes((const unsigned char *)data, length);
+}
+
+/**
+ * Reads the packed bytes of a field written by write_field() into data.  base
+ * is the bytes the client has for the field, and must be given if and only if
+ * the server had them too.  Returns false if the data is bad.
+ */
+bool SnapshotCodec::
+read_field(SnapshotBitReader &bits, int num_quantized,
+           const std::string *base, std::string &data) {
+  if (num_quantized != 0) {
+    if (base != nullptr && base->size() != (size_t)num_quantized * 8) {
+      return false;
+    }
+
+    data.resize(num_quantized * 8);
+    for (int i = 0; i < num_quantized; i++) {
+      int64_t base_value = 0;
+      if (base != nullptr) {
+        double value = get_float64(base->data() + i * 8);
+        if (value == value) {
+          value = std::max(-max_quantized_value, std::min(max_quantized_value, value));
+          base_value = (int64_t)value;
+        }
+      }
+
+      // The delta can be anything, so limit it before adding it to keep the
+      // sum from overflowing, and clamp the sum like quantize_field() does.
+      int64_t delta = bits.read_int();
+      delta = std::max(-2 * max_quantized_int, std::min(2 * max_quantized_int, delta));
+      int64_t value = std::max(-max_quantized_int, std::min(max_quantized_int, base_value + delta));
+      set_float64(&data[i * 8], (double)value);
+    }
+    return !bits.is_overflow();
+  }
+
+  if (base != nullptr && bits.read_bit()) {
+    data = *base;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (bits.read_bit()) {
+        data[i] ^= (char)bits.read_bits(8);
+      }
+    }
+    return !bits.is_overflow();
+  }
+
+  uint64_t length = bits.read_uint();
+  if (bits.is_overflow() || length > 0xffff) {
+    // A field never takes up more than a datagram.
+    return false;
+  }
+  data.resize((size_t)length);
+  bits.read_bytes((unsigned char *)&data[0], (size_t)length);
+  return !bits.is_overflow();
+}
+
+/**
+ * Returns the payload compressed with zlib at the level given by
+ * snapshot-compression-level, or an empty string if compression is turned
+ * off, unavailable, or doesn't make the payload any smaller.
+ */
+std::string SnapshotCodec::
+compress_payload(const vector_uchar &payload) {
+#ifdef HAVE_ZLIB
+  int level = snapshot_compression_level;
+  if (level > 0 && !payload.empty()) {
+    std::string source((const char *)payload.data(), payload.size());
+    std::string compressed = compress_string(source, level);
+    if (!compressed.empty() && compressed.size() < payload.size()) {
+      return compressed;
+    }
+  }
+#endif
+  return std::string();
+}
+
+/**
+ * Undoes compress_payload().  Returns false if the payload can't be
+ * decompressed.
+ */
+bool SnapshotCodec::
+decompress_payload(const std::string &compressed, std::string &payload) {
+#ifdef HAVE_ZLIB
+  payload = decompress_string(compressed);
+  return !payload.empty();
+#else
+  distributed2_cat.error()
+    << "Received a compressed snapshot, but Panda was built without zlib.\n";
+  return false;
+#endif
+}
+
+/**
+ * Returns the float64 packed at the indicated address, in the little-endian
+ * order used by the DCPacker.
+ */
+double SnapshotCodec::
+get_float64(const char *data) {
+  LittleEndian s(data, 8);
+  double value;
+  memcpy(&value, s.get_data(), 8);
+  return value;
+}
+
+/**
+ * Packs the float64 at the indicated address.
+ */
+void SnapshotCodec::
+set_float64(char *data, double value) {
+  LittleEndian s(&value, 8);
+  memcpy(data, s.get_data(), 8);
+}
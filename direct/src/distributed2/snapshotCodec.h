@@ -0,0 +1,61 @@
+/**
+ * PANDA 3D SOFTWARE
+ * Copyright (c) Carnegie Mellon University.  All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license.  You should have received a copy of this license along
+ * with this source code in a file named "LICENSE."
+ *
+ * @file snapshotCodec.h
+ * @author lachbr
+ * @date 2026-10-17
+ */
+
+#ifndef SNAPSHOTCODEC_H
+#define SNAPSHOTCODEC_H
+
+#include "config_distributed2.h"
+#include "snapshotBitWriter.h"
+#include "snapshotBitReader.h"
+
+class DCField;
+
+/**
+ * The encoding of individual fields in a client snapshot, shared by the
+ * server, which writes them (FrameSnapshotManager), and the client, which
+ * reads them (CClientRepository).
+ *
+ * A field is encoded against the value the client already has for it, if
+ * there is one:
+ *
+ * A field marked with the "quantized" keyword, whose type is float64 or a
+ * fixed-size array of float64, is rounded to a multiple of 1 / the divisor of
+ * the type when the object is packed, so "float64/100 x quantized;" keeps two
+ * decimal places.  It is sent as the difference between the rounded integers,
+ * which is a handful of bits for a value that moved a little.  The "quantized"
+ * keyword has to be declared in the dc file.
+ *
+ * Any other field is sent as the XOR of its bytes with the old bytes, with a
+ * single bit for each unchanged byte, or as plain bytes if it changed size or
+ * there is no old value.
+ */
+class EXPCL_DIRECT_DISTRIBUTED2 SnapshotCodec {
+public:
+  static int get_num_quantized_values(const DCField *field);
+  static void quantize_field(char *data, size_t length, int num_values);
+
+  static void write_field(SnapshotBitWriter &bits, int num_quantized,
+                          const char *data, size_t length,
+                          const char *base, size_t base_length);
+  static bool read_field(SnapshotBitReader &bits, int num_quantized,
+                         const std::string *base, std::string &data);
+
+  static std::string compress_payload(const vector_uchar &payload);
+  static bool decompress_payload(const std::string &compressed, std::string &payload);
+
+private:
+  static double get_float64(const char *data);
+  static void set_float64(char *data, double value);
+};
+
+#endif // SNAPSHOTCODEC_H